@@ -156,6 +156,37 @@ public:
     return xc;
   }
 
+  // un-project a point xp in pixel coordinates to the unit bearing vector in
+  // the camera frame, which is also defined beyond 90 degrees of incidence.
+  template <typename Derived>
+  Eigen::Matrix<typename Derived::Scalar, 3, 1>
+  UnProjectBearing(const Eigen::MatrixBase<Derived> &xp) const {
+    EIGEN_STATIC_ASSERT_MATRIX_SPECIFIC_SIZE(Derived, 2, 1);
+    using f_t = typename Derived::Scalar;
+
+    f_t xn = (xp[0] - cx_) / fx_;
+    f_t yn = (xp[1] - cy_) / fy_;
+    f_t rth = sqrt(xn * xn + yn * yn);
+    f_t phi = std::atan2(yn, xn);
+
+    // solve th + k0*th**3 + k1*th**5 + k2*th**7 + k3*th**9 = rth by Newton
+    f_t th = rth;
+    for (int i = 0; i < max_iter_; i++) {
+      f_t th2 = th * th;
+      f_t th4 = th2 * th2;
+      f_t th6 = th4 * th2;
+      f_t th8 = th4 * th4;
+      f_t f = th * (1 + k0_ * th2 + k1_ * th4 + k2_ * th6 + k3_ * th8) - rth;
+      f_t df = 1 + 3 * k0_ * th2 + 5 * k1_ * th4 + 7 * k2_ * th6 + 9 * k3_ * th8;
+      th -= f / df;
+    }
+
+    Eigen::Matrix<f_t, 3, 1> b;
+    b << std::sin(th) * std::cos(phi), std::sin(th) * std::sin(phi),
+        std::cos(th);
+    return b;
+  }
+
   void Print(std::ostream &out) const {
     out << "Equidistant Camera" << std::endl
         << "[rows, cols]=" << rows_ << "," << cols_ << "]" << std::endl
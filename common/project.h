@@ -94,4 +94,47 @@ Eigen::Matrix<typename Derived::Scalar, 3, 1> unproject_logz(
   return Xc;
 }
 
+
+/** Orthonormal basis (3x2) of the plane tangent to the unit sphere at the
+ *  unit vector b. */
+template <typename Derived>
+Eigen::Matrix<typename Derived::Scalar, 3, 2>
+tangent_basis(const Eigen::MatrixBase<Derived> &b) {
+  EIGEN_STATIC_ASSERT_MATRIX_SPECIFIC_SIZE(Derived, 3, 1);
+  using Vec3 = Eigen::Matrix<typename Derived::Scalar, 3, 1>;
+
+  // the axis least aligned with b
+  int k;
+  b.cwiseAbs().minCoeff(&k);
+  Vec3 e1 = b.cross(Vec3::Unit(k)).normalized();
+
+  Eigen::Matrix<typename Derived::Scalar, 3, 2> B;
+  B << e1, b.cross(e1);
+  return B;
+}
+
+
+/** Projection onto the tangent plane of the unit sphere at the unit vector b.
+ *  For input Xc, returns B'*Xc/|Xc| with B=tangent_basis(b), which is zero if
+ *  Xc points along b. Unlike `project`, valid for any direction of Xc.
+ *  Optionally computes the 2x3 Jacobian d(xt)/d(Xc) */
+template <typename Derived, typename DerivedB>
+Eigen::Matrix<typename Derived::Scalar, 2, 1> project_tangent(
+    const Eigen::MatrixBase<Derived> &Xc, const Eigen::MatrixBase<DerivedB> &b,
+    Eigen::Matrix<typename Derived::Scalar, 2, 3> *dxt_dXc = nullptr) {
+  EIGEN_STATIC_ASSERT_MATRIX_SPECIFIC_SIZE(Derived, 3, 1);
+  EIGEN_STATIC_ASSERT_MATRIX_SPECIFIC_SIZE(DerivedB, 3, 1);
+  using f_t = typename Derived::Scalar;
+
+  Eigen::Matrix<f_t, 3, 2> B = tangent_basis(b);
+  f_t norm = Xc.norm();
+  Eigen::Matrix<f_t, 3, 1> u = Xc / norm;
+  if (dxt_dXc) {
+    *dxt_dXc = B.transpose() *
+               (Eigen::Matrix<f_t, 3, 3>::Identity() - u * u.transpose()) /
+               norm;
+  }
+  return B.transpose() * u;
+}
+
 } // namespace xivo
@@ -1,6 +1,7 @@
 #include "pybind11/eigen.h"
 #include "pybind11/numpy.h"
 #include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
 
 #include "estimator.h"
 #include "opencv2/core/eigen.hpp"
@@ -94,6 +95,18 @@ public:
   }
 
   Eigen::Matrix<double, 3, 4> gsb() { return estimator_->gsb().matrix3x4(); }
+  // body pose in the global frame, differs from gsb() after re-centering
+  Eigen::Matrix<double, 3, 4> gsb_global() {
+    return estimator_->gsb_global().matrix3x4();
+  }
+  // pose of the spatial frame in the global frame
+  Eigen::Matrix<double, 3, 4> origin() {
+    return estimator_->origin().matrix3x4();
+  }
+  // body pose corrected by loop closure
+  Eigen::Matrix<double, 3, 4> gsb_corrected() {
+    return estimator_->gsb_corrected().matrix3x4();
+  }
   Eigen::Matrix<double, 3, 4> gsc() { return estimator_->gsc().matrix3x4(); }
   Eigen::Matrix<double, 3, 4> gbc() { return estimator_->gbc().matrix3x4(); }
   Eigen::Matrix<double, -1, -1> Pstate() { return estimator_->Pstate(); }
@@ -103,6 +116,7 @@ public:
   Vec3 ba() { return estimator_->ba(); }
   Mat3 Rg() { return estimator_->Rg().matrix(); }
   number_t td() { return estimator_->td(); }
+  number_t tr() { return estimator_->tr(); }
   Mat3 Ca() { return estimator_->Ca(); }
   Mat3 Cg() { return estimator_->Cg(); }
 
@@ -173,6 +187,27 @@ public:
     return estimator_->InstateGroupSinds();
   }
 
+  // Groups which left the state since the last call (requires
+  // `output_departed_groups` in the configuration).
+  // Returns (timestamps, poses [qx qy qz qw Tx Ty Tz], covariances (row-major 6x6))
+  std::tuple<std::vector<uint64_t>, MatX7, MatX>
+  DepartedGroups(bool include_instate) {
+    auto groups = estimator_->DrainDepartedGroups(include_instate);
+    std::vector<uint64_t> ts(groups.size());
+    MatX7 poses(groups.size(), 7);
+    MatX covs(groups.size(), 36);
+    for (int i = 0; i < groups.size(); ++i) {
+      const auto &dg = groups[i];
+      ts[i] = dg.ts.count();
+      Quat Qsb(dg.gsb.R().matrix());
+      poses.row(i) << Qsb.x(), Qsb.y(), Qsb.z(), Qsb.w(), dg.gsb.T().transpose();
+      for (int j = 0; j < 6; ++j) {
+        covs.block<1, 6>(i, 6 * j) = dg.cov.row(j);
+      }
+    }
+    return std::make_tuple(ts, poses, covs);
+  }
+
   int num_instate_features() { return estimator_->num_instate_features(); }
 
   int num_instate_groups() { return estimator_->num_instate_groups(); }
@@ -203,6 +238,9 @@ PYBIND11_MODULE(pyxivo, m) {
       .def("VisualMeas", py::overload_cast<uint64_t, py::array_t<unsigned char, py::array::c_style | py::array::forcecast>>(&EstimatorWrapper::VisualMeas))
       .def("gbc", &EstimatorWrapper::gbc)
       .def("gsb", &EstimatorWrapper::gsb)
+      .def("gsb_global", &EstimatorWrapper::gsb_global)
+      .def("origin", &EstimatorWrapper::origin)
+      .def("gsb_corrected", &EstimatorWrapper::gsb_corrected)
       .def("gsc", &EstimatorWrapper::gsc)
       .def("Vsb", &EstimatorWrapper::Vsb)
       .def("inn_Tsb", &EstimatorWrapper::inn_Tsb)
@@ -214,6 +252,7 @@ PYBIND11_MODULE(pyxivo, m) {
       .def("ba", &EstimatorWrapper::ba)
       .def("Rg", &EstimatorWrapper::Rg)
       .def("td", &EstimatorWrapper::td)
+      .def("tr", &EstimatorWrapper::tr)
       .def("Ca", &EstimatorWrapper::Ca)
       .def("Cg", &EstimatorWrapper::Cg)
       .def("InstateFeaturePositions", py::overload_cast<int>(&EstimatorWrapper::InstateFeaturePositions))
@@ -230,6 +269,8 @@ PYBIND11_MODULE(pyxivo, m) {
       .def("InstateGroupSinds", &EstimatorWrapper::InstateGroupSinds)
       .def("InstateGroupPoses", &EstimatorWrapper::InstateGroupPoses)
       .def("InstateGroupCovs", &EstimatorWrapper::InstateGroupCovs)
+      .def("DepartedGroups", &EstimatorWrapper::DepartedGroups,
+           py::arg("include_instate") = false)
       .def("num_instate_features", &EstimatorWrapper::num_instate_features)
       .def("num_instate_groups", &EstimatorWrapper::num_instate_groups)
       .def("now", &EstimatorWrapper::now)
@@ -2,6 +2,8 @@ import numpy as np
 import argparse
 import os, sys
 from shutil import copyfile
+from transforms3d.axangles import axangle2mat
+from transforms3d.quaternions import mat2quat
 
 TP_ROOT = '/home/feixh/Data/tumvi/exported/euroc/512_16'
 KIF_ROOT = '/local2/Data/tumvi/exported/euroc/512_16'
@@ -18,7 +20,7 @@ parser.add_argument(
     '-use_viewer', default=False, action='store_true', help='visualize if set')
 
 # parser.add_argument(
-#     '-double-fusion', default=False, action='store_true', help='if ture, take average of two trajectories in the same coordinate system')
+#     '-double-fusion', default=False, action='store_true', help='if true, also run one estimator per camera and fuse them online with bin/fusion_vio')
 #
 parser.add_argument(
     '-stdout', default=False, action='store_true', help='write to stdout instead of a benchmark file if set')
@@ -96,15 +98,32 @@ if __name__ == '__main__':
         os.system(cmd)
 
     if double_fusion:
-        # fuse trajectories
-        cmd = 'python3 scripts/double_fusion.py \
+        # run one estimator per camera in parallel and fuse their poses online
+        # by covariance intersection, see cfg/fusion.json
+        fused_state = os.path.join(args.out_dir, 'tumvi_{}_fused_state'.format(args.seq))
+        cmd = 'bin/fusion_vio \
+-cfg cfg/fusion.json \
 -root {root:} \
--working-dir {workdir:}  \
--seq {seq:}'.format( root=args.root, workdir=args.out_dir, seq=args.seq)
+-seq {seq:} \
+-out {out:}'.format(root=args.root, seq=args.seq, out=fused_state)
         print('*** COMMAND TO BE EXECUTED ***')
         print(cmd)
         os.system(cmd)
 
+        # timestamp (ns) | translation | rotation (axis-angle) to the format of
+        # the benchmark tools
+        fused_traj = []
+        for line in np.loadtxt(fused_state, ndmin=2):
+            W = line[4:7]
+            angle = np.linalg.norm(W)
+            R = axangle2mat(W / angle, angle) if angle > 0 else np.eye(3)
+            q = mat2quat(R)  # [w, x, y, z]
+            fused_traj.append([line[0] * 1e-9, line[1], line[2], line[3], q[1], q[2], q[3], q[0]])
+        np.savetxt(
+                os.path.join(args.out_dir, 'tumvi_{}_fused'.format(args.seq)),
+                fused_traj,
+                fmt='%f %f %f %f %f %f %f %f')
+
         os.system('echo double-fusion >> {}'.format(benchmark_file))
 
         # evaluate the fused trajectory
@@ -0,0 +1,341 @@
+# Parallel parameter tuning of the estimator configuration.
+# Each trial is a full estimator configuration derived from a base config and
+# a point in the search space (see cfg/tune_space.json). Trials are run with
+# bin/vio on every sequence in parallel processes and scored with bin/eval
+# (ATE & RPE from src/metrics.cpp) and the per-frame CPU time reported by vio.
+# Sampling is driven by CMA-ES on a scalarized objective; all trials are kept
+# and the Pareto front over (ATE, RPE, CPU time) is written at the end.
+#
+# Example:
+# python3 scripts/tune.py -root /path/to/tumvi -seqs room1 room2 room3 \
+#   -space cfg/tune_space.json -out_dir tune_out -jobs 8 -generations 20
+import argparse
+import json
+import math
+import multiprocessing
+import os
+import re
+import shutil
+import subprocess
+import time
+
+import numpy as np
+
+KIF_ROOT = '/local2/Data/tumvi/exported/euroc/512_16'
+
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    '-root', default=KIF_ROOT, help='root directory of the dataset')
+parser.add_argument(
+    '-dataset', default='tumvi', help='xivo | euroc | tumvi')
+parser.add_argument(
+    '-seqs', nargs='+', default=['room1'], help='sequences to evaluate each trial on')
+parser.add_argument(
+    '-cam_id', default=0, type=int, help='specify which camera to use')
+parser.add_argument(
+    '-space', default='cfg/tune_space.json', help='search space definition')
+parser.add_argument(
+    '-out_dir', default='tune_out', help='output directory to save trials and the Pareto front')
+parser.add_argument(
+    '-bin_dir', default='bin', help='directory containing the vio and eval executables')
+parser.add_argument(
+    '-jobs', default=multiprocessing.cpu_count(), type=int, help='number of parallel processes')
+parser.add_argument(
+    '-optimizer', default='cmaes', help='[cmaes|random] sampling strategy')
+parser.add_argument(
+    '-generations', default=10, type=int, help='number of generations')
+parser.add_argument(
+    '-popsize', default=0, type=int, help='trials per generation; 0 to use the CMA-ES default')
+parser.add_argument(
+    '-sigma', default=0.3, type=float, help='initial CMA-ES step size in the normalized space')
+parser.add_argument(
+    '-rpe_weight', default=1.0, type=float, help='weight of RPE (meters) in the scalarized objective')
+parser.add_argument(
+    '-time_weight', default=0.01, type=float, help='weight of CPU time (ms/frame) in the scalarized objective')
+parser.add_argument(
+    '-timeout', default=3600, type=int, help='per-run timeout in seconds')
+parser.add_argument(
+    '-seed', default=0, type=int, help='random seed')
+
+OBJECTIVES = ['ATE', 'RPE', 'cpu_ms']
+
+
+def load_json(path):
+    """ Load json files with // comments as used in cfg/. """
+    content = []
+    with open(path, 'r') as fid:
+        for line in fid:
+            in_string = False
+            for i, c in enumerate(line):
+                if c == '"' and (i == 0 or line[i-1] != '\\'):
+                    in_string = not in_string
+                elif not in_string and line[i:i+2] == '//':
+                    line = line[:i] + '\n'
+                    break
+            content.append(line)
+    return json.loads(''.join(content))
+
+
+def set_value(cfg, key, value):
+    node = cfg
+    fields = key.split('.')
+    for f in fields[:-1]:
+        node = node.setdefault(f, {})
+    node[fields[-1]] = value
+
+
+class SearchSpace:
+    """ Maps points in the unit hypercube to parameter values. """
+    def __init__(self, params):
+        self.params = params
+
+    @property
+    def dim(self):
+        return len(self.params)
+
+    def decode(self, u):
+        values = {}
+        for p, ui in zip(self.params, np.clip(u, 0, 1)):
+            lo, hi = p['min'], p['max']
+            if p.get('log', False):
+                v = math.exp(math.log(lo) + ui * (math.log(hi) - math.log(lo)))
+            else:
+                v = lo + ui * (hi - lo)
+            values[p['key']] = int(round(v)) if p['type'] == 'int' else float(v)
+        return values
+
+
+class RandomSearch:
+    def __init__(self, dim, popsize, rng):
+        self.dim, self.popsize, self.rng = dim, popsize, rng
+
+    def ask(self):
+        return [self.rng.uniform(size=self.dim) for _ in range(self.popsize)]
+
+    def tell(self, xs, fs):
+        pass
+
+
+class CMAES:
+    """ (mu/mu_w, lambda)-CMA-ES in the normalized search space [0, 1]^n.
+    Reference: N. Hansen, The CMA Evolution Strategy: A Tutorial, 2016. """
+    def __init__(self, dim, sigma, popsize, rng):
+        n = dim
+        self.n, self.rng = n, rng
+        self.lam = popsize if popsize > 0 else 4 + int(3 * math.log(n))
+        self.mu = self.lam // 2
+        w = math.log(self.mu + 0.5) - np.log(np.arange(1, self.mu + 1))
+        self.w = w / w.sum()
+        self.mueff = 1.0 / np.sum(self.w ** 2)
+
+        self.cc = (4 + self.mueff / n) / (n + 4 + 2 * self.mueff / n)
+        self.cs = (self.mueff + 2) / (n + self.mueff + 5)
+        self.c1 = 2 / ((n + 1.3) ** 2 + self.mueff)
+        self.cmu = min(1 - self.c1,
+                       2 * (self.mueff - 2 + 1 / self.mueff) / ((n + 2) ** 2 + self.mueff))
+        self.damps = 1 + 2 * max(0, math.sqrt((self.mueff - 1) / (n + 1)) - 1) + self.cs
+        self.chiN = math.sqrt(n) * (1 - 1 / (4 * n) + 1 / (21 * n * n))
+
+        self.mean = np.full(n, 0.5)
+        self.sigma = sigma
+        self.C = np.eye(n)
+        self.pc = np.zeros(n)
+        self.ps = np.zeros(n)
+        self.generation = 0
+
+    def ask(self):
+        D2, B = np.linalg.eigh(self.C)
+        A = B * np.sqrt(np.maximum(D2, 1e-20))
+        return [np.clip(self.mean + self.sigma * A.dot(self.rng.standard_normal(self.n)), 0, 1)
+                for _ in range(self.lam)]
+
+    def tell(self, xs, fs):
+        self.generation += 1
+        order = np.argsort(fs)[:self.mu]
+        X = np.array([xs[i] for i in order])
+        old_mean = self.mean
+        self.mean = self.w.dot(X)
+
+        D2, B = np.linalg.eigh(self.C)
+        invsqrtC = B.dot(np.diag(1 / np.sqrt(np.maximum(D2, 1e-20)))).dot(B.T)
+        y = (self.mean - old_mean) / self.sigma
+        self.ps = (1 - self.cs) * self.ps + \
+            math.sqrt(self.cs * (2 - self.cs) * self.mueff) * invsqrtC.dot(y)
+        hsig = np.linalg.norm(self.ps) / math.sqrt(1 - (1 - self.cs) ** (2 * self.generation)) \
+            < (1.4 + 2 / (self.n + 1)) * self.chiN
+        self.pc = (1 - self.cc) * self.pc + \
+            hsig * math.sqrt(self.cc * (2 - self.cc) * self.mueff) * y
+
+        Y = (X - old_mean) / self.sigma
+        self.C = (1 - self.c1 - self.cmu) * self.C \
+            + self.c1 * (np.outer(self.pc, self.pc)
+                         + (1 - hsig) * self.cc * (2 - self.cc) * self.C) \
+            + self.cmu * (Y.T * self.w).dot(Y)
+        self.sigma *= math.exp((self.cs / self.damps)
+                               * (np.linalg.norm(self.ps) / self.chiN - 1))
+
+
+def run_sequence(job):
+    """ Run vio & eval of one trial on one sequence. Executed in a worker process. """
+    trial_dir, seq, args = job
+    out_prefix = os.path.join(trial_dir, seq)
+    result = {'seq': seq, 'ATE': float('inf'), 'RPE': float('inf'), 'cpu_ms': float('inf')}
+
+    vio_cmd = [os.path.join(args.bin_dir, 'vio'),
+               '-cfg', os.path.join(trial_dir, 'vio.json'),
+               '-root', args.root,
+               '-dataset', args.dataset,
+               '-seq', seq,
+               '-cam_id', str(args.cam_id),
+               '-out', out_prefix + '_state',
+               '-timing', out_prefix + '_timing']
+    eval_cmd = [os.path.join(args.bin_dir, 'eval'),
+                '-root', args.root,
+                '-dataset', args.dataset,
+                '-seq', seq,
+                '-cam_id', str(args.cam_id),
+                '-result', out_prefix + '_state',
+                '-save_aligned=false']
+    try:
+        with open(out_prefix + '_log', 'w') as log:
+            subprocess.run(vio_cmd, stdout=log, stderr=subprocess.STDOUT,
+                           timeout=args.timeout, check=True)
+            output = subprocess.run(eval_cmd, stdout=subprocess.PIPE, stderr=log,
+                                    timeout=args.timeout, check=True).stdout.decode()
+    except (subprocess.CalledProcessError, subprocess.TimeoutExpired) as e:
+        print('trial {} failed on {}: {}'.format(trial_dir, seq, e))
+        return result
+
+    ate = re.search(r'ATE=([-+\d.eE]+|nan|inf)', output)
+    rpe = re.search(r'RPE @ [\d.]+ ms=\[([-+\d.eE]+|nan|inf) meters', output)
+    if ate is None or rpe is None:
+        print('trial {} on {}: cannot parse eval output'.format(trial_dir, seq))
+        return result
+
+    timing = np.loadtxt(out_prefix + '_timing', ndmin=2)
+    result['ATE'] = float(ate.group(1))
+    result['RPE'] = float(rpe.group(1))
+    if timing.size > 0:
+        result['cpu_ms'] = float(np.mean(timing[:, 1]))
+        result['cpu_ms_p99'] = float(np.percentile(timing[:, 1], 99))
+    for k in OBJECTIVES:
+        if not math.isfinite(result[k]):
+            result[k] = float('inf')
+    return result
+
+
+def pareto_front(trials):
+    """ Non-dominated trials w.r.t. OBJECTIVES (all minimized). """
+    front = []
+    for t in trials:
+        obj = [t[k] for k in OBJECTIVES]
+        if not all(math.isfinite(v) for v in obj):
+            continue
+        dominated = False
+        for s in trials:
+            other = [s[k] for k in OBJECTIVES]
+            if all(b <= a for a, b in zip(obj, other)) and any(b < a for a, b in zip(obj, other)):
+                dominated = True
+                break
+        if not dominated:
+            front.append(t)
+    return sorted(front, key=lambda t: t['ATE'])
+
+
+def main(args):
+    if not os.path.exists(args.out_dir):
+        os.makedirs(args.out_dir)
+
+    space_cfg = load_json(args.space)
+    space = SearchSpace(space_cfg['parameters'])
+    base_cfg = load_json(space_cfg['base_cfg'])
+    # benchmarking mode: synchronous, no visualization & logging overhead
+    base_cfg['async_run'] = False
+    base_cfg['print_timing'] = False
+    base_cfg['use_canvas'] = False
+
+    rng = np.random.RandomState(args.seed)
+    if args.optimizer == 'cmaes':
+        optimizer = CMAES(space.dim, args.sigma, args.popsize, rng)
+        popsize = optimizer.lam
+    elif args.optimizer == 'random':
+        popsize = args.popsize if args.popsize > 0 else 8
+        optimizer = RandomSearch(space.dim, popsize, rng)
+    else:
+        raise ValueError('optimizer=[cmaes|random]')
+
+    trials = []
+    pool = multiprocessing.Pool(args.jobs)
+    trials_file = open(os.path.join(args.out_dir, 'trials.jsonl'), 'w')
+
+    for gen in range(args.generations):
+        xs = optimizer.ask()
+        jobs = []
+        generation_trials = []
+        for x in xs:
+            trial_id = len(trials) + len(generation_trials)
+            trial_dir = os.path.abspath(
+                os.path.join(args.out_dir, 'trial_{:04d}'.format(trial_id)))
+            if not os.path.exists(trial_dir):
+                os.makedirs(trial_dir)
+
+            values = space.decode(x)
+            cfg = json.loads(json.dumps(base_cfg))
+            for key, value in values.items():
+                set_value(cfg, key, value)
+            with open(os.path.join(trial_dir, 'estimator.json'), 'w') as fid:
+                json.dump(cfg, fid, indent=2)
+            with open(os.path.join(trial_dir, 'vio.json'), 'w') as fid:
+                json.dump({'estimator_cfg': os.path.join(trial_dir, 'estimator.json'),
+                           'visualize': False,
+                           'verbose': False}, fid, indent=2)
+
+            generation_trials.append({'id': trial_id, 'dir': trial_dir, 'params': values})
+            jobs += [(trial_dir, seq, args) for seq in args.seqs]
+
+        start = time.time()
+        results = pool.map(run_sequence, jobs)
+
+        fs = []
+        for i, t in enumerate(generation_trials):
+            per_seq = results[i * len(args.seqs):(i + 1) * len(args.seqs)]
+            t['sequences'] = per_seq
+            for k in OBJECTIVES:
+                t[k] = float(np.mean([r[k] for r in per_seq]))
+            t['score'] = t['ATE'] + args.rpe_weight * t['RPE'] + args.time_weight * t['cpu_ms']
+            fs.append(t['score'] if math.isfinite(t['score']) else 1e10)
+            trials_file.write(json.dumps(t) + '\n')
+        trials_file.flush()
+
+        optimizer.tell(xs, fs)
+        trials += generation_trials
+
+        best = min(trials, key=lambda t: t['score'])
+        print('generation {}/{}: {} trials in {:.1f}s; best score={:.4f} (ATE={:.4f}, RPE={:.4f}, cpu={:.2f}ms) @ trial {}'.format(
+            gen + 1, args.generations, len(generation_trials), time.time() - start,
+            best['score'], best['ATE'], best['RPE'], best['cpu_ms'], best['id']))
+
+    pool.close()
+    trials_file.close()
+
+    ########################################
+    # SAVE PARETO FRONT
+    ########################################
+    front = pareto_front(trials)
+    front_dir = os.path.join(args.out_dir, 'pareto')
+    if not os.path.exists(front_dir):
+        os.makedirs(front_dir)
+    for t in front:
+        shutil.copyfile(os.path.join(t['dir'], 'estimator.json'),
+                        os.path.join(front_dir, 'trial_{:04d}.json'.format(t['id'])))
+    with open(os.path.join(args.out_dir, 'pareto.json'), 'w') as fid:
+        json.dump(front, fid, indent=2)
+
+    print('Pareto front ({} of {} trials):'.format(len(front), len(trials)))
+    for t in front:
+        print('  trial {:04d}: ATE={:.4f} m, RPE={:.4f} m, cpu={:.2f} ms/frame'.format(
+            t['id'], t['ATE'], t['RPE'], t['cpu_ms']))
+
+
+if __name__ == '__main__':
+    main(parser.parse_args())
@@ -0,0 +1,59 @@
+#include "adaptive_noise.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "glog/logging.h"
+
+namespace xivo {
+
+AdaptiveNoise::AdaptiveNoise(const AdaptiveNoiseOptions &options, int cols,
+                             int rows)
+    : options_{options}, cols_{cols}, rows_{rows}, scale_{1} {
+  CHECK(options_.grid_cols > 0 && options_.grid_rows > 0);
+  CHECK(options_.min_scale <= 1 && options_.max_scale >= 1);
+  cells_.resize(options_.grid_cols * options_.grid_rows);
+}
+
+int AdaptiveNoise::CellOf(const Vec2 &xp) const {
+  int c = std::clamp(int(xp(0) * options_.grid_cols / cols_), 0,
+                     options_.grid_cols - 1);
+  int r = std::clamp(int(xp(1) * options_.grid_rows / rows_), 0,
+                     options_.grid_rows - 1);
+  return r * options_.grid_cols + c;
+}
+
+void AdaptiveNoise::AddSample(const Vec2 &xp, number_t d) {
+  if (!std::isfinite(d)) {
+    return;
+  }
+  auto &cell = cells_[CellOf(xp)];
+  // d is about inversely proportional to the variance, when it dominates the
+  // innovation covariance, so d * scale is what d would be at scale 1, and
+  // samples taken at other scales stay comparable
+  cell.samples.push_back(d * cell.scale);
+  if (cell.samples.size() > options_.window) {
+    cell.samples.pop_front();
+  }
+}
+
+void AdaptiveNoise::Adapt() {
+  // median of the chi-squared distribution of 2 degrees of freedom
+  static const number_t median = 2 * std::log(2.0);
+
+  number_t log_scale{0};
+  for (auto &cell : cells_) {
+    if (cell.samples.size() >= options_.min_samples) {
+      std::vector<number_t> d(cell.samples.begin(), cell.samples.end());
+      std::nth_element(d.begin(), d.begin() + d.size() / 2, d.end());
+      number_t target = d[d.size() / 2] / median;
+      cell.scale = std::clamp(std::pow(cell.scale, 1 - options_.rate) *
+                                  std::pow(target, options_.rate),
+                              options_.min_scale, options_.max_scale);
+    }
+    log_scale += std::log(cell.scale);
+  }
+  scale_ = std::exp(log_scale / cells_.size());
+}
+
+} // namespace xivo
@@ -0,0 +1,52 @@
+// Online estimation of the variance of visual measurements.
+//
+// The variance which makes the filter consistent depends on the images, e.g.,
+// on their blur, and on the camera, so a configured value is either too small,
+// and the gating rejects good tracks, or too large, and the update wastes
+// information. If the measurements have the variance assumed, the normalized
+// innovations d = r' S^-1 r of the gating, with S = J P J' + R, follow a
+// chi-squared distribution of 2 degrees of freedom, of median 2 ln 2. The
+// variance is scaled, slowly, until the median of the last normalized
+// innovations matches it. The median keeps outliers from inflating the
+// variance, so all the measurements are used, not only the gated ones.
+#pragma once
+#include <deque>
+#include <vector>
+
+#include "core.h"
+#include "options.h"
+
+namespace xivo {
+
+class AdaptiveNoise {
+public:
+  /** Over an image of `cols` x `rows` pixels. */
+  AdaptiveNoise(const AdaptiveNoiseOptions &options, int cols, int rows);
+
+  /** Adds the normalized innovation `d` of a measurement at pixel `xp`. */
+  void AddSample(const Vec2 &xp, number_t d);
+  /** Moves the scale of each cell of enough samples by `rate` towards the
+   *  one which matches the median of its samples; once per frame. */
+  void Adapt();
+
+  /** Scale of the variance of a measurement at pixel `xp`. */
+  number_t scale(const Vec2 &xp) const { return cells_[CellOf(xp)].scale; }
+  /** Scale of the variance over the whole image, the geometric mean of those
+   *  of the cells, e.g., for measurements of several pixels. */
+  number_t scale() const { return scale_; }
+
+private:
+  int CellOf(const Vec2 &xp) const;
+
+  struct Cell {
+    std::deque<number_t> samples;
+    number_t scale{1};
+  };
+
+  AdaptiveNoiseOptions options_;
+  int cols_, rows_;
+  std::vector<Cell> cells_;
+  number_t scale_;
+};
+
+} // namespace xivo
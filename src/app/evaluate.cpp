@@ -0,0 +1,112 @@
+// Evaluate a trajectory produced by the vio app against ground truth.
+// Prints ATE & RPE and writes the aligned trajectory next to the result.
+// Author: Xiaohan Fei (feixh@cs.ucla.edu)
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <tuple>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "alias.h"
+#include "loader.h"
+#include "message_types.h"
+#include "metrics.h"
+#include "utils.h"
+
+// flags
+DEFINE_string(root, "/home/feixh/Data/tumvi/exported/euroc/512_16/",
+              "Root directory containing tumvi dataset folder.");
+DEFINE_string(dataset, "tumvi", "xivo | euroc | tumvi");
+DEFINE_string(seq, "room1", "Sequence of TUM VI benchmark to play with.");
+DEFINE_int32(cam_id, 0, "Camera id.");
+DEFINE_string(result, "out_state", "Path to the result file.");
+
+// flags for evaluation
+DEFINE_double(resolution, 0.001,
+              "Asynchronized timestemps within this bound, in seconds, are "
+              "paired and compared.");
+DEFINE_double(RPE_interval, 1.0,
+              "Interval, in seconds, over which to compute RPE.");
+DEFINE_bool(save_aligned, true,
+            "Write the aligned trajectory to <result>_aligned if set.");
+
+namespace xivo {
+// load trajectory in the format written by the vio app:
+// timestamp (ns) | translation (3) | rotation in exponential coordinates (3)
+// trailing columns, e.g., covariance in the smoothed trajectory, are ignored
+std::vector<msg::Pose> LoadEstimatedState(const std::string &path) {
+  std::vector<msg::Pose> out;
+  if (std::ifstream istream{path, std::ios::in}) {
+    std::string line;
+    while (std::getline(istream, line)) {
+      std::istringstream ss{line};
+      int64_t ts;          // timestamp
+      number_t x, y, z;    // translation
+      number_t w0, w1, w2; // rotation in exponential coordinates
+      if (!(ss >> ts >> x >> y >> z >> w0 >> w1 >> w2)) {
+        continue;
+      }
+      auto R = SO3::exp({w0, w1, w2});
+      auto T = Vec3{x, y, z};
+      out.emplace_back(timestamp_t{ts}, SE3{R, T});
+    }
+  } else {
+    LOG(FATAL) << "failed to open estimated trajectory @ " << path;
+  }
+  return out;
+}
+} // namespace xivo
+
+using namespace xivo;
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  std::string image_dir, imu_dir, mocap_dir;
+  std::tie(image_dir, imu_dir, mocap_dir) =
+      GetDirs(FLAGS_dataset, FLAGS_root, FLAGS_seq, FLAGS_cam_id);
+  std::unique_ptr<DataLoader> loader(new DataLoader{image_dir, imu_dir});
+
+  auto traj_gt = loader->LoadGroundTruthState(mocap_dir);
+  LOG(INFO) << "Ground truth loaded";
+
+  std::vector<msg::Pose> traj_est = LoadEstimatedState(FLAGS_result);
+  LOG(INFO) << "Estimated trajectory loaded";
+
+  // Absolute Trajectory Error
+  number_t ate;
+  SE3 g_est_gt;
+  std::tie(ate, g_est_gt) = ComputeATE(traj_est, traj_gt, FLAGS_resolution);
+  LOG(INFO) << "ATE computed";
+
+  // Relative Pose Error
+  number_t rpe_pos, rpe_rot;
+  std::tie(rpe_pos, rpe_rot) =
+      ComputeRPE(traj_est, traj_gt, FLAGS_RPE_interval, FLAGS_resolution);
+  LOG(INFO) << "RPE computed";
+
+  std::cout << StrFormat("ATE=%0.4f meters\n", ate);
+  std::cout << StrFormat("RPE @ %0.4f ms=[%0.4f meters, %0.4f degrees]\n",
+                         1000.0 * FLAGS_RPE_interval, rpe_pos,
+                         rpe_rot / M_PI * 180);
+
+  if (FLAGS_save_aligned) {
+    // write aligned estimates to file.
+    std::string output_path = FLAGS_result + "_aligned";
+    std::ofstream ostream{output_path, std::ios::out};
+    if (!ostream.is_open()) {
+      LOG(FATAL) << "failed to open output file @ " << output_path;
+    }
+    for (const auto &msg : traj_est) {
+      auto aligned_g = g_est_gt.inv() * msg.g_;
+      ostream << StrFormat("%ld", msg.ts_.count()) << " "
+              << aligned_g.translation().transpose() << " "
+              << aligned_g.rotation().log().transpose() << std::endl;
+    }
+    LOG(INFO) << "aligned trajectory saved";
+  }
+}
@@ -0,0 +1,209 @@
+// Replays a sequence once without faults and once per class of faults, e.g.,
+// dropped images or IMU gaps, and reports how accuracy and latency degrade.
+//
+// Each replay runs in a forked process, since the estimator is a singleton,
+// one at a time so the latencies are not skewed by the other replays.
+// Latency is the time from the capture of an image to the end of its
+// processing, with the delivery delays of the faults and the processing
+// time on this host, and messages waiting while the estimator is busy.
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <tuple>
+
+#include "sys/wait.h"
+#include "unistd.h"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "estimator.h"
+#include "fault_injection.h"
+#include "loader.h"
+#include "metrics.h"
+#include "utils.h"
+
+// flags
+DEFINE_string(cfg, "cfg/vio.json",
+              "Configuration file for the VIO application.");
+DEFINE_string(faults, "cfg/faults.json", "Configuration of the faults.");
+DEFINE_string(root, "/home/feixh/Data/tumvi/exported/euroc/512_16/",
+              "Root directory containing tumvi dataset folder.");
+DEFINE_string(dataset, "tumvi", "xivo | euroc | tumvi");
+DEFINE_string(seq, "room1", "Sequence of TUM VI benchmark to play with.");
+DEFINE_int32(cam_id, 0, "Camera id.");
+DEFINE_string(out_dir, "",
+              "If set, write the trajectory of each replay to "
+              "<out_dir>/<class>.txt.");
+DEFINE_double(resolution, 0.001,
+              "Asynchronized timestemps within this bound, in seconds, are "
+              "paired and compared.");
+DEFINE_double(RPE_interval, 1.0,
+              "Interval, in seconds, over which to compute RPE.");
+
+using namespace xivo;
+
+namespace {
+
+struct ReplayResult {
+  bool ok; // the replay ran to the end
+  int num_images;
+  number_t ate, rpe_pos, rpe_rot;                 // meters, meters, radians
+  number_t latency_p50, latency_p99, latency_max; // milliseconds
+};
+
+ReplayResult Replay(const Json::Value &est_cfg, const DeliveryStream &stream,
+                    const std::vector<msg::Pose> &traj_gt,
+                    const std::string &out) {
+  auto est = CreateSystem(est_cfg);
+  std::vector<msg::Pose> traj_est;
+  std::vector<number_t> latency;
+  // time on the replay clock until which the estimator is busy
+  timestamp_t busy_until{0};
+  for (const auto &d : stream) {
+    cv::Mat image;
+    if (d.type == Delivery::IMAGE) {
+      image = FaultInjector::ReadImage(d);
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (d.type == Delivery::IMAGE) {
+      est->VisualMeas(d.ts, image);
+    } else if (d.type == Delivery::IMU) {
+      est->InertialMeas(d.ts, d.gyro, d.accel);
+    } else {
+      est->EventMeas(d.ts,
+                     static_cast<const msg::EventBatch *>(d.msg)->events_);
+    }
+    busy_until = std::max(busy_until, d.arrival) +
+                 std::chrono::duration_cast<timestamp_t>(
+                     std::chrono::steady_clock::now() - start);
+    if (d.type == Delivery::IMAGE) {
+      latency.push_back(1e-6 * (busy_until - d.sensor_ts).count());
+      traj_est.emplace_back(est->ts(), est->gsb_global());
+    }
+  }
+
+  if (!out.empty()) {
+    if (std::ofstream ostream{out, std::ios::out}) {
+      for (const auto &pose : traj_est) {
+        ostream << StrFormat("%ld", pose.ts_.count()) << " "
+                << pose.g_.translation().transpose() << " "
+                << pose.g_.rotation().log().transpose() << std::endl;
+      }
+    } else {
+      LOG(ERROR) << "failed to open output file @ " << out;
+    }
+  }
+
+  ReplayResult result{true, int(latency.size()), 0, 0, 0, 0, 0, 0};
+  if (!traj_est.empty()) {
+    std::tie(result.ate, std::ignore) =
+        ComputeATE(traj_est, traj_gt, FLAGS_resolution);
+    std::tie(result.rpe_pos, result.rpe_rot) =
+        ComputeRPE(traj_est, traj_gt, FLAGS_RPE_interval, FLAGS_resolution);
+  }
+  if (!latency.empty()) {
+    std::sort(latency.begin(), latency.end());
+    result.latency_p50 = latency[latency.size() / 2];
+    result.latency_p99 = latency[latency.size() * 99 / 100];
+    result.latency_max = latency.back();
+  }
+  return result;
+}
+
+// runs the replay in a child process; a replay which crashes, e.g., on a
+// failed check in the estimator, is reported as such
+ReplayResult RunReplay(const Json::Value &est_cfg, const DeliveryStream &stream,
+                       const std::vector<msg::Pose> &traj_gt,
+                       const std::string &out) {
+  int fd[2];
+  CHECK(pipe(fd) == 0) << "failed to create pipe";
+  // buffered output would otherwise be written by both processes
+  std::cout.flush();
+  fflush(nullptr);
+
+  pid_t pid = fork();
+  CHECK(pid >= 0) << "fork failed";
+  if (pid == 0) {
+    close(fd[0]);
+    ReplayResult result = Replay(est_cfg, stream, traj_gt, out);
+    bool ok = write(fd[1], &result, sizeof(result)) == sizeof(result);
+    // skip the destructors of the singletons shared with the parent
+    _exit(ok ? 0 : 1);
+  }
+  close(fd[1]);
+  ReplayResult result{false, 0, 0, 0, 0, 0, 0, 0};
+  if (read(fd[0], &result, sizeof(result)) != sizeof(result)) {
+    result.ok = false;
+  }
+  close(fd[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    result.ok = false;
+  }
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto cfg = LoadJson(FLAGS_cfg);
+  auto faults_cfg = LoadJson(FLAGS_faults);
+
+  std::string image_dir, imu_dir, mocap_dir;
+  std::tie(image_dir, imu_dir, mocap_dir) =
+      GetDirs(FLAGS_dataset, FLAGS_root, FLAGS_seq, FLAGS_cam_id);
+  std::unique_ptr<DataLoader> loader(new DataLoader{image_dir, imu_dir});
+  auto traj_gt = loader->LoadGroundTruthState(mocap_dir);
+
+  auto est_cfg = LoadJson(cfg["estimator_cfg"].asString());
+  est_cfg["use_canvas"] = false;
+  est_cfg["print_timing"] = false;
+
+  // one class per fault, each with the seed of the configuration, preceded
+  // by the replay without faults and followed by all faults at once
+  std::vector<std::pair<std::string, Json::Value>> classes;
+  Json::Value none;
+  none["seed"] = faults_cfg.get("seed", 0);
+  none["faults"] = Json::arrayValue;
+  classes.emplace_back("none", none);
+  for (const auto &fault : faults_cfg["faults"]) {
+    Json::Value single = none;
+    single["faults"].append(fault);
+    classes.emplace_back(MakeFault(fault)->name(), single);
+  }
+  if (faults_cfg.get("combined", true).asBool() &&
+      faults_cfg["faults"].size() > 1) {
+    classes.emplace_back("combined", faults_cfg);
+  }
+
+  std::cout << StrFormat("%-16s %6s %8s %9s %9s %9s %9s %9s %9s\n", "class",
+                         "images", "ATE[m]", "dATE[m]", "RPE[m]", "RPE[deg]",
+                         "p50[ms]", "p99[ms]", "dp99[ms]");
+  ReplayResult baseline{false, 0, 0, 0, 0, 0, 0, 0};
+  for (int k = 0; k < classes.size(); ++k) {
+    const auto &name = classes[k].first;
+    auto stream = FaultInjector{classes[k].second}.Apply(*loader);
+    std::string out =
+        FLAGS_out_dir.empty() ? "" : FLAGS_out_dir + "/" + name + ".txt";
+    auto r = RunReplay(est_cfg, stream, traj_gt, out);
+    if (k == 0) {
+      baseline = r;
+    }
+    if (!r.ok) {
+      std::cout << StrFormat("%-16s failed\n", name.c_str());
+      continue;
+    }
+    std::cout << StrFormat(
+        "%-16s %6d %8.4f %+9.4f %9.4f %9.4f %9.2f %9.2f %+9.2f\n",
+        name.c_str(), r.num_images, r.ate,
+        baseline.ok ? r.ate - baseline.ate : 0, r.rpe_pos,
+        r.rpe_rot / M_PI * 180, r.latency_p50, r.latency_p99,
+        baseline.ok ? r.latency_p99 - baseline.latency_p99 : 0);
+  }
+}
@@ -0,0 +1,196 @@
+// Runs several estimators, e.g., one per camera, on the same sequence in
+// parallel processes and fuses their poses by covariance intersection as they
+// come, see fusion.h.
+//
+// The estimator and its subsystems are singletons, so each estimator runs in a
+// forked process, on a core of its own, and sends its pose & covariance after
+// every image through a pipe.
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "estimator.h"
+#include "estimator_process.h"
+#include "fusion.h"
+#include "loader.h"
+
+DEFINE_string(cfg, "cfg/fusion.json",
+              "Configuration file listing the estimators to fuse.");
+DEFINE_string(root, "/home/feixh/Data/tumvi/exported/euroc/512_16/",
+              "Root directory containing tumvi dataset folder.");
+DEFINE_string(dataset, "tumvi", "xivo | euroc | tumvi");
+DEFINE_string(seq, "room1", "Sequence of TUM VI benchmark to play with.");
+DEFINE_string(out, "out_state_fused",
+              "Output file path of the fused trajectory, in the format of vio.");
+
+using namespace xivo;
+
+namespace {
+
+// what an estimator sends after each image
+struct PoseRecord {
+  int64_t ts;
+  double T[3];
+  double W[3];
+  double cov[36]; // row-major, of the error (W, T)
+};
+
+bool ReadRecord(int fd, PoseRecord *record) {
+  auto *buf = reinterpret_cast<uint8_t *>(record);
+  size_t done{0};
+  while (done < sizeof(PoseRecord)) {
+    ssize_t n = read(fd, buf + done, sizeof(PoseRecord) - done);
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+// runs in the child process
+void RunEstimator(const Json::Value &source, int fd) {
+  auto est_cfg = LoadJson(source["estimator_cfg"].asString());
+  est_cfg["use_canvas"] = false;
+  est_cfg["print_timing"] = false;
+
+  std::string image_dir, imu_dir, mocap_dir;
+  std::tie(image_dir, imu_dir, mocap_dir) = GetDirs(
+      FLAGS_dataset, FLAGS_root, FLAGS_seq, source.get("cam_id", 0).asInt());
+  DataLoader loader{image_dir, imu_dir};
+  auto est = CreateSystem(est_cfg);
+
+  for (int i = 0; i < loader.size(); ++i) {
+    auto raw_msg = loader.Get(i);
+    if (auto msg = dynamic_cast<msg::Image *>(raw_msg)) {
+      est->VisualMeas(msg->ts_, cv::imread(msg->image_path_));
+      if (!est->MeasurementUpdateInitialized()) {
+        continue;
+      }
+      // in the global frame, i.e., undo re-centering
+      SE3 gsb = est->gsb_global();
+      Mat6 C = Mat6::Identity();
+      C.block<3, 3>(3, 3) = est->origin().R().matrix();
+      Mat6 cov = C * est->Pstate().block<6, 6>(0, 0) * C.transpose();
+
+      PoseRecord record;
+      record.ts = est->ts().count();
+      Vec3 T = gsb.T(), W = gsb.R().log();
+      for (int j = 0; j < 3; ++j) {
+        record.T[j] = T(j);
+        record.W[j] = W(j);
+      }
+      Eigen::Map<Eigen::Matrix<double, 6, 6, Eigen::RowMajor>>(record.cov) =
+          cov.cast<double>();
+      // smaller than PIPE_BUF, hence written at once
+      if (write(fd, &record, sizeof(record)) != sizeof(record)) {
+        LOG(WARNING) << "fusion stage is gone";
+        return;
+      }
+    } else if (auto msg = dynamic_cast<msg::IMU *>(raw_msg)) {
+      est->InertialMeas(msg->ts_, msg->gyro_, msg->accel_);
+    }
+  }
+}
+
+// writes the fused poses in the format of vio
+class TrajectoryWriter : public Publisher {
+public:
+  TrajectoryWriter(std::ostream &ostream) : ostream_{ostream} {}
+  void Publish(const timestamp_t &ts, const SE3 &gsb,
+               const Mat6 &cov) override {
+    ostream_ << StrFormat("%ld", ts.count()) << " "
+             << gsb.translation().transpose() << " "
+             << gsb.rotation().log().transpose() << std::endl;
+  }
+
+private:
+  std::ostream &ostream_;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto cfg = LoadJson(FLAGS_cfg);
+  const auto &sources = cfg["sources"];
+  CHECK(sources.size() > 0) << "no estimator to fuse";
+
+  FusionOptions options;
+  options.max_dt = cfg.get("max_dt", 0.002).asDouble();
+  options.align_frames = cfg.get("align_frames", true).asBool();
+  options.max_iters = cfg.get("max_iters", 50).asInt();
+  options.max_pending = cfg.get("max_pending", 100).asInt();
+
+  std::ofstream ostream{FLAGS_out, std::ios::out};
+  if (!ostream.is_open()) {
+    LOG(FATAL) << "failed to open output file @ " << FLAGS_out;
+  }
+  TrajectoryWriter writer{ostream};
+  PoseFusion fusion(sources.size(), options, &writer);
+
+  std::vector<pollfd> fds;
+  std::vector<pid_t> pids;
+  for (int k = 0; k < sources.size(); ++k) {
+    int fd[2];
+    CHECK(pipe(fd) == 0) << "failed to create pipe";
+    // buffered output would otherwise be written by both processes
+    std::cout.flush();
+    fflush(nullptr);
+
+    pid_t pid = fork();
+    CHECK(pid >= 0) << "fork failed";
+    if (pid == 0) {
+      for (const auto &other : fds) {
+        close(other.fd);
+      }
+      close(fd[0]);
+      RunEstimator(sources[k], fd[1]);
+      close(fd[1]);
+      _exit(0);
+    }
+    close(fd[1]);
+    fds.push_back({fd[0], POLLIN, 0});
+    pids.push_back(pid);
+  }
+
+  // fuse as the estimates come, until every estimator is done
+  int open = fds.size();
+  while (open > 0) {
+    CHECK(poll(fds.data(), fds.size(), -1) >= 0) << "poll failed";
+    for (int k = 0; k < fds.size(); ++k) {
+      if (fds[k].fd < 0 || !fds[k].revents) {
+        continue;
+      }
+      PoseRecord record;
+      if (ReadRecord(fds[k].fd, &record)) {
+        PoseEstimate est;
+        est.ts = timestamp_t{record.ts};
+        est.gsb = SE3{SO3::exp(Vec3{record.W[0], record.W[1], record.W[2]}),
+                      Vec3{record.T[0], record.T[1], record.T[2]}};
+        est.cov = Eigen::Map<Eigen::Matrix<double, 6, 6, Eigen::RowMajor>>(
+                      record.cov)
+                      .cast<number_t>();
+        fusion.Add(k, est);
+      } else {
+        LOG(INFO) << "estimator #" << k << " done";
+        fusion.Remove(k);
+        close(fds[k].fd);
+        fds[k].fd = -1;
+        --open;
+      }
+    }
+  }
+  for (auto pid : pids) {
+    waitpid(pid, nullptr, 0);
+  }
+  LOG(INFO) << "#fused poses=" << fusion.num_fused();
+}
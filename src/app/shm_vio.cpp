@@ -0,0 +1,64 @@
+// Runs the estimator on images and IMU samples read from a shared memory ring
+// written by a driver process (see shm_writer for a stand-in).
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "estimator.h"
+#include "shm_ring.h"
+#include "utils.h"
+
+DEFINE_string(cfg, "cfg/vio.json",
+              "Configuration file for the VIO application.");
+DEFINE_string(shm, "/xivo", "Name of the shared memory segment.");
+DEFINE_string(out, "out_state", "Output file path.");
+DEFINE_double(idle_timeout, 2.0,
+              "Stop if nothing arrives for this many seconds.");
+
+using namespace xivo;
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto cfg = LoadJson(FLAGS_cfg);
+  auto est = CreateSystem(LoadJson(cfg["estimator_cfg"].asString()));
+
+  std::ofstream ostream{FLAGS_out, std::ios::out};
+  if (!ostream.is_open()) {
+    LOG(FATAL) << "failed to open output file @ " << FLAGS_out;
+  }
+
+  ShmReader reader{FLAGS_shm};
+
+  auto on_image = [&est, &ostream](const timestamp_t &ts, const cv::Mat &image) {
+    est->VisualMeas(ts, image);
+    SE3 gsb = est->gsb_global();
+    ostream << StrFormat("%ld", est->ts().count()) << " "
+            << gsb.translation().transpose() << " "
+            << gsb.rotation().log().transpose() << std::endl;
+  };
+  auto on_inertial = [&est](const timestamp_t &ts, const Vec3 &gyro,
+                            const Vec3 &accel) {
+    est->InertialMeas(ts, gyro, accel);
+  };
+
+  auto last_arrival = std::chrono::steady_clock::now();
+  for (;;) {
+    if (reader.Poll(on_image, on_inertial) > 0) {
+      last_arrival = std::chrono::steady_clock::now();
+    } else if (std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             last_arrival)
+                   .count() > FLAGS_idle_timeout) {
+      reader.Poll(on_image, on_inertial, true);
+      break;
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  LOG(INFO) << "no data for " << FLAGS_idle_timeout << " seconds, stopping; "
+            << reader.imu_overruns() << " IMU samples lost";
+}
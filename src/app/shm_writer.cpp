@@ -0,0 +1,134 @@
+// Writes images and IMU samples into a shared memory ring, standing in for a
+// camera/IMU driver process. Replays a dataset in real time, or, if no
+// dataset is given, generates a synthetic sequence.
+#include <chrono>
+#include <thread>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "loader.h"
+#include "shm_ring.h"
+
+DEFINE_string(shm, "/xivo", "Name of the shared memory segment.");
+DEFINE_int32(slots, 8, "Number of image slots.");
+DEFINE_int32(imu_capacity, 4096, "Number of IMU samples in the ring.");
+DEFINE_string(root, "", "Root directory of the dataset to replay. If empty, "
+                        "write a synthetic sequence.");
+DEFINE_string(dataset, "tumvi", "xivo | euroc | tumvi");
+DEFINE_string(seq, "room1", "Sequence to replay.");
+DEFINE_int32(cam_id, 0, "Camera id.");
+DEFINE_double(speed, 1.0, "Playback speed, 0 to write as fast as possible.");
+// synthetic sequence
+DEFINE_int32(rows, 512, "Image rows of the synthetic sequence.");
+DEFINE_int32(cols, 512, "Image columns of the synthetic sequence.");
+DEFINE_double(duration, 10.0, "Duration of the synthetic sequence, seconds.");
+DEFINE_double(image_rate, 20.0, "Image rate of the synthetic sequence, Hz.");
+DEFINE_double(imu_rate, 200.0, "IMU rate of the synthetic sequence, Hz.");
+
+using namespace xivo;
+
+namespace {
+
+// sleep such that messages go out at their timestamps (scaled by the speed)
+class Pacer {
+public:
+  void Wait(const timestamp_t &ts) {
+    if (FLAGS_speed <= 0)
+      return;
+    auto now = std::chrono::steady_clock::now();
+    if (!started_) {
+      started_ = true;
+      t0_ = now;
+      ts0_ = ts;
+      return;
+    }
+    auto target = t0_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            (ts - ts0_) / FLAGS_speed);
+    if (target > now) {
+      std::this_thread::sleep_until(target);
+    }
+  }
+
+private:
+  bool started_{false};
+  std::chrono::steady_clock::time_point t0_;
+  timestamp_t ts0_;
+};
+
+void Replay(ShmWriter *writer, DataLoader *loader) {
+  Pacer pacer;
+  int dropped = 0;
+  for (int i = 0; i < loader->size(); ++i) {
+    auto raw_msg = loader->Get(i);
+    pacer.Wait(raw_msg->ts_);
+    if (auto msg = dynamic_cast<msg::Image *>(raw_msg)) {
+      auto image = cv::imread(msg->image_path_);
+      dropped += !writer->WriteImage(msg->ts_, image);
+    } else if (auto msg = dynamic_cast<msg::IMU *>(raw_msg)) {
+      writer->WriteInertial(msg->ts_, msg->gyro_, msg->accel_);
+    }
+  }
+  LOG(INFO) << "replay done, " << dropped << " images dropped";
+}
+
+// a textured plane sliding sideways in front of a camera at rest, with a
+// noise-free IMU measuring gravity only
+void Synthesize(ShmWriter *writer) {
+  cv::Mat texture(FLAGS_rows, 2 * FLAGS_cols, CV_8UC3);
+  cv::randu(texture, cv::Scalar::all(0), cv::Scalar::all(255));
+  cv::GaussianBlur(texture, texture, cv::Size(5, 5), 0);
+
+  Pacer pacer;
+  timestamp_t ts{0};
+  timestamp_t imu_dt{static_cast<int64_t>(1e9 / FLAGS_imu_rate)};
+  timestamp_t image_dt{static_cast<int64_t>(1e9 / FLAGS_image_rate)};
+  timestamp_t next_image{0};
+  timestamp_t end{static_cast<int64_t>(FLAGS_duration * 1e9)};
+  int frame = 0;
+  for (; ts < end; ts += imu_dt) {
+    pacer.Wait(ts);
+    writer->WriteInertial(ts, Vec3::Zero(), Vec3{0, 0, 9.8});
+    if (ts >= next_image) {
+      int shift = frame++ % FLAGS_cols;
+      writer->WriteImage(ts, texture(cv::Rect(shift, 0, FLAGS_cols, FLAGS_rows)));
+      next_image += image_dt;
+    }
+  }
+  LOG(INFO) << frame << " synthetic images written";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_root.empty()) {
+    ShmWriter writer{FLAGS_shm, FLAGS_slots, FLAGS_rows, FLAGS_cols, CV_8UC3,
+                     FLAGS_imu_capacity};
+    Synthesize(&writer);
+  } else {
+    std::string image_dir, imu_dir, mocap_dir;
+    std::tie(image_dir, imu_dir, mocap_dir) =
+        GetDirs(FLAGS_dataset, FLAGS_root, FLAGS_seq, FLAGS_cam_id);
+    DataLoader loader{image_dir, imu_dir};
+
+    // slots are sized after the first image
+    cv::Mat first;
+    for (int i = 0; i < loader.size() && first.empty(); ++i) {
+      if (auto msg = dynamic_cast<msg::Image *>(loader.Get(i))) {
+        first = cv::imread(msg->image_path_);
+      }
+    }
+    CHECK(!first.empty()) << "no image to replay";
+    ShmWriter writer{FLAGS_shm, FLAGS_slots, first.rows, first.cols,
+                     first.type(), FLAGS_imu_capacity};
+    Replay(&writer, &loader);
+  }
+  // keep the segment around until the reader is done with it
+  LOG(INFO) << "press enter to remove the shared memory segment";
+  std::cin.get();
+}
@@ -0,0 +1,88 @@
+// Times the Kalman update in covariance and information form over a range of
+// ratios of measurement rows to states updated, on random problems the shape
+// of the estimator's: a full-size error state of which only some states are
+// in use.
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "core.h"
+#include "helpers.h"
+#include "utils.h"
+
+// flags
+DEFINE_int32(states, 120, "Number of states in use.");
+DEFINE_int32(size, xivo::kFullSize, "Size of the error state.");
+DEFINE_string(ratios, "0.25,0.5,1,1.5,2,4,8",
+              "Ratios of measurement rows to states in use.");
+DEFINE_int32(reps, 10, "Repetitions of each update; the median is reported.");
+
+using namespace xivo;
+
+namespace {
+
+// median time, in milliseconds, of `reps` runs of the update
+template <typename F> number_t Time(F &&update, int reps) {
+  std::vector<number_t> times;
+  for (int k = 0; k < reps; ++k) {
+    auto start = std::chrono::steady_clock::now();
+    update();
+    times.push_back(std::chrono::duration<number_t, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count());
+  }
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK(FLAGS_states > 0 && FLAGS_states <= FLAGS_size);
+
+  int n = FLAGS_states;
+  MatX L = MatX::Random(n, n);
+  MatX P = MatX::Identity(FLAGS_size, FLAGS_size);
+  P.topLeftCorner(n, n) = 1e-2 * (L * L.transpose()) + 1e-3 * MatX::Identity(n, n);
+
+  std::cout << StrFormat("%8s %6s %6s %10s %10s %8s %6s\n", "m/n", "m", "n",
+                         "cov[ms]", "info[ms]", "speedup", "auto");
+  std::stringstream ss(FLAGS_ratios);
+  for (std::string token; std::getline(ss, token, ',');) {
+    number_t ratio = std::stod(token);
+    int m = std::max(1, int(ratio * n));
+    MatX H = MatX::Zero(m, FLAGS_size);
+    H.leftCols(n) = MatX::Random(m, n);
+    VecX diagR = VecX::Constant(m, 1.0);
+    VecX inn = VecX::Random(m);
+    auto states = UpdatedStates(H, P);
+
+    VecX err;
+    number_t t_cov = Time(
+        [&]() {
+          MatX P_new = P;
+          CovarianceFormUpdate(H, diagR, inn, P_new, err);
+        },
+        FLAGS_reps);
+    number_t t_info = Time(
+        [&]() {
+          MatX P_new = P;
+          number_t nis;
+          bool ok =
+              InformationFormUpdate(H, diagR, inn, states, P_new, err, &nis);
+          CHECK(ok) << "covariance not positive definite";
+        },
+        FLAGS_reps);
+    std::cout << StrFormat("%8.2f %6d %6d %10.3f %10.3f %8.2f %6s\n", ratio, m,
+                           int(states.size()), t_cov, t_info, t_cov / t_info,
+                           m > states.size() ? "info" : "cov");
+  }
+}
@@ -1,6 +1,8 @@
 // Author: Xiaohan Fei
 #include "unistd.h"
 #include <algorithm>
+#include <chrono>
+#include <ctime>
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
@@ -8,6 +10,7 @@
 
 #include "estimator.h"
 #include "estimator_process.h"
+#include "init_hypotheses.h"
 #include "metrics.h"
 #include "tracker.h"
 #include "loader.h"
@@ -23,6 +26,20 @@ DEFINE_string(dataset, "tumvi", "xivo | euroc | tumvi");
 DEFINE_string(seq, "room1", "Sequence of TUM VI benchmark to play with.");
 DEFINE_int32(cam_id, 0, "Camera id.");
 DEFINE_string(out, "out_state", "Output file path.");
+DEFINE_string(timing, "",
+              "If set, write per-frame processing time (CPU & wall-clock, in "
+              "milliseconds) to this path.");
+DEFINE_string(smoothed_out, "",
+              "If set, write the fixed-lag smoothed trajectory, i.e., poses and "
+              "covariances of groups when they leave the state, to this path.");
+DEFINE_string(events, "",
+              "If set, binary file of events to feed to the event tracker "
+              "instead of the images, see DataLoader::LoadEvents; requires "
+              "event_tracker_cfg in the estimator configuration.");
+DEFINE_double(event_batch_ms, 1.0, "Duration of the batches of events.");
+DEFINE_string(loop_out, "",
+              "If set, write the trajectory corrected by loop closure to this "
+              "path; requires a build with g2o and loop_closure enabled.");
 
 using namespace xivo;
 
@@ -38,12 +55,54 @@ int main(int argc, char **argv) {
       GetDirs(FLAGS_dataset, FLAGS_root, FLAGS_seq, FLAGS_cam_id);
 
   std::unique_ptr<DataLoader> loader(new DataLoader{image_dir, imu_dir});
+  // events replace the images: both trackers share the visibility graph, and
+  // would update the features of each other
+  bool use_events = !FLAGS_events.empty();
+  if (use_events) {
+    loader->LoadEvents(FLAGS_events,
+                       timestamp_t(int64_t(FLAGS_event_batch_ms * 1e6)));
+  }
 
   // create estimator
   // auto est = std::make_unique<Estimator>(
   //     LoadJson(cfg["estimator_cfg"].asString()));
-  auto est = CreateSystem(
-      LoadJson(cfg["estimator_cfg"].asString()));
+  auto est_cfg = LoadJson(cfg["estimator_cfg"].asString());
+  if (!FLAGS_smoothed_out.empty()) {
+    est_cfg["output_departed_groups"] = true;
+  }
+
+  // multi-hypothesis initialization
+  if (auto init_cfg = cfg["multi_init"]; init_cfg.get("enabled", false).asBool()) {
+    auto hypotheses = MakeInitHypotheses(est_cfg, init_cfg);
+    number_t duration = init_cfg.get("duration", 3.0).asDouble();
+    auto results = RunInitHypotheses(
+        hypotheses, init_cfg.get("max_parallel", 0).asInt(),
+        [&loader, duration, use_events](EstimatorPtr est) {
+          timestamp_t t0 = loader->Get(0)->ts_;
+          for (int i = 0; i < loader->size(); ++i) {
+            auto raw_msg = loader->Get(i);
+            if (std::chrono::duration<number_t>(raw_msg->ts_ - t0).count() >
+                duration) {
+              break;
+            }
+            if (auto msg = dynamic_cast<msg::Image *>(raw_msg)) {
+              if (!use_events) {
+                est->VisualMeas(msg->ts_, cv::imread(msg->image_path_));
+              }
+            } else if (auto msg = dynamic_cast<msg::EventBatch *>(raw_msg)) {
+              est->EventMeas(msg->ts_, msg->events_);
+            } else if (auto msg = dynamic_cast<msg::IMU *>(raw_msg)) {
+              est->InertialMeas(msg->ts_, msg->gyro_, msg->accel_);
+            }
+          }
+        });
+    int best =
+        SelectInitHypothesis(results, init_cfg.get("min_updates", 10).asInt());
+    LOG(INFO) << "selected init hypothesis #" << best << " of "
+              << hypotheses.size();
+    est_cfg = hypotheses[best];
+  }
+  auto est = CreateSystem(est_cfg);
 
   // create viewer
   std::unique_ptr<Viewer> viewer;
@@ -52,7 +111,25 @@ int main(int argc, char **argv) {
         LoadJson(cfg["viewer_cfg"].asString()), FLAGS_seq);
   }
 
+  // per-frame timing, used by the parameter tuner (scripts/tune.py)
+  std::ofstream timing_stream;
+  if (!FLAGS_timing.empty()) {
+    timing_stream.open(FLAGS_timing, std::ios::out);
+    if (!timing_stream.is_open()) {
+      LOG(FATAL) << "failed to open timing file @ " << FLAGS_timing;
+    }
+  }
+
   // setup I/O for saving results
+  DepartedGroups traj_smoothed;
+  std::ofstream loop_stream;
+  if (!FLAGS_loop_out.empty()) {
+    loop_stream.open(FLAGS_loop_out, std::ios::out);
+    if (!loop_stream.is_open()) {
+      LOG(FATAL) << "failed to open output file @ " << FLAGS_loop_out;
+    }
+  }
+
   if (std::ofstream ostream{FLAGS_out, std::ios::out}) {
 
     std::vector<msg::Pose> traj_est;
@@ -65,11 +142,30 @@ int main(int argc, char **argv) {
       }
 
       if (auto msg = dynamic_cast<msg::Image *>(raw_msg)) {
+        if (use_events) {
+          continue;
+        }
         auto image = cv::imread(msg->image_path_);
+        std::clock_t cpu_start = std::clock();
+        auto wall_start = std::chrono::steady_clock::now();
         est->VisualMeas(msg->ts_, image);
+        if (!FLAGS_smoothed_out.empty()) {
+          auto departed = est->DrainDepartedGroups();
+          traj_smoothed.insert(traj_smoothed.end(), departed.begin(),
+                               departed.end());
+        }
+        if (timing_stream.is_open()) {
+          number_t cpu_ms = 1000.0 * (std::clock() - cpu_start) / CLOCKS_PER_SEC;
+          number_t wall_ms = std::chrono::duration<number_t, std::milli>(
+                                 std::chrono::steady_clock::now() - wall_start)
+                                 .count();
+          timing_stream << StrFormat("%ld %0.4f %0.4f", msg->ts_.count(),
+                                     cpu_ms, wall_ms)
+                        << std::endl;
+        }
         if (viewer) {
-          viewer->Update_gsb(est->gsb());
-          viewer->Update_gsc(est->gsc());
+          viewer->Update_gsb(est->gsb_global());
+          viewer->Update_gsc(est->origin() * est->gsc());
 
           cv::Mat disp = Canvas::instance()->display();
 
@@ -79,6 +175,8 @@ int main(int argc, char **argv) {
             viewer->Refresh();
           }
         }
+      } else if (auto msg = dynamic_cast<msg::EventBatch *>(raw_msg)) {
+        est->EventMeas(msg->ts_, msg->events_);
       } else if (auto msg = dynamic_cast<msg::IMU *>(raw_msg)) {
         est->InertialMeas(msg->ts_, msg->gyro_, msg->accel_);
         // if (viewer) {
@@ -89,10 +187,17 @@ int main(int argc, char **argv) {
         LOG(FATAL) << "Invalid entry type.";
       }
 
-      traj_est.emplace_back(est->ts(), est->gsb());
+      SE3 gsb = est->gsb_global();
+      traj_est.emplace_back(est->ts(), gsb);
       ostream << StrFormat("%ld", est->ts().count()) << " "
-        << est->gsb().translation().transpose() << " "
-        << est->gsb().rotation().log().transpose() << std::endl;
+        << gsb.translation().transpose() << " "
+        << gsb.rotation().log().transpose() << std::endl;
+      if (loop_stream.is_open()) {
+        SE3 gsb = est->gsb_corrected();
+        loop_stream << StrFormat("%ld", est->ts().count()) << " "
+                    << gsb.translation().transpose() << " "
+                    << gsb.rotation().log().transpose() << std::endl;
+      }
 
       // std::this_thread::sleep_for(std::chrono::milliseconds(3));
 
@@ -100,6 +205,32 @@ int main(int argc, char **argv) {
   } else {
     LOG(FATAL) << "failed to open output file @ " << FLAGS_out;
   }
+
+  if (!FLAGS_smoothed_out.empty()) {
+    // groups still in the state carry their latest estimates
+    auto remaining = est->DrainDepartedGroups(true);
+    traj_smoothed.insert(traj_smoothed.end(), remaining.begin(),
+                         remaining.end());
+    // groups do not leave the state in the order they were created
+    std::sort(traj_smoothed.begin(), traj_smoothed.end(),
+              [](const DepartedGroup &g1, const DepartedGroup &g2) {
+                return g1.ts < g2.ts;
+              });
+    if (std::ofstream ostream{FLAGS_smoothed_out, std::ios::out}) {
+      // timestamp | translation | rotation | covariance (row-major)
+      for (const auto &dg : traj_smoothed) {
+        ostream << StrFormat("%ld", dg.ts.count()) << " "
+                << dg.gsb.translation().transpose() << " "
+                << dg.gsb.rotation().log().transpose();
+        for (int i = 0; i < 6; ++i) {
+          ostream << " " << dg.cov.row(i);
+        }
+        ostream << std::endl;
+      }
+    } else {
+      LOG(FATAL) << "failed to open output file @ " << FLAGS_smoothed_out;
+    }
+  }
   // while (viewer) {
   //   viewer->Refresh();
   //   usleep(30);
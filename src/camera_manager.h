@@ -74,6 +74,20 @@ public:
     }
   }
 
+  // unproject a point from pixel coordinates xp to the unit bearing vector in
+  // camera coordinates. Only the equidistant model covers directions beyond
+  // 90 degrees of incidence.
+  template <typename Derived>
+  Eigen::Matrix<typename Derived::Scalar, 3, 1>
+  UnProjectBearing(const Eigen::MatrixBase<Derived> &xp) const {
+    if (std::holds_alternative<EquiDist>(model_)) {
+      return std::get<EquiDist>(model_).UnProjectBearing(xp);
+    }
+    Eigen::Matrix<typename Derived::Scalar, 2, 1> xc = UnProject(xp);
+    return Eigen::Matrix<typename Derived::Scalar, 3, 1>{xc(0), xc(1), 1}
+        .normalized();
+  }
+
   void Print(std::ostream &out) const {
     if (std::holds_alternative<ATAN>(model_)) {
       std::get<ATAN>(model_).Print(out);
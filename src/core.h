@@ -11,6 +11,7 @@
 #include <list>
 #include <memory>
 #include <type_traits>
+#include <vector>
 
 #include "alias.h"
 #include "camera_manager.h"
@@ -60,18 +61,25 @@ enum Index : int {
   Cg = Wg + 2, // gyro calibration, 9 numbers
 #endif
   Ca = Cg + 9, // accel calibration, 6 numbers
-  End = Ca + 6,
+  CalibEnd = Ca + 6,
 
 #else
 
 #ifdef USE_ONLINE_TEMPORAL_CALIB // USE_ONLINE_TEMPORAL_CALIB, but not USE_ONLINE_IMU_CALIB
-  End = td + 1,
+  CalibEnd = td + 1,
 #else
-  End = Wg + 2
+  CalibEnd = Wg + 2,
 #endif
 
 #endif
 
+#ifdef USE_ONLINE_ROLLING_SHUTTER_CALIB
+  tr = CalibEnd, // rolling shutter line readout time
+  End = tr + 1,
+#else
+  End = CalibEnd,
+#endif
+
 };
 
 constexpr int kMotionSize = Index::End;
@@ -94,9 +102,18 @@ constexpr int kFeatureSize = 3;
 constexpr int kMaxFeature = 30;
 constexpr int kMaxGroup = 15;
 
+#ifdef USE_FIDUCIAL_TAGS
+// fiducial tags of unknown pose estimated along with the state
+constexpr int kMaxTag = 4;
+#else
+constexpr int kMaxTag = 0;
+#endif
+constexpr int kTagSize = 6;
+
 constexpr int kGroupBegin = kCameraBegin + kMaxCameraIntrinsics;
 constexpr int kFeatureBegin = kGroupBegin + kGroupSize * kMaxGroup;
-constexpr int kFullSize = kFeatureBegin + kFeatureSize * kMaxFeature;
+constexpr int kTagBegin = kFeatureBegin + kFeatureSize * kMaxFeature;
+constexpr int kFullSize = kTagBegin + kTagSize * kMaxTag;
 
 // frequency to project rotation matrices to SO3 to get rid of the accumulated numeric error
 constexpr int kEnforceSO3Freq = 50;  
@@ -107,7 +124,7 @@ constexpr int kEnforceSO3Freq = 50;
 struct State {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   // nominal state
-  State(): counter{0} {}
+  State(): counter{0}, tr{0} {}
 
   int counter;
   SO3 Rsb;       // body to spatial rotation
@@ -119,6 +136,7 @@ struct State {
   SO3 Rg;  // gravity -> spatial
 
   number_t td;
+  number_t tr; // rolling shutter line readout time, 0 for global shutter
 
   using Tangent = Eigen::Matrix<number_t, kMotionSize, 1>;
 
@@ -136,6 +154,9 @@ struct State {
 #ifdef USE_ONLINE_TEMPORAL_CALIB
     td += dX(Index::td);
 #endif
+#ifdef USE_ONLINE_ROLLING_SHUTTER_CALIB
+    tr += dX(Index::tr);
+#endif
 
     if constexpr(kEnforceSO3Freq > 0) {
       if (++counter % kEnforceSO3Freq == 0) {
@@ -185,6 +206,18 @@ enum class FeatureStatus : int {
   // GAUGE = 7 // chosen to fix gauge freedom
 };
 
+// parametrization of the depth of a feature, on top of the coordinates of
+// its projection in the reference camera
+enum class DepthParam : int {
+  LOG = 0,    // log(Z), well-conditioned once the depth is known
+  INVERSE = 1 // 1/Z, which reaches far points with a bounded uncertainty
+};
+#ifdef USE_INVDEPTH
+constexpr DepthParam kDefaultDepthParam = DepthParam::INVERSE;
+#else
+constexpr DepthParam kDefaultDepthParam = DepthParam::LOG;
+#endif
+
 enum class GroupStatus : int {
   CREATED = 0,  // newly created
   INSTATE = 1,  // instate
@@ -215,8 +248,29 @@ struct Observation {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   GroupPtr g;
   Vec2 xp;
+  Vec3 b; // unit bearing of xp, only kept with USE_BEARING_MEASUREMENT
 };
 
 using Obs = Observation;
 
+/** Quality of a track's last observation, computed by the tracker. */
+struct TrackQuality {
+  number_t fb_error{0};  // forward-backward consistency error, pixels
+  number_t klt_error{0}; // patch dissimilarity reported by KLT
+  number_t min_eig{0};   // Shi-Tomasi score of the patch, 0 if unknown
+  int level{0};          // pyramid level needed to cover the displacement
+};
+
+/** Zero-mean intensity patches around a feature, one per pyramid level, kept
+ *  for the direct photometric update. */
+using PhotometricPatch = std::vector<MatX>;
+
+/** Brightness change reported by an event camera at pixel (x, y). */
+struct Event {
+  timestamp_t ts;
+  uint16_t x, y;
+  int8_t polarity; // +1 brighter, -1 darker
+};
+using Events = std::vector<Event>;
+
 } // namespace xivo
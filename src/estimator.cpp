@@ -8,6 +8,7 @@
 #include "glog/logging.h"
 
 #include "estimator.h"
+#include "event_tracker.h"
 #include "feature.h"
 #include "geometry.h"
 #include "group.h"
@@ -18,6 +19,7 @@
 #include "helpers.h"
 
 #ifdef USE_G2O
+#include "loop_closure.h"
 #include "optimizer.h"
 #endif
 
@@ -57,6 +59,10 @@ void Inertial::Execute(Estimator *est) {
 }
 
 void Visual::Execute(Estimator *est) { est->VisualMeasInternal(ts_, img_); }
+
+void EventBatch::Execute(Estimator *est) {
+  est->EventMeasInternal(ts_, events_);
+}
 } // namespace internal
 
 // destructor
@@ -67,6 +73,7 @@ Estimator::~Estimator() {
     std::cout << "Wbc=" << SO3::log(X_.Rbc).transpose() << std::endl;
     std::cout << "Tbc=" << X_.Tbc.transpose() << std::endl;
     std::cout << "td=" << X_.td << std::endl;
+    std::cout << "tr=" << X_.tr << std::endl;
     std::cout << "gyro.bias=" << X_.bg.transpose() << std::endl;
     std::cout << "accel.bias=" << X_.ba.transpose() << std::endl;
     std::cout << "===== Camera intrinsics =====\n";
@@ -88,6 +95,7 @@ Estimator::Estimator(const Json::Value &cfg)
   simulation_ = cfg_.get("simulation", false).asBool();
   use_canvas_ = cfg_.get("use_canvas", true).asBool();
   print_timing_ = cfg_.get("print_timing", false).asBool();
+  output_departed_groups_ = cfg_.get("output_departed_groups", false).asBool();
   integration_method_ =
       cfg_.get("integration_method", "unspecified").asString();
 
@@ -98,6 +106,27 @@ Estimator::Estimator(const Json::Value &cfg)
       cfg_.get("compression_trigger_ratio", 1.5).asDouble();
   OOS_update_min_observations_ =
       cfg_.get("OOS_update_min_observations", 5).asInt();
+  OOS_max_views_ = cfg_.get("OOS_max_views", 0).asInt();
+  if (OOS_max_views_ > 0 && OOS_max_views_ < 2) {
+    LOG(WARNING) << "OOS_max_views raised to 2";
+    OOS_max_views_ = 2;
+  }
+  oos_schedule_options_.budget_rows =
+      cfg_["oos_schedule"].get("budget_rows", 0).asInt();
+  oos_schedule_options_.max_wait =
+      cfg_["oos_schedule"].get("max_wait", 5).asInt();
+
+  // form of the Kalman update
+  auto update_form = cfg_["update_form"].get("form", "auto").asString();
+  if (update_form == "covariance") {
+    update_form_options_.form = UpdateFormOptions::Form::COVARIANCE;
+  } else if (update_form == "information") {
+    update_form_options_.form = UpdateFormOptions::Form::INFORMATION;
+  } else if (update_form != "auto") {
+    LOG(WARNING) << "unknown update form " << update_form << "; auto instead";
+  }
+  update_form_options_.ratio =
+      cfg_["update_form"].get("ratio", 1.0).asDouble();
 
   // IMU clamping
   Vec3 _vec_;
@@ -124,6 +153,8 @@ Estimator::Estimator(const Json::Value &cfg)
   refinement_options_.two_view =
       cfg_["depth_opt"].get("two_view", false).asBool();
   refinement_options_.use_hessian = cfg_["depth_opt"].get("use_hessian", false).asBool();
+  refinement_options_.correlated_init =
+      cfg_["depth_opt"].get("correlated_init", false).asBool();
   refinement_options_.max_iters = cfg_["depth_opt"].get("max_iters", 5).asInt();
   refinement_options_.eps = cfg_["depth_opt"].get("eps", 1e-4).asDouble();
   refinement_options_.damping =
@@ -139,8 +170,115 @@ Estimator::Estimator(const Json::Value &cfg)
       cfg_["triangulation"].get("zmin", 0.05).asDouble();
   triangulate_options_.zmax = cfg_["triangulation"].get("zmax", 5.0).asDouble();
 
+  // structureless update options
+  use_structureless_ = cfg_.get("use_structureless", false).asBool();
+  structureless_options_.max_parallax =
+      cfg_["structureless"].get("max_parallax", 2.0).asDouble() * M_PI / 180;
+  structureless_options_.min_baseline =
+      cfg_["structureless"].get("min_baseline", 0.02).asDouble();
+  structureless_options_.min_views =
+      cfg_["structureless"].get("min_views", 3).asInt();
+  structureless_options_.MH_thresh =
+      cfg_["structureless"].get("MH_thresh", 3.0).asDouble();
+
   remove_outlier_counter_ = cfg_.get("remove_outlier_counter", 10).asInt();
 
+  // track quality options
+  track_quality_options_.enabled =
+      cfg_["track_quality"].get("enabled", false).asBool();
+  track_quality_options_.fb_std =
+      cfg_["track_quality"].get("fb_std", 0.5).asDouble();
+  track_quality_options_.klt_error_std =
+      cfg_["track_quality"].get("klt_error_std", 20).asDouble();
+  track_quality_options_.min_eig =
+      cfg_["track_quality"].get("min_eig", 25).asDouble();
+  track_quality_options_.level_factor =
+      cfg_["track_quality"].get("level_factor", 0.25).asDouble();
+  track_quality_options_.max_scale =
+      cfg_["track_quality"].get("max_scale", 25).asDouble();
+  track_quality_options_.demote_scale =
+      cfg_["track_quality"].get("demote_scale", 6).asDouble();
+
+  // robust update options
+  auto kernel = cfg_["robust_update"].get("kernel", "none").asString();
+  if (kernel == "huber") {
+    robust_update_options_.kernel = RobustUpdateOptions::Kernel::HUBER;
+  } else if (kernel == "cauchy") {
+    robust_update_options_.kernel = RobustUpdateOptions::Kernel::CAUCHY;
+  } else if (kernel != "none") {
+    LOG(WARNING) << "unknown robust kernel " << kernel << "; robust update off";
+  }
+  robust_update_options_.width =
+      cfg_["robust_update"].get("width", 2.0).asDouble();
+  robust_update_options_.iters =
+      std::max(1, cfg_["robust_update"].get("iters", 2).asInt());
+  robust_update_options_.min_weight =
+      cfg_["robust_update"].get("min_weight", 0.1).asDouble();
+  if (robust_update_options_.kernel != RobustUpdateOptions::Kernel::NONE &&
+      use_1pt_RANSAC_) {
+    LOG(WARNING) << "robust update replaces MH gating & 1-pt RANSAC";
+  }
+
+  // re-centering options
+  recenter_options_.enabled = cfg_["recenter"].get("enabled", false).asBool();
+  recenter_options_.max_distance =
+      cfg_["recenter"].get("max_distance", 100).asDouble();
+  recenter_options_.yaw = cfg_["recenter"].get("yaw", false).asBool();
+
+  // choice of the new reference of features whose reference is discarded
+  ownership_options_.min_depth =
+      cfg_["ownership"].get("min_depth", 0.05).asDouble();
+  ownership_options_.min_parallax =
+      cfg_["ownership"].get("min_parallax", 0.02).asDouble();
+
+  // photometric update of in-state features, in place of KLT
+  direct_update_options_.enabled =
+      cfg_["direct_update"].get("enabled", false).asBool();
+  direct_update_options_.levels =
+      std::max(1, cfg_["direct_update"].get("levels", 3).asInt());
+  direct_update_options_.patch_size =
+      cfg_["direct_update"].get("patch_size", 7).asInt();
+  direct_update_options_.intensity_std =
+      cfg_["direct_update"].get("intensity_std", 12).asDouble();
+  direct_update_options_.min_eig =
+      cfg_["direct_update"].get("min_eig", 10).asDouble();
+#ifdef USE_BEARING_MEASUREMENT
+  if (direct_update_options_.enabled) {
+    LOG(WARNING) << "direct update needs pixel measurements; disabled";
+    direct_update_options_.enabled = false;
+  }
+#endif
+  if (auto tracker = Tracker::instance()) {
+    tracker->SetDirectUpdate(direct_update_options_.enabled);
+  }
+
+  // fiducial tags
+  tag_map_aligned_ = false;
+  if (auto tag_cfg = cfg_["fiducials"]; tag_cfg.get("enabled", false).asBool()) {
+    tag_detector_ = std::make_unique<TagDetector>(tag_cfg);
+    fiducial_options_.size = tag_cfg.get("size", 0.16).asDouble();
+    fiducial_options_.corner_std = tag_cfg.get("corner_std", 1.0).asDouble();
+    fiducial_options_.MH_thresh = tag_cfg.get("MH_thresh", 20.09).asDouble();
+    fiducial_options_.init_std_rotation =
+        tag_cfg.get("init_std_rotation", 0.05).asDouble();
+    fiducial_options_.init_std_range =
+        tag_cfg.get("init_std_range", 0.05).asDouble();
+    for (const auto &tag : tag_cfg["map"]) {
+      int id = tag["id"].asInt();
+      tag_map_[id] = {id, tag.get("size", fiducial_options_.size).asDouble(),
+                      SE3{SO3::exp(GetVectorFromJson<number_t, 3>(tag, "W")),
+                          GetVectorFromJson<number_t, 3>(tag, "T")},
+                      -1};
+    }
+    LOG(INFO) << "fiducial tags enabled with " << tag_map_.size()
+              << " tags in the map";
+#ifndef USE_FIDUCIAL_TAGS
+    LOG_IF(WARNING, tag_map_.empty())
+        << "no tags in the map and tag states disabled; build with "
+           "USE_FIDUCIAL_TAGS";
+#endif
+  }
+
   // load imu calibration
   auto imu_calib = cfg_["imu_calib"];
   // load accel axis misalignment first as a 3x3 matrix
@@ -200,6 +338,8 @@ Estimator::Estimator(const Json::Value &cfg)
 #ifdef USE_ONLINE_TEMPORAL_CALIB
   X_.td = X["td"].asDouble();
 #endif
+  // rolling shutter line readout time, 0 for global shutter cameras
+  X_.tr = X.get("tr", 0.0).asDouble();
 
   // initialize error state
   err_.resize(kFullSize);
@@ -207,6 +347,7 @@ Estimator::Estimator(const Json::Value &cfg)
   // make all group & feature slots available
   std::fill(gsel_.begin(), gsel_.end(), false);
   std::fill(fsel_.begin(), fsel_.end(), false);
+  std::fill(tsel_.begin(), tsel_.end(), false);
   LOG(INFO) << "Initial state loaded";
   LOG(INFO) << X_;
 
@@ -228,6 +369,9 @@ Estimator::Estimator(const Json::Value &cfg)
 #ifdef USE_ONLINE_TEMPORAL_CALIB
   P_(Index::td, Index::td) *= P["td"].asDouble();
 #endif
+#ifdef USE_ONLINE_ROLLING_SHUTTER_CALIB
+  P_(Index::tr, Index::tr) *= P.get("tr", 1e-10).asDouble();
+#endif
 
 #ifdef USE_ONLINE_IMU_CALIB
   // online IMU calibration
@@ -293,8 +437,37 @@ Estimator::Estimator(const Json::Value &cfg)
   Roos_ = cfg["oos_meas_std"].asDouble();
   Roos_ *= Roos_;
 
+#ifdef USE_BEARING_MEASUREMENT
+  // measurement noise is given in pixels, convert it to radians on the sphere
+  number_t fl = Camera::instance()->GetFocalLength();
+  R_ /= fl * fl;
+  Roos_ /= fl * fl;
+#ifdef USE_ONLINE_CAMERA_CALIB
+  LOG(WARNING) << "camera intrinsics are not refined with bearing measurements";
+#endif
+#endif
+
   LOG(INFO) << "R=" << R_ << " ;Roos=" << Roos_;
 
+  // online scale of the visual measurement noise
+  const auto &adaptive = cfg_["adaptive_noise"];
+  adaptive_noise_options_.enabled = adaptive.get("enabled", false).asBool();
+  adaptive_noise_options_.window = adaptive.get("window", 300).asInt();
+  adaptive_noise_options_.min_samples =
+      adaptive.get("min_samples", 50).asInt();
+  adaptive_noise_options_.rate = adaptive.get("rate", 0.05).asDouble();
+  adaptive_noise_options_.min_scale =
+      adaptive.get("min_scale", 0.25).asDouble();
+  adaptive_noise_options_.max_scale = adaptive.get("max_scale", 4.0).asDouble();
+  adaptive_noise_options_.grid_cols = adaptive.get("grid_cols", 1).asInt();
+  adaptive_noise_options_.grid_rows = adaptive.get("grid_rows", 1).asInt();
+  if (adaptive_noise_options_.enabled) {
+    adaptive_noise_ = std::make_unique<AdaptiveNoise>(
+        adaptive_noise_options_, Camera::instance()->cols(),
+        Camera::instance()->rows());
+    LOG(INFO) << "adaptive visual noise enabled";
+  }
+
   // /////////////////////////////
   // Load initial std on feature state
   // /////////////////////////////
@@ -305,10 +478,18 @@ Estimator::Estimator(const Json::Value &cfg)
   init_std_y_ /= Camera::instance()->GetFocalLength();
   init_std_z_ = cfg_["initial_std_z"].asDouble();
   min_z_ = cfg_["min_depth"].asDouble();
+  depth_param_options_.adaptive =
+      cfg_["depth_param"].get("adaptive", false).asBool();
+  depth_param_options_.max_rel_std =
+      cfg_["depth_param"].get("max_rel_std", 0.1).asDouble();
+  depth_param_options_.min_inverse_depth =
+      cfg_["depth_param"].get("min_inverse_depth", 1e-3).asDouble();
   max_z_ = cfg_["max_depth"].asDouble();
   LOG(INFO) << "Initial covariance for features loaded";
 
   MeasurementUpdateInitialized_ = false;
+  nis_sum_ = 0;
+  num_updates_ = 0;
 
   // /////////////////////////////
   // Outlier rejection options
@@ -682,6 +863,11 @@ void Estimator::RemoveGroupFromState(GroupPtr g) {
 #endif
 
   VLOG(0) << "removing group #" << g->id();
+  if (output_departed_groups_) {
+    std::scoped_lock lck(departed_groups_mtx_);
+    departed_groups_.push_back(MakeDepartedGroup(g));
+  }
+
   // change the covariance and error state
   int index = g->sind();
 
@@ -773,6 +959,8 @@ void Estimator::AddFeatureToState(FeaturePtr f) {
     ;
   if (index < fsel_.size()) {
     fsel_[index] = true;
+    // while the covariance is still local to the feature
+    UpdateDepthParam(f);
     f->SetStatus(FeatureStatus::INSTATE);
     f->SetSind(index);
     f->FillCovarianceBlock(P_);
@@ -851,6 +1039,11 @@ void Estimator::AbsorbError(const VecX &err) {
     int offset = kFeatureBegin + 3 * f->sind();
     f->UpdateState(err.segment<3>(offset));
   }
+  for (auto &[id, tag] : tags_) {
+    int offset = kTagBegin + kTagSize * tag.sind;
+    tag.g = SE3{tag.g.R() * SO3::exp(err.segment<3>(offset)),
+                tag.g.T() + err.segment<3>(offset + 3)};
+  }
 }
 
 void Estimator::AbsorbError() {
@@ -897,6 +1090,25 @@ void Estimator::VisualMeas(const timestamp_t &ts_raw, const cv::Mat &img) {
   }
 }
 
+void Estimator::EventMeas(const timestamp_t &ts_raw, const Events &events) {
+  timestamp_t ts{ts_raw};
+#ifdef USE_ONLINE_TEMPORAL_CALIB
+  if (X_.td >= 0) {
+    ts += timestamp_t(uint64_t(X_.td * 1e9)); // seconds -> nanoseconds
+  } else {
+    ts -= timestamp_t(uint64_t(-X_.td * 1e9)); // seconds -> nanoseconds
+  }
+#endif
+  if (async_run_) {
+    std::scoped_lock lck(buf_.mtx);
+    buf_.push_back(std::make_unique<internal::EventBatch>(ts, events));
+    MaintainBuffer();
+  } else {
+    buf_.push_back(std::make_unique<internal::EventBatch>(ts, events));
+    MaintainBuffer();
+  }
+}
+
 void Estimator::InertialMeas(const timestamp_t &ts, const Vec3 &gyro,
                              const Vec3 &accel) {
   if (async_run_) {
@@ -939,51 +1151,123 @@ void Estimator::VisualMeasInternal(const timestamp_t &ts, const cv::Mat &img) {
     ProcessTracks(ts, tracker->features_);
     timer_.Tock("process-tracks");
 
+    if (direct_update_options_.enabled) {
+      // templates of the next direct update, at the corrected observations
+      auto levels = tracker->levels(direct_update_options_.levels);
+      for (auto f : tracker->features_) {
+        if (f->instate() && f->track_status() == TrackStatus::TRACKED) {
+          PhotometricPatch patch;
+          SamplePatch(levels, f->xp(), direct_update_options_.patch_size,
+                      &patch);
+          f->SetPatch(std::move(patch));
+        }
+      }
+    }
+
     if (gauge_group_ == -1) {
       SwitchRefGroup();
     }
 
+    if (tag_detector_) {
+      timer_.Tick("tags");
+      int level =
+          std::min(tag_detector_->detect_level(), tracker->num_levels() - 1);
+      TagUpdate(tag_detector_->Detect(tracker->image(),
+                                      tracker->pyramid(level), level));
+      timer_.Tock("tags");
+    }
+
+    ModelUpdate();
+
+#ifdef USE_G2O
+    if (auto lc = LoopClosure::instance(); lc && lc->options().update_filter) {
+      SE3 gsb_corrected;
+      if (lc->TakeFeedback(gsb(), &gsb_corrected)) {
+        LoopClosureUpdate(gsb_corrected);
+      }
+    }
+#endif
+
+    if (recenter_options_.enabled &&
+        X_.Tsb.norm() > recenter_options_.max_distance) {
+      Recenter();
+    }
   }
   timer_.Tock("visual-meas");
 }
 
-void Estimator::Predict(std::list<FeaturePtr> &features) {
-  for (auto f : features) {
-    f->Predict(gsb(), gbc());
-  }
-}
+void Estimator::EventMeasInternal(const timestamp_t &ts,
+                                  const Events &events) {
+  if (!GoodTimestamp(ts))
+    return;
 
-void Estimator::UpdateJosephForm() {
+  auto tracker = EventTracker::instance();
+  CHECK(tracker) << "event tracker not created; set event_tracker_cfg";
+  // the surface of active events is kept up to date before the filter starts
+  tracker->AddEvents(events);
+  if (!tracker->Ready(ts)) {
+    return;
+  }
 
-  S_ = H_ * P_ * H_.transpose();
+  ++vision_counter_;
+  timer_.Tick("event-meas");
+  UpdateSystemClock(ts);
+  if (vision_initialized_) {
+    // propagate state upto current timestamp
+    Propagate(true);
+    // measurement prediction for feature tracking
+    Predict(tracker->features_);
+    timer_.Tick("track");
+    tracker->Update(ts);
+    timer_.Tock("track");
+    if (use_canvas_) {
+      cv::Mat surface;
+      tracker->TimeSurface(ts).convertTo(surface, CV_8U, 255);
+      Canvas::instance()->Update(surface);
+    }
+    timer_.Tick("process-tracks");
+    ProcessTracks(ts, tracker->features_);
+    timer_.Tock("process-tracks");
 
-  for (int i = 0; i < diagR_.size(); ++i) {
-    S_(i, i) += diagR_(i);
+    if (gauge_group_ == -1) {
+      SwitchRefGroup();
+    }
   }
+  timer_.Tock("event-meas");
+}
 
-  K_.setZero(err_.size(), H_.rows());
-  K_.transpose() = S_.ldlt().solve(H_ * P_);
-  err_ = K_ * inn_;
+void Estimator::Predict(std::list<FeaturePtr> &features) {
+  for (auto f : features) {
+    f->Predict(gsb(), gbc());
+  }
+}
 
-  // I_KH_.noalias() = -K_ * H_;
-  // for (int i = 0; i < err_.size(); ++i) {
-  //   I_KH_(i, i) += 1;
-  // }
-  
-  // Here, I_KH is actually KH - I, but since
-  // update of P is quadratic in I_KH, so it does not matter.
-  I_KH_ = K_ * H_;
-  for (int i = 0; i < err_.size(); ++i) {
-    I_KH_(i, i) -= 1;
+void Estimator::MeasurementUpdate() {
+  // the covariance form factors an m x m matrix, of the rows of the
+  // measurement, the information form an n x n one, of the states updated
+  std::vector<int> states = UpdatedStates(H_, P_);
+  using Form = UpdateFormOptions::Form;
+  bool information =
+      update_form_options_.form == Form::INFORMATION ||
+      (update_form_options_.form == Form::AUTO &&
+       H_.rows() > update_form_options_.ratio * states.size());
+
+  number_t nis;
+  if (information &&
+      InformationFormUpdate(H_, diagR_, inn_, states, P_, err_, &nis)) {
+    VLOG(1) << "information-form update: " << H_.rows() << " rows, "
+            << states.size() << " states";
+  } else {
+    LOG_IF(WARNING, information)
+        << "covariance of the updated states not positive definite; "
+           "covariance-form update instead";
+    nis = CovarianceFormUpdate(H_, diagR_, inn_, P_, err_);
   }
-  P_ = I_KH_ * P_ * I_KH_.transpose();
 
-  int kr = K_.rows();
-  int kc = K_.cols();
-  for (int i = 0; i < kc; ++i) {
-    K_.block(0, i, kr, 1) *= sqrt(diagR_(i));
+  if (std::isfinite(nis)) {
+    nis_sum_ += nis;
+    ++num_updates_;
   }
-  P_.noalias() +=  K_ * K_.transpose();
 }
 
 std::tuple<number_t, bool> Estimator::HuberOnInnovation(const Vec2 &inn,
@@ -1006,14 +1290,13 @@ std::tuple<number_t, bool> Estimator::HuberOnInnovation(const Vec2 &inn,
 
 std::vector<FeaturePtr>
 Estimator::DiscardGroups(const std::vector<GroupPtr> &discards) {
-  std::vector<FeaturePtr> nullref_features;
   Graph& graph{*Graph::instance()};
-  for (auto g : discards) {
-    // transfer ownership of the remaining features whose reference is this one
-    auto failed = graph.TransferFeatureOwnership(g, gbc());
-    nullref_features.insert(nullref_features.end(), failed.begin(),
-                            failed.end());
+  // transfer ownership of the remaining features whose reference is one of
+  // the discarded groups, before any of them leaves the state
+  auto nullref_features = graph.TransferFeatureOwnership(
+      discards, gbc(), P_, ownership_options_);
 
+  for (auto g : discards) {
     if (g->id() == gauge_group_) {
       // just lost the gauge group
       gauge_group_ = -1;
@@ -1029,7 +1312,144 @@ Estimator::DiscardGroups(const std::vector<GroupPtr> &discards) {
   return nullref_features;
 }
 
+SE3 Estimator::gsb_corrected() const {
+#ifdef USE_G2O
+  if (auto lc = LoopClosure::instance()) {
+    // the odometry frame of loop closure undoes re-centering jumps as well
+    return lc->Correct(gsb());
+  }
+#endif
+  return gsb_global();
+}
+
+void Estimator::Recenter() {
+  // new spatial frame relative to the current one
+  SO3 R0;
+  if (recenter_options_.yaw) {
+    R0 = HeadingRotation(X_, g_);
+  }
+  SE3 g0{R0, X_.Tsb};
+  SE3 g0inv = g0.inv();
+  SO3 R0t = R0.inv();
+  VLOG(0) << "re-centering at Tsb=" << X_.Tsb.transpose();
+
+  RecenterState(g0, &X_);
+  for (auto g : Graph::instance()->GetGroups()) {
+    g->SetState(g0inv * g->gsb());
+    g->SetMotion(R0t * g->Vsb(), g->gyro());
+  }
+  for (auto f : Graph::instance()->GetFeatures()) {
+    if (f->ref()) {
+      f->Xs(gbc()); // refresh the cached position
+    }
+  }
+  for (auto &[id, tag] : tags_) {
+    tag.g = g0inv * tag.g;
+  }
+  gsm_ = g0inv * gsm_;
+
+  // covariance: J * P * J', with J the identity except for blocks of R0'
+  // on the translations and velocity
+  if (recenter_options_.yaw) {
+    Mat3 R0tm = R0t.matrix();
+    std::vector<int> blocks{Index::Tsb, Index::Vsb};
+    for (int i = 0; i < kMaxGroup; ++i) {
+      if (gsel_[i]) {
+        blocks.push_back(kGroupBegin + 6 * i + 3);
+      }
+    }
+    for (const auto &[id, tag] : tags_) {
+      blocks.push_back(kTagBegin + kTagSize * tag.sind + 3);
+    }
+    for (int k : blocks) {
+      P_.middleRows<3>(k) = R0tm * P_.middleRows<3>(k);
+    }
+    for (int k : blocks) {
+      P_.middleCols<3>(k) = P_.middleCols<3>(k) * R0tm.transpose();
+    }
+  }
+
+  origin_ = origin_ * g0;
+  LOG(INFO) << "spatial frame re-centered; origin at "
+            << origin_.T().transpose();
+
+#ifdef USE_G2O
+  if (auto lc = LoopClosure::instance()) {
+    lc->NotifyJump(g0inv);
+  }
+#endif
+}
+
+SO3 HeadingRotation(const State &X, const Vec3 &g) {
+  // rotate about gravity such that the projections of the body x axis and
+  // of the new frame's x axis onto the horizontal plane coincide
+  Vec3 up = -(X.Rg * g).normalized();
+  Vec3 a = Vec3::UnitX() - up(0) * up;
+  Vec3 b = X.Rsb * Vec3::UnitX();
+  b -= b.dot(up) * up;
+  if (a.norm() > 1e-3 && b.norm() > 1e-3) {
+    return SO3::exp(up * atan2(up.dot(a.cross(b)), a.dot(b)));
+  }
+  return SO3{};
+}
+
+void RecenterState(const SE3 &g0, State *X) {
+  // rotations perturbed on the right are unchanged in the error state,
+  // translations & velocities are rotated. Gravity Rg * g is invariant
+  // under a rotation about itself, and Rg keeps the zero z-component of
+  // its log, which the canonicalization of State enforces.
+  SO3 R0t = g0.R().inv();
+  X->Rsb = R0t * X->Rsb;
+  X->Tsb = R0t * (X->Tsb - g0.T());
+  X->Vsb = R0t * X->Vsb;
+}
+
+#ifdef USE_G2O
+void Estimator::LoopClosureUpdate(const SE3 &gsb_corrected) {
+  auto lc = LoopClosure::instance();
+  const auto &options = lc->options();
+
+  // direct measurement of the body pose
+  SE3 gsb0 = gsb();
+  auto meas = PoseMeasurement::Make(gsb0, gsb_corrected,
+                                    options.feedback_std_rotation,
+                                    options.feedback_std_translation);
+  // a tight 6-DoF measurement, under which the simple form of the covariance
+  // update loses positive definiteness
+  BlockSparseUpdate({meas}, true);
+  lc->NotifyJump(gsb() * gsb0.inv());
+  LOG(INFO) << "loop closure feedback: |inn|=" << meas.residual.norm();
+}
+#endif
+
+DepartedGroups Estimator::DrainDepartedGroups(bool include_instate) {
+  DepartedGroups out;
+  {
+    std::scoped_lock lck(departed_groups_mtx_);
+    out.swap(departed_groups_);
+  }
+  if (include_instate) {
+    auto groups = Graph::instance()->GetGroupsIf(
+        [](GroupPtr g) -> bool { return g->instate(); });
+    for (auto g : groups) {
+      out.push_back(MakeDepartedGroup(g));
+    }
+  }
+  return out;
+}
+
+DepartedGroup Estimator::MakeDepartedGroup(GroupPtr g) const {
+  int offset = kGroupBegin + 6 * g->sind();
+  // resolve in the global frame: only the translation block rotates
+  Mat6 J = Mat6::Identity();
+  J.block<3, 3>(3, 3) = origin_.R().matrix();
+  return {g->ts(), g->id(), origin_ * g->gsb(),
+          J * P_.block<6, 6>(offset, offset) * J.transpose()};
+}
+
 void Estimator::DiscardFeatures(const std::vector<FeaturePtr> &discards) {
+  // queued features would otherwise be scheduled after being recycled
+  DropQueued(discards, &oos_queue_);
   Graph::instance()->RemoveFeatures(discards);
   for (auto f : discards) {
     if (f->instate()) {
@@ -6,6 +6,7 @@
 #include <functional>
 #include <iostream>
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <ostream>
@@ -20,10 +21,13 @@
 #include "opencv2/core/core.hpp"
 #include "json/json.h"
 
+#include "adaptive_noise.h"
 #include "component.h"
 #include "core.h"
+#include "fiducial.h"
 #include "graph.h"
 #include "imu.h"
+#include "measurement.h"
 #include "tracker.h"
 #include "visualize.h"
 
@@ -55,6 +59,16 @@ private:
   cv::Mat img_;
 };
 
+class EventBatch : public Message {
+public:
+  EventBatch(const timestamp_t &ts, const Events &events)
+      : Message{ts}, events_{events} {}
+  void Execute(EstimatorPtr est);
+
+private:
+  Events events_;
+};
+
 class Inertial : public Message {
 public:
   Inertial(const timestamp_t &ts, const Vec3 &gyro, const Vec3 &accel)
@@ -68,8 +82,24 @@ private:
 } // namespace internal
 
 
+/** Pose and marginal covariance of a group at the moment it leaves the state.
+ *  By then the group has absorbed all the updates of the features it shares
+ *  with later frames, so the sequence of departed groups forms a fixed-lag
+ *  smoothed trajectory sampled at the groups' frame timestamps. */
+struct DepartedGroup {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  timestamp_t ts; // timestamp of the frame where the group was created
+  int id;
+  SE3 gsb;        // in the global frame, see `Estimator::origin`
+  Mat6 cov; // error-state ordering: (W, T)
+};
+using DepartedGroups =
+    std::vector<DepartedGroup, Eigen::aligned_allocator<DepartedGroup>>;
+
+
 class Estimator : public Component<Estimator, State> {
   friend class internal::Visual;
+  friend class internal::EventBatch;
   friend class internal::Inertial;
 
 public:
@@ -86,11 +116,25 @@ public:
   void InertialMeas(const timestamp_t &ts, const Vec3 &gyro, const Vec3 &accel);
   // perform tracking/matching to generate tracks
   void VisualMeas(const timestamp_t &ts, const cv::Mat &img);
+  // feed events of an event camera, whose tracks are processed at the rate
+  // of the event tracker, i.e., when the batch ending at ts completes a period
+  void EventMeas(const timestamp_t &ts, const Events &events);
+
+  /** Registers a measurement model, which is linearized and applied at every
+   *  image from then on, after the visual update. */
+  void RegisterMeasurement(MeasurementModelPtr model);
 
   // accessors
   SE3 gbc() const { return SE3{X_.Rbc, X_.Tbc}; }
   SE3 gsb() const { return SE3{X_.Rsb, X_.Tsb}; }
   SE3 gsc() const { return gsb() * gbc(); }
+  /** Pose of the spatial frame, in which the state is resolved, relative to
+   *  the global frame. The identity unless re-centering is enabled. */
+  const SE3 &origin() const { return origin_; }
+  /** Body pose in the global frame. */
+  SE3 gsb_global() const { return origin_ * gsb(); }
+  /** Body pose corrected by loop closure; gsb() if loop closure is off. */
+  SE3 gsb_corrected() const;
   const State& X() const { return X_; }
   const timestamp_t &ts() const { return curr_time_; }
   MatX P() const { return P_; }
@@ -109,12 +153,17 @@ public:
   Vec3 ba() const { return X_.ba; }
   SO3 Rg() const { return X_.Rg; }
   number_t td() const { return X_.td; }
+  number_t tr() const { return X_.tr; }
   Mat3 Ca() const { return imu_.Ca(); }
   Mat3 Cg() const { return imu_.Cg(); }
   Vec3 inn_Wsb() const { return inn_.segment(Index::Wsb,3); }
   Vec3 inn_Tsb() const { return inn_.segment(Index::Tsb,3); }
   Vec3 inn_Vsb() const { return inn_.segment(Index::Vsb,3); }
   bool MeasurementUpdateInitialized() const { return MeasurementUpdateInitialized_; }
+  /** Normalized innovation squared per degree of freedom, averaged over all
+   *  the updates so far; about 1 for a consistent filter. */
+  number_t mean_nis() const { return num_updates_ ? nis_sum_ / num_updates_ : 0; }
+  int num_updates() const { return num_updates_; }
   int gauge_group() const { return gauge_group_; }
   int num_instate_features() const { return instate_features_.size(); };
   int num_instate_groups() const {return instate_groups_.size(); };
@@ -136,8 +185,23 @@ public:
   VecXi InstateGroupSinds() const;
 
   int OOS_update_min_observations() { return OOS_update_min_observations_; }
+  int OOS_max_views() const { return OOS_max_views_; }
+
+  /** Poses of the tags estimated in the state, in the global frame. */
+  std::vector<std::pair<int, SE3>> InstateTagPoses() const;
+  int num_instate_tags() const { return tags_.size(); }
+
+  /** Returns groups which left the state since the last call and clears the
+   *  buffer. If `include_instate` is set, the groups still in the state are
+   *  appended with their current estimates (without removing them), which is
+   *  useful to complete the smoothed trajectory at the end of a sequence.
+   *  Groups are only recorded if `output_departed_groups` is set. */
+  DepartedGroups DrainDepartedGroups(bool include_instate = false);
 
 private:
+  /** Pose & covariance of an instate group in the global frame. */
+  DepartedGroup MakeDepartedGroup(GroupPtr g) const;
+
   void UpdateState(const State::Tangent &dX) { X_ += dX; }
 
   /** Top-level function for state prediction and update when an IMU packet
@@ -149,14 +213,20 @@ private:
    *  packet arrives */
   void VisualMeasInternal(const timestamp_t &ts, const cv::Mat &img);
 
+  /** Top-level function for state prediction and update when a batch of
+   *  events arrives */
+  void EventMeasInternal(const timestamp_t &ts, const Events &events);
+
   // initialize gravity with initial stationary samples
   bool InitializeGravity();
   /** Integrates the State `X`. If parameter `visual_meas` is set to `false`, we
    *  update `slope_accel_` and `slope_gyro_`. If `visual_meas` is set to `true`, we
    *  use `slope_accel_` and `slope_gyro` to adjust the last IMU measurement. */
   void Propagate(bool visual_meas);
-  /** kalman filter update step -- uses Joseph form */
-  void UpdateJosephForm();
+  /** Kalman filter update step with the stacked measurement (`H_`, `inn_`,
+   *  `diagR_`), in covariance (Joseph) or information form, see
+   *  `UpdateFormOptions`. */
+  void MeasurementUpdate();
   /** Predicts measurement (pixels) of features in input. */
   void Predict(std::list<FeaturePtr> &features);
   /** compute the motion jacobian F and G (private members `F_` and `G_`) at the
@@ -189,6 +259,18 @@ private:
   std::vector<FeaturePtr>
   OnePointRANSAC(const std::vector<FeaturePtr> &ic_matches);
   std::tuple<number_t, bool> HuberOnInnovation(const Vec2 &inn, number_t Rviz);
+  /** Iteratively reweights the stacked measurement (`H_`, `inn_`, `diagR_`)
+   *  by the robust kernel; `blocks` are the (offset, size) of the residual
+   *  blocks of each feature. Inflates `diagR_` and returns the block weights. */
+  VecX RobustReweight(const std::vector<std::pair<int, int>> &blocks);
+  /** Variance of each coordinate of the measurement of instate feature `f`,
+   *  scaled by its track quality and the adaptive noise, if any. */
+  number_t VisualNoise(const FeaturePtr &f) const;
+  /** Variance of each row of OOS & structureless measurements. */
+  number_t OOSNoise() const;
+  /** Bounds the inverse depth of feature `f`, and switches it to log-depth
+   *  once its depth is well-conditioned, see DepthParamOptions. */
+  void UpdateDepthParam(FeaturePtr f);
 
   void UpdateSystemClock(const timestamp_t &now);
 
@@ -201,6 +283,11 @@ private:
   void AddGroupToState(GroupPtr g);
   std::vector<FeaturePtr> DiscardGroups(const std::vector<GroupPtr> &discards);
   void DiscardFeatures(const std::vector<FeaturePtr> &discards);
+  /** Queues the features just dropped, in `oos_features_`, and takes back
+   *  as many queued features as the OOS budget of the frame allows, those
+   *  observed by the oldest groups first, which are the first ones discarded.
+   *  Features waiting for `max_wait` frames are taken regardless. */
+  void ScheduleOOS();
   void SwitchRefGroup();
 
   // same as above, but the feature list will be untouched
@@ -209,6 +296,31 @@ private:
 
   void AbsorbError(const VecX &err); // absorb error state into nominal state
   void AbsorbError();                // absorb error state into nominal state
+  /** Moves the spatial frame to the current body position, and to its heading
+   *  if `recenter.yaw` is set, by transforming the nominal states of the
+   *  body, the groups and the tags along with the covariance. Features are
+   *  parametrized in their reference camera and need not change. */
+  void Recenter();
+
+  /** Update with the corners of the detected tags. The first detection of a
+   *  tag of the map aligns the map with the spatial frame; the first detection
+   *  of any other tag adds its pose to the state if a slot is free. */
+  void TagUpdate(const TagDetections &detections);
+  /** Adds a tag seen at pose `gct` in the current camera to the state, with
+   *  its covariance derived from the body pose's. */
+  void AddTagToState(int id, number_t size, const SE3 &gct);
+  /** Update with the pending measurements of the registered models. */
+  void ModelUpdate();
+  /** Gates the measurements one by one and updates the state with the others,
+   *  stacked in the columns of the state they involve, with the covariance in
+   *  Joseph form if `joseph` is set. Returns the number of measurements
+   *  used. */
+  int BlockSparseUpdate(const std::vector<LinearizedMeasurement> &meas,
+                        bool joseph = false);
+#ifdef USE_G2O
+  /** Updates the state with the body pose corrected by the pose graph. */
+  void LoopClosureUpdate(const SE3 &gsb_corrected);
+#endif
   // helpers
   void PrintErrorStateNorm();
   void PrintErrorState();
@@ -222,8 +334,19 @@ private:
 private:
   std::vector<FeaturePtr> instate_features_; ///< in-state features
   std::vector<FeaturePtr> oos_features_;     ///< out-of-state features
+  std::vector<FeaturePtr> structureless_features_; ///< OOS features used
+                                                   ///< without triangulation
+  /** Dropped features waiting for their OOS update, with the frame they were
+   *  dropped at. They stay in the graph, and so do the groups observing them. */
+  std::vector<std::pair<FeaturePtr, int>> oos_queue_;
   std::vector<GroupPtr> instate_groups_;     ///< in-state groups
 
+  /** Whether or not to record groups leaving the state. */
+  bool output_departed_groups_;
+  /** Groups which left the state but not yet drained by the caller. */
+  DepartedGroups departed_groups_;
+  std::mutex departed_groups_mtx_;
+
   /** Index of the current gauge group. It is set to -1 when we lose the current
    *  gauge group while calling `ProcessTracks`. */
   int gauge_group_;
@@ -248,11 +371,38 @@ private:
   /** Minimum number of observations a feature needs by the time `Tracker` drops
    *  it in order to use it in a MSCKF update. */
   int OOS_update_min_observations_;
+  /** Maximal number of observations of a feature used in its MSCKF update,
+   *  selected for parallax; 0 to use all of them. */
+  int OOS_max_views_;
   bool use_depth_opt_;              // use depth optimization or not
+  DepthParamOptions depth_param_options_;
   RefinementOptions refinement_options_; // depth refinement options
   SubfilterOptions subfilter_options_;   // depth-subfilter options
   bool triangulate_pre_subfilter_; // depth triangulation before depth subfilter
   TriangulateOptions triangulate_options_;
+  /** Whether or not to use epipolar & three-view constraints, instead of the
+   *  MSCKF update, for OOS features of low parallax or failed depth refinement. */
+  bool use_structureless_;
+  StructurelessOptions structureless_options_;
+  RobustUpdateOptions robust_update_options_;
+  UpdateFormOptions update_form_options_;
+  TrackQualityOptions track_quality_options_;
+  RecenterOptions recenter_options_;
+  OwnershipOptions ownership_options_;
+  DirectUpdateOptions direct_update_options_;
+  OOSScheduleOptions oos_schedule_options_;
+
+  // fiducial tags
+  std::unique_ptr<TagDetector> tag_detector_; ///< null if tags are disabled
+  FiducialOptions fiducial_options_;
+  std::map<int, Tag> tag_map_; ///< tags of known pose in the map frame
+  bool tag_map_aligned_;       ///< whether `gsm_` is known
+  SE3 gsm_;                    ///< map to spatial frame
+  std::map<int, Tag> tags_;    ///< tags estimated in the state
+  std::array<bool, kMaxTag> tsel_;
+  /** Pose of the current spatial frame in the global frame, i.e., the
+   *  spatial frame at the start. Changed by `Recenter`. */
+  SE3 origin_;
 
   /** Minimum number of steps a feature is an outlier before it is removed */
   int remove_outlier_counter_;
@@ -321,14 +471,14 @@ private:
 
   /** Set to true once update has been initialized */
   bool MeasurementUpdateInitialized_;
-  /** Filter predicted covariance */
-  MatX S_;
-  /** Filter Kalman gain */
-  MatX K_;
+  // innovation statistics, see `mean_nis()`
+  number_t nis_sum_;
+  int num_updates_;
+  /** Measurement models registered, see `RegisterMeasurement` */
+  std::vector<MeasurementModelPtr> models_;
+  std::mutex models_mtx_;
   /** Filter measurement Jacobian */
   MatX H_;
-  /** The matrix `I-K*H` used in the Kalman Filter measurement update */
-  MatX I_KH_;
   /** Filter innovation */
   VecX inn_;
   /** Diagonal of visual feature measurement covariance used in the filter.
@@ -342,6 +492,9 @@ private:
   /** The filter's (assumed) measurement covariance of x and y pixel measurement for
    *  in-state tracked features. */
   number_t R_;
+  AdaptiveNoiseOptions adaptive_noise_options_;
+  /** Online scale of `R_` and `Roos_`, if enabled. */
+  std::unique_ptr<AdaptiveNoise> adaptive_noise_;
   number_t Rtri_;           // UNUSED? measurement covariance, depth sub-filter
   number_t outlier_thresh_; // outlier threshold -- multipler of the measurement
                          // variance
@@ -391,4 +544,29 @@ private:
   std::unique_ptr<std::default_random_engine> rng_;
 };
 
+/** Groups to discard from the full window of instate `groups`: all but the
+ *  oldest and every `step`-th one, unless `keep` holds. Groups in `pinned`,
+ *  which observe features queued for an OOS update, are kept as well unless
+ *  nothing else could be discarded. */
+std::vector<GroupPtr>
+SelectDiscardGroups(std::vector<GroupPtr> groups, int step,
+                    const std::unordered_set<GroupPtr> &pinned,
+                    const std::function<bool(GroupPtr)> &keep);
+
+/** Removes the `discards` from the OOS `queue`, as they are about to be
+ *  deleted. Features of pinned groups which could not be handed to another
+ *  group end up there. */
+void DropQueued(const std::vector<FeaturePtr> &discards,
+                std::vector<std::pair<FeaturePtr, int>> *queue);
+
+/** Rotation about gravity `X.Rg * g` which turns the x axis of the spatial
+ *  frame to the heading of the body of `X`, or the identity if either is
+ *  vertical. */
+SO3 HeadingRotation(const State &X, const Vec3 &g);
+/** Transforms the nominal motion state `X` to the spatial frame `g0`, given
+ *  in the current one, whose rotation is about gravity. Rotations perturbed
+ *  on the right keep their error state, and so does gravity, which such a
+ *  rotation leaves unchanged. */
+void RecenterState(const SE3 &g0, State *X);
+
 } // xivo
@@ -97,6 +97,13 @@ bool EstimatorProcess::Handle(EstimatorMessage *message) {
         estimator_->Vsb(), estimator_->Rg(), estimator_->Pstate());
     }
 
+    if (smoothed_pose_publisher_ != nullptr) {
+      // stamped with the frame time of the group, not the current time
+      for (const auto &dg : estimator_->DrainDepartedGroups()) {
+        smoothed_pose_publisher_->Publish(dg.ts, dg.gsb, dg.cov);
+      }
+    }
+
     return true;
   } else if (auto msg = dynamic_cast<InertialMeas *>(message)) {
 
@@ -81,7 +81,8 @@ private:
 class EstimatorProcess : public Process<EstimatorMessage> {
 public:
   EstimatorProcess(const std::string &name, uint32_t size = 1000)
-      : Process{size}, name_{name}, estimator_{nullptr}, publisher_{nullptr} {
+      : Process{size}, name_{name}, estimator_{nullptr}, publisher_{nullptr},
+        smoothed_pose_publisher_{nullptr} {
     LOG(INFO) << "Process " << name_ << " created!";
   }
   void Initialize(const std::string &config_path);
@@ -97,6 +98,12 @@ public:
   void Set2dNavStatePublisher(Publisher *publisher) {
     twod_nav_publisher_ = publisher;
   }
+  // publishes poses & covariances of groups leaving the state, i.e., the
+  // fixed-lag smoothed trajectory; requires `output_departed_groups` to be set
+  // in the estimator configuration
+  void SetSmoothedPosePublisher(Publisher *publisher) {
+    smoothed_pose_publisher_ = publisher;
+  }
 
   ////////////////////////////////////////
   // used for synchronized communication
@@ -125,6 +132,7 @@ private:
   Publisher *map_publisher_;
   Publisher *full_state_publisher_;
   Publisher *twod_nav_publisher_;
+  Publisher *smoothed_pose_publisher_;
   int max_pts_to_publish_;
 };                       // EstimatorProcess
 
@@ -0,0 +1,327 @@
+// Feature tracking on the output of an event camera: time surface corners
+// tracked by patch alignment.
+#include <algorithm>
+#include <cmath>
+
+#include "glog/logging.h"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "event_tracker.h"
+#include "feature.h"
+#include "tracker.h"
+
+namespace xivo {
+
+std::unique_ptr<EventTracker> EventTracker::instance_ = nullptr;
+
+EventTrackerPtr EventTracker::Create(const Json::Value &cfg, int rows,
+                                     int cols) {
+  if (instance_ == nullptr) {
+    instance_ =
+        std::unique_ptr<EventTracker>(new EventTracker(cfg, rows, cols));
+  } else {
+    LOG(WARNING) << "event tracker already created";
+  }
+  return instance_.get();
+}
+
+EventTracker::EventTracker(const Json::Value &cfg, int rows, int cols)
+    : rows_{rows}, cols_{cols}, initialized_{false} {
+  sae_ = cv::Mat(rows_, cols_, CV_64F, cv::Scalar(-1));
+  mask_ = cv::Mat(rows_, cols_, CV_8UC1, cv::Scalar(0));
+
+  period_ = 1.0 / cfg.get("rate", 200).asDouble();
+  tau_ = cfg.get("tau", 0.03).asDouble();
+  win_size_ = cfg.get("win_size", 11).asInt() | 1; // odd
+  search_ = cfg.get("search", 8).asInt();
+  max_iter_ = cfg.get("max_iter", 10).asInt();
+  eps_ = cfg.get("eps", 0.01).asDouble();
+  max_residual_ = cfg.get("max_residual", 0.3).asDouble();
+  min_activity_ = cfg.get("min_activity", 0.02).asDouble();
+  min_eig_ = cfg.get("min_eig", 1e-3).asDouble();
+  max_pixel_displacement_ = cfg.get("max_pixel_displacement", 8).asDouble();
+
+  num_features_min_ = cfg.get("num_features_min", 60).asInt();
+  num_features_max_ = cfg.get("num_features_max", 80).asInt();
+  mask_size_ = cfg.get("mask_size", 15).asInt();
+  margin_ = std::max(cfg.get("margin", 16).asInt(),
+                     win_size_ / 2 + search_ + 2);
+  quality_level_ = cfg.get("quality_level", 0.05).asDouble();
+  LOG(INFO) << "event tracker @ " << 1.0 / period_ << " Hz on " << cols_
+            << "x" << rows_;
+}
+
+void EventTracker::AddEvents(const Events &events) {
+  for (const auto &e : events) {
+    if (!initialized_) {
+      t0_ = last_update_ = e.ts;
+      initialized_ = true;
+    }
+    if (e.x < cols_ && e.y < rows_) {
+      sae_.at<double>(e.y, e.x) =
+          std::chrono::duration<double>(e.ts - t0_).count();
+    }
+  }
+}
+
+bool EventTracker::Ready(const timestamp_t &ts) const {
+  return initialized_ &&
+         std::chrono::duration<number_t>(ts - last_update_).count() >=
+             period_ * (1 - 1e-6);
+}
+
+number_t EventTracker::TimeSurfaceAt(const timestamp_t &ts, int x,
+                                     int y) const {
+  double t = sae_.at<double>(y, x);
+  if (t < 0) {
+    return 0;
+  }
+  double dt = std::chrono::duration<double>(ts - t0_).count() - t;
+  return std::exp(-std::max(0.0, dt) / tau_);
+}
+
+cv::Mat EventTracker::TimeSurface(const timestamp_t &ts) const {
+  cv::Mat surface(rows_, cols_, CV_32F, cv::Scalar(0));
+  if (initialized_) {
+    for (int y = 0; y < rows_; ++y) {
+      for (int x = 0; x < cols_; ++x) {
+        surface.at<float>(y, x) = TimeSurfaceAt(ts, x, y);
+      }
+    }
+  }
+  return surface;
+}
+
+cv::Mat EventTracker::Patch(const timestamp_t &ts, int cx, int cy,
+                            int size) const {
+  // rendered with a border of 1 pixel for the smoothing
+  int half = size / 2 + 1;
+  int full = size + 2;
+  cv::Mat raw(full, full, CV_64F, cv::Scalar(0));
+  for (int v = 0; v < full; ++v) {
+    int y = cy - half + v;
+    if (y < 0 || y >= rows_)
+      continue;
+    for (int u = 0; u < full; ++u) {
+      int x = cx - half + u;
+      if (x >= 0 && x < cols_) {
+        raw.at<double>(v, u) = TimeSurfaceAt(ts, x, y);
+      }
+    }
+  }
+  // events are sparse: a binomial filter makes the surface smooth enough for
+  // the alignment
+  cv::Mat patch(size, size, CV_64F);
+  for (int v = 0; v < size; ++v) {
+    for (int u = 0; u < size; ++u) {
+      double sum{0};
+      for (int j = 0; j < 3; ++j) {
+        for (int i = 0; i < 3; ++i) {
+          sum += (1 + (i == 1)) * (1 + (j == 1)) * raw.at<double>(v + j, u + i);
+        }
+      }
+      patch.at<double>(v, u) = sum / 16;
+    }
+  }
+  return patch;
+}
+
+bool EventTracker::Align(const cv::Mat &templ, const Vec2 &xp0,
+                         const timestamp_t &ts, Vec2 *xp, number_t *residual,
+                         bool *idle) const {
+  // template over the window, made zero-mean and unit-norm since the time
+  // surface decays as a whole between updates, and its gradients
+  int half = win_size_ / 2;
+  int n = win_size_ * win_size_;
+  VecX T(n);
+  Eigen::Matrix<number_t, Eigen::Dynamic, 2> G(n, 2);
+  for (int v = -half, k = 0; v <= half; ++v) {
+    for (int u = -half; u <= half; ++u, ++k) {
+      int r = v + half + 1, c = u + half + 1;
+      T(k) = templ.at<double>(r, c);
+      G(k, 0) = 0.5 * (templ.at<double>(r, c + 1) - templ.at<double>(r, c - 1));
+      G(k, 1) = 0.5 * (templ.at<double>(r + 1, c) - templ.at<double>(r - 1, c));
+    }
+  }
+  Mat2 H = G.transpose() * G / n;
+  if (H.selfadjointView<Eigen::Upper>().eigenvalues().minCoeff() < min_eig_) {
+    return false;
+  }
+  T.array() -= T.mean();
+  number_t norm = T.norm();
+  if (norm < 1e-6) {
+    return false;
+  }
+  T /= norm;
+  G /= norm;
+  H = G.transpose() * G;
+
+  // time surface around the initial guess, large enough for the search
+  int R = half + search_ + 1;
+  int cx = std::round((*xp)(0)), cy = std::round((*xp)(1));
+  cv::Mat I = Patch(ts, cx, cy, 2 * R + 1);
+
+  number_t activity{0};
+  for (int v = R - half; v <= R + half; ++v) {
+    for (int u = R - half; u <= R + half; ++u) {
+      activity += I.at<double>(v, u);
+    }
+  }
+  *idle = activity / n < min_activity_;
+  if (*idle) {
+    return true;
+  }
+
+  // inverse compositional Gauss-Newton on the translation; the template point
+  // u is at xp0.round() + u, i.e., at xp + offset + u in the current surface
+  Vec2 offset{std::round(xp0(0)) - xp0(0), std::round(xp0(1)) - xp0(1)};
+  Vec2 p = *xp;
+  VecX e(n);
+  for (int iter = 0; iter < max_iter_; ++iter) {
+    Vec2 q0 = p + offset - Vec2{cx - R, cy - R};
+    for (int v = -half, k = 0; v <= half; ++v) {
+      for (int u = -half; u <= half; ++u, ++k) {
+        number_t x = q0(0) + u, y = q0(1) + v;
+        int x0 = std::floor(x), y0 = std::floor(y);
+        if (x0 < 0 || y0 < 0 || x0 + 1 >= I.cols || y0 + 1 >= I.rows) {
+          return false;
+        }
+        number_t ax = x - x0, ay = y - y0;
+        e(k) = (1 - ay) * ((1 - ax) * I.at<double>(y0, x0) +
+                           ax * I.at<double>(y0, x0 + 1)) +
+               ay * ((1 - ax) * I.at<double>(y0 + 1, x0) +
+                     ax * I.at<double>(y0 + 1, x0 + 1));
+      }
+    }
+    e.array() -= e.mean();
+    number_t enorm = e.norm();
+    if (enorm < 1e-6) {
+      return false;
+    }
+    e = e / enorm - T;
+    Vec2 dp = H.ldlt().solve(G.transpose() * e);
+    p -= dp;
+    if (dp.norm() < eps_) {
+      break;
+    }
+  }
+  // 1 - normalized cross-correlation at the last linearization point
+  *residual = 0.5 * e.squaredNorm();
+  if (*residual > max_residual_ || (p - *xp).norm() > search_) {
+    return false;
+  }
+  *xp = p;
+  return true;
+}
+
+void EventTracker::Update(const timestamp_t &ts) {
+  last_update_ = ts;
+  ResetMask(mask_(
+      cv::Rect(margin_, margin_, cols_ - 2 * margin_, rows_ - 2 * margin_)));
+
+  int num_valid_features = 0;
+  std::unordered_map<int, std::pair<cv::Mat, Vec2>> templates;
+  for (auto f : features_) {
+    Vec2 last_pos{f->xp()};
+    Vec2 xp{last_pos};
+    // start from the predicted location if any
+    auto pred = f->pred();
+    if (pred(0) != -1 && pred(1) != -1) {
+      xp = pred;
+      f->ResetPred();
+    }
+
+    bool ok{false}, idle{false};
+    number_t residual{0};
+    auto it = templates_.find(f->id());
+    if (it != templates_.end()) {
+      ok = Align(it->second.first, it->second.second, ts, &xp, &residual,
+                 &idle);
+      if (idle) {
+        // no events, no apparent motion
+        xp = last_pos;
+      }
+    }
+    if (ok && MaskValid(mask_, xp(0), xp(1)) &&
+        (xp - last_pos).norm() < max_pixel_displacement_) {
+      f->SetTrackStatus(TrackStatus::TRACKED);
+      f->UpdateTrack(xp);
+      MaskOut(mask_, xp(0), xp(1), mask_size_);
+      // the template is kept as long as it matches well, so that errors do
+      // not accumulate from one update to the next
+      if (idle || (residual < 0.5 * max_residual_ &&
+                   (xp - it->second.second).norm() < 0.5 * search_)) {
+        templates[f->id()] = it->second;
+      } else {
+        templates[f->id()] = {
+            Patch(ts, std::round(xp(0)), std::round(xp(1)), win_size_ + 2),
+            xp};
+      }
+      ++num_valid_features;
+    } else {
+      f->SetTrackStatus(TrackStatus::DROPPED);
+    }
+  }
+  templates_.swap(templates);
+
+  if (num_valid_features < num_features_min_) {
+    Detect(ts, num_features_max_ - num_valid_features);
+  }
+}
+
+void EventTracker::Detect(const timestamp_t &ts, int num_to_add) {
+  std::vector<cv::Point2f> corners;
+  cv::goodFeaturesToTrack(TimeSurface(ts), corners, num_to_add, quality_level_,
+                          0.5 * mask_size_, mask_);
+  for (const auto &pt : corners) {
+    if (!MaskValid(mask_, pt.x, pt.y)) {
+      continue;
+    }
+    FeaturePtr f = Feature::Create(pt.x, pt.y);
+    features_.push_back(f);
+    templates_[f->id()] = {
+        Patch(ts, std::round(pt.x), std::round(pt.y), win_size_ + 2),
+        Vec2{pt.x, pt.y}};
+    MaskOut(mask_, pt.x, pt.y, mask_size_);
+  }
+}
+
+Events EventSimulator::Feed(const timestamp_t &ts, const cv::Mat &img) {
+  cv::Mat L;
+  img.convertTo(L, CV_64F);
+  for (int y = 0; y < L.rows; ++y) {
+    for (int x = 0; x < L.cols; ++x) {
+      L.at<double>(y, x) = std::log(1 + L.at<double>(y, x));
+    }
+  }
+
+  Events events;
+  if (ref_.empty()) {
+    ref_ = L.clone();
+  } else {
+    number_t span = (ts - last_ts_).count();
+    for (int y = 0; y < L.rows; ++y) {
+      for (int x = 0; x < L.cols; ++x) {
+        double l0 = last_.at<double>(y, x), l1 = L.at<double>(y, x);
+        double &ref = ref_.at<double>(y, x);
+        int8_t polarity = l1 > ref ? 1 : -1;
+        // crossings of the contrast levels, at times interpolated linearly
+        while (polarity * (l1 - ref) >= contrast_) {
+          ref += polarity * contrast_;
+          number_t alpha = (ref - l0) / (l1 - l0);
+          events.push_back(
+              {last_ts_ + timestamp_t(int64_t(alpha * span)), uint16_t(x),
+               uint16_t(y), polarity});
+        }
+      }
+    }
+    std::stable_sort(
+        events.begin(), events.end(),
+        [](const Event &e1, const Event &e2) { return e1.ts < e2.ts; });
+  }
+  last_ = L;
+  last_ts_ = ts;
+  return events;
+}
+
+} // namespace xivo
@@ -0,0 +1,114 @@
+// Feature tracking on the output of an event camera.
+//
+// Events update the surface of active events (SAE), i.e., the timestamp of the
+// latest event at each pixel. At the configured rate, every feature is tracked
+// by aligning a patch of the exponentially decaying time surface around it to
+// the patch kept from the previous step, and new corners are detected on the
+// time surface where features are missing. Tracking only reads the patches
+// around the features, never the full sensor.
+#pragma once
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "opencv2/core/core.hpp"
+#include "json/json.h"
+
+#include "core.h"
+
+namespace xivo {
+
+class EventTracker;
+using EventTrackerPtr = EventTracker *;
+
+class EventTracker {
+public:
+  static EventTrackerPtr Create(const Json::Value &cfg, int rows, int cols);
+  static EventTrackerPtr instance() { return instance_.get(); }
+
+  /** Stamps the events, in time order, into the surface of active events. */
+  void AddEvents(const Events &events);
+
+  /** Whether tracks are due at time `ts`, according to the configured rate. */
+  bool Ready(const timestamp_t &ts) const;
+
+  /** Tracks the features to time `ts` and detects new ones. */
+  void Update(const timestamp_t &ts);
+
+  /** Time surface at time `ts` over the whole sensor, in [0, 1]. */
+  cv::Mat TimeSurface(const timestamp_t &ts) const;
+
+  /** Time surface at time `ts` at pixel (x, y): exp(-(ts - SAE(x, y)) / tau),
+   *  0 if no event has been seen there. */
+  number_t TimeSurfaceAt(const timestamp_t &ts, int x, int y) const;
+
+public:
+  std::list<FeaturePtr> features_;
+
+private:
+  EventTracker(const EventTracker &other) = delete;
+  EventTracker &operator=(const EventTracker &other) = delete;
+
+  EventTracker(const Json::Value &cfg, int rows, int cols);
+  static std::unique_ptr<EventTracker> instance_;
+
+  /** Time surface at `ts` on a `size` x `size` patch centered at integer pixel
+   *  (cx, cy), pixels outside of the sensor are 0. */
+  cv::Mat Patch(const timestamp_t &ts, int cx, int cy, int size) const;
+
+  /** Aligns the template of a feature, taken at `xp0`, to the time surface at
+   *  `ts`, starting from `xp`, and sets `residual` to 1 - normalized
+   *  cross-correlation. Returns false if the alignment fails. `idle`
+   *  is set, and `xp` left as is, if too few events hit the patch to move it. */
+  bool Align(const cv::Mat &templ, const Vec2 &xp0, const timestamp_t &ts,
+             Vec2 *xp, number_t *residual, bool *idle) const;
+
+  void Detect(const timestamp_t &ts, int num_to_add);
+
+  int rows_, cols_;
+  cv::Mat sae_; // CV_64F, seconds since t0_ of the latest event, -1 if none
+  timestamp_t t0_, last_update_;
+  bool initialized_;
+
+  number_t period_;       // seconds between two updates
+  number_t tau_;          // decay of the time surface, seconds
+  int win_size_;          // of the aligned patches
+  int search_;            // pixels around the prediction covered by a patch
+  int max_iter_;          // Gauss-Newton iterations of the alignment
+  number_t eps_;          // stop once the step is below this, pixels
+  number_t max_residual_; // 1 - normalized cross-correlation of aligned patches
+  number_t min_activity_; // average time surface below which the patch is idle
+  number_t min_eig_;      // templates of lower Shi-Tomasi score are dropped
+  number_t max_pixel_displacement_; // between two updates
+
+  int num_features_min_;
+  int num_features_max_;
+  int mask_size_;
+  int margin_;
+  number_t quality_level_; // of corners, relative to the strongest one
+  cv::Mat mask_;
+
+  // templates keyed by feature id, with the position they were taken at
+  std::unordered_map<int, std::pair<cv::Mat, Vec2>> templates_;
+};
+
+/** Converts a sequence of images into events as an ideal event camera would:
+ *  a pixel fires each time its log intensity moved by `contrast` since its last
+ *  event, with timestamps interpolated between the images. */
+class EventSimulator {
+public:
+  EventSimulator(number_t contrast = 0.15) : contrast_{contrast} {}
+
+  /** Events between the previous image and grayscale image `img` at `ts`, in
+   *  time order. The first image only sets the reference. */
+  Events Feed(const timestamp_t &ts, const cv::Mat &img);
+
+private:
+  number_t contrast_;
+  cv::Mat ref_;  // CV_64F, log intensity at the last event of each pixel
+  cv::Mat last_; // CV_64F, log intensity of the previous image
+  timestamp_t last_ts_;
+};
+
+} // namespace xivo
@@ -4,10 +4,12 @@
 #include "camera_manager.h"
 #include "mm.h"
 #include "tracker.h"
+#include "event_tracker.h"
 #include "graph.h"
 #include "estimator.h"
 
 #ifdef USE_G2O
+#include "loop_closure.h"
 #include "optimizer.h"
 #endif
 
@@ -43,6 +45,17 @@ EstimatorPtr CreateSystem(const Json::Value &cfg) {
   Tracker::Create(tracker_cfg);
   LOG(INFO) << "Tracker created";
 
+  // Initialize the tracker of the event camera, if any, which shares the
+  // intrinsics of the camera
+  if (cfg.isMember("event_tracker_cfg")) {
+    auto event_tracker_cfg = cfg["event_tracker_cfg"].isString()
+                                 ? LoadJson(cfg["event_tracker_cfg"].asString())
+                                 : cfg["event_tracker_cfg"];
+    EventTracker::Create(event_tracker_cfg, Camera::instance()->rows(),
+                         Camera::instance()->cols());
+    LOG(INFO) << "Event tracker created";
+  }
+
   // Initialize the visibility graph
   Graph::Create();
   LOG(INFO) << "Visibility graph created";
@@ -51,6 +64,16 @@ EstimatorPtr CreateSystem(const Json::Value &cfg) {
   // Initialize the optimizer
   Optimizer::Create(cfg["optimizer"]);
   LOG(INFO) << "Optimizer created";
+
+  // Initialize loop closure
+  if (cfg["loop_closure"].get("enabled", false).asBool()) {
+    LoopClosure::Create(cfg["loop_closure"]);
+    LOG(INFO) << "Loop closure created";
+  }
+#else
+  if (cfg["loop_closure"].get("enabled", false).asBool()) {
+    LOG(WARNING) << "loop closure requires g2o; build with BUILD_G2O";
+  }
 #endif
 
   // Initialize the estimator
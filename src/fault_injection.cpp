@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <cmath>
+
+#include "glog/logging.h"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "fault_injection.h"
+#include "loader.h"
+
+namespace xivo {
+
+namespace {
+
+timestamp_t Seconds(number_t s) { return timestamp_t(int64_t(s * 1e9)); }
+
+// drops each message with the given probability
+class DropFault : public Fault {
+public:
+  DropFault(const Json::Value &cfg) : Fault{cfg} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    std::uniform_real_distribution<number_t> u;
+    stream->erase(std::remove_if(stream->begin(), stream->end(),
+                                 [&](const Delivery &d) {
+                                   return Targets(d) && u(*rng) < probability_;
+                                 }),
+                  stream->end());
+  }
+};
+
+// delivers each message twice with the given probability
+class DuplicateFault : public Fault {
+public:
+  DuplicateFault(const Json::Value &cfg) : Fault{cfg} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    std::uniform_real_distribution<number_t> u;
+    DeliveryStream out;
+    out.reserve(stream->size());
+    for (const auto &d : *stream) {
+      out.push_back(d);
+      if (Targets(d) && u(*rng) < probability_) {
+        out.push_back(d);
+      }
+    }
+    stream->swap(out);
+  }
+};
+
+// delays each message with the given probability by up to "max_delay" seconds
+class DelayFault : public Fault {
+public:
+  DelayFault(const Json::Value &cfg)
+      : Fault{cfg}, max_delay_{cfg.get("max_delay", 0.05).asDouble()} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    std::uniform_real_distribution<number_t> u;
+    for (auto &d : *stream) {
+      if (Targets(d) && u(*rng) < probability_) {
+        d.arrival += Seconds(u(*rng) * max_delay_);
+      }
+    }
+  }
+
+private:
+  number_t max_delay_;
+};
+
+// delivers each message with the given probability after the next one it
+// targets
+class ReorderFault : public Fault {
+public:
+  ReorderFault(const Json::Value &cfg) : Fault{cfg} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    std::uniform_real_distribution<number_t> u;
+    for (int i = 0; i < stream->size(); ++i) {
+      auto &d = (*stream)[i];
+      if (!Targets(d) || u(*rng) >= probability_) {
+        continue;
+      }
+      int j = i + 1;
+      while (j < stream->size() && !Targets((*stream)[j])) {
+        ++j;
+      }
+      if (j < stream->size()) {
+        // held until the next one arrives, and delivered after it
+        d.arrival = (*stream)[j].arrival;
+        std::swap(d, (*stream)[j]);
+        i = j;
+      }
+    }
+  }
+};
+
+// every "period" seconds, with the given probability, holds the messages for
+// "duration" seconds and releases them at once, as a stalled driver would
+class BurstFault : public Fault {
+public:
+  BurstFault(const Json::Value &cfg)
+      : Fault{cfg}, period_{cfg.get("period", 1.0).asDouble()},
+        duration_{cfg.get("duration", 0.1).asDouble()} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    if (stream->empty()) {
+      return;
+    }
+    std::uniform_real_distribution<number_t> u;
+    timestamp_t start = stream->front().arrival;
+    timestamp_t end =
+        u(*rng) < probability_ ? start + Seconds(duration_) : start;
+    for (auto &d : *stream) {
+      while (d.arrival >= start + Seconds(period_)) {
+        start += Seconds(period_);
+        end = u(*rng) < probability_ ? start + Seconds(duration_) : start;
+      }
+      if (Targets(d) && d.arrival < end) {
+        d.arrival = end;
+      }
+    }
+  }
+
+private:
+  number_t period_, duration_;
+};
+
+// adds zero-mean Gaussian noise of "std" seconds to the timestamps
+class JitterFault : public Fault {
+public:
+  JitterFault(const Json::Value &cfg)
+      : Fault{cfg}, std_{cfg.get("std", 0.0005).asDouble()} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    std::uniform_real_distribution<number_t> u;
+    std::normal_distribution<number_t> n{0, std_};
+    for (auto &d : *stream) {
+      if (Targets(d) && u(*rng) < probability_) {
+        d.ts += Seconds(n(*rng));
+      }
+    }
+  }
+
+private:
+  number_t std_;
+};
+
+// additive Gaussian noise of "std" intensity levels on images
+class NoiseFault : public Fault {
+public:
+  NoiseFault(const Json::Value &cfg)
+      : Fault{cfg}, std_{cfg.get("std", 8.0).asDouble()} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    std::uniform_real_distribution<number_t> u;
+    for (auto &d : *stream) {
+      if (d.type == Delivery::IMAGE && Targets(d) && u(*rng) < probability_) {
+        d.noise_std = std::hypot(d.noise_std, std_);
+        d.noise_seed = (*rng)();
+      }
+    }
+  }
+
+private:
+  number_t std_;
+};
+
+// Gaussian blur of "sigma" pixels on images, e.g., motion or defocus blur
+class BlurFault : public Fault {
+public:
+  BlurFault(const Json::Value &cfg)
+      : Fault{cfg}, sigma_{cfg.get("sigma", 2.0).asDouble()} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    std::uniform_real_distribution<number_t> u;
+    for (auto &d : *stream) {
+      if (d.type == Delivery::IMAGE && Targets(d) && u(*rng) < probability_) {
+        d.blur_sigma = std::hypot(d.blur_sigma, sigma_);
+      }
+    }
+  }
+
+private:
+  number_t sigma_;
+};
+
+// with the given probability per image, the exposure jumps by a gain in
+// ["min_gain", "max_gain"], which holds for "frames" images
+class ExposureFault : public Fault {
+public:
+  ExposureFault(const Json::Value &cfg)
+      : Fault{cfg}, min_gain_{cfg.get("min_gain", 0.5).asDouble()},
+        max_gain_{cfg.get("max_gain", 2.0).asDouble()},
+        frames_{cfg.get("frames", 10).asInt()} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    std::uniform_real_distribution<number_t> u;
+    number_t gain{1};
+    int left{0};
+    for (auto &d : *stream) {
+      if (d.type != Delivery::IMAGE || !Targets(d)) {
+        continue;
+      }
+      if (left == 0 && u(*rng) < probability_) {
+        gain = min_gain_ + u(*rng) * (max_gain_ - min_gain_);
+        left = frames_;
+      }
+      if (left > 0) {
+        d.gain *= gain;
+        --left;
+      }
+    }
+  }
+
+private:
+  number_t min_gain_, max_gain_;
+  int frames_;
+};
+
+// clamps the gyroscope and accelerometer readings to their ranges
+class IMUSaturationFault : public Fault {
+public:
+  IMUSaturationFault(const Json::Value &cfg)
+      : Fault{cfg}, gyro_max_{cfg.get("gyro_max", 4.0).asDouble()},
+        accel_max_{cfg.get("accel_max", 16.0).asDouble()} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    for (auto &d : *stream) {
+      if (d.type == Delivery::IMU && Targets(d)) {
+        d.gyro = d.gyro.cwiseMax(-gyro_max_).cwiseMin(gyro_max_);
+        d.accel = d.accel.cwiseMax(-accel_max_).cwiseMin(accel_max_);
+      }
+    }
+  }
+
+private:
+  number_t gyro_max_, accel_max_;
+};
+
+// with the given probability per IMU message, the IMU goes silent for
+// "duration" seconds
+class IMUGapFault : public Fault {
+public:
+  IMUGapFault(const Json::Value &cfg)
+      : Fault{cfg}, duration_{cfg.get("duration", 0.1).asDouble()} {}
+  void Apply(DeliveryStream *stream, std::mt19937 *rng) const override {
+    std::uniform_real_distribution<number_t> u;
+    timestamp_t end{0};
+    bool gap{false};
+    stream->erase(std::remove_if(stream->begin(), stream->end(),
+                                 [&](const Delivery &d) {
+                                   if (d.type != Delivery::IMU || !Targets(d)) {
+                                     return false;
+                                   }
+                                   if (gap && d.sensor_ts < end) {
+                                     return true;
+                                   }
+                                   gap = u(*rng) < probability_;
+                                   end = d.sensor_ts + Seconds(duration_);
+                                   return gap;
+                                 }),
+                  stream->end());
+  }
+
+private:
+  number_t duration_;
+};
+
+} // namespace
+
+Delivery::Delivery(const msg::Message *msg)
+    : msg{msg}, ts{msg->ts_}, sensor_ts{msg->ts_}, arrival{msg->ts_},
+      gyro{Vec3::Zero()}, accel{Vec3::Zero()}, gain{1}, noise_std{0},
+      blur_sigma{0}, noise_seed{0} {
+  if (auto imu = dynamic_cast<const msg::IMU *>(msg)) {
+    type = IMU;
+    gyro = imu->gyro_;
+    accel = imu->accel_;
+  } else if (dynamic_cast<const msg::Image *>(msg)) {
+    type = IMAGE;
+  } else if (dynamic_cast<const msg::EventBatch *>(msg)) {
+    type = EVENTS;
+  } else {
+    LOG(FATAL) << "Invalid entry type.";
+  }
+}
+
+Fault::Fault(const Json::Value &cfg)
+    : name_{cfg.get("name", cfg["type"]).asString()},
+      probability_{cfg.get("probability", 1.0).asDouble()} {
+  std::string type = cfg["type"].asString();
+  std::string target = cfg.get("target", "").asString();
+  if (target.empty()) {
+    // photometric faults only affect images, and IMU faults the IMU
+    if (type == "noise" || type == "blur" || type == "exposure") {
+      target = "image";
+    } else if (type.compare(0, 4, "imu_") == 0) {
+      target = "imu";
+    } else {
+      target = "all";
+    }
+  }
+  image_ = target == "image" || target == "all";
+  imu_ = target == "imu" || target == "all";
+  events_ = target == "events" || target == "all";
+  CHECK(image_ || imu_ || events_) << "Unknown fault target " << target;
+}
+
+bool Fault::Targets(const Delivery &d) const {
+  switch (d.type) {
+  case Delivery::IMAGE:
+    return image_;
+  case Delivery::IMU:
+    return imu_;
+  default:
+    return events_;
+  }
+}
+
+std::unique_ptr<Fault> MakeFault(const Json::Value &cfg) {
+  std::string type = cfg["type"].asString();
+  if (type == "drop") {
+    return std::make_unique<DropFault>(cfg);
+  } else if (type == "duplicate") {
+    return std::make_unique<DuplicateFault>(cfg);
+  } else if (type == "delay") {
+    return std::make_unique<DelayFault>(cfg);
+  } else if (type == "reorder") {
+    return std::make_unique<ReorderFault>(cfg);
+  } else if (type == "burst") {
+    return std::make_unique<BurstFault>(cfg);
+  } else if (type == "jitter") {
+    return std::make_unique<JitterFault>(cfg);
+  } else if (type == "noise") {
+    return std::make_unique<NoiseFault>(cfg);
+  } else if (type == "blur") {
+    return std::make_unique<BlurFault>(cfg);
+  } else if (type == "exposure") {
+    return std::make_unique<ExposureFault>(cfg);
+  } else if (type == "imu_saturation") {
+    return std::make_unique<IMUSaturationFault>(cfg);
+  } else if (type == "imu_gap") {
+    return std::make_unique<IMUGapFault>(cfg);
+  }
+  LOG(FATAL) << "Unknown fault type " << type;
+  return nullptr;
+}
+
+FaultInjector::FaultInjector(const Json::Value &cfg)
+    : seed_{cfg.get("seed", 0).asUInt()} {
+  for (const auto &fault_cfg : cfg["faults"]) {
+    faults_.push_back(MakeFault(fault_cfg));
+  }
+}
+
+DeliveryStream FaultInjector::Apply(const DataLoader &loader) const {
+  std::vector<const msg::Message *> msgs(loader.size());
+  for (int i = 0; i < loader.size(); ++i) {
+    msgs[i] = loader.Get(i);
+  }
+  return Apply(msgs);
+}
+
+DeliveryStream
+FaultInjector::Apply(const std::vector<const msg::Message *> &msgs) const {
+  DeliveryStream stream;
+  stream.reserve(msgs.size());
+  for (auto msg : msgs) {
+    stream.emplace_back(msg);
+  }
+  std::mt19937 rng{seed_};
+  for (const auto &fault : faults_) {
+    fault->Apply(&stream, &rng);
+    // messages of the same arrival keep their order
+    std::stable_sort(stream.begin(), stream.end(),
+                     [](const Delivery &d1, const Delivery &d2) {
+                       return d1.arrival < d2.arrival;
+                     });
+  }
+  return stream;
+}
+
+cv::Mat FaultInjector::ReadImage(const Delivery &d) {
+  CHECK(d.type == Delivery::IMAGE);
+  cv::Mat image =
+      cv::imread(static_cast<const msg::Image *>(d.msg)->image_path_);
+  Perturb(d, &image);
+  return image;
+}
+
+void FaultInjector::Perturb(const Delivery &d, cv::Mat *image) {
+  if (image->empty() ||
+      (d.gain == 1 && d.noise_std == 0 && d.blur_sigma == 0)) {
+    return;
+  }
+  // exposure, then the optics, then the sensor
+  cv::Mat img;
+  image->convertTo(img, CV_32F, d.gain);
+  if (d.blur_sigma > 0) {
+    cv::GaussianBlur(img, img, cv::Size(0, 0), d.blur_sigma);
+  }
+  if (d.noise_std > 0) {
+    cv::Mat noise(img.size(), img.type());
+    cv::RNG rng(d.noise_seed);
+    rng.fill(noise, cv::RNG::NORMAL, 0, d.noise_std);
+    img += noise;
+  }
+  // saturates
+  img.convertTo(*image, image->type());
+}
+
+std::vector<std::string> FaultInjector::names() const {
+  std::vector<std::string> out;
+  for (const auto &fault : faults_) {
+    out.push_back(fault->name());
+  }
+  return out;
+}
+
+} // namespace xivo
@@ -0,0 +1,108 @@
+// Fault injection between the data loader and the estimator, to replay a
+// recording as a misbehaving driver or an overloaded host would deliver it:
+// messages dropped, duplicated, delayed, reordered or released in bursts,
+// jittered timestamps, noisy, blurred or wrongly exposed images, saturated
+// IMU readings and IMU gaps.
+//
+// Faults are configured as a list and applied in order, each with its own
+// draws from a generator seeded once, so a replay is reproducible:
+//   {
+//     "seed": 0,
+//     "faults": [
+//       {"type": "drop", "target": "image", "probability": 0.05},
+//       {"type": "jitter", "target": "imu", "std": 0.0005}
+//     ]
+//   }
+// See fault_injection.cpp, or cfg/faults.json, for the faults and parameters.
+#pragma once
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+#include "opencv2/core/core.hpp"
+
+#include "core.h"
+#include "message_types.h"
+
+namespace xivo {
+
+class DataLoader;
+
+/** A message as delivered to the estimator. */
+struct Delivery {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  enum Type { IMAGE, IMU, EVENTS };
+
+  Delivery(const msg::Message *msg);
+
+  const msg::Message *msg; // recorded message, owned by the loader
+  Type type;
+  timestamp_t ts;        // timestamp the message carries
+  timestamp_t sensor_ts; // when the data was captured
+  timestamp_t arrival;   // when it reaches the estimator
+  Vec3 gyro, accel;      // of IMU messages
+
+  // applied to images when they are read, see FaultInjector::ReadImage
+  number_t gain;       // of the intensity
+  number_t noise_std;  // of additive Gaussian noise, intensity levels
+  number_t blur_sigma; // of Gaussian blur, pixels
+  uint32_t noise_seed;
+};
+
+/** Messages in the order of arrival. */
+using DeliveryStream = std::vector<Delivery>;
+
+/** One kind of fault, see MakeFault. */
+class Fault {
+public:
+  virtual ~Fault() = default;
+  virtual void Apply(DeliveryStream *stream, std::mt19937 *rng) const = 0;
+  const std::string &name() const { return name_; }
+
+protected:
+  Fault(const Json::Value &cfg);
+
+  /** Whether the fault applies to the delivery, according to "target":
+   *  "image", "imu", "events" or "all". */
+  bool Targets(const Delivery &d) const;
+
+  std::string name_;
+  number_t probability_;
+
+private:
+  bool image_, imu_, events_;
+};
+
+/** Creates the fault of the given configuration, whose "type" is one of
+ *  drop, duplicate, delay, reorder, burst, jitter, noise, blur, exposure,
+ *  imu_saturation or imu_gap. */
+std::unique_ptr<Fault> MakeFault(const Json::Value &cfg);
+
+class FaultInjector {
+public:
+  FaultInjector(const Json::Value &cfg);
+
+  /** Messages of the loader, in the order they would be delivered with the
+   *  faults. */
+  DeliveryStream Apply(const DataLoader &loader) const;
+  DeliveryStream Apply(const std::vector<const msg::Message *> &msgs) const;
+
+  /** Reads the image of an image delivery and applies its photometric
+   *  faults. */
+  static cv::Mat ReadImage(const Delivery &d);
+  /** Applies the photometric faults of the delivery to `image` in place. */
+  static void Perturb(const Delivery &d, cv::Mat *image);
+
+  /** Names of the faults, in the order they are applied. */
+  std::vector<std::string> names() const;
+  int size() const { return faults_.size(); }
+
+private:
+  uint32_t seed_;
+  std::vector<std::unique_ptr<Fault>> faults_;
+};
+
+} // namespace xivo
@@ -41,11 +41,14 @@ void Feature::Reset(number_t x, number_t y) {
   status_ = FeatureStatus::CREATED;
   ref_ = nullptr;
   Track::Reset(x, y);
+  bearing_valid_ = false;
   x_ << x, y, 2.0;
+  depth_param_ = kDefaultDepthParam;
   pred_ << -1, -1;
   J_.setZero();
   inn_ << 0, 0;
   outlier_counter_ = 0;
+  noise_scale_ = mean_noise_scale_ = 1;
 
   sim_.Xs << -1, -1, -1;
   sim_.xp << -1, -1;
@@ -53,25 +56,23 @@ void Feature::Reset(number_t x, number_t y) {
   sim_.z = -1;
   sim_.lifetime = -1;
 
-#ifdef APPROXIMATE_INIT_COVARIANCE
-  cov_.clear();
-  cov_xc_.setZero();
-  cov_xr_.setZero();
-#endif
+  ResetInitJacobian();
 }
 
 ////////////////////////////////////////
 // SOME ACCESSORS
 ////////////////////////////////////////
 Vec3 Feature::Xc(Mat3 *J) {
-#ifdef USE_INVDEPTH
-  Xc_ = unproject_invz(x_, J);
-#else
-  Xc_ = unproject_logz(x_, J);
-#endif
+  Xc_ = depth_param_ == DepthParam::INVERSE ? unproject_invz(x_, J)
+                                            : unproject_logz(x_, J);
   return Xc_;
 }
 
+Vec3 Feature::Parametrize(const Vec3 &Xc, Mat3 *J) const {
+  return depth_param_ == DepthParam::INVERSE ? project_invz(Xc, J)
+                                             : project_logz(Xc, J);
+}
+
 Vec3 Feature::Xs(const SE3 &gbc, Mat3 *J) {
   // Rsb * (Rbc*Xc + Tbc) + Tsb
 #ifndef NDEBUG
@@ -86,11 +87,31 @@ Vec3 Feature::Xs(const SE3 &gbc, Mat3 *J) {
 }
 
 number_t Feature::z() const {
-#ifdef USE_INVDEPTH
-  return 1.0 / x_(2);
-#else
-  return exp(x_(2));
-#endif
+  return depth_param_ == DepthParam::INVERSE ? 1.0 / x_(2) : exp(x_(2));
+}
+
+void Feature::SetDepthParam(DepthParam param, MatX &P) {
+  if (param == depth_param_) {
+    return;
+  }
+  // log(z) = -log(1/z): d(log z) = -z d(1/z), and d(1/z) = -(1/z) d(log z)
+  number_t z = this->z();
+  number_t d = param == DepthParam::LOG ? -z : -1.0 / z;
+  x_(2) = param == DepthParam::LOG ? log(z) : 1.0 / z;
+  depth_param_ = param;
+
+  if (instate()) {
+    int offset = kFeatureBegin + kFeatureSize * sind_ + 2;
+    P.row(offset) *= d;
+    P.col(offset) *= d;
+  } else {
+    P_.row(2) *= d;
+    P_.col(2) *= d;
+    for (auto &[g, A] : init_jac_) {
+      A.row(2) *= d;
+    }
+    init_jac_c_.row(2) *= d;
+  }
 }
 
 bool Feature::instate() const { return status_ == FeatureStatus::INSTATE; }
@@ -101,18 +122,21 @@ number_t Feature::score() const {
       << "score function should only be called for feature not-instate yet";
 #endif
   // TODO: come up with better scoring
-  // confidence (negative uncertainty) in depth as score
+  // confidence (negative uncertainty) in depth as score, discounted by how
+  // well the feature has been tracked
   // return -P_(0, 0) * P_(1, 1) * P_(2, 2);
-  return -P_(2, 2);
+  // variance of log-depth, such that parametrizations compare
+  number_t var_z = P_(2, 2);
+  if (depth_param_ == DepthParam::INVERSE) {
+    var_z *= z() * z();
+  }
+  return -var_z * mean_noise_scale_;
 }
 
-void Feature::Initialize(number_t z0, const Vec3 &std_xyz) {
+void Feature::Initialize(number_t z0, const Vec3 &std_xyz, DepthParam param) {
   x_.head<2>() = Camera::instance()->UnProject(back());
-#ifdef USE_INVDEPTH
-  x_(2) = 1.0 / z0;
-#else
-  x_(2) = log(z0);
-#endif
+  depth_param_ = param;
+  x_(2) = param == DepthParam::INVERSE ? 1.0 / z0 : log(z0);
 
   // number_t rho = 1.0 / z0;
   // number_t rho_max = std::max(1.0 / (z0 - std_xyz(2)), 0.10);  // 0.10 is
@@ -121,6 +145,10 @@ void Feature::Initialize(number_t z0, const Vec3 &std_xyz) {
   // number_t std_rho = std::max(fabs(rho - rho_min), fabs(rho - rho_max));
 
   P_ << std_xyz(0), 0, 0, 0, std_xyz(1), 0, 0, 0, std_xyz(2);
+  if (param != kDefaultDepthParam) {
+    // first order, as SetDepthParam
+    P_(2, 2) *= param == DepthParam::INVERSE ? 1.0 / z0 : z0;
+  }
   P_ *= P_;
   status_ = FeatureStatus::INITIALIZING;
 }
@@ -315,7 +343,9 @@ bool Feature::RefineDepth(const SE3 &gbc,
     // std::cout << "H.inv=\n" << H.inverse() << std::endl;
     // std::cout << "P=\n" << P_ << std::endl;
 
-  if (options.use_hessian) {
+  correlated_init_ =
+      options.correlated_init && LinearizeInit(gbc, views, options.Rtri);
+  if (!correlated_init_ && options.use_hessian) {
     // auto Hinv = H.inverse();
     // Pseudo-Inverse, since H is rank 2 (3x2 matrix times 2x2 matrix times 2x3 matrix)
     Mat3 H_pinv{H.completeOrthogonalDecomposition().pseudoInverse()};
@@ -324,131 +354,88 @@ bool Feature::RefineDepth(const SE3 &gbc,
       return false;
     }
     P_ = H_pinv;
+  }
+  return true;
+}
 
-#ifdef APPROXIMATE_INIT_COVARIANCE
-    // std::cout << "approximating covariance using inverse of Hessian" << std::endl;
-    // compute correlation blocks
-    Mat3 dXc_dx;
-    Vec3 Xc = this->Xc(&dXc_dx);
-
-    SO3 Rr{ref_->gsb().R()};
-    Vec3 Tr{ref_->gsb().T()};
-
-    SO3 Rbc{gbc.R()};
-    Vec3 Tbc{gbc.T()};
-
-    // total rotation & translation w.r.t. body pose and alignment
-    Mat3 dWtot_dWr, dWtot_dWbc;
-    Mat3 dTtot_dWr, dTtot_dTr, dTtot_dTbc;
-    // compose and compute the Jacobians
-    auto [Rtot, Ttot] = Compose(Rr, Tr, Rbc, Tbc,
-        &dWtot_dWr, &dWtot_dWbc,
-        &dTtot_dWr, &dTtot_dTr, &dTtot_dTbc);
-    // 3D point in spatial frame (Xs) w.r.t. total rotation & translation, and 3D point in camera frame (Xc)
-    Mat3 dXs_dWtot, dXs_dTtot, dXs_dXc;
-    auto Xs = Transform(Rtot, Ttot, Xc, &dXs_dWtot, &dXs_dTtot, &dXs_dXc);
-
-    Mat3 dXs_dWr{dXs_dWtot * dWtot_dWr + dXs_dTtot * dTtot_dWr};
-    Mat3 dXs_dTr{dXs_dTtot * dTtot_dTr};
-    Mat3 dXs_dWbc{dXs_dWtot * dWtot_dWbc}; //  + dXs_dTtot * dTtot_dWbc};
-    Mat3 dXs_dTbc{dXs_dTtot * dTtot_dTbc};
-    Mat3 dXs_dx{dXs_dXc * dXc_dx};
-
-    // allocate Jacobian matrices
-    Eigen::Matrix<number_t, 2, kFeatureSize> Hx;  // dxp_dx
-    Eigen::Matrix<number_t, 2, kGroupSize> Hc;  // dxp_d[Wbc, Tbc]
-    Eigen::Matrix<number_t, 2, kGroupSize> Hr;  // dxp_d[Wr, Tr]
-    Eigen::Matrix<number_t, 2, kGroupSize> Hg;  // dxp_d[Wbs, Tbs]
-    Eigen::Matrix<number_t, 2, -1> Hstack;  // Jacobian stack: [Hx, Hc, Hr, Hg]
-    Hstack.setZero(2, kFeatureSize + kGroupSize * 3);
-    // allocate information matrices
-    // Note: Ix, Ic and Ir should be accumulated
-    MatX Ixcr;  // information matrix of [x, camera-body-alignment, reference group pose]
-    Ixcr.setZero(kFeatureSize + kGroupSize * 2, kFeatureSize + kGroupSize * 2);
+bool Feature::LinearizeInit(const SE3 &gbc, const std::vector<Obs> &obs,
+                            number_t Rtri) {
+  init_jac_.clear();
+  init_jac_c_.setZero();
 
-    for (const auto &obs : views) {
-      Group* g{obs.g};
-      if (g->id() == ref_->id() || !g->instate())
-        continue;
-      // Feeling too lasy to derive the Jacobians on paper,
-      // so I'm gonna use chain rule to compute them.
-      SO3 Rsb{g->gsb().R()};
-      Vec3 Tsb{g->gsb().T()};
-      // compute the total transformation from spatial frame to new camera frame
-      Mat3 dWi_dWsb, dWi_dWbc; 
-      Mat3 dTi_dWsb, dTi_dTsb, dTi_dTbc;
-      // [Ri, Ti] = spatial to camera transformation
-      auto [Ri, Ti] = InverseOfCompose(Rsb, Tsb,
-          Rbc, Tbc,
-          &dWi_dWsb, &dWi_dWbc, 
-          &dTi_dWsb, &dTi_dTsb, &dTi_dTbc);
-
-      // transfrom from spatial frame to new camera frame
-      Mat3 dXcn_dWi, dXcn_dTi, dXcn_dXs;
-      Vec3 Xcn = Transform(Ri, Ti, Xs,
-          &dXcn_dWi, &dXcn_dTi, &dXcn_dXs);
-
-      // intermediate Jacobians
-      Mat3 dXcn_dx = dXcn_dXs * dXs_dx;
-      Mat3 dXcn_dWsb = dXcn_dWi * dWi_dWsb + dXcn_dTi * dTi_dWsb;
-      Mat3 dXcn_dTsb = dXcn_dTi * dTi_dTsb;
-      Mat3 dXcn_dWbc = dXcn_dWi * dWi_dWbc + dXcn_dXs * dXs_dWbc; //  + dXcn_dTi * dTi_dWbc;
-      Mat3 dXcn_dTbc = dXcn_dTi * dTi_dTbc + dXcn_dXs * dXs_dTbc;
-      Mat3 dXcn_dWr = dXcn_dXs * dXs_dWr;
-      Mat3 dXcn_dTr = dXcn_dXs * dXs_dTr;
-
-      // perspective projection
-      Mat23 dxcn_dXcn;
-      Vec2 xcn = project(Xcn, &dxcn_dXcn);
+  Mat3 Rbc = gbc.R().matrix();
+  Vec3 Tbc = gbc.T();
+  Mat3 Rr = ref_->gsb().R().matrix();
+  Vec3 Tr = ref_->gsb().T();
 
-      // apply distortion model
-      Mat2 dxp_dxcn;
-      Vec2 xp = Camera::instance()->Project(xcn, &dxp_dxcn);
-
-      // fill-in Jacobian w.r.t. the group
-      Mat23 dxp_dXcn{dxp_dxcn * dxcn_dXcn};
-      Hg.block<2, 3>(0, 0) = dxp_dXcn * dXcn_dWsb; 
-      Hg.block<2, 3>(0, 3) = dxp_dXcn * dXcn_dTsb;
-
-      // update Jacobian w.r.t. the pose of the reference group
-      Hr.block<2, 3>(0, 0) = dxp_dXcn * dXcn_dWr;
-      Hr.block<2, 3>(0, 3) = dxp_dXcn * dXcn_dTr;
-
-      // update Jacobian w.r.t. the pose of the camera-body alignment
-      Hc.block<2, 3>(0, 0) = dxp_dXcn * dXcn_dWbc;
-      Hc.block<2, 3>(0, 3) = dxp_dXcn * dXcn_dTbc;
-
-      // update Jacobian w.r.t. local parametrization of the feature
-      Hx = dxp_dXcn * dXcn_dx;
-      Hstack << Hx, Hc, Hr, Hg;
-      // std::cout << "Hstack=\n" << Hstack << std::endl;
-      auto I = Hstack.transpose() * invC * Hstack;  // hessian as information matrix
-      auto P = I.completeOrthogonalDecomposition().pseudoInverse(); // info mat -> cov mat
-      // accumulate the top left corner of the info mat
-      Ixcr += I.topLeftCorner(kFeatureSize + kGroupSize * 2, kFeatureSize + kGroupSize * 2);
-      // keep the covariance block between feature state and group state
-      int g_offset = kGroupBegin + kGroupSize * g->sind();
-      cov_[g_offset] = P.block<kFeatureSize, kGroupSize>(0, kFeatureSize + kGroupSize * 2);
+  // the point in the spatial frame and its derivatives w.r.t. the feature
+  // state, the reference group and the alignment, with R * exp(W), T + dT
+  Mat3 dXc_dx;
+  Vec3 Xc = this->Xc(&dXc_dx);
+  Vec3 Xb = Rbc * Xc + Tbc;
+  Vec3 Xs = Rr * Xb + Tr;
+  Mat3 dXs_dx = Rr * Rbc * dXc_dx;
+  InitJacobian dXs_dr, dXs_dc;
+  dXs_dr << -Rr * hat(Xb), Mat3::Identity();
+  dXs_dc << -Rr * Rbc * hat(Xc), Rr;
+
+  // normal equations: Hxx = H_x' H_x and H_x' H_k of each state block k
+  Mat3 Hxx = Mat3::Zero();
+  InitJacobian Hxr = InitJacobian::Zero(), Hxc = InitJacobian::Zero();
+  for (const auto &o : obs) {
+    if (o.g->id() == ref_->id()) {
+      // the reference view measures the first two components of x only
+      Mat2 dxp_dxc;
+      Camera::instance()->Project(x_.head<2>(), &dxp_dxc);
+      Mat23 Hx = Mat23::Zero();
+      Hx.leftCols<2>() = dxp_dxc;
+      Hxx += Hx.transpose() * Hx;
+      continue;
     }
-    // convert info mat to cov mat
-    auto P = Ixcr.completeOrthogonalDecomposition().pseudoInverse();
-    cov_xc_ = P.block<kFeatureSize, kGroupSize>(0, kFeatureSize);
-    cov_xr_ = P.block<kFeatureSize, kGroupSize>(0, kFeatureSize + kGroupSize);
-
-    if (!P.isZero(0)) {
-      std::cout << "P=\n" << P << std::endl;
-      std::cout << "cov_xc=\n" << cov_xc_ << std::endl;
-      std::cout << "cov_xr=\n" << cov_xr_ << std::endl;
+    Mat3 Rg = o.g->gsb().R().matrix();
+    Vec3 Tg = o.g->gsb().T();
+    Vec3 Xg = Rg.transpose() * (Xs - Tg); // in the body frame of the view
+    Vec3 Xcn = Rbc.transpose() * (Xg - Tbc);
+
+    Mat23 dxcn_dXcn;
+    Vec2 xcn = project(Xcn, &dxcn_dXcn);
+    Mat2 dxp_dxcn;
+    Camera::instance()->Project(xcn, &dxp_dxcn);
+    Mat23 dxp_dXs = dxp_dxcn * dxcn_dXcn * Rbc.transpose() * Rg.transpose();
+
+    Mat23 Hx = dxp_dXs * dXs_dx;
+    Eigen::Matrix<number_t, 2, kGroupSize> Hr = dxp_dXs * dXs_dr, Hc, Hg;
+    Hc << dxp_dxcn * dxcn_dXcn * hat(Xcn), -dxp_dxcn * dxcn_dXcn * Rbc.transpose();
+    Hc += dxp_dXs * dXs_dc;
+    Hxx += Hx.transpose() * Hx;
+    Hxr += Hx.transpose() * Hr;
+    Hxc += Hx.transpose() * Hc;
+    if (o.g->instate()) {
+      Hg << dxp_dxcn * dxcn_dXcn * Rbc.transpose() * hat(Xg),
+          -dxp_dXs;
+      init_jac_.emplace_back(o.g, Hx.transpose() * Hg);
     }
-#endif
   }
+
+  Eigen::LDLT<Mat3> ldlt(Hxx);
+  if (ldlt.info() != Eigen::Success || !ldlt.isPositive() ||
+      ldlt.vectorD().minCoeff() <= 1e-9 * ldlt.vectorD().maxCoeff()) {
+    init_jac_.clear();
+    return false;
+  }
+  for (auto &[g, A] : init_jac_) {
+    A = -ldlt.solve(A);
+  }
+  init_jac_.emplace_back(ref_, -ldlt.solve(Hxr));
+  init_jac_c_ = -ldlt.solve(Hxc);
+  P_ = Rtri * ldlt.solve(Mat3::Identity());
   return true;
 }
 
 void Feature::ComputeJacobian(const Mat3 &Rsb, const Vec3 &Tsb, const Mat3 &Rbc,
                               const Vec3 &Tbc, const Vec3 &gyro, const Mat3 &Cg,
                               const Vec3 &bg, const Vec3 &Vsb, number_t td,
-                              const VecX &error_state) {
+                              number_t tr, const VecX &error_state) {
 
   Mat3 Rsb_t = Rsb.transpose();
   Mat3 Rbc_t = Rbc.transpose();
@@ -516,11 +503,21 @@ void Feature::ComputeJacobian(const Mat3 &Rsb, const Vec3 &Tsb, const Mat3 &Rbc,
   cache_.dXcn_dTr = cache_.dXcn_dXs * cache_.dXs_dTr;
 
 
-#ifdef USE_ONLINE_TEMPORAL_CALIB
+  // velocity of the point in the current camera frame
   Vec3 gyro_calib = Cg * gyro - bg;
-  cache_.dXcn_dtd =
+  Vec3 dXcn_dt =
       -Rbc_t * (hat(gyro_calib) * Rsb_t * (cache_.Xs - Tsb) + Rsb_t * Vsb);
 
+  // rolling shutter: the image timestamp refers to the middle row, and the
+  // row where the feature is observed is exposed tr * row_offset later.
+  // Move the point to that time to first order, as is done for td.
+  number_t row_offset = RowOffset(back());
+  cache_.dXcn_dtr = dXcn_dt * row_offset;
+  cache_.Xcn += tr * cache_.dXcn_dtr;
+
+#ifdef USE_ONLINE_TEMPORAL_CALIB
+  cache_.dXcn_dtd = dXcn_dt;
+
   // since imu.Cg is used here, also need to compute jacobian block w.r.t. Cg
   auto dXcn_dW =
       dAB_dB<3, 1>(Rbc_t * hat(Rsb_t * (cache_.Xs - Tsb)) * td); // W=Cg * Wm
@@ -534,6 +531,11 @@ void Feature::ComputeJacobian(const Mat3 &Rsb, const Vec3 &Tsb, const Mat3 &Rbc,
   cache_.dXcn_dbg = -dXcn_dW;
 #endif
 
+#ifdef USE_BEARING_MEASUREMENT
+  // tangent-plane error on the unit sphere at the measured bearing, which
+  // takes the camera model out of the jacobians
+  cache_.xp = project_tangent(cache_.Xcn, bearing(), &cache_.dxp_dXcn);
+#else
   // xc(new)
   cache_.xcn = project(cache_.Xcn, &cache_.dxcn_dXcn);
 
@@ -545,6 +547,7 @@ void Feature::ComputeJacobian(const Mat3 &Rsb, const Vec3 &Tsb, const Mat3 &Rbc,
 #endif
 
   cache_.dxp_dXcn = cache_.dxp_dxcn * cache_.dxcn_dXcn;
+#endif
 
   // set jacobians
   J_.setZero();
@@ -559,6 +562,9 @@ void Feature::ComputeJacobian(const Mat3 &Rsb, const Vec3 &Tsb, const Mat3 &Rbc,
 #endif
   J_.block<2, 3>(0, Index::bg) = cache_.dxp_dXcn * cache_.dXcn_dbg;
 #endif
+#ifdef USE_ONLINE_ROLLING_SHUTTER_CALIB
+  J_.block<2, 1>(0, Index::tr) = cache_.dxp_dXcn * cache_.dXcn_dtr;
+#endif
 
 #ifndef NDEBUG
   CHECK(ref_->sind() != -1);
@@ -571,14 +577,18 @@ void Feature::ComputeJacobian(const Mat3 &Rsb, const Vec3 &Tsb, const Mat3 &Rbc,
   J_.block<2, 3>(0, goff + 3) = cache_.dxp_dXcn * cache_.dXcn_dTr;
   J_.block<2, 3>(0, foff) = cache_.dxp_dXcn * cache_.dXcn_dx;
 
-#ifdef USE_ONLINE_CAMERA_CALIB
+#if defined(USE_ONLINE_CAMERA_CALIB) && !defined(USE_BEARING_MEASUREMENT)
   // fill-in jacobian w.r.t. camera intrinsics
   int dim{Camera::instance()->dim()};
   J_.block(0, kCameraBegin, 2, dim) = jacc.block(0, 0, 2, dim);
 #endif
 
   // innovation
+#ifdef USE_BEARING_MEASUREMENT
+  cache_.inn = -cache_.xp;
+#else
   cache_.inn = back() - cache_.xp;
+#endif
   inn_ = cache_.inn;
 }
 
@@ -595,6 +605,9 @@ void Feature::FillJacobianBlock(MatX &H, int offset) {
 #endif
   H.block<2, 3>(offset, Index::bg) = J_.block<2, 3>(0, Index::bg);
 #endif
+#ifdef USE_ONLINE_ROLLING_SHUTTER_CALIB
+  H.block<2, 1>(offset, Index::tr) = J_.block<2, 1>(0, Index::tr);
+#endif
 
   int goff = kGroupBegin + 6 * ref_->sind();
   int foff = kFeatureBegin + 3 * sind();
@@ -625,12 +638,7 @@ void Feature::Triangulate(const SE3 &gsb, const SE3 &gbc,
     // triangulated depth is not great
     // stick to the constant depth
   } else {
-    x_.head<2>() = Xc1.head<2>() / z;
-#ifdef USE_INVDEPTH
-    x_(2) = 1.0 / z;
-#else
-    x_(2) = log(z);
-#endif
+    x_ = Parametrize(Xc1);
   }
 }
 
@@ -643,20 +651,31 @@ void Feature::FillCovarianceBlock(MatX &P) {
   // copy local covariance obtained during initialization to state covariance
   P.block<kFeatureSize, kFeatureSize>(offset, offset) = P_;
 
-#ifdef APPROXIMATE_INIT_COVARIANCE
-  // cross correlation of featur state (x) and spatial alignment (c)
-  P.block<kFeatureSize, kGroupSize>(offset, Index::Wbc) = cov_xc_;
-  P.block<kGroupSize, kFeatureSize>(Index::Wbc, offset) = cov_xc_.transpose();
-  // cross correlation of x and reference group
-  int ref_offset = kGroupBegin + kGroupSize * ref_->sind();
-  P.block<kFeatureSize, kGroupSize>(offset, ref_offset) = cov_xr_;
-  P.block<kGroupSize, kFeatureSize>(ref_offset, offset) = cov_xr_.transpose();
-
-  for (auto [g_offset, cov] : cov_) {
-    P.block<kFeatureSize, kGroupSize>(offset, g_offset) = cov;
-    P.block<kGroupSize, kFeatureSize>(g_offset, offset) = cov.transpose();
+  if (!correlated_init_) {
+    return;
   }
-#endif
+  // x = x^ + sum_k A_k ds_k + n: cov(x, .) = sum_k A_k P(s_k, .) and
+  // cov(x, x) = P_ + sum_k cov(x, s_k) A_k'
+  auto for_each_block = [this](auto fn) {
+    fn(Index::Wbc, init_jac_c_); // followed by Tbc
+    for (const auto &[g, A] : init_jac_) {
+      // groups which left the state since are taken as known
+      if (g->instate()) {
+        fn(kGroupBegin + kGroupSize * g->sind(), A);
+      }
+    }
+  };
+  MatX cross = MatX::Zero(kFeatureSize, size);
+  for_each_block([&](int k, const InitJacobian &A) {
+    cross += A * P.block(k, 0, kGroupSize, size);
+  });
+  Mat3 Pxx = P_;
+  for_each_block([&](int k, const InitJacobian &A) {
+    Pxx += cross.middleCols<kGroupSize>(k) * A.transpose();
+  });
+  P.block(offset, 0, kFeatureSize, size) = cross;
+  P.block(0, offset, size, kFeatureSize) = cross.transpose();
+  P.block<kFeatureSize, kFeatureSize>(offset, offset) = 0.5 * (Pxx + Pxx.transpose());
 }
 
 } // xivo
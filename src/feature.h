@@ -31,27 +31,42 @@ public:
   void Reset(number_t x, number_t y) {
     clear();
     status_ = TrackStatus::CREATED;
+    quality_ = {};
+    patch_.clear();
     push_back(Vec2(x, y));
   }
 
   TrackStatus status() const { return status_; }
   void SetStatus(TrackStatus status) { status_ = status; }
+  const TrackQuality &quality() const { return quality_; }
+  void SetQuality(const TrackQuality &quality) { quality_ = quality; }
   void SetDescriptor(const cv::Mat &descriptor) { descriptor_ = descriptor; }
   void SetKeypoint(const cv::KeyPoint &keypoint) { keypoint_ = keypoint; }
   const cv::KeyPoint &keypoint() const { return keypoint_; }
   cv::KeyPoint &keypoint() { return keypoint_; }
   const cv::Mat &descriptor() const { return descriptor_; }
   cv::Mat &descriptor() { return descriptor_; }
+  /** Intensity patch of the last observation, empty unless the feature is
+   *  updated directly from the image, see `DirectUpdateOptions`. */
+  const PhotometricPatch &patch() const { return patch_; }
+  void SetPatch(PhotometricPatch patch) { patch_ = std::move(patch); }
 
 protected:
   /** CREATED, TRACKED, REJECTED, or DROPPED */
   TrackStatus status_;
 
+  /** Quality of the last observation, set by the `Tracker` */
+  TrackQuality quality_;
+
   /** OpenCV Keypoint from when this track was first detected in `Tracker::Detect()` */
   cv::KeyPoint keypoint_;
 
   /** Descriptor of the very last keypoint. */
   cv::Mat descriptor_;
+
+  /** Patch sampled around the last observation, the template of the direct
+   *  photometric update. */
+  PhotometricPatch patch_;
 };
 
 
@@ -71,7 +86,10 @@ public:
 
   /** Appends another point to vector of observations.
    *  Recall: (`Feature` << `Track` << `std::vector` */
-  void UpdateTrack(number_t x, number_t y) { emplace_back(x, y); }
+  void UpdateTrack(number_t x, number_t y) {
+    emplace_back(x, y);
+    bearing_valid_ = false;
+  }
   /** Appends another point to vector of observations.
    *  Recall: (`Feature` << `Track` << `std::vector` */
   void UpdateTrack(const Vec2 &pt) { UpdateTrack(pt(0), pt(1)); }
@@ -82,13 +100,30 @@ public:
   // The higher, the better.
   number_t score() const;
   number_t outlier_counter() const { return outlier_counter_; }
+  /** Multiplier of the measurement noise of the last observation, derived
+   *  from its track quality, and its running mean over the track. */
+  number_t noise_scale() const { return noise_scale_; }
+  number_t mean_noise_scale() const { return mean_noise_scale_; }
+  void SetNoiseScale(number_t scale) {
+    noise_scale_ = scale;
+    mean_noise_scale_ += (scale - mean_noise_scale_) / size();
+  }
   /**
    * Gets actual depth of feature from variable `x_` (calculation is different
-   * depending on whether or not we're using an inverse-depth or log-depth
-   * parameterization).
+   * depending on whether the feature uses an inverse-depth or log-depth
+   * parameterization, see `depth_param()`).
    * \todo Ensure depth is positive when using inverse-depth parameterization,
    *       which is guaranteed when using log-depth paramterization. */
   number_t z() const;
+  DepthParam depth_param() const { return depth_param_; }
+  /** Changes the parametrization of the depth, transforming the covariance
+   *  through the Jacobian of the change: the rows and columns of the feature
+   *  in the state covariance `P` if instate, else the local covariance and
+   *  the initialization Jacobians. */
+  void SetDepthParam(DepthParam param, MatX &P);
+  /** Projection of the point `Xc` in the reference camera to the state of
+   *  the feature under its parametrization; the inverse of `Xc()`. */
+  Vec3 Parametrize(const Vec3 &Xc, Mat3 *dx_dXc = nullptr) const;
   const Vec3 &x() const { return x_; }
   const Mat3 &P() const { return P_; }
   Vec3 &x() { return x_; }
@@ -102,22 +137,49 @@ public:
   const Vec3& Xs() const { return Xs_; }
 
   // return (2M-3) as the dimension of the measurement
-  /** Computes the Jacobian for the in-state (EKF) measurement model. */
+  /** Computes the Jacobian for the in-state (EKF) measurement model.
+   *  `tr` is the rolling shutter line readout time (0 for global shutter). */
   void ComputeJacobian(const Mat3 &Rsb, const Vec3 &Tsb, const Mat3 &Rbc,
                        const Vec3 &Tbc, const Vec3 &gyro, const Mat3 &Cg,
                        const Vec3 &bg, const Vec3 &Vsb, number_t td,
-                       const VecX &error_state);
+                       number_t tr, const VecX &error_state);
 
   int oos_inn_size() const { return oos_jac_counter_; }
 
-  /** Computes the Jacobian for the out-of-state (MSCKF) measurement model. */
+  /** Computes the Jacobian for the out-of-state (MSCKF) measurement model,
+   *  with a subset of the in-state observations if the estimator limits
+   *  their number, see `SelectViews`. */
   int ComputeOOSJacobian(const std::vector<Obs> &obs, const Mat3 &Rbc,
-                         const Vec3 &Tbc, const VecX &error_state);
+                         const Vec3 &Tbc, number_t tr,
+                         const VecX &error_state);
   /** Contains the equations used in `Feature::ComputeOOSJacobian` for each
    *  observation.
    *  \todo make the following private */
   void ComputeOOSJacobianInternal(const Obs &obs, const Mat3 &Rbc,
-                                  const Vec3 &Tbc, const VecX &error_state);
+                                  const Vec3 &Tbc, number_t tr,
+                                  const VecX &error_state);
+
+  /** Computes epipolar (two-view) and three-view constraints among the
+   *  in-state poses observing the feature, which need no 3D point. The
+   *  whitened constraints and their Jacobians are stored in place of the OOS
+   *  Jacobians, see `ro()` and `Ho()`. Returns the number of constraints. */
+  int ComputeStructurelessJacobian(const std::vector<Obs> &obs,
+                                   const Mat3 &Rbc, const Vec3 &Tbc,
+                                   const StructurelessOptions &options);
+  /** Largest angle, in radians, between the bearing of the first in-state
+   *  observation and those of the others, with rotation compensated. */
+  static number_t Parallax(const std::vector<Obs> &obs, const Mat3 &Rbc);
+  /** Indices, in increasing order, of up to `k` of the views of a point at
+   *  `Xs` from the camera centers `centers`, spread for parallax: the first
+   *  and the last view, then repeatedly the view whose ray to the point is
+   *  the farthest, in angle, from the rays of the views selected so far. */
+  static std::vector<int> SelectViews(const Vec3 &Xs,
+                                      const std::vector<Vec3> &centers, int k);
+  /** Up to `k` of the observations `obs`, in any order, of a point at `Xs`,
+   *  selected as above in the order the groups were created, i.e., of their
+   *  ids. `Tbc` locates the camera in the body frame. */
+  static std::vector<Obs> SelectViews(const Vec3 &Xs, std::vector<Obs> obs,
+                                      const Vec3 &Tbc, int k);
 
   // fill-in the corresponding jacobian block
   // H: the big jacobian matrix of all measurements
@@ -129,9 +191,31 @@ public:
 
   const Eigen::Matrix<number_t, 2, kFullSize> &J() const { return J_; }
   const Vec2 &inn() const { return inn_; }
+  /** Replaces the reprojection measurement set by `ComputeJacobian` with the
+   *  photometric one of the direct update, `Lt * (xp - pred) = r`, where the
+   *  last measurement `xp` is the point the patch alignment was linearized at,
+   *  see `PhotometricResidual`. */
+  void SetPhotometricMeasurement(const Mat2 &Lt, const Vec2 &r) {
+    J_ = Lt * J_;
+    inn_ = r + Lt * inn_;
+  }
+  /** Moves the last measurement to pixel `xp`. */
+  void CorrectTrack(const Vec2 &xp) {
+    back() = xp;
+    bearing_valid_ = false;
+  }
 
   /** Gets the last measurement (from the `Tracker`) of this feature */
   const Vec2 &xp() const { return back(); }
+  /** Unit bearing of the last measurement in the camera frame. The camera
+   *  model is undistorted once per measurement. */
+  const Vec3 &bearing() {
+    if (!bearing_valid_) {
+      bearing_ = Camera::instance()->UnProjectBearing(back());
+      bearing_valid_ = true;
+    }
+    return bearing_;
+  }
   /** Returns the last-computed predicted measurement
    *  (does not compute a new prediction) */
   const Vec2 &pred() const { return pred_; }
@@ -142,6 +226,11 @@ public:
     pred_ = Camera::instance()->Project(project(Xc));
     return pred_;
   }
+  /** Offset, in rows, of pixel `xp` from the middle row of the image, which
+   *  is the row the image timestamp refers to for rolling shutter cameras. */
+  static number_t RowOffset(const Vec2 &xp) {
+    return xp(1) - 0.5 * Camera::instance()->rows();
+  }
   /** Sets variable `pred_`, the last computed predicted measurement to (-1,-1),
    *  the default "invalid" value for a predicted measurement. */
   void ResetPred() { pred_ << -1, -1; }
@@ -152,7 +241,11 @@ public:
   VecX ro() const { return oos_.inn.head(oos_jac_counter_); }
   MatX Ho() const { return oos_.Hx.topRows(oos_jac_counter_); }
 
-  void Initialize(number_t z0, const Vec3 &std_xyz);
+  /** Initializes the depth to `z0` in parametrization `param`. `std_xyz` is
+   *  the standard deviation of the state in `kDefaultDepthParam`, and is
+   *  transformed to `param` at `z0`. */
+  void Initialize(number_t z0, const Vec3 &std_xyz,
+                  DepthParam param = kDefaultDepthParam);
 
   FeatureStatus status() const { return status_; }
   void SetStatus(FeatureStatus status) { status_ = status; }
@@ -177,6 +270,25 @@ public:
                        const SubfilterOptions &options);
   bool RefineDepth(const SE3 &gbc, const std::vector<Obs> &obs,
                    const RefinementOptions &options);
+  /** Linearizes the refined state as a function of the states it was refined
+   *  from: the poses of the reference group and of the other in-state groups
+   *  observing the feature, and the camera-body alignment. With the
+   *  observations of variance `Rtri` stacked as H_x dx + sum_k H_k ds_k,
+   *  marginalizing them gives
+   *    x = x^ + sum_k A_k ds_k + n, A_k = -(H_x' H_x)^-1 H_x' H_k,
+   *  with n ~ N(0, Rtri (H_x' H_x)^-1), which becomes the covariance P() of
+   *  the feature. `FillCovarianceBlock` then writes the cross-covariances
+   *  A P(s, :) into the state covariance. Returns false, leaving the feature
+   *  uncorrelated, if H_x' H_x is singular. */
+  bool LinearizeInit(const SE3 &gbc, const std::vector<Obs> &obs,
+                     number_t Rtri);
+  /** Leaves the feature uncorrelated, as if `LinearizeInit` failed, e.g.,
+   *  when the groups of an earlier linearization may have been removed. */
+  void ResetInitJacobian() {
+    correlated_init_ = false;
+    init_jac_.clear();
+    init_jac_c_.setZero();
+  }
   // triangulate the 3D point from the reference and another view
   void Triangulate(const SE3 &gsb, const SE3 &gbc,
                    const TriangulateOptions &options);
@@ -222,9 +334,10 @@ private:
 
   /** Projected state: Let (X, Y, Z) be the coordinates of the feature in 3D
    *  space with respect to the current camera frame. Then, this variable
-   *  contains the vector (X/Z, Y/Z, log(Z)) or (X/Z, Y/Z, 1/Z) when compiling
-   *  with `#USE_INVDEPTH` */
+   *  contains the vector (X/Z, Y/Z, log(Z)) or (X/Z, Y/Z, 1/Z), depending on
+   *  `depth_param_` */
   Vec3 x_;
+  DepthParam depth_param_;
 
   /** "Backup" of `Feature::x_` used in `Estimator::OnePointRANSAC` */
   Vec3 x0_;
@@ -248,6 +361,10 @@ private:
   /** `xp` - predicted observation used in the filter for this particular feature. */
   Vec2 inn_;
 
+  /** Cached unit bearing of the last measurement, see `bearing()` */
+  Vec3 bearing_;
+  bool bearing_valid_;
+
   /** Measurement model Jacobian with respect to the error state used in the filter. */
   Mat23 Hx_;
 
@@ -256,6 +373,9 @@ private:
   bool inlier_;
   number_t outlier_counter_;
 
+  // measurement noise multipliers, see `noise_scale()`
+  number_t noise_scale_, mean_noise_scale_;
+
   /** Contains current intermediate variables used to compute the Jacobians in both the
    *  EKF and MSCKF measurement models. */
   static JacobianCache cache_;
@@ -266,13 +386,14 @@ private:
   /** Number of measurements in the MSCKF measurement update. */
   int oos_jac_counter_;
 
-#ifdef APPROXIMATE_INIT_COVARIANCE
-  // correlation block between local feature state (x) and group pose
-  std::unordered_map<int, Eigen::Matrix<number_t, kFeatureSize, kGroupSize>> cov_;
-  // correlation block between local feature state (x) and camera-body alignment (c),
-  // and reference group (r)
-  Eigen::Matrix<number_t, kFeatureSize, kGroupSize> cov_xc_, cov_xr_;
-#endif
+  // dependence of the feature state on the groups (A_g) and the camera-body
+  // alignment (A_c) it was refined from, see LinearizeInit
+  using InitJacobian = Eigen::Matrix<number_t, kFeatureSize, kGroupSize>;
+  bool correlated_init_;
+  std::vector<std::pair<GroupPtr, InitJacobian>,
+              Eigen::aligned_allocator<std::pair<GroupPtr, InitJacobian>>>
+      init_jac_;
+  InitJacobian init_jac_c_;
 
 
 public:
@@ -0,0 +1,355 @@
+#include <bitset>
+#include <cmath>
+#include <random>
+#include <unordered_map>
+
+#include "glog/logging.h"
+#include "opencv2/calib3d/calib3d.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "camera_manager.h"
+#include "fiducial.h"
+#include "rodrigues.h"
+
+namespace xivo {
+
+static int HammingDistance(uint64_t a, uint64_t b) {
+  return std::bitset<64>(a ^ b).count();
+}
+
+uint64_t RotateCode(uint64_t code, int bits) {
+  uint64_t out{0};
+  for (int r = 0; r < bits; ++r) {
+    for (int c = 0; c < bits; ++c) {
+      // new(r, c) = old(bits-1-c, r)
+      if (code >> ((bits - 1 - c) * bits + r) & 1) {
+        out |= uint64_t{1} << (r * bits + c);
+      }
+    }
+  }
+  return out;
+}
+
+////////////////////////////////////////
+// tag family
+////////////////////////////////////////
+TagFamily::TagFamily(int bits, int count, int min_distance, uint32_t seed)
+    : bits_{bits} {
+  CHECK(bits >= 3 && bits <= 8) << "tags of 3x3 to 8x8 cells are supported";
+  uint64_t mask = bits * bits == 64 ? ~uint64_t{0}
+                                    : (uint64_t{1} << (bits * bits)) - 1;
+  std::mt19937_64 rng(seed);
+  for (int attempt = 0; attempt < 1000000 && codes_.size() < count;
+       ++attempt) {
+    uint64_t code = rng() & mask;
+    // a code must not look like one of its own rotations
+    bool ok{true};
+    uint64_t rotated{code};
+    for (int k = 1; k < 4 && ok; ++k) {
+      rotated = RotateCode(rotated, bits);
+      ok = HammingDistance(code, rotated) >= min_distance;
+    }
+    for (int i = 0; i < codes_.size() && ok; ++i) {
+      rotated = codes_[i];
+      for (int k = 0; k < 4 && ok; ++k) {
+        ok = HammingDistance(code, rotated) >= min_distance;
+        rotated = RotateCode(rotated, bits);
+      }
+    }
+    if (ok) {
+      codes_.push_back(code);
+    }
+  }
+  CHECK(codes_.size() == count)
+      << "failed to draw " << count << " tags of " << bits << "x" << bits
+      << " cells with minimal distance " << min_distance;
+}
+
+int TagFamily::Decode(uint64_t code, int max_errors, int *rotation,
+                      int *errors) const {
+  int best_id{-1}, best_rotation{0}, best_errors{max_errors + 1};
+  for (int i = 0; i < codes_.size(); ++i) {
+    uint64_t rotated{codes_[i]};
+    for (int k = 0; k < 4; ++k) {
+      if (int d = HammingDistance(code, rotated); d < best_errors) {
+        best_id = i;
+        best_rotation = k;
+        best_errors = d;
+      }
+      rotated = RotateCode(rotated, bits_);
+    }
+  }
+  if (rotation) {
+    *rotation = best_rotation;
+  }
+  if (errors) {
+    *errors = best_errors;
+  }
+  return best_id;
+}
+
+cv::Mat TagFamily::Render(int id, int cell) const {
+  int m = bits_ + 4; // cells across, including the border and the margin
+  cv::Mat img(m * cell, m * cell, CV_8UC1, cv::Scalar(255));
+  img(cv::Rect(cell, cell, (m - 2) * cell, (m - 2) * cell)).setTo(0);
+  for (int r = 0; r < bits_; ++r) {
+    for (int c = 0; c < bits_; ++c) {
+      if (codes_[id] >> (r * bits_ + c) & 1) {
+        img(cv::Rect((c + 2) * cell, (r + 2) * cell, cell, cell)).setTo(255);
+      }
+    }
+  }
+  return img;
+}
+
+Vec3 TagCorner(int i, number_t size) {
+  static const number_t sx[4] = {-0.5, 0.5, 0.5, -0.5};
+  static const number_t sy[4] = {-0.5, -0.5, 0.5, 0.5};
+  return Vec3{sx[i] * size, sy[i] * size, 0};
+}
+
+////////////////////////////////////////
+// detector
+////////////////////////////////////////
+TagDetector::TagDetector(const Json::Value &cfg)
+    : family_{cfg["family"].get("bits", 5).asInt(),
+              cfg["family"].get("count", 32).asInt(),
+              cfg["family"].get("min_distance", 6).asInt()},
+      max_errors_{cfg.get("max_errors", 2).asInt()},
+      detect_level_{cfg.get("detect_level", 1).asInt()},
+      min_perimeter_{cfg.get("min_perimeter", 80).asDouble()},
+      min_contrast_{cfg.get("min_contrast", 20).asDouble()} {
+  int min_distance = cfg["family"].get("min_distance", 6).asInt();
+  if (2 * max_errors_ >= min_distance) {
+    max_errors_ = (min_distance - 1) / 2;
+    LOG(WARNING) << "tag max_errors reduced to " << max_errors_
+                 << " to keep decoding unambiguous";
+  }
+}
+
+// bilinear interpolation, negative outside the image
+static number_t Interpolate(const cv::Mat &img, number_t x, number_t y) {
+  int x0 = std::floor(x), y0 = std::floor(y);
+  if (x0 < 0 || y0 < 0 || x0 + 1 >= img.cols || y0 + 1 >= img.rows) {
+    return -1;
+  }
+  number_t ax = x - x0, ay = y - y0;
+  return (1 - ay) * ((1 - ax) * img.at<uint8_t>(y0, x0) +
+                     ax * img.at<uint8_t>(y0, x0 + 1)) +
+         ay * ((1 - ax) * img.at<uint8_t>(y0 + 1, x0) +
+               ax * img.at<uint8_t>(y0 + 1, x0 + 1));
+}
+
+int TagDetector::ReadCode(const cv::Mat &img, const std::array<Vec2, 4> &quad,
+                          int *rotation, int *errors) const {
+  int n = family_.bits();
+  int m = n + 2; // cells across the black square
+  std::vector<cv::Point2f> src{{0.f, 0.f},
+                               {float(m), 0.f},
+                               {float(m), float(m)},
+                               {0.f, float(m)}};
+  std::vector<cv::Point2f> dst;
+  for (const auto &x : quad) {
+    dst.emplace_back(x(0), x(1));
+  }
+  cv::Mat H = cv::getPerspectiveTransform(src, dst);
+
+  // average of a few samples around the center of cell (r, c); the cells
+  // r, c = -1 and m belong to the white margin
+  auto cell = [&](int r, int c) -> number_t {
+    number_t sum{0};
+    for (number_t dv : {-0.2, 0.0, 0.2}) {
+      for (number_t du : {-0.2, 0.0, 0.2}) {
+        number_t u = c + 0.5 + du, v = r + 0.5 + dv;
+        number_t w = H.at<double>(2, 0) * u + H.at<double>(2, 1) * v +
+                     H.at<double>(2, 2);
+        number_t x = (H.at<double>(0, 0) * u + H.at<double>(0, 1) * v +
+                      H.at<double>(0, 2)) / w;
+        number_t y = (H.at<double>(1, 0) * u + H.at<double>(1, 1) * v +
+                      H.at<double>(1, 2)) / w;
+        number_t val = Interpolate(img, x, y);
+        if (val < 0) {
+          return -1;
+        }
+        sum += val;
+      }
+    }
+    return sum / 9;
+  };
+
+  // intensities of the margin and the border set the threshold
+  std::vector<number_t> border;
+  number_t white{0}, black{0};
+  for (int i = -1; i <= m; ++i) {
+    for (int j = -1; j <= m; ++j) {
+      bool on_margin = i == -1 || i == m || j == -1 || j == m;
+      bool on_border = !on_margin && (i == 0 || i == m - 1 || j == 0 || j == m - 1);
+      if (!on_margin && !on_border) {
+        continue;
+      }
+      number_t val = cell(i, j);
+      if (val < 0) {
+        return -1;
+      }
+      if (on_margin) {
+        white += val;
+      } else {
+        black += val;
+        border.push_back(val);
+      }
+    }
+  }
+  white /= 4 * (m + 1);
+  black /= border.size();
+  if (white - black < min_contrast_) {
+    return -1;
+  }
+  number_t thresh = 0.5 * (white + black);
+  for (number_t val : border) {
+    if (val > thresh) {
+      return -1;
+    }
+  }
+
+  uint64_t code{0};
+  for (int r = 0; r < n; ++r) {
+    for (int c = 0; c < n; ++c) {
+      number_t val = cell(r + 1, c + 1);
+      if (val < 0) {
+        return -1;
+      }
+      if (val > thresh) {
+        code |= uint64_t{1} << (r * n + c);
+      }
+    }
+  }
+  return family_.Decode(code, max_errors_, rotation, errors);
+}
+
+TagDetections TagDetector::Detect(const cv::Mat &img) const {
+  cv::Mat coarse = img;
+  for (int i = 0; i < detect_level_; ++i) {
+    cv::pyrDown(coarse, coarse);
+  }
+  return Detect(img, coarse, detect_level_);
+}
+
+TagDetections TagDetector::Detect(const cv::Mat &img, const cv::Mat &coarse,
+                                  int level) const {
+  number_t scale = 1 << level;
+
+  cv::Mat bin;
+  cv::adaptiveThreshold(coarse, bin, 255, cv::ADAPTIVE_THRESH_MEAN_C,
+                        cv::THRESH_BINARY_INV, 15, 7);
+  std::vector<std::vector<cv::Point>> contours;
+  cv::findContours(bin, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+
+  std::unordered_map<int, int> found; // id -> index in out
+  TagDetections out;
+  for (const auto &contour : contours) {
+    number_t perimeter = cv::arcLength(contour, true);
+    if (contour.size() < 4 || perimeter * scale < min_perimeter_) {
+      continue;
+    }
+    std::vector<cv::Point> poly;
+    cv::approxPolyDP(contour, poly, 0.05 * perimeter, true);
+    if (poly.size() != 4 || !cv::isContourConvex(poly)) {
+      continue;
+    }
+
+    // corners at full resolution, clockwise in the image
+    std::vector<cv::Point2f> corners;
+    number_t area{0}, min_side{perimeter};
+    for (int i = 0; i < 4; ++i) {
+      const auto &p = poly[i], &q = poly[(i + 1) % 4];
+      area += p.x * q.y - q.x * p.y;
+      min_side = std::min<number_t>(min_side, cv::norm(q - p));
+      corners.emplace_back((p.x + 0.5) * scale - 0.5,
+                           (p.y + 0.5) * scale - 0.5);
+    }
+    if (min_side < perimeter / 16) {
+      continue;
+    }
+    if (area < 0) {
+      std::swap(corners[1], corners[3]);
+    }
+    // refine on the full image within about half a cell
+    int win = std::clamp<int>(
+        min_side * scale / (family_.bits() + 2) / 2, 2, 10);
+    cv::cornerSubPix(img, corners, cv::Size(win, win), cv::Size(-1, -1),
+                     cv::TermCriteria(cv::TermCriteria::EPS +
+                                          cv::TermCriteria::COUNT,
+                                      20, 0.01));
+
+    std::array<Vec2, 4> quad;
+    for (int i = 0; i < 4; ++i) {
+      quad[i] << corners[i].x, corners[i].y;
+    }
+    int rotation, errors;
+    int id = ReadCode(img, quad, &rotation, &errors);
+    if (id < 0) {
+      continue;
+    }
+
+    // turning the tag `rotation` quarters clockwise brings its top-left
+    // corner to the quad corner `rotation`
+    TagDetection det;
+    det.id = id;
+    det.errors = errors;
+    for (int i = 0; i < 4; ++i) {
+      det.xp[i] = quad[(i + rotation) % 4];
+    }
+    if (auto it = found.find(id); it == found.end()) {
+      found[id] = out.size();
+      out.push_back(det);
+    } else if (errors < out[it->second].errors) {
+      out[it->second] = det;
+    }
+  }
+  return out;
+}
+
+////////////////////////////////////////
+// geometry
+////////////////////////////////////////
+bool EstimateTagPose(const TagDetection &det, number_t size, SE3 *gct) {
+  std::vector<cv::Point3f> object_points;
+  std::vector<cv::Point2f> image_points;
+  for (int i = 0; i < 4; ++i) {
+    Vec3 Xt = TagCorner(i, size);
+    Vec2 xc = Camera::instance()->UnProject(det.xp[i]);
+    object_points.emplace_back(Xt(0), Xt(1), Xt(2));
+    image_points.emplace_back(xc(0), xc(1));
+  }
+  // normalized coordinates, hence identity intrinsics
+  cv::Mat K = cv::Mat::eye(3, 3, CV_64F);
+  cv::Mat rvec, tvec;
+  if (!cv::solvePnP(object_points, image_points, K, cv::noArray(), rvec, tvec,
+                    false, cv::SOLVEPNP_ITERATIVE)) {
+    return false;
+  }
+  *gct = SE3{SO3::exp(Vec3{rvec.at<double>(0), rvec.at<double>(1),
+                           rvec.at<double>(2)}),
+             Vec3{tvec.at<double>(0), tvec.at<double>(1), tvec.at<double>(2)}};
+  return gct->T()(2) > 0;
+}
+
+Vec3 TagPointInCamera(const SE3 &gsb, const SE3 &gbc, const SE3 &gst,
+                      const Vec3 &Xt, TagCornerJacobian *J) {
+  Vec3 Xs = gst * Xt;
+  Vec3 Xb = gsb.inv() * Xs;
+  Vec3 Xc = gbc.inv() * Xb;
+  if (J) {
+    Mat3 Rcb = gbc.R().matrix().transpose();
+    Mat3 Rcs = Rcb * gsb.R().matrix().transpose();
+    J->dXc_dWsb = Rcb * hat(Xb);
+    J->dXc_dTsb = -Rcs;
+    J->dXc_dWbc = hat(Xc);
+    J->dXc_dTbc = -Rcb;
+    J->dXc_dWst = -Rcs * gst.R().matrix() * hat(Xt);
+    J->dXc_dTst = Rcs;
+  }
+  return Xc;
+}
+
+} // namespace xivo
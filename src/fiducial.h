@@ -0,0 +1,125 @@
+// Square fiducial markers ("tags") of known size.
+//
+// A tag is a grid of n x n binary cells (white = 1) inside a black border of
+// one cell, printed on a white background. The detector looks for dark
+// quadrilaterals on a coarse level of the tracker's pyramid, refines their
+// corners on the full resolution image and reads the cells through the
+// homography of the quadrilateral. Codes come from a family generated with a
+// minimal Hamming distance between all the codes and their rotations, so a
+// few misread cells are corrected and the orientation is unambiguous.
+//
+// Tag frame: the tag lies in the plane z = 0 with its center at the origin,
+// x to the right and y down when the tag is viewed upright, such that a
+// camera facing the tag looks along +z. The side length is the one of the
+// black square.
+#pragma once
+#include <array>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "json/json.h"
+
+#include "core.h"
+
+namespace xivo {
+
+/** Rotates a code of `bits` x `bits` cells, stored row-major from the least
+ *  significant bit, by a quarter turn clockwise. */
+uint64_t RotateCode(uint64_t code, int bits);
+
+class TagFamily {
+public:
+  /** Draws `count` codes of `bits` x `bits` cells, each at least
+   *  `min_distance` bits away from all the other codes and from its own
+   *  rotations. The family only depends on the arguments. */
+  TagFamily(int bits, int count, int min_distance, uint32_t seed = 0);
+
+  int bits() const { return bits_; }
+  int size() const { return codes_.size(); }
+  uint64_t code(int id) const { return codes_[id]; }
+
+  /** Returns the id of the tag which, turned `rotation` quarters clockwise,
+   *  is within `max_errors` bits of `code`, or -1. */
+  int Decode(uint64_t code, int max_errors, int *rotation = nullptr,
+             int *errors = nullptr) const;
+
+  /** Image of tag `id` with `cell` pixels per cell and a white margin of one
+   *  cell, for printing. */
+  cv::Mat Render(int id, int cell) const;
+
+private:
+  int bits_;
+  std::vector<uint64_t> codes_;
+};
+
+struct TagDetection {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  int id;
+  std::array<Vec2, 4> xp; // pixel coordinates of the corners, see TagCorner
+  int errors;             // number of corrected cells
+};
+using TagDetections =
+    std::vector<TagDetection, Eigen::aligned_allocator<TagDetection>>;
+
+/** Corner `i` of a tag with side length `size`, in the tag frame: top-left,
+ *  top-right, bottom-right, bottom-left. */
+Vec3 TagCorner(int i, number_t size);
+
+class TagDetector {
+public:
+  /** Reads "family" {"bits", "count", "min_distance"}, "max_errors",
+   *  "detect_level", "min_perimeter", "min_contrast" from `cfg`. */
+  TagDetector(const Json::Value &cfg);
+
+  /** Detects tags in the grayscale image `img`. Quadrilaterals are searched
+   *  in `coarse`, the image downsampled `1 << level` times. */
+  TagDetections Detect(const cv::Mat &img, const cv::Mat &coarse,
+                       int level) const;
+  /** Detects tags in `img` at the pyramid level given in the configuration. */
+  TagDetections Detect(const cv::Mat &img) const;
+
+  const TagFamily &family() const { return family_; }
+  int detect_level() const { return detect_level_; }
+
+private:
+  /** Reads the code inside the quadrilateral `quad` (clockwise in the image,
+   *  full resolution). Returns the id or -1. */
+  int ReadCode(const cv::Mat &img, const std::array<Vec2, 4> &quad,
+               int *rotation, int *errors) const;
+
+  TagFamily family_;
+  int max_errors_;       // cells corrected at most
+  int detect_level_;     // pyramid level to search quadrilaterals in
+  number_t min_perimeter_; // of quadrilaterals, in pixels of the full image
+  number_t min_contrast_;  // between the white margin and the black border
+};
+
+/** A tag of known pose, either listed in the map or estimated in the state. */
+struct Tag {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  int id;
+  number_t size; // side length, meters
+  SE3 g;         // tag to spatial frame, or to the map frame for map tags
+  int sind;      // index of the state slot, -1 for map tags
+};
+
+/** Estimates the pose of a tag with side length `size` in the camera frame
+ *  from its detected corners. */
+bool EstimateTagPose(const TagDetection &det, number_t size, SE3 *gct);
+
+/** Jacobians of a tag corner in the camera frame w.r.t. the error state of
+ *  the body pose, the camera to body alignment and the tag pose, all of them
+ *  perturbed as R*exp(W), T+dT. */
+struct TagCornerJacobian {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  Mat3 dXc_dWsb, dXc_dTsb;
+  Mat3 dXc_dWbc, dXc_dTbc;
+  Mat3 dXc_dWst, dXc_dTst;
+};
+
+/** The point `Xt` of the tag at pose `gst` in the frame of the camera at
+ *  `gsb * gbc`. */
+Vec3 TagPointInCamera(const SE3 &gsb, const SE3 &gbc, const SE3 &gst,
+                      const Vec3 &Xt, TagCornerJacobian *J = nullptr);
+
+} // namespace xivo
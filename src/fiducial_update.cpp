@@ -0,0 +1,169 @@
+// Measurement update with fiducial tags: each detected tag contributes the
+// pixel coordinates of its 4 corners, predicted from the body pose, the
+// camera to body alignment and the pose of the tag, which is either known
+// from the map or estimated in the state.
+#include "glog/logging.h"
+
+#include "camera_manager.h"
+#include "estimator.h"
+#include "feature.h"
+#include "fiducial.h"
+#include "graph.h"
+#include "group.h"
+#include "project.h"
+#include "rodrigues.h"
+
+namespace xivo {
+
+void Estimator::TagUpdate(const TagDetections &detections) {
+  if (detections.empty()) {
+    return;
+  }
+
+  // the update touches every instate group & feature, including the ones
+  // created after the last visual update
+  Graph &graph{*Graph::instance()};
+  instate_groups_ =
+      graph.GetGroupsIf([](GroupPtr g) -> bool { return g->instate(); });
+  instate_features_ =
+      graph.GetFeaturesIf([](FeaturePtr f) -> bool { return f->instate(); });
+
+  number_t R = fiducial_options_.corner_std * fiducial_options_.corner_std;
+  MatX H;
+  H.setZero(8 * detections.size(), err_.size());
+  VecX inn(8 * detections.size());
+  int rows{0};
+
+  for (const auto &det : detections) {
+    SE3 gst;
+    number_t size;
+    int offset{-1}; // of the tag in the state
+    if (auto it = tag_map_.find(det.id); it != tag_map_.end()) {
+      size = it->second.size;
+      if (!tag_map_aligned_) {
+        SE3 gct;
+        if (EstimateTagPose(det, size, &gct)) {
+          gsm_ = gsc() * gct * it->second.g.inv();
+          tag_map_aligned_ = true;
+          LOG(INFO) << "map of tags aligned at tag #" << det.id;
+        }
+        continue;
+      }
+      gst = gsm_ * it->second.g;
+    } else if (auto it = tags_.find(det.id); it != tags_.end()) {
+      size = it->second.size;
+      gst = it->second.g;
+      offset = kTagBegin + kTagSize * it->second.sind;
+    } else {
+      SE3 gct;
+      if (kMaxTag > 0 && EstimateTagPose(det, fiducial_options_.size, &gct)) {
+        AddTagToState(det.id, fiducial_options_.size, gct);
+      }
+      continue;
+    }
+
+    Eigen::Matrix<number_t, 8, Eigen::Dynamic> Hd;
+    Hd.setZero(8, err_.size());
+    Eigen::Matrix<number_t, 8, 1> innd;
+    bool visible{true};
+    for (int i = 0; i < 4 && visible; ++i) {
+      TagCornerJacobian J;
+      Vec3 Xc = TagPointInCamera(gsb(), gbc(), gst, TagCorner(i, size), &J);
+      if (Xc(2) < 1e-3) {
+        visible = false;
+        break;
+      }
+      Mat23 dxc_dXc;
+      Vec2 xc = project(Xc, &dxc_dXc);
+      Mat2 dxp_dxc;
+#ifdef USE_ONLINE_CAMERA_CALIB
+      Eigen::Matrix<number_t, 2, -1> jacc;
+      Vec2 xp = Camera::instance()->Project(xc, &dxp_dxc, &jacc);
+      int dim{Camera::instance()->dim()};
+      Hd.block(2 * i, kCameraBegin, 2, dim) = jacc.block(0, 0, 2, dim);
+#else
+      Vec2 xp = Camera::instance()->Project(xc, &dxp_dxc);
+#endif
+      Mat23 dxp_dXc = dxp_dxc * dxc_dXc;
+      Hd.block<2, 3>(2 * i, Index::Wsb) = dxp_dXc * J.dXc_dWsb;
+      Hd.block<2, 3>(2 * i, Index::Tsb) = dxp_dXc * J.dXc_dTsb;
+      Hd.block<2, 3>(2 * i, Index::Wbc) = dxp_dXc * J.dXc_dWbc;
+      Hd.block<2, 3>(2 * i, Index::Tbc) = dxp_dXc * J.dXc_dTbc;
+      if (offset >= 0) {
+        Hd.block<2, 3>(2 * i, offset) = dxp_dXc * J.dXc_dWst;
+        Hd.block<2, 3>(2 * i, offset + 3) = dxp_dXc * J.dXc_dTst;
+      }
+      innd.segment<2>(2 * i) = det.xp[i] - xp;
+    }
+    if (!visible) {
+      continue;
+    }
+
+    // Mahalanobis gating of the tag as a whole
+    Eigen::Matrix<number_t, 8, 8> S = Hd * P_ * Hd.transpose();
+    S.diagonal().array() += R;
+    if (number_t chi2 = innd.dot(S.ldlt().solve(innd));
+        chi2 > fiducial_options_.MH_thresh) {
+      VLOG(0) << "tag #" << det.id << " gated, chi2=" << chi2;
+      continue;
+    }
+    H.middleRows<8>(rows) = Hd;
+    inn.segment<8>(rows) = innd;
+    rows += 8;
+  }
+  if (rows == 0) {
+    return;
+  }
+
+  H_ = H.topRows(rows);
+  inn_ = inn.head(rows);
+  diagR_.setConstant(rows, R);
+  MeasurementUpdate();
+  AbsorbError();
+  VLOG(0) << "tag update with " << rows / 8 << " tags, |inn|=" << inn_.norm();
+}
+
+void Estimator::AddTagToState(int id, number_t size, const SE3 &gct) {
+  int index;
+  for (index = 0; index < kMaxTag && tsel_[index]; ++index)
+    ;
+  if (index == kMaxTag) {
+    VLOG(0) << "no slot in state for tag #" << id;
+    return;
+  }
+  tsel_[index] = true;
+
+  // gst = gsb * gbt, linearized w.r.t. the body pose; the errors of the
+  // alignment and of the pose estimate are absorbed in the prior
+  SE3 gbt = gbc() * gct;
+  int offset = kTagBegin + kTagSize * index;
+  Eigen::Matrix<number_t, 6, Eigen::Dynamic> J;
+  J.setZero(6, err_.size());
+  J.block<3, 3>(0, Index::Wsb) = gbt.R().matrix().transpose();
+  J.block<3, 3>(3, Index::Wsb) = -X_.Rsb.matrix() * hat(gbt.T());
+  J.block<3, 3>(3, Index::Tsb).setIdentity();
+
+  Eigen::Matrix<number_t, 6, Eigen::Dynamic> JP = J * P_;
+  Mat6 Ptt = JP * J.transpose();
+  number_t std_rotation = fiducial_options_.init_std_rotation;
+  number_t std_translation = fiducial_options_.init_std_range * gct.T().norm();
+  Ptt.diagonal().head<3>().array() += std_rotation * std_rotation;
+  Ptt.diagonal().tail<3>().array() += std_translation * std_translation;
+  P_.middleRows(offset, kTagSize) = JP;
+  P_.middleCols(offset, kTagSize) = JP.transpose();
+  P_.block<kTagSize, kTagSize>(offset, offset) = Ptt;
+  err_.segment<kTagSize>(offset).setZero();
+
+  tags_[id] = {id, size, gsb() * gbt, index};
+  LOG(INFO) << "tag #" << id << " inserted @ " << index << "/" << kMaxTag;
+}
+
+std::vector<std::pair<int, SE3>> Estimator::InstateTagPoses() const {
+  std::vector<std::pair<int, SE3>> out;
+  for (const auto &[id, tag] : tags_) {
+    out.emplace_back(id, origin_ * tag.g);
+  }
+  return out;
+}
+
+} // namespace xivo
@@ -0,0 +1,180 @@
+#include "fusion.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+#include "estimator_process.h"
+
+namespace xivo {
+
+VecX CovarianceIntersection(const std::vector<VecX> &x,
+                            const std::vector<MatX> &P, VecX *xf, MatX *Pf,
+                            int max_iters) {
+  CHECK(!x.empty() && x.size() == P.size());
+  int n = x.size();
+  int d = x[0].size();
+  MatX I = MatX::Identity(d, d);
+
+  // information matrices & vectors
+  std::vector<MatX> Y(n);
+  std::vector<VecX> y(n);
+  for (int i = 0; i < n; ++i) {
+    Y[i] = P[i].ldlt().solve(I);
+    y[i] = Y[i] * x[i];
+  }
+
+  // -log det of the fused information is convex in the weights; at its
+  // minimum over the simplex, tr(M^{-1} Y_i) = d for every positive weight.
+  // The multiplicative update below stays on the simplex and decreases the
+  // determinant monotonically, as in the computation of D-optimal designs.
+  // Any weights give a consistent estimate, so stopping early is safe.
+  VecX w = VecX::Constant(n, 1.0 / n);
+  for (int iter = 0; iter < max_iters && n > 1; ++iter) {
+    MatX M = MatX::Zero(d, d);
+    for (int i = 0; i < n; ++i) {
+      M += w(i) * Y[i];
+    }
+    MatX Minv = M.ldlt().solve(I);
+    VecX w_new(n);
+    for (int i = 0; i < n; ++i) {
+      w_new(i) = w(i) * Minv.cwiseProduct(Y[i]).sum() / d;
+    }
+    w_new /= w_new.sum();
+    number_t change = (w_new - w).cwiseAbs().maxCoeff();
+    w = w_new;
+    if (change < 1e-9) {
+      break;
+    }
+  }
+
+  MatX M = MatX::Zero(d, d);
+  VecX m = VecX::Zero(d);
+  for (int i = 0; i < n; ++i) {
+    M += w(i) * Y[i];
+    m += w(i) * y[i];
+  }
+  *Pf = M.ldlt().solve(I);
+  *Pf = 0.5 * (*Pf + Pf->transpose());
+  *xf = *Pf * m;
+  return w;
+}
+
+PoseFusion::PoseFusion(int num_sources, const FusionOptions &options,
+                       Publisher *publisher)
+    : options_{options}, publisher_{publisher}, active_(num_sources, true),
+      pending_(num_sources), frames_(num_sources),
+      aligned_{!options.align_frames}, num_fused_{0},
+      weights_{VecX::Zero(num_sources)} {
+  CHECK(num_sources > 0);
+}
+
+void PoseFusion::Add(int k, const PoseEstimate &estimate) {
+  CHECK(k >= 0 && k < pending_.size());
+  if (!active_[k]) {
+    return;
+  }
+  pending_[k].push_back(estimate);
+  if (pending_[k].size() > options_.max_pending) {
+    // some source lags behind, or skips the times of this one
+    pending_[k].pop_front();
+  }
+  while (FuseOldest()) {
+  }
+}
+
+void PoseFusion::Remove(int k) {
+  CHECK(k >= 0 && k < pending_.size());
+  active_[k] = false;
+  pending_[k].clear();
+  while (FuseOldest()) {
+  }
+}
+
+bool PoseFusion::FuseOldest() {
+  // the latest of the oldest estimates of the sources
+  timestamp_t t{0};
+  std::vector<int> sources;
+  for (int k = 0; k < pending_.size(); ++k) {
+    if (active_[k]) {
+      if (pending_[k].empty()) {
+        return false;
+      }
+      t = std::max(t, pending_[k].front().ts);
+      sources.push_back(k);
+    }
+  }
+  if (sources.empty()) {
+    return false;
+  }
+
+  // older estimates have no counterpart in some source
+  timestamp_t max_dt{int64_t(options_.max_dt * 1e9)};
+  bool synced{true};
+  for (int k : sources) {
+    while (!pending_[k].empty() && pending_[k].front().ts + max_dt < t) {
+      pending_[k].pop_front();
+    }
+    if (pending_[k].empty()) {
+      return false;
+    }
+    synced = synced && pending_[k].front().ts <= t + max_dt;
+  }
+  if (!synced) {
+    // try again from the new oldest estimates
+    return true;
+  }
+
+  if (!aligned_) {
+    const SE3 &g0 = pending_[sources[0]].front().gsb;
+    for (int k : sources) {
+      frames_[k] = g0 * pending_[k].front().gsb.inv();
+    }
+    aligned_ = true;
+  }
+
+  // estimates in the frame of the first source
+  std::vector<SE3> g;
+  std::vector<MatX> P;
+  for (int k : sources) {
+    const auto &est = pending_[k].front();
+    g.push_back(frames_[k] * est.gsb);
+    // the rotation error is in the body frame, the translation error in the
+    // spatial frame
+    Mat6 C = Mat6::Identity();
+    C.block<3, 3>(3, 3) = frames_[k].R().matrix();
+    P.push_back(C * est.cov * C.transpose());
+    pending_[k].pop_front();
+  }
+
+  // linearized about the first estimate, and again about the fused one
+  SE3 gf = g[0];
+  VecX w;
+  MatX Pf;
+  for (int pass = 0; pass < 2; ++pass) {
+    std::vector<VecX> x;
+    for (const auto &gi : g) {
+      VecX xi(6);
+      xi << (gf.R().inv() * gi.R()).log(), gi.T() - gf.T();
+      x.push_back(xi);
+    }
+    VecX xf;
+    w = CovarianceIntersection(x, P, &xf, &Pf, options_.max_iters);
+    gf = SE3{gf.R() * SO3::exp(xf.head<3>()), gf.T() + xf.tail<3>()};
+  }
+
+  fused_.ts = t;
+  fused_.gsb = gf;
+  fused_.cov = Pf;
+  weights_.setZero();
+  for (int i = 0; i < sources.size(); ++i) {
+    weights_(sources[i]) = w(i);
+  }
+  ++num_fused_;
+  if (publisher_ != nullptr) {
+    publisher_->Publish(fused_.ts, fused_.gsb, fused_.cov);
+  }
+  return true;
+}
+
+} // namespace xivo
@@ -0,0 +1,78 @@
+// Fusion of the poses of independent estimators, e.g., one per camera or per
+// configuration, by covariance intersection.
+//
+// The estimators share their inputs, the IMU at least, so their errors are
+// correlated by an unknown amount, and fusing them as independent estimates
+// would be overconfident. Covariance intersection is consistent for any
+// cross-correlation: the information matrices are combined by a convex
+// combination whose weights minimize the determinant of the fused covariance.
+#pragma once
+#include <deque>
+#include <vector>
+
+#include "core.h"
+#include "options.h"
+
+namespace xivo {
+
+class Publisher;
+
+/** Covariance intersection of estimates `x[i]` of covariance `P[i]`:
+ *    Pf^{-1} = sum_i w_i P[i]^{-1},  xf = Pf sum_i w_i P[i]^{-1} x[i],
+ *  with the weights w on the simplex minimizing det(Pf), found by at most
+ *  `max_iters` multiplicative updates. Returns the weights. */
+VecX CovarianceIntersection(const std::vector<VecX> &x,
+                            const std::vector<MatX> &P, VecX *xf, MatX *Pf,
+                            int max_iters = 50);
+
+/** Pose of the body in the spatial frame with the covariance of its error
+ *  (W, T), where gsb = (Rsb * exp(W), Tsb + T), as the estimator keeps it. */
+struct PoseEstimate {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  timestamp_t ts;
+  SE3 gsb;
+  Mat6 cov;
+};
+
+/** Synchronizes the estimates of `num_sources` estimators and publishes their
+ *  covariance intersection once every active source has an estimate at the
+ *  same time. */
+class PoseFusion {
+public:
+  PoseFusion(int num_sources, const FusionOptions &options,
+             Publisher *publisher = nullptr);
+
+  /** Adds the estimate of source `k`, in the order of time. */
+  void Add(int k, const PoseEstimate &estimate);
+  /** Stops waiting for source `k`, e.g., once its estimator is done or has
+   *  failed; the others keep being fused. */
+  void Remove(int k);
+
+  /** The last fused estimate, in the frame of the first source. */
+  const PoseEstimate &fused() const { return fused_; }
+  /** Number of estimates fused so far. */
+  int num_fused() const { return num_fused_; }
+  /** Weights of the sources in the last fused estimate, 0 for inactive ones. */
+  const VecX &weights() const { return weights_; }
+
+private:
+  /** Fuses the oldest estimates of the active sources if they are in sync.
+   *  Returns false if some source has yet to catch up. */
+  bool FuseOldest();
+
+  FusionOptions options_;
+  Publisher *publisher_; // non-owned
+  std::vector<bool> active_;
+  std::vector<std::deque<PoseEstimate,
+                         Eigen::aligned_allocator<PoseEstimate>>> pending_;
+  // frame of each source to the frame of the first, fixed with the first
+  // estimates fused
+  std::vector<SE3> frames_;
+  bool aligned_;
+
+  PoseEstimate fused_;
+  int num_fused_;
+  VecX weights_;
+};
+
+} // namespace xivo
@@ -2,6 +2,7 @@
 #include "estimator.h"
 #include "feature.h"
 #include "group.h"
+#include "rodrigues.h"
 
 #ifdef USE_G2O
 #include "optimizer_adapters.h"
@@ -9,8 +10,16 @@
 
 namespace xivo {
 
-void FeatureAdj::Add(const Observation &obs) { insert({obs.g->id(), obs.xp}); }
-void FeatureAdj::Remove(int id) { erase(id); }
+void FeatureAdj::Add(const Observation &obs) {
+  insert({obs.g->id(), obs.xp});
+#ifdef USE_BEARING_MEASUREMENT
+  bearings.insert({obs.g->id(), obs.b});
+#endif
+}
+void FeatureAdj::Remove(int id) {
+  erase(id);
+  bearings.erase(id);
+}
 void GroupAdj::Add(int id) { insert(id); }
 void GroupAdj::Remove(int id) { erase(id); }
 
@@ -130,7 +139,11 @@ void Graph::AddGroupToFeature(GroupPtr g, FeaturePtr f) {
   CHECK(HasFeature(f)) << "feature #" << fid << " not exists";
   CHECK(HasGroup(g)) << "group #" << gid << " not exists";
 
+#ifdef USE_BEARING_MEASUREMENT
+  feature_adj_.at(fid).Add({g, f->xp(), f->bearing()});
+#else
   feature_adj_.at(fid).Add({g, f->xp()});
+#endif
   LOG(INFO) << "group #" << gid << " added to feature #" << fid;
 }
 
@@ -204,8 +217,14 @@ std::vector<GroupPtr> Graph::GetGroupsOf(FeaturePtr f) const {
 
 std::vector<Observation> Graph::GetObservationsOf(FeaturePtr f) const {
   std::vector<Observation> out;
-  for (const auto &obs : feature_adj_.at(f->id())) {
+  const auto &adj = feature_adj_.at(f->id());
+  for (const auto &obs : adj) {
+#ifdef USE_BEARING_MEASUREMENT
+    out.push_back(
+        {groups_.at(obs.first), obs.second, adj.bearings.at(obs.first)});
+#else
     out.push_back({groups_.at(obs.first), obs.second});
+#endif
   }
   return out;
 }
@@ -234,80 +253,144 @@ void Graph::SanityCheck() {
             << " ;#graph.groups=" << groups_.size();
 }
 
-std::vector<FeaturePtr> Graph::TransferFeatureOwnership(GroupPtr g,
-                                                        const SE3 &gbc) {
+std::vector<FeaturePtr>
+Graph::TransferFeatureOwnership(const std::vector<GroupPtr> &groups,
+                                const SE3 &gbc, const MatX &P,
+                                const OwnershipOptions &options) {
 
-  CHECK(HasGroup(g));
+  // features are never handed to a group leaving in the same batch, which
+  // would transfer them twice
+  std::unordered_set<int> excluded;
+  for (auto g : groups) {
+    CHECK(HasGroup(g));
+    excluded.insert(g->id());
+  }
 
   std::vector<FeaturePtr> failed;
-  int gid = g->id();
+  int transferred{0};
 
-  for (int fid : group_adj_.at(gid)) {
-    CHECK(HasFeature(fid));
+  for (auto g : groups) {
+    int gid = g->id();
+    for (int fid : group_adj_.at(gid)) {
+      CHECK(HasFeature(fid));
 
-    auto f = features_.at(fid);
-    if (f->ref() == g) {
+      auto f = features_.at(fid);
+      if (f->ref() != g) {
+        continue;
+      }
       // transfer ownership
-      auto nref = FindNewOwner(f);
-      if (nref) {
-        // now transfer
-        SE3 g_cn_s =
-            (nref->gsb() * gbc)
-                .inv(); // spatial (s) to camera of the new reference (cn)
-        Mat3 dXs_dx;
-        Vec3 Xcn = g_cn_s * f->Xs(gbc, &dXs_dx);
-        // Mat3 dXcn_dXs = gcb.R() * gbs.R();
-        Mat3 dXcn_dx = g_cn_s.R().matrix() * dXs_dx;
-        Mat3 dxn_dXcn;
-#ifdef USE_INVDEPTH
-        Vec3 xn = project_invz(Xcn, &dxn_dXcn);
-#else
-        if (Xcn(2) < 0) {
-          f->ResetRef(nullptr);
-          failed.push_back(f);
-          LOG(WARNING) << "negative depth; mark feature #" << fid
-                       << " as failed";
-          continue;
-        }
-        Vec3 xn = project_logz(Xcn, &dxn_dXcn);
-#endif
-        f->x() = xn;
-
-        Mat3 J;
-        J = dxn_dXcn * dXcn_dx;
-
-        f->P() =
-            J * f->P() * J.transpose() * 1.5; // inflate covariance a little bit
-
-        f->ResetRef(nref);
-
-        LOG(INFO) << "feature #" << fid << " transfered from group #" << gid
-                  << " to group #" << nref->id();
-      } else {
+      auto nref = FindNewOwner(f, excluded, gbc, options);
+      if (!nref) {
         f->ResetRef(nullptr);
         failed.push_back(f);
         LOG(WARNING) << "failed to find new owner for feature #" << fid;
+        continue;
       }
+
+      SE3 g_cn_s =
+          (nref->gsb() * gbc)
+              .inv(); // spatial (s) to camera of the new reference (cn)
+      Mat3 dXs_dx;
+      Vec3 Xs = f->Xs(gbc, &dXs_dx);
+      Vec3 Xcn = g_cn_s * Xs;
+      Mat3 dXcn_dXs = g_cn_s.R().matrix();
+      Mat3 dxn_dXcn;
+      Vec3 xn = f->Parametrize(Xcn, &dxn_dXcn);
+
+      // Jacobians w.r.t. the pose errors (W, T) of the old (r) and new (n)
+      // references, both perturbed as R*exp(W), T+dT
+      Mat3 Rsr = g->gsb().R().matrix();
+      Mat3 Rsn = nref->gsb().R().matrix();
+      Eigen::Matrix<number_t, 3, 12> dXcn_dg;
+      dXcn_dg.block<3, 3>(0, 0) =
+          -dXcn_dXs * Rsr * hat(Vec3{Rsr.transpose() * (Xs - g->gsb().T())});
+      dXcn_dg.block<3, 3>(0, 3) = dXcn_dXs;
+      dXcn_dg.block<3, 3>(0, 6) =
+          gbc.R().matrix().transpose() *
+          hat(Vec3{Rsn.transpose() * (Xs - nref->gsb().T())});
+      dXcn_dg.block<3, 3>(0, 9) = -dXcn_dXs;
+
+      // joint covariance of the two poses, zero for floating groups
+      Eigen::Matrix<number_t, 12, 12> Pgg;
+      Pgg.setZero();
+      int offsets[2] = {g->instate() ? kGroupBegin + 6 * g->sind() : -1,
+                        nref->instate() ? kGroupBegin + 6 * nref->sind() : -1};
+      for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2; ++j) {
+          if (offsets[i] >= 0 && offsets[j] >= 0) {
+            Pgg.block<6, 6>(6 * i, 6 * j) =
+                P.block<6, 6>(offsets[i], offsets[j]);
+          }
+        }
+      }
+
+      Mat3 J = dxn_dXcn * dXcn_dXs * dXs_dx;
+      Eigen::Matrix<number_t, 3, 12> Jg = dxn_dXcn * dXcn_dg;
+      f->x() = xn;
+      f->P() = J * f->P() * J.transpose() + Jg * Pgg * Jg.transpose();
+      f->ResetRef(nref);
+      ++transferred;
+
+      VLOG(0) << "feature #" << fid << " transfered from group #" << gid
+              << " to group #" << nref->id();
     }
   }
+  if (transferred > 0 || !failed.empty()) {
+    LOG(INFO) << transferred << " features transfered, " << failed.size()
+              << " failed, from " << groups.size() << " groups";
+  }
   return failed;
 }
 
-GroupPtr Graph::FindNewOwner(FeaturePtr f) {
+GroupPtr Graph::FindNewOwner(FeaturePtr f,
+                             const std::unordered_set<int> &excluded,
+                             const SE3 &gbc, const OwnershipOptions &options) {
   int fid = f->id();
   CHECK(features_.count(fid));
   CHECK(feature_adj_.count(fid));
+  const auto &adj = feature_adj_.at(fid);
   auto old_gid = f->ref()->id();
-  for (const auto &obs : feature_adj_.at(fid)) {
+  Vec3 Xs = f->Xs(gbc);
+
+  // group ids increase with time: the latest view of the feature, and the
+  // newest groups are the ones staying the longest in the graph
+  int latest{-1};
+  for (const auto &obs : adj) {
+    latest = std::max(latest, obs.first);
+  }
+  if (latest < 0) {
+    return nullptr;
+  }
+  Vec3 ray_latest =
+      (Xs - (groups_.at(latest)->gsb() * gbc).T()).normalized();
+
+  // rank: instate with parallax > instate > floating with parallax > floating,
+  // then newest first
+  GroupPtr best{nullptr};
+  int best_rank{-1}, best_gid{-1};
+  for (const auto &obs : adj) {
     int gid = obs.first;
-    if (gid != old_gid) {
-      // TODO: can have fancy measure on which group should be the best to be
-      // the new owner
-      // For now, just pick the first one met.
-      return groups_.at(gid);
+    if (gid == old_gid || excluded.count(gid)) {
+      continue;
+    }
+    auto g = groups_.at(gid);
+    SE3 gsc = g->gsb() * gbc;
+    // behind the camera regardless of the configured minimum depth, which
+    // the depth parametrizations could not represent
+    if (number_t z = (gsc.inv() * Xs)(2); z <= 0 || z < options.min_depth) {
+      continue;
+    }
+    number_t cos_parallax =
+        std::min<number_t>(1, (Xs - gsc.T()).normalized().dot(ray_latest));
+    bool parallax{std::acos(cos_parallax) >= options.min_parallax};
+    int rank = 2 * g->instate() + parallax;
+    if (rank > best_rank || (rank == best_rank && gid > best_gid)) {
+      best = g;
+      best_rank = rank;
+      best_gid = gid;
     }
   }
-  return nullptr;
+  return best;
 }
 
 void Graph::CleanIsolatedGroups() {
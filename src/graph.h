@@ -8,12 +8,15 @@
 
 #include "core.h"
 #include "feature.h"
+#include "options.h"
 
 namespace xivo {
 
 struct FeatureAdj : public std::unordered_map<int, Vec2> {
   void Add(const Observation &obs);
   void Remove(int id);
+  // unit bearings of the observations, undistorted once when added
+  std::unordered_map<int, Vec3> bearings;
 };
 
 struct GroupAdj : public std::unordered_set<int> {
@@ -59,11 +62,20 @@ public:
   const FeatureAdj &GetFeatureAdj(FeaturePtr f) const;
   const GroupAdj &GetGroupAdj(GroupPtr g) const;
 
-  // transfer ownership of features owned by g, i.e., with g as reference
+  // transfer ownership of features owned by any of the groups, i.e., with one
+  // of them as reference, to groups outside of the batch
   // return those for which a new owner cannot be found
-  // gsc is the camera to spatial frame transformation
-  std::vector<FeaturePtr> TransferFeatureOwnership(GroupPtr g, const SE3 &gbc);
-  GroupPtr FindNewOwner(FeaturePtr f);
+  // gbc is the camera to body transformation, P the covariance of the
+  // estimator, whose group blocks account for the uncertainty of the poses of
+  // the old and new references
+  std::vector<FeaturePtr>
+  TransferFeatureOwnership(const std::vector<GroupPtr> &groups, const SE3 &gbc,
+                           const MatX &P, const OwnershipOptions &options);
+  // pick the new reference of f among the groups observing it, except the
+  // excluded ones: newest instate group which sees f at positive depth and
+  // with enough parallax w.r.t. the latest view of f
+  GroupPtr FindNewOwner(FeaturePtr f, const std::unordered_set<int> &excluded,
+                        const SE3 &gbc, const OwnershipOptions &options);
 
   void SanityCheck();
   void CleanIsolatedGroups();
@@ -28,6 +28,9 @@ void Group::Reset(const SO3 &Rsb, const Vec3 &Tsb) {
     LOG(FATAL) << "Group index overflow!!!";
   }
   lifetime_ = 0;
+  ts_ = timestamp_t{0};
+  Vsb_.setZero();
+  gyro_.setZero();
   sind_ = -1;
   status_ = GroupStatus::CREATED;
   X_.Rsb = Rsb;
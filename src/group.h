@@ -43,6 +43,17 @@ public:
   int lifetime() const { return lifetime_; }
   void IncrementLifetime() { lifetime_++; }
   void ResetLifetime() { lifetime_ = 0; }
+  const timestamp_t &ts() const { return ts_; }
+  void SetTimestamp(const timestamp_t &ts) { ts_ = ts; }
+
+  // motion of the body when the group was created; not part of the state,
+  // used to model the rolling shutter
+  const Vec3 &Vsb() const { return Vsb_; }
+  const Vec3 &gyro() const { return gyro_; }
+  void SetMotion(const Vec3 &Vsb, const Vec3 &gyro) {
+    Vsb_ = Vsb;
+    gyro_ = gyro;
+  }
 
   void BackupState() { X0_ = X_; }
   void RestoreState() { X_ = X0_; }
@@ -88,6 +99,13 @@ private:
   /** Number of images that have been processed since group was created. */
   int lifetime_;
 
+  /** Timestamp of the image at which the group was created. */
+  timestamp_t ts_;
+
+  /** Velocity (spatial frame) and calibrated angular velocity (body frame)
+   *  at the time the group was created. */
+  Vec3 Vsb_, gyro_;
+
   /** Nominal State: (Rsb, Tsb) */
   SO3xR3 X_;
 
@@ -1,6 +1,7 @@
 #include "helpers.h"
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <memory>
 
@@ -100,6 +101,126 @@ int QR(VecX &x, MatX &Hx, int effective_rows) {
   return rows;
 }
 
+std::vector<int> UpdatedStates(const MatX &H, const MatX &P) {
+  std::vector<int> states;
+  for (int i = 0; i < P.rows(); ++i) {
+    number_t var = P(i, i);
+    if (var > 0 && (!H.col(i).isZero(0) ||
+                    P.row(i).squaredNorm() > var * var)) {
+      states.push_back(i);
+    }
+  }
+  return states;
+}
+
+number_t CovarianceFormUpdate(const MatX &H, const VecX &diagR,
+                              const VecX &inn, MatX &P, VecX &err) {
+  MatX PHt = P * H.transpose();
+  MatX S = H * PHt;
+  S.diagonal() += diagR;
+
+  auto S_ldlt = S.ldlt();
+  MatX K = S_ldlt.solve(PHt.transpose()).transpose();
+  err = K * inn;
+  number_t nis = inn.dot(S_ldlt.solve(inn)) / inn.size();
+
+  // Here, I_KH is actually KH - I, but since
+  // update of P is quadratic in I_KH, so it does not matter.
+  MatX I_KH = K * H;
+  I_KH.diagonal().array() -= 1;
+  P = I_KH * P * I_KH.transpose();
+
+  K *= diagR.cwiseSqrt().asDiagonal();
+  P.noalias() += K * K.transpose();
+  return nis;
+}
+
+bool InformationFormUpdate(const MatX &H, const VecX &diagR, const VecX &inn,
+                           const std::vector<int> &states, MatX &P, VecX &err,
+                           number_t *nis) {
+  int m = H.rows();
+  int n = states.size();
+
+  // the covariance of the states as D C D, with D = diag(P)^(1/2), such that
+  // C stays well-conditioned whatever the units of the states, and the
+  // measurement whitened by R^(-1/2): G = R^(-1/2) H D, z = R^(-1/2) inn
+  VecX w = diagR.cwiseSqrt().cwiseInverse();
+  VecX d(n);
+  for (int j = 0; j < n; ++j) {
+    d(j) = std::sqrt(P(states[j], states[j]));
+  }
+  MatX C(n, n), G(m, n);
+  for (int j = 0; j < n; ++j) {
+    G.col(j) = d(j) * w.cwiseProduct(H.col(states[j]));
+    for (int i = 0; i < n; ++i) {
+      C(i, j) = P(states[i], states[j]) / (d(i) * d(j));
+    }
+  }
+  VecX z = w.cwiseProduct(inn);
+
+  Eigen::LLT<MatX> C_llt(C);
+  if (C_llt.info() != Eigen::Success) {
+    return false;
+  }
+  // information matrix C^-1 + G'G, of which only the lower half is used
+  MatX Y = C_llt.solve(MatX::Identity(n, n));
+  Y.selfadjointView<Eigen::Lower>().rankUpdate(G.transpose());
+  Eigen::LLT<MatX> Y_llt(Y);
+  if (Y_llt.info() != Eigen::Success) {
+    return false;
+  }
+
+  VecX g = G.transpose() * z;
+  VecX e = Y_llt.solve(g);
+  // S^-1 = R^-1 - R^-1 H P+ H' R^-1 by the matrix inversion lemma
+  *nis = (z.squaredNorm() - g.dot(e)) / m;
+
+  MatX C_new = Y_llt.solve(MatX::Identity(n, n));
+  err.setZero(P.rows());
+  for (int i = 0; i < n; ++i) {
+    err(states[i]) = d(i) * e(i);
+    for (int j = 0; j <= i; ++j) {
+      P(states[i], states[j]) = P(states[j], states[i]) =
+          0.5 * d(i) * (C_new(i, j) + C_new(j, i)) * d(j);
+    }
+  }
+  return true;
+}
+
+number_t SparseCovarianceFormUpdate(const MatX &Hc, const std::vector<int> &cols,
+                                    const VecX &diagR, const VecX &inn,
+                                    MatX &P, VecX &err, bool joseph) {
+  CHECK(Hc.cols() == cols.size());
+  // P H' and H P H', through the columns of H in use only
+  MatX PHt = MatX::Zero(P.rows(), Hc.rows());
+  for (int j = 0; j < cols.size(); ++j) {
+    PHt.noalias() += P.col(cols[j]) * Hc.col(j).transpose();
+  }
+  MatX S = diagR.asDiagonal();
+  for (int j = 0; j < cols.size(); ++j) {
+    S.noalias() += Hc.col(j) * PHt.row(cols[j]);
+  }
+
+  auto S_ldlt = S.ldlt();
+  MatX K = S_ldlt.solve(PHt.transpose()).transpose();
+  err = K * inn;
+  number_t nis = inn.dot(S_ldlt.solve(inn)) / inn.size();
+
+  // P - P H' S^-1 H P
+  P.noalias() -= K * PHt.transpose();
+  if (joseph) {
+    // the above is (I - KH) P, times (I - KH)' on the right, plus K R K'
+    MatX PHt_new = MatX::Zero(P.rows(), Hc.rows());
+    for (int j = 0; j < cols.size(); ++j) {
+      PHt_new.noalias() += P.col(cols[j]) * Hc.col(j).transpose();
+    }
+    P.noalias() -= PHt_new * K.transpose();
+    P.noalias() += K * diagR.asDiagonal() * K.transpose();
+  }
+  P = 0.5 * (P + P.transpose()).eval();
+  return nis;
+}
+
 Vec3 Triangulate1(const SE3 &g12, const Vec2 &xc1, const Vec2 &xc2) {
   Vec3 t12{g12.T()};
   Mat3 R12{g12.R()};
@@ -33,6 +33,41 @@ static Mat2 givens(number_t a, number_t b);
 // Returns: size of the upper triangular matrix Th
 int QR(VecX &r, MatX &Hx, int effective_rows = -1);
 
+// Indices of the states which a measurement with jacobian H can change: those
+// of nonzero variance, which are either measured by H or correlated with other
+// states. The others, e.g., free slots of groups and features, are left as
+// they are by the update.
+std::vector<int> UpdatedStates(const MatX &H, const MatX &P);
+
+// Kalman update in covariance form, which factors the m x m innovation
+// covariance S = H P H' + R and updates P in Joseph form.
+// Args:
+//  H, diagR, inn: measurement jacobian, diagonal of the measurement
+//    covariance, and innovation of m rows
+//  P: state covariance, updated in place
+//  err: error state estimated from the innovation
+// Returns: normalized innovation squared, inn' S^-1 inn / m
+number_t CovarianceFormUpdate(const MatX &H, const VecX &diagR,
+                              const VecX &inn, MatX &P, VecX &err);
+
+// The same update in information form, which factors the n x n information
+// matrix P^-1 + H' R^-1 H of the given states instead, and is the cheaper of
+// the two when m exceeds n. Returns false, and leaves P and err untouched, if
+// the covariance of the states is not positive definite.
+bool InformationFormUpdate(const MatX &H, const VecX &diagR, const VecX &inn,
+                           const std::vector<int> &states, MatX &P, VecX &err,
+                           number_t *nis);
+
+// The covariance-form update with a measurement jacobian which is zero but in
+// the columns `cols` of the state, H(:, cols) = Hc. The cost is O(n k m) in
+// the k columns, plus O(n^2 m) for the rank-m covariance update, instead of
+// the O(n^2 m + n^3) of the Joseph form at full width. With `joseph` set, P
+// is updated in Joseph form as well, (I - KH) P (I - KH)' + K R K', still at
+// O(n^2 m), which keeps it positive definite under tight measurements.
+number_t SparseCovarianceFormUpdate(const MatX &Hc, const std::vector<int> &cols,
+                                    const VecX &diagR, const VecX &inn,
+                                    MatX &P, VecX &err, bool joseph = false);
+
 template <typename T> void MakePtrVectorUnique(std::vector<T *> &v) {
   std::sort(v.begin(), v.end());
   v.erase(std::unique(v.begin(), v.end()), v.end());
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+#include "sys/wait.h"
+#include "unistd.h"
+
+#include "glog/logging.h"
+
+#include "init_hypotheses.h"
+
+namespace xivo {
+
+std::vector<Json::Value> MakeInitHypotheses(const Json::Value &est_cfg,
+                                            const Json::Value &cfg) {
+  std::vector<Json::Value> out{est_cfg};
+
+  // replaces each configuration with one copy per alternative
+  auto expand = [&out, &cfg](const std::string &key,
+                             std::function<void(Json::Value &,
+                                                const Json::Value &)> apply) {
+    if (!cfg.isMember(key) || cfg[key].empty()) {
+      return;
+    }
+    std::vector<Json::Value> expanded;
+    for (const auto &hyp : out) {
+      for (const auto &alt : cfg[key]) {
+        expanded.push_back(hyp);
+        apply(expanded.back(), alt);
+      }
+    }
+    out.swap(expanded);
+  };
+
+  expand("initial_z", [](Json::Value &hyp, const Json::Value &alt) {
+    hyp["initial_z"] = alt.asDouble();
+  });
+  expand("gravity_init_counter", [](Json::Value &hyp, const Json::Value &alt) {
+    hyp["gravity_init_counter"] = alt.asInt();
+  });
+  expand("bias_std_scale", [](Json::Value &hyp, const Json::Value &alt) {
+    for (auto key : {"bg", "ba"}) {
+      hyp["P"][key] = hyp["P"][key].asDouble() * alt.asDouble();
+    }
+  });
+  return out;
+}
+
+std::vector<InitHypothesisResult>
+RunInitHypotheses(const std::vector<Json::Value> &hypotheses, int max_parallel,
+                  std::function<void(EstimatorPtr)> run) {
+  if (max_parallel <= 0) {
+    max_parallel = std::max<int>(1, std::thread::hardware_concurrency() - 1);
+  }
+
+  std::vector<InitHypothesisResult> results(hypotheses.size(),
+                                            {false, 0, 0});
+  std::vector<pid_t> pids(hypotheses.size(), -1);
+  std::vector<int> fds(hypotheses.size(), -1);
+
+  // collects the result of one finished child
+  auto reap = [&]() {
+    int status;
+    pid_t pid = wait(&status);
+    CHECK(pid > 0) << "wait failed";
+    int k = std::find(pids.begin(), pids.end(), pid) - pids.begin();
+    CHECK(k < pids.size());
+    InitHypothesisResult result;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+        read(fds[k], &result, sizeof(result)) == sizeof(result)) {
+      results[k] = result;
+    }
+    close(fds[k]);
+    pids[k] = -1;
+    LOG(INFO) << "init hypothesis #" << k << ": ok=" << results[k].ok
+              << " mean_nis=" << results[k].mean_nis
+              << " #updates=" << results[k].num_updates;
+  };
+
+  int running{0};
+  for (int k = 0; k < hypotheses.size(); ++k) {
+    if (running == max_parallel) {
+      reap();
+      --running;
+    }
+    int fd[2];
+    CHECK(pipe(fd) == 0) << "failed to create pipe";
+    // buffered output would otherwise be written by both processes
+    std::cout.flush();
+    fflush(nullptr);
+
+    pid_t pid = fork();
+    CHECK(pid >= 0) << "fork failed";
+    if (pid == 0) {
+      // child: run the hypothesis without any visualization
+      close(fd[0]);
+      Json::Value cfg = hypotheses[k];
+      cfg["use_canvas"] = false;
+      cfg["print_timing"] = false;
+      auto est = CreateSystem(cfg);
+      run(est);
+      InitHypothesisResult result{true, est->mean_nis(), est->num_updates()};
+      bool ok = write(fd[1], &result, sizeof(result)) == sizeof(result);
+      // skip the destructors of the singletons shared with the parent
+      _exit(ok ? 0 : 1);
+    }
+    close(fd[1]);
+    pids[k] = pid;
+    fds[k] = fd[0];
+    ++running;
+  }
+  while (running > 0) {
+    reap();
+    --running;
+  }
+  return results;
+}
+
+int SelectInitHypothesis(const std::vector<InitHypothesisResult> &results,
+                         int min_updates) {
+  int best{-1};
+  number_t best_cost{0};
+  for (int k = 0; k < results.size(); ++k) {
+    const auto &r = results[k];
+    if (!r.ok || r.num_updates < min_updates || !(r.mean_nis > 0) ||
+        !std::isfinite(r.mean_nis)) {
+      continue;
+    }
+    number_t cost = std::fabs(std::log(r.mean_nis));
+    if (best == -1 || cost < best_cost) {
+      best = k;
+      best_cost = cost;
+    }
+  }
+  if (best == -1) {
+    LOG(WARNING) << "no initialization hypothesis succeeded; use the first";
+    return 0;
+  }
+  return best;
+}
+
+} // namespace xivo
@@ -0,0 +1,48 @@
+// Multi-hypothesis initialization: the first seconds of a run are processed
+// by several estimators which differ in initial depth, gravity window and
+// bias priors; the one with the most consistent innovations is kept.
+//
+// The estimator and its subsystems are singletons, so each hypothesis runs in
+// a forked process. The caller then creates the system with the selected
+// configuration and processes the data from the start, which reproduces the
+// state & graph of the selected hypothesis since the estimator is
+// deterministic.
+#pragma once
+#include <functional>
+#include <vector>
+
+#include "json/json.h"
+
+#include "estimator.h"
+
+namespace xivo {
+
+struct InitHypothesisResult {
+  bool ok;          // the hypothesis ran to the end of the phase
+  number_t mean_nis; // see Estimator::mean_nis
+  int num_updates;
+};
+
+/** Expands the estimator configuration `est_cfg` into one configuration per
+ *  hypothesis, the cartesian product of the alternatives in `cfg`:
+ *    "initial_z": initial depth of features,
+ *    "gravity_init_counter": number of accelerometer samples to initialize
+ *      gravity,
+ *    "bias_std_scale": multiplier of the prior covariance of IMU biases.
+ *  Alternatives not given keep the value in `est_cfg`. */
+std::vector<Json::Value> MakeInitHypotheses(const Json::Value &est_cfg,
+                                            const Json::Value &cfg);
+
+/** Runs each hypothesis in a child process, at most `max_parallel` at a time
+ *  (0 to use all but one of the cores). `run` feeds the messages of the
+ *  initialization phase to the given estimator. */
+std::vector<InitHypothesisResult>
+RunInitHypotheses(const std::vector<Json::Value> &hypotheses, int max_parallel,
+                  std::function<void(EstimatorPtr)> run);
+
+/** Returns the index of the hypothesis whose mean NIS is the closest to 1 in
+ *  log scale among those with at least `min_updates` updates, or 0 if none. */
+int SelectInitHypothesis(const std::vector<InitHypothesisResult> &results,
+                         int min_updates);
+
+} // namespace xivo
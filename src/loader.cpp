@@ -1,5 +1,6 @@
 // Dataloader for ASL-compatible dataset.
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -58,6 +59,54 @@ DataLoader::DataLoader(const std::string &image_dir,
             [](const auto &e1, const auto &e2) { return e1->ts_ < e2->ts_; });
 }
 
+void DataLoader::LoadEvents(const std::string &event_file,
+                            const timestamp_t &batch) {
+  std::ifstream is{event_file, std::ios::binary};
+  if (!is) {
+    LOG(FATAL) << "failed to open event file @ " << event_file;
+  }
+
+  constexpr int kRecordSize = 13;
+  char record[kRecordSize];
+  Events events;
+  timestamp_t end;
+  int num_events{0}, num_batches{0};
+  auto flush = [&]() {
+    if (!events.empty()) {
+      entries_.emplace_back(
+          std::make_unique<msg::EventBatch>(end, std::move(events)));
+      events.clear();
+      ++num_batches;
+    }
+  };
+  while (is.read(record, kRecordSize)) {
+    int64_t t;
+    uint16_t x, y;
+    int8_t polarity;
+    std::memcpy(&t, record, 8);
+    std::memcpy(&x, record + 8, 2);
+    std::memcpy(&y, record + 10, 2);
+    std::memcpy(&polarity, record + 12, 1);
+    timestamp_t ts{t};
+    if (events.empty()) {
+      end = ts + batch;
+    } else if (ts >= end) {
+      flush();
+      end = ts + batch;
+    }
+    events.push_back({ts, x, y, polarity});
+    ++num_events;
+  }
+  flush();
+  LOG(INFO) << StrFormat("%d events in %d batches loaded", num_events,
+                         num_batches);
+
+  // ascend timestamps
+  std::stable_sort(
+      entries_.begin(), entries_.end(),
+      [](const auto &e1, const auto &e2) { return e1->ts_ < e2->ts_; });
+}
+
 std::vector<msg::Pose>
 DataLoader::LoadGroundTruthState(const std::string &state_dir) {
   std::string state_data = state_dir + "/data.csv";
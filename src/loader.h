@@ -16,6 +16,10 @@ public:
 
   DataLoader(const std::string &image_dir, const std::string &imu_dir);
   std::vector<msg::Pose> LoadGroundTruthState(const std::string &state_dir);
+  // add the events of a binary file of packed little-endian records
+  // (int64 t [ns], uint16 x, uint16 y, int8 polarity), in time order, as
+  // batches spanning `batch` each
+  void LoadEvents(const std::string &event_file, const timestamp_t &batch);
 
   msg::Message *Get(int i) const { return entries_[i].get(); };
   int size() const { return entries_.size(); }
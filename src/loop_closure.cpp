@@ -0,0 +1,473 @@
+#include <algorithm>
+#include <cmath>
+
+#include "glog/logging.h"
+#include "opencv2/calib3d/calib3d.hpp"
+#include "opencv2/features2d/features2d.hpp"
+
+#include "camera_manager.h"
+#include "feature.h"
+#include "group.h"
+#include "loop_closure.h"
+#include "optimizer.h"
+
+namespace xivo {
+
+////////////////////////////////////////
+// appearance index
+////////////////////////////////////////
+AppearanceIndex::AppearanceIndex(int num_tables, int key_bits, uint32_t seed)
+    : num_tables_{num_tables}, key_bits_{key_bits}, desc_bytes_{0},
+      rng_{seed}, tables_(num_tables), size_{0} {
+  CHECK(num_tables_ > 0);
+  CHECK(key_bits_ > 0 && key_bits_ <= 32) << "hash keys are 32-bit";
+}
+
+uint32_t AppearanceIndex::Key(const uint8_t *desc, int table) const {
+  uint32_t key{0};
+  for (int b : bits_[table]) {
+    key = (key << 1) | ((desc[b >> 3] >> (b & 7)) & 1);
+  }
+  return key;
+}
+
+void AppearanceIndex::Add(int id, const cv::Mat &descriptors) {
+  if (descriptors.empty()) {
+    return;
+  }
+  CHECK(descriptors.type() == CV_8UC1) << "binary descriptors expected";
+  if (bits_.empty()) {
+    desc_bytes_ = descriptors.cols;
+    std::uniform_int_distribution<int> dist(0, 8 * desc_bytes_ - 1);
+    bits_.resize(num_tables_);
+    for (auto &bits : bits_) {
+      for (int i = 0; i < key_bits_; ++i) {
+        bits.push_back(dist(rng_));
+      }
+    }
+  }
+  CHECK_EQ(descriptors.cols, desc_bytes_);
+
+  for (int i = 0; i < descriptors.rows; ++i) {
+    const uint8_t *desc = descriptors.ptr<uint8_t>(i);
+    for (int t = 0; t < num_tables_; ++t) {
+      auto &bucket = tables_[t][Key(desc, t)];
+      // ids are added in increasing order, one keyframe at a time
+      if (bucket.empty() || bucket.back() != id) {
+        bucket.push_back(id);
+      }
+    }
+  }
+  ++size_;
+}
+
+std::vector<std::pair<int, number_t>>
+AppearanceIndex::Query(const cv::Mat &descriptors, int max_id,
+                       int max_results) const {
+  std::vector<std::pair<int, number_t>> out;
+  if (descriptors.empty() || bits_.empty() || max_id < 0) {
+    return out;
+  }
+  CHECK_EQ(descriptors.cols, desc_bytes_);
+
+  std::unordered_map<int, number_t> scores;
+  for (int i = 0; i < descriptors.rows; ++i) {
+    const uint8_t *desc = descriptors.ptr<uint8_t>(i);
+    for (int t = 0; t < num_tables_; ++t) {
+      auto it = tables_[t].find(Key(desc, t));
+      if (it == tables_[t].end()) {
+        continue;
+      }
+      // buckets shared by many keyframes are less distinctive
+      number_t weight = std::log(1.0 + size_ / number_t(it->second.size()));
+      for (int id : it->second) {
+        if (id <= max_id) {
+          scores[id] += weight;
+        }
+      }
+    }
+  }
+  out.assign(scores.begin(), scores.end());
+  std::sort(out.begin(), out.end(),
+            [](const auto &s1, const auto &s2) { return s1.second > s2.second; });
+  if (out.size() > max_results) {
+    out.resize(max_results);
+  }
+  return out;
+}
+
+////////////////////////////////////////
+// geometric verification
+////////////////////////////////////////
+int VerifyLoop(const Keyframe &cand, const Keyframe &query,
+               const LoopClosureOptions &options, SE3 *gcq) {
+  if (cand.descriptors.empty() || query.descriptors.empty()) {
+    return 0;
+  }
+
+  cv::BFMatcher matcher{cv::NORM_HAMMING};
+  std::vector<std::vector<cv::DMatch>> knn_matches;
+  matcher.knnMatch(query.descriptors, cand.descriptors, knn_matches, 2);
+
+  // landmarks of the candidate in its camera frame & observations of the query
+  std::vector<cv::Point3f> object_points;
+  std::vector<cv::Point2f> image_points;
+  for (const auto &m : knn_matches) {
+    if (m.empty() || m[0].distance > options.max_hamming) {
+      continue;
+    }
+    if (m.size() > 1 && m[0].distance > options.ratio_test * m[1].distance) {
+      continue;
+    }
+    if (!cand.has_landmark[m[0].trainIdx]) {
+      continue;
+    }
+    const Vec3 &Xc = cand.Xc[m[0].trainIdx];
+    const Vec2 &xc = query.xc[m[0].queryIdx];
+    object_points.emplace_back(Xc(0), Xc(1), Xc(2));
+    image_points.emplace_back(xc(0), xc(1));
+  }
+  if (object_points.size() < std::max(options.min_inliers, 6)) {
+    return 0;
+  }
+
+  // observations are in normalized coordinates, hence identity intrinsics
+  cv::Mat K = cv::Mat::eye(3, 3, CV_64F);
+  cv::Mat rvec, tvec;
+  std::vector<int> inliers;
+  if (!cv::solvePnPRansac(object_points, image_points, K, cv::noArray(), rvec,
+                          tvec, false, options.ransac_iters,
+                          options.ransac_thresh, 0.99, inliers,
+                          cv::SOLVEPNP_EPNP) ||
+      inliers.size() < options.min_inliers) {
+    return 0;
+  }
+
+  // refine on the inliers
+  std::vector<cv::Point3f> inlier_object_points;
+  std::vector<cv::Point2f> inlier_image_points;
+  for (int i : inliers) {
+    inlier_object_points.push_back(object_points[i]);
+    inlier_image_points.push_back(image_points[i]);
+  }
+  cv::solvePnP(inlier_object_points, inlier_image_points, K, cv::noArray(),
+               rvec, tvec, true, cv::SOLVEPNP_ITERATIVE);
+
+  // (rvec, tvec) maps the candidate camera frame to the query camera frame
+  SE3 gqc{SO3::exp(Vec3{rvec.at<double>(0), rvec.at<double>(1),
+                        rvec.at<double>(2)}),
+          Vec3{tvec.at<double>(0), tvec.at<double>(1), tvec.at<double>(2)}};
+  *gcq = cand.gbc * gqc.inv() * query.gbc.inv();
+  return inliers.size();
+}
+
+////////////////////////////////////////
+// loop closure
+////////////////////////////////////////
+std::unique_ptr<LoopClosure> LoopClosure::instance_{nullptr};
+
+LoopClosurePtr LoopClosure::Create(const Json::Value &cfg) {
+  if (instance_) {
+    LOG(WARNING) << "Loop closure already created!";
+  } else {
+    instance_ = std::unique_ptr<LoopClosure>(new LoopClosure{cfg});
+  }
+  return instance_.get();
+}
+
+static LoopClosureOptions LoadOptions(const Json::Value &cfg) {
+  LoopClosureOptions options;
+  options.min_translation = cfg.get("min_translation", 0.25).asDouble();
+  options.min_rotation = cfg.get("min_rotation", 15).asDouble() / 180 * M_PI;
+  options.min_landmarks = cfg.get("min_landmarks", 15).asInt();
+
+  options.num_tables = cfg.get("num_tables", 8).asInt();
+  options.key_bits = cfg.get("key_bits", 12).asInt();
+  options.exclude_recent = cfg.get("exclude_recent", 30).asInt();
+  options.max_candidates = cfg.get("max_candidates", 3).asInt();
+  options.min_score = cfg.get("min_score", 5.0).asDouble();
+
+  options.ratio_test = cfg.get("ratio_test", 0.8).asDouble();
+  options.max_hamming = cfg.get("max_hamming", 64).asInt();
+  options.ransac_thresh = cfg.get("ransac_thresh", 0.01).asDouble();
+  options.ransac_iters = cfg.get("ransac_iters", 200).asInt();
+  options.min_inliers = cfg.get("min_inliers", 20).asInt();
+
+  options.solver = cfg.get("solver", "dense").asString();
+  options.max_iters = cfg.get("max_iters", 20).asInt();
+  options.odometry_std_rotation =
+      cfg.get("odometry_std_rotation", 0.01).asDouble();
+  options.odometry_std_translation =
+      cfg.get("odometry_std_translation", 0.05).asDouble();
+  options.loop_std_rotation = cfg.get("loop_std_rotation", 0.02).asDouble();
+  options.loop_std_translation =
+      cfg.get("loop_std_translation", 0.05).asDouble();
+  options.use_robust_kernel = cfg.get("use_robust_kernel", true).asBool();
+
+  options.update_filter = cfg.get("update_filter", false).asBool();
+  options.feedback_std_rotation =
+      cfg.get("feedback_std_rotation", 0.02).asDouble();
+  options.feedback_std_translation =
+      cfg.get("feedback_std_translation", 0.1).asDouble();
+  return options;
+}
+
+LoopClosure::LoopClosure(const Json::Value &cfg)
+    : options_{LoadOptions(cfg)},
+      index_{options_.num_tables, options_.key_bits},
+      has_kf_{false}, busy_{false}, stop_{false}, new_solution_{false} {
+  worker_ = std::thread(&LoopClosure::Run, this);
+}
+
+LoopClosure::~LoopClosure() {
+  {
+    std::scoped_lock lck(mtx_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+void LoopClosure::AddFrame(GroupPtr g, const std::list<FeaturePtr> &features,
+                           const SE3 &gbc) {
+  SE3 gsb = g->gsb();
+  if (has_kf_) {
+    SE3 motion = last_kf_pose_.inv() * gsb;
+    if (motion.T().norm() < options_.min_translation &&
+        motion.R().log().norm() < options_.min_rotation) {
+      return;
+    }
+  }
+
+  std::vector<FeaturePtr> described;
+  std::copy_if(features.begin(), features.end(), std::back_inserter(described),
+               [](FeaturePtr f) { return !f->descriptor().empty(); });
+  if (described.empty()) {
+    LOG(WARNING) << "no descriptors for loop closure; "
+                    "set extract_descriptor in the tracker configuration";
+    return;
+  }
+
+  auto kf = std::make_unique<Keyframe>();
+  kf->gid = g->id();
+  kf->ts = g->ts();
+  kf->godom = gsb;
+  kf->gbc = gbc;
+  kf->descriptors.create(described.size(), described[0]->descriptor().cols,
+                         described[0]->descriptor().type());
+
+  SE3 gcs = (gsb * gbc).inv();
+  int num_landmarks{0};
+  for (int i = 0; i < described.size(); ++i) {
+    auto f = described[i];
+    f->descriptor().copyTo(kf->descriptors.row(i));
+    kf->xc.push_back(Camera::instance()->UnProject(f->xp()));
+    // same criterion as the one for adapting the initial depth
+    bool has_landmark = f->status() == FeatureStatus::INSTATE ||
+                        (f->status() == FeatureStatus::READY &&
+                         f->lifetime() > 5);
+    kf->has_landmark.push_back(has_landmark);
+    kf->Xc.push_back(has_landmark ? Vec3{gcs * f->Xs(gbc)} : Vec3::Zero());
+    num_landmarks += has_landmark;
+  }
+  if (num_landmarks < options_.min_landmarks) {
+    return;
+  }
+
+  last_kf_pose_ = gsb;
+  has_kf_ = true;
+  AddKeyframe(std::move(kf));
+}
+
+void LoopClosure::AddKeyframe(KeyframePtr kf) {
+  {
+    std::scoped_lock lck(mtx_);
+    kf->godom = godom_filter_.inv() * kf->godom;
+    pending_.push_back(std::move(kf));
+  }
+  cv_.notify_all();
+}
+
+SE3 LoopClosure::Correct(const SE3 &gsb) const {
+  std::scoped_lock lck(mtx_);
+  return gcorr_odom_ * godom_filter_.inv() * gsb;
+}
+
+bool LoopClosure::TakeFeedback(const SE3 &gsb, SE3 *gsb_corrected) {
+  std::scoped_lock lck(mtx_);
+  if (!new_solution_) {
+    return false;
+  }
+  new_solution_ = false;
+  *gsb_corrected = gcorr_odom_ * godom_filter_.inv() * gsb;
+  return true;
+}
+
+void LoopClosure::NotifyJump(const SE3 &jump) {
+  std::scoped_lock lck(mtx_);
+  godom_filter_ = jump * godom_filter_;
+  last_kf_pose_ = jump * last_kf_pose_;
+}
+
+void LoopClosure::Flush() {
+  std::unique_lock lck(mtx_);
+  cv_.wait(lck, [this] { return (pending_.empty() && !busy_) || stop_; });
+}
+
+std::vector<std::pair<timestamp_t, SE3>>
+LoopClosure::KeyframeTrajectory() const {
+  std::scoped_lock lck(mtx_);
+  std::vector<std::pair<timestamp_t, SE3>> out;
+  for (int i = 0; i < keyframes_.size(); ++i) {
+    out.emplace_back(keyframes_[i]->ts, poses_[i]);
+  }
+  return out;
+}
+
+int LoopClosure::num_keyframes() const {
+  std::scoped_lock lck(mtx_);
+  return keyframes_.size();
+}
+
+int LoopClosure::num_loops() const {
+  std::scoped_lock lck(mtx_);
+  return loops_.size();
+}
+
+void LoopClosure::Run() {
+  for (;;) {
+    KeyframePtr kf;
+    {
+      std::unique_lock lck(mtx_);
+      cv_.wait(lck, [this] { return stop_ || !pending_.empty(); });
+      if (stop_) {
+        return;
+      }
+      kf = std::move(pending_.front());
+      pending_.pop_front();
+      busy_ = true;
+    }
+
+    if (Process(std::move(kf))) {
+      Optimize();
+    }
+
+    {
+      std::scoped_lock lck(mtx_);
+      busy_ = false;
+    }
+    cv_.notify_all();
+  }
+}
+
+bool LoopClosure::Process(KeyframePtr kf) {
+  // keyframes are only appended by this thread, no need to lock for reading
+  kf->id = keyframes_.size();
+
+  bool found{false};
+  LoopConstraint loop;
+  auto candidates =
+      index_.Query(kf->descriptors, kf->id - options_.exclude_recent - 1,
+                   options_.max_candidates);
+  for (const auto &[id, score] : candidates) {
+    if (score < options_.min_score) {
+      break;
+    }
+    SE3 gcq;
+    if (int inliers = VerifyLoop(*keyframes_[id], *kf, options_, &gcq);
+        inliers > 0) {
+      loop = {id, kf->id, gcq, inliers};
+      found = true;
+      LOG(INFO) << "loop closed: keyframe #" << kf->id << " -> #" << id
+                << " (" << inliers << " inliers)";
+      break;
+    }
+  }
+  index_.Add(kf->id, kf->descriptors);
+
+  std::scoped_lock lck(mtx_);
+  poses_.push_back(gcorr_odom_ * kf->godom);
+  keyframes_.push_back(std::move(kf));
+  if (found) {
+    loops_.push_back(loop);
+  }
+  return found;
+}
+
+void LoopClosure::Optimize() {
+  std::vector<SE3> odom, init;
+  std::vector<LoopConstraint> loops;
+  {
+    std::scoped_lock lck(mtx_);
+    for (const auto &kf : keyframes_) {
+      odom.push_back(kf->godom);
+    }
+    init = poses_;
+    loops = loops_;
+  }
+  int n = odom.size();
+
+  g2o::SparseOptimizer optimizer;
+  optimizer.setAlgorithm(CreateOptimizationAlgorithm(options_.solver));
+
+  std::vector<GroupVertex *> vertices;
+  for (int i = 0; i < n; ++i) {
+    auto v = new GroupVertex();
+    v->setId(i);
+    v->setEstimate(init[i]);
+    // the first keyframe fixes the gauge
+    v->setFixed(i == 0);
+    optimizer.addVertex(v);
+    vertices.push_back(v);
+  }
+
+  auto information = [](number_t std_rotation, number_t std_translation) {
+    Vec6 diag;
+    diag << Vec3::Constant(1.0 / (std_rotation * std_rotation)),
+        Vec3::Constant(1.0 / (std_translation * std_translation));
+    return Mat6{diag.asDiagonal()};
+  };
+  auto add_edge = [&](int i, int j, const SE3 &gij, const Mat6 &info,
+                      bool robust) {
+    auto e = new RelativePoseEdge();
+    e->setVertex(0, vertices[i]);
+    e->setVertex(1, vertices[j]);
+    e->setMeasurement(gij);
+    e->setInformation(info);
+    if (robust) {
+      auto rk = new g2o::RobustKernelHuber();
+      rk->setDelta(std::sqrt(12.592)); // 95% of chi2 with 6 dofs
+      e->setRobustKernel(rk);
+    }
+    optimizer.addEdge(e);
+  };
+
+  Mat6 odom_info = information(options_.odometry_std_rotation,
+                               options_.odometry_std_translation);
+  for (int i = 1; i < n; ++i) {
+    add_edge(i - 1, i, odom[i - 1].inv() * odom[i], odom_info, false);
+  }
+  Mat6 loop_info =
+      information(options_.loop_std_rotation, options_.loop_std_translation);
+  for (const auto &loop : loops) {
+    add_edge(loop.i, loop.j, loop.gij, loop_info, options_.use_robust_kernel);
+  }
+
+  optimizer.initializeOptimization();
+  optimizer.computeActiveErrors();
+  number_t init_chi2 = optimizer.chi2();
+  optimizer.optimize(options_.max_iters);
+  LOG(INFO) << "pose graph of " << n << " keyframes & " << loops.size()
+            << " loops; chi2: " << init_chi2 << " -> " << optimizer.chi2();
+
+  std::scoped_lock lck(mtx_);
+  for (int i = 0; i < n; ++i) {
+    poses_[i] = vertices[i]->estimate();
+  }
+  gcorr_odom_ = poses_[n - 1] * odom[n - 1].inv();
+  new_solution_ = true;
+}
+
+} // namespace xivo
@@ -0,0 +1,198 @@
+// Loop closure: keyframes, appearance-based place recognition, geometric
+// verification and pose graph optimization in the background.
+//
+// Keyframes are made of groups created by the estimator. Each keyframe keeps
+// the descriptors of the features tracked on its frame, their normalized
+// coordinates and, for features with a reliable depth, their 3D positions.
+// A new keyframe queries an inverted index of all the older keyframes; the
+// best candidates are verified by PnP RANSAC of the new keyframe's
+// observations against the candidate's landmarks. A verified loop adds a
+// relative pose constraint to the pose graph, which is re-solved on a worker
+// thread.
+//
+// Frames:
+//  filter: the frame of the filter estimates (gsb);
+//  odometry: the filter frame with the jumps caused by loop feedback (see
+//    `NotifyJump`) undone, such that keyframe poses form a continuous odometry;
+//  corrected: the frame of the pose graph solution.
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "json/json.h"
+
+#include "core.h"
+
+namespace xivo {
+
+class LoopClosure;
+using LoopClosurePtr = LoopClosure *;
+
+struct LoopClosureOptions {
+  // keyframe selection
+  number_t min_translation = 0.25; // meters between keyframes
+  number_t min_rotation = 0.26;    // radians between keyframes
+  int min_landmarks = 15;          // features with depth for a keyframe
+
+  // place recognition
+  int num_tables = 8;      // number of hash tables
+  int key_bits = 12;       // bits per hash key
+  int exclude_recent = 30; // most recent keyframes not considered for loops
+  int max_candidates = 3;  // candidates passed to geometric verification
+  number_t min_score = 5.0; // minimal appearance score of a candidate
+
+  // geometric verification
+  number_t ratio_test = 0.8;   // Lowe's ratio test on descriptor distances
+  int max_hamming = 64;        // maximal descriptor distance of a match
+  number_t ransac_thresh = 0.01; // reprojection threshold, normalized coords
+  int ransac_iters = 200;
+  int min_inliers = 20;
+
+  // pose graph
+  std::string solver = "dense";
+  int max_iters = 20;
+  number_t odometry_std_rotation = 0.01;   // radians
+  number_t odometry_std_translation = 0.05; // meters
+  number_t loop_std_rotation = 0.02;
+  number_t loop_std_translation = 0.05;
+  bool use_robust_kernel = true;
+
+  // feedback to the filter
+  bool update_filter = false;
+  number_t feedback_std_rotation = 0.02;
+  number_t feedback_std_translation = 0.1;
+};
+
+/** A keyframe, i.e., a group along with the features visible at its frame. */
+struct Keyframe {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  int id;           // keyframe index, assigned when the keyframe is processed
+  int gid;          // id of the group the keyframe is made of
+  timestamp_t ts;
+  SE3 godom;        // body to odometry frame
+  SE3 gbc;          // camera to body
+  cv::Mat descriptors; // one row per feature
+  std::vector<Vec2> xc;          // normalized coordinates
+  std::vector<Vec3> Xc;          // landmarks in camera frame
+  std::vector<bool> has_landmark; // whether Xc is valid
+};
+using KeyframePtr = std::unique_ptr<Keyframe>;
+
+/** A relative pose constraint between keyframes found by place recognition. */
+struct LoopConstraint {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  int i, j; // keyframe indices, i < j
+  SE3 gij;  // pose of body j in body i
+  int inliers;
+};
+
+/** Inverted index of binary descriptors by locality-sensitive hashing. Each of
+ *  the tables hashes a descriptor by a random subset of its bits; keyframes
+ *  are scored by the number of query descriptors sharing a bucket with one of
+ *  theirs, weighted by the inverse frequency of the bucket. */
+class AppearanceIndex {
+public:
+  AppearanceIndex(int num_tables, int key_bits, uint32_t seed = 0);
+
+  void Add(int id, const cv::Mat &descriptors);
+  /** Returns up to `max_results` (id, score) pairs, best first, among
+   *  keyframes with id no larger than `max_id`. */
+  std::vector<std::pair<int, number_t>>
+  Query(const cv::Mat &descriptors, int max_id, int max_results) const;
+  int size() const { return size_; }
+
+private:
+  uint32_t Key(const uint8_t *desc, int table) const;
+
+  int num_tables_, key_bits_;
+  int desc_bytes_; // descriptor size, fixed by the first descriptor added
+  std::mt19937 rng_;
+  // bit positions of each table, drawn when the first descriptor arrives
+  std::vector<std::vector<int>> bits_;
+  // key -> ids of keyframes with a descriptor of that key
+  std::vector<std::unordered_map<uint32_t, std::vector<int>>> tables_;
+  int size_;
+};
+
+/** Estimates the pose of `query` relative to `cand` by matching descriptors
+ *  and PnP RANSAC of the query's observations against the candidate's
+ *  landmarks. Returns the number of inliers, 0 if verification failed. */
+int VerifyLoop(const Keyframe &cand, const Keyframe &query,
+               const LoopClosureOptions &options, SE3 *gcq);
+
+class LoopClosure {
+public:
+  static LoopClosurePtr Create(const Json::Value &cfg);
+  /** Returns nullptr if loop closure is not enabled. */
+  static LoopClosurePtr instance() { return instance_.get(); }
+  ~LoopClosure();
+
+  /** Called by the estimator once per frame with the newly created group and
+   *  the features tracked on the frame. The frame becomes a keyframe if the
+   *  body moved enough since the last keyframe. */
+  void AddFrame(GroupPtr g, const std::list<FeaturePtr> &features,
+                const SE3 &gbc);
+  /** Queues a keyframe for place recognition; its `godom` is expected in the
+   *  filter frame and converted here. */
+  void AddKeyframe(KeyframePtr kf);
+
+  /** Maps a body pose from the filter frame to the corrected frame. */
+  SE3 Correct(const SE3 &gsb) const;
+  /** If the pose graph was solved since the last call, returns true along
+   *  with the corrected body pose, to be used as a pose measurement. */
+  bool TakeFeedback(const SE3 &gsb, SE3 *gsb_corrected);
+  /** Tells the loop closure that the filter frame moved by `jump`, i.e.,
+   *  gsb_after = jump * gsb_before, after a feedback update. */
+  void NotifyJump(const SE3 &jump);
+
+  /** Blocks until all the queued keyframes are processed. */
+  void Flush();
+
+  /** Poses of the keyframes in the corrected frame. */
+  std::vector<std::pair<timestamp_t, SE3>> KeyframeTrajectory() const;
+  int num_keyframes() const;
+  int num_loops() const;
+  const LoopClosureOptions &options() const { return options_; }
+
+private:
+  LoopClosure(const LoopClosure &) = delete;
+  LoopClosure &operator=(const LoopClosure &) = delete;
+  LoopClosure(const Json::Value &cfg);
+  static std::unique_ptr<LoopClosure> instance_;
+
+  void Run();
+  /** Place recognition for one keyframe; returns true if a loop is found. */
+  bool Process(KeyframePtr kf);
+  void Optimize();
+
+  LoopClosureOptions options_;
+  AppearanceIndex index_;
+
+  // accessed by the estimator thread only
+  SE3 last_kf_pose_; // filter frame
+  bool has_kf_;
+
+  // shared between the estimator and the worker, guarded by `mtx_`
+  mutable std::mutex mtx_;
+  std::condition_variable cv_;
+  std::deque<KeyframePtr> pending_;
+  bool busy_, stop_;
+  SE3 godom_filter_;     // filter = godom_filter_ * odometry
+  SE3 gcorr_odom_;       // corrected = gcorr_odom_ * odometry
+  bool new_solution_;
+  std::vector<KeyframePtr> keyframes_;
+  std::vector<SE3> poses_; // corrected poses of the keyframes
+  std::vector<LoopConstraint> loops_;
+
+  std::thread worker_;
+};
+
+} // namespace xivo
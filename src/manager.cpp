@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <unordered_set>
 
 #include "glog/logging.h"
@@ -11,8 +12,48 @@
 #include "group.h"
 #include "tracker.h"
 
+#ifdef USE_G2O
+#include "loop_closure.h"
+#endif
+
 namespace xivo {
 
+std::vector<GroupPtr>
+SelectDiscardGroups(std::vector<GroupPtr> groups, int step,
+                    const std::unordered_set<GroupPtr> &pinned,
+                    const std::function<bool(GroupPtr)> &keep) {
+  // sort such that oldest groups are at the front of the vector
+  std::sort(groups.begin(), groups.end(),
+            [](GroupPtr g1, GroupPtr g2) { return g1->id() < g2->id(); });
+  // NOTE: start with 1 is NOT a mistake, since the oldest (index 0) one
+  // should be kept
+  // (0), 1, 2, (3), 4, 5 ...
+  // bracketed indices are those to keep
+  std::vector<GroupPtr> discards, pinned_discards;
+  for (int i = 1; i < groups.size(); ++i) {
+    if (i % step != 0 && !keep(groups[i])) {
+      (pinned.count(groups[i]) ? pinned_discards : discards)
+          .push_back(groups[i]);
+    }
+  }
+  // pinning every candidate would leave no slot for the new group: the
+  // queued features then lose these views instead
+  return discards.empty() ? pinned_discards : discards;
+}
+
+void DropQueued(const std::vector<FeaturePtr> &discards,
+                std::vector<std::pair<FeaturePtr, int>> *queue) {
+  if (discards.empty() || queue->empty()) {
+    return;
+  }
+  std::unordered_set<FeaturePtr> dropped(discards.begin(), discards.end());
+  queue->erase(std::remove_if(queue->begin(), queue->end(),
+                              [&dropped](const auto &item) {
+                                return dropped.count(item.first) > 0;
+                              }),
+               queue->end());
+}
+
 void Estimator::ProcessTracks(const timestamp_t &ts,
                               std::list<FeaturePtr> &tracks) {
   if (simulation_) {
@@ -22,6 +63,7 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
   }
   instate_features_.clear();
   oos_features_.clear();
+  structureless_features_.clear();
   instate_groups_.clear();
 
   // retrieve the visibility graph
@@ -76,6 +118,9 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
 #ifndef NDEBUG
       CHECK(f->track_status() == TrackStatus::TRACKED);
 #endif
+      if (track_quality_options_.enabled) {
+        f->SetNoiseScale(track_quality_options_.NoiseScale(f->quality()));
+      }
       if (f->instate()) {
         // instate feature being tracked -- use in measurement update later on
         ++it;
@@ -84,6 +129,14 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
         CHECK(!f->instate());
 #endif
 
+        // poorly tracked features are dropped before they cost anything
+        if (f->mean_noise_scale() > track_quality_options_.demote_scale) {
+          graph.RemoveFeature(f);
+          Feature::Delete(f);
+          it = tracks.erase(it);
+          continue;
+        }
+
         // perform triangulation before
         if (triangulate_pre_subfilter_ && f->size() == 2) {
           // got a second view, triangulate!
@@ -105,6 +158,10 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
     }
   }
 
+  if (use_OOS_ && oos_schedule_options_.budget_rows > 0) {
+    ScheduleOOS();
+  }
+
   // remaining in tracks: just created (not in graph yet) and being tracked well
   // (may or may not be in graph, for those in graph, may or may not in state)
   instate_features_ = graph.GetFeaturesIf([](FeaturePtr f) -> bool {
@@ -142,6 +199,8 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
           }
         } else {
           // FIXME: if not observation, should also skip
+          // an earlier refinement refers to groups which may be gone since
+          f->ResetInitJacobian();
           ++it;
         }
       } else {
@@ -155,22 +214,38 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
       }
 
       instate_features_.push_back(f);
-      AddFeatureToState(f); // insert f to state vector and covariance
       if (!f->ref()->instate()) {
 #ifndef NDEBUG
         CHECK(graph.HasGroup(f->ref()));
         CHECK(graph.GetGroupAdj(f->ref()).count(f->id()));
         CHECK(graph.GetFeatureAdj(f).count(f->ref()->id()));
 #endif
-        // need to add reference group to state if it's not yet instate
+        // need to add reference group to state if it's not yet instate,
+        // before the feature, which can be correlated with it
         AddGroupToState(f->ref());
         // use up one more free slot
         --free_slots;
       }
+      AddFeatureToState(f); // insert f to state vector and covariance
     }
     DiscardFeatures(bad_features);
   }
 
+  // OOS features with little parallax skip triangulation and depth refinement,
+  // and are used in the structureless update
+  if (use_structureless_) {
+    for (auto it = oos_features_.begin(); it != oos_features_.end();) {
+      auto f = *it;
+      if (Feature::Parallax(graph.GetObservationsOf(f), X_.Rbc) <
+          structureless_options_.max_parallax) {
+        structureless_features_.push_back(f);
+        it = oos_features_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
   // Perform depth refinement before using oos features
   if (!oos_features_.empty() && use_depth_opt_) {
     std::vector<FeaturePtr> bad_features;
@@ -180,8 +255,13 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
       if (obs.size() > 1 && f->RefineDepth(gbc(), obs, refinement_options_)) {
         ++it;
       } else {
-        // remove those failed to be optimized in depth refinement
-        bad_features.push_back(f);
+        // remove those failed to be optimized in depth refinement, or
+        // fall back to the structureless update
+        if (use_structureless_) {
+          structureless_features_.push_back(f);
+        } else {
+          bad_features.push_back(f);
+        }
         it = oos_features_.erase(it);
       }
     }
@@ -189,8 +269,10 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
   }
 
   // Once we have enough instate features, perform state update
-  if (!instate_features_.empty() || !oos_features_.empty()) {
+  if (!instate_features_.empty() || !oos_features_.empty() ||
+      !structureless_features_.empty()) {
     MakePtrVectorUnique(oos_features_);
+    MakePtrVectorUnique(structureless_features_);
     MakePtrVectorUnique(instate_features_);
 
     instate_groups_ =
@@ -208,6 +290,10 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
     graph.RemoveFeature(f);
     Feature::Delete(f);
   }
+  for (auto f : structureless_features_) {
+    graph.RemoveFeature(f);
+    Feature::Delete(f);
+  }
 
   // Post-update feature management
   // For instate features rejected by the filter,
@@ -258,26 +344,21 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
         graph.GetGroupsIf([](GroupPtr g) { return g->instate(); });
     if (groups.size() == kMaxGroup) {
       int oos_discard_step = cfg_.get("oos_discard_step", 3).asInt();
-      // sort such that oldest groups are at the front of the vector
-      std::sort(groups.begin(), groups.end(),
-                [](GroupPtr g1, GroupPtr g2) { return g1->id() < g2->id(); });
-      // NOTE: start with 1 is NOT a mistake, since the oldest (index 0) one
-      // should be kept
-      // (0), 1, 2, (3), 4, 5 ...
-      // bracketed indices are those to keep
-      for (int i = 1; i < groups.size(); ++i) {
-        if (i % oos_discard_step != 0) {
-          // if the group does not have instate features referring back to
-          // itself,
-          auto g = groups[i];
-          auto adj_f = graph.GetFeaturesOf(g);
-          if (std::none_of(adj_f.begin(), adj_f.end(), [g](FeaturePtr f) {
-                return f->instate() && f->ref() == g;
-              })) {
-            discards.push_back(g);
-          }
+      // groups observing queued features are kept until those are used
+      std::unordered_set<GroupPtr> pinned;
+      for (const auto &[f, frame] : oos_queue_) {
+        for (auto g : graph.GetGroupsOf(f)) {
+          pinned.insert(g);
         }
       }
+      discards = SelectDiscardGroups(
+          groups, oos_discard_step, pinned, [&graph](GroupPtr g) {
+            // groups which have instate features referring back to them
+            auto adj_f = graph.GetFeaturesOf(g);
+            return std::any_of(adj_f.begin(), adj_f.end(), [g](FeaturePtr f) {
+              return f->instate() && f->ref() == g;
+            });
+          });
     } // instate group size == kMaxGroup
   }   // use_OOS
 
@@ -289,6 +370,8 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
   // initialize those newly detected featuers
   // create a new group and associate newly detected features to the new group
   GroupPtr g = Group::Create(X_.Rsb, X_.Tsb);
+  g->SetTimestamp(ts);
+  g->SetMotion(X_.Vsb, imu_.Cg() * last_gyro_ - X_.bg);
   graph.AddGroup(g);
   if (use_OOS_) {
     // In OOS mode, always try to add groups to state.
@@ -306,7 +389,9 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
     CHECK(f->ref() == nullptr);
 #endif
     f->SetRef(g);
-    f->Initialize(init_z_, {init_std_x_, init_std_y_, init_std_z_});
+    f->Initialize(init_z_, {init_std_x_, init_std_y_, init_std_z_},
+                  depth_param_options_.adaptive ? DepthParam::INVERSE
+                                                : kDefaultDepthParam);
 
     graph.AddFeature(f);
     graph.AddFeatureToGroup(f, g);
@@ -332,6 +417,12 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
     tracks.push_back(f);
   }
 
+#ifdef USE_G2O
+  if (auto lc = LoopClosure::instance()) {
+    lc->AddFrame(g, tracks, gbc());
+  }
+#endif
+
   // adapt initial depth to average depth of features currently visible
   auto depth_features = graph.GetFeaturesIf([this](FeaturePtr f) -> bool {
     return f->status() == FeatureStatus::INSTATE ||
@@ -406,4 +497,54 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
   Canvas::instance()->SaveFrame();
 }
 
+void Estimator::ScheduleOOS() {
+  Graph &graph{*Graph::instance()};
+  for (auto f : oos_features_) {
+    oos_queue_.emplace_back(f, vision_counter_);
+  }
+  oos_features_.clear();
+
+  // rows of the OOS jacobian, once the feature is eliminated, and the oldest
+  // instate group observing the feature
+  struct Item {
+    FeaturePtr f;
+    int frame;
+    int rows;
+    int oldest;
+  };
+  std::vector<Item> items;
+  for (const auto &[f, frame] : oos_queue_) {
+    Item item{f, frame, -3, std::numeric_limits<int>::max()};
+    for (auto g : graph.GetGroupsOf(f)) {
+      if (g->instate()) {
+        item.rows += 2;
+        item.oldest = std::min(item.oldest, g->id());
+      }
+    }
+    if (OOS_max_views_ > 0) {
+      item.rows = std::min(item.rows, 2 * OOS_max_views_ - 3);
+    }
+    items.push_back(item);
+  }
+  std::sort(items.begin(), items.end(), [](const Item &a, const Item &b) {
+    return a.oldest < b.oldest || (a.oldest == b.oldest && a.frame < b.frame);
+  });
+
+  int rows{0};
+  oos_queue_.clear();
+  for (const auto &item : items) {
+    bool overdue =
+        vision_counter_ - item.frame >= oos_schedule_options_.max_wait;
+    if (overdue || oos_features_.empty() ||
+        rows + std::max(item.rows, 0) <= oos_schedule_options_.budget_rows) {
+      oos_features_.push_back(item.f);
+      rows += std::max(item.rows, 0);
+    } else {
+      oos_queue_.emplace_back(item.f, item.frame);
+    }
+  }
+  VLOG(0) << "OOS schedule: #used=" << oos_features_.size()
+          << " #rows=" << rows << " #queued=" << oos_queue_.size();
+}
+
 } // namespace xivo
@@ -0,0 +1,224 @@
+// Generic measurement models, and the block-sparse update of the estimator
+// with them.
+#include <algorithm>
+
+#include "glog/logging.h"
+
+#include "estimator.h"
+#include "feature.h"
+#include "graph.h"
+#include "group.h"
+#include "measurement.h"
+#include "rodrigues.h"
+
+namespace xivo {
+
+void StackMeasurements(const std::vector<LinearizedMeasurement> &meas,
+                       MatX *H, std::vector<int> *cols, VecX *residual,
+                       VecX *diagR) {
+  cols->clear();
+  int rows{0};
+  for (const auto &m : meas) {
+    CHECK(m.blocks.size() == m.jacobians.size());
+    CHECK(m.diagR.size() == m.residual.size());
+    rows += m.residual.size();
+    for (const auto &b : m.blocks) {
+      for (int i = 0; i < b.size; ++i) {
+        cols->push_back(b.offset + i);
+      }
+    }
+  }
+  std::sort(cols->begin(), cols->end());
+  cols->erase(std::unique(cols->begin(), cols->end()), cols->end());
+
+  // column of H of each column of the state involved
+  std::vector<int> where(cols->empty() ? 0 : cols->back() + 1, -1);
+  for (int j = 0; j < cols->size(); ++j) {
+    where[(*cols)[j]] = j;
+  }
+
+  H->setZero(rows, cols->size());
+  residual->resize(rows);
+  diagR->resize(rows);
+  int row{0};
+  for (const auto &m : meas) {
+    int size = m.residual.size();
+    for (int k = 0; k < m.blocks.size(); ++k) {
+      const auto &b = m.blocks[k];
+      CHECK(m.jacobians[k].rows() == size && m.jacobians[k].cols() == b.size)
+          << "jacobian of the wrong size";
+      for (int i = 0; i < b.size; ++i) {
+        // blocks involved twice add up
+        H->col(where[b.offset + i]).segment(row, size) +=
+            m.jacobians[k].col(i);
+      }
+    }
+    residual->segment(row, size) = m.residual;
+    diagR->segment(row, size) = m.diagR;
+    row += size;
+  }
+}
+
+number_t MahalanobisDistance(const LinearizedMeasurement &meas,
+                             const MatX &P) {
+  MatX H;
+  std::vector<int> cols;
+  VecX residual, diagR;
+  StackMeasurements({meas}, &H, &cols, &residual, &diagR);
+
+  MatX Pc(cols.size(), cols.size());
+  for (int i = 0; i < cols.size(); ++i) {
+    for (int j = 0; j < cols.size(); ++j) {
+      Pc(i, j) = P(cols[i], cols[j]);
+    }
+  }
+  MatX S = H * Pc * H.transpose();
+  S.diagonal() += diagR;
+  return residual.dot(S.ldlt().solve(residual));
+}
+
+bool PoseMeasurement::Linearize(const Estimator &est,
+                                LinearizedMeasurement *meas) {
+  SE3 measured;
+  {
+    std::scoped_lock lck(mtx_);
+    if (!pending_) {
+      return false;
+    }
+    pending_ = false;
+    measured = measured_;
+  }
+  *meas = Make(est.gsb(), measured, std_rotation_, std_translation_);
+  meas->MH_thresh = MH_thresh_;
+  return true;
+}
+
+void PoseMeasurement::Push(const SE3 &gsb) {
+  std::scoped_lock lck(mtx_);
+  measured_ = gsb;
+  pending_ = true;
+}
+
+LinearizedMeasurement PoseMeasurement::Make(const SE3 &gsb,
+                                            const SE3 &measured,
+                                            number_t std_rotation,
+                                            number_t std_translation) {
+  LinearizedMeasurement meas;
+  meas.residual.resize(6);
+  meas.residual << (gsb.R().inv() * measured.R()).log(),
+      measured.T() - gsb.T();
+  meas.diagR.resize(6);
+  meas.diagR << Vec3::Constant(std_rotation * std_rotation),
+      Vec3::Constant(std_translation * std_translation);
+  meas.Add(StateBlock::Pose(), MatX::Identity(6, 6));
+  return meas;
+}
+
+bool VelocityMeasurement::Linearize(const Estimator &est,
+                                    LinearizedMeasurement *meas) {
+  Vec3 measured;
+  {
+    std::scoped_lock lck(mtx_);
+    if (!pending_) {
+      return false;
+    }
+    pending_ = false;
+    measured = measured_;
+  }
+  *meas = Make(est.X().Rsb, est.Vsb(), measured, std_);
+  meas->MH_thresh = MH_thresh_;
+  return true;
+}
+
+void VelocityMeasurement::Push(const Vec3 &Vb) {
+  std::scoped_lock lck(mtx_);
+  measured_ = Vb;
+  pending_ = true;
+}
+
+LinearizedMeasurement VelocityMeasurement::Make(const SO3 &Rsb,
+                                                const Vec3 &Vsb,
+                                                const Vec3 &Vb, number_t std) {
+  // Vb = Rsb' Vsb, where Rsb * exp(W) turns Vb into exp(-W) Vb = Vb + Vb x W
+  Mat3 Rbs = Rsb.matrix().transpose();
+  Vec3 Vb_pred = Rbs * Vsb;
+
+  LinearizedMeasurement meas;
+  meas.residual = Vb - Vb_pred;
+  meas.diagR = Vec3::Constant(std * std);
+  MatX dVb_dpose = MatX::Zero(3, 6);
+  dVb_dpose.leftCols<3>() = hat(Vb_pred);
+  meas.Add(StateBlock::Pose(), dVb_dpose);
+  meas.Add(StateBlock::Velocity(), Rbs);
+  return meas;
+}
+
+void Estimator::RegisterMeasurement(MeasurementModelPtr model) {
+  std::scoped_lock lck(models_mtx_);
+  LOG(INFO) << "measurement model " << model->name() << " registered";
+  models_.push_back(model);
+}
+
+void Estimator::ModelUpdate() {
+  std::vector<LinearizedMeasurement> meas;
+  {
+    // models may be registered from another thread at any time
+    std::scoped_lock lck(models_mtx_);
+    if (models_.empty()) {
+      return;
+    }
+    timer_.Tick("models");
+    for (auto model : models_) {
+      LinearizedMeasurement m;
+      if (model->Linearize(*this, &m)) {
+        meas.push_back(std::move(m));
+      }
+    }
+  }
+  if (!meas.empty()) {
+    BlockSparseUpdate(meas);
+  }
+  timer_.Tock("models");
+}
+
+int Estimator::BlockSparseUpdate(
+    const std::vector<LinearizedMeasurement> &meas, bool joseph) {
+  std::vector<LinearizedMeasurement> inliers;
+  for (const auto &m : meas) {
+    if (m.MH_thresh >= 0) {
+      if (number_t chi2 = MahalanobisDistance(m, P_); chi2 > m.MH_thresh) {
+        VLOG(0) << "measurement gated, chi2=" << chi2;
+        continue;
+      }
+    }
+    inliers.push_back(m);
+  }
+  if (inliers.empty()) {
+    return 0;
+  }
+
+  // the update touches every instate group & feature, including the ones
+  // created after the last visual update
+  Graph &graph{*Graph::instance()};
+  instate_groups_ =
+      graph.GetGroupsIf([](GroupPtr g) -> bool { return g->instate(); });
+  instate_features_ =
+      graph.GetFeaturesIf([](FeaturePtr f) -> bool { return f->instate(); });
+
+  MatX H;
+  std::vector<int> cols;
+  VecX inn, diagR;
+  StackMeasurements(inliers, &H, &cols, &inn, &diagR);
+  number_t nis =
+      SparseCovarianceFormUpdate(H, cols, diagR, inn, P_, err_, joseph);
+  if (std::isfinite(nis)) {
+    nis_sum_ += nis;
+    ++num_updates_;
+  }
+  AbsorbError();
+  VLOG(0) << "block-sparse update with " << inliers.size()
+          << " measurements in " << cols.size() << " columns";
+  return inliers.size();
+}
+
+} // namespace xivo
@@ -0,0 +1,128 @@
+// Generic measurement models.
+//
+// A measurement model declares the blocks of the error state it involves,
+// e.g., the body pose, the camera to body alignment, group i or feature j,
+// and returns its residual, its Jacobian w.r.t. each of these blocks and the
+// diagonal of its covariance. Models registered with the estimator are
+// linearized at every image, gated one by one, and stacked in the columns
+// they involve only, such that their update costs nothing for the columns of
+// the state they do not touch.
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "core.h"
+
+namespace xivo {
+
+class Estimator;
+
+/** A block of consecutive columns of the error state. */
+struct StateBlock {
+  int offset, size;
+
+  /** Rotation and translation of the body, Rsb * exp(W), Tsb + T */
+  static StateBlock Pose() { return {Index::Wsb, 6}; }
+  static StateBlock Velocity() { return {Index::Vsb, 3}; }
+  /** The whole motion state, including biases and calibration */
+  static StateBlock Motion() { return {0, kMotionSize}; }
+  /** Rotation and translation of the camera to body alignment */
+  static StateBlock Alignment() { return {Index::Wbc, 6}; }
+  static StateBlock GroupPose(int sind) {
+    return {kGroupBegin + kGroupSize * sind, kGroupSize};
+  }
+  static StateBlock FeaturePoint(int sind) {
+    return {kFeatureBegin + kFeatureSize * sind, kFeatureSize};
+  }
+};
+
+/** A measurement linearized at the current estimate. */
+struct LinearizedMeasurement {
+  /** Adds the Jacobian of the predicted measurement w.r.t. a block, of
+   *  `residual.size()` rows and `block.size` columns. */
+  void Add(const StateBlock &block, const MatX &jacobian) {
+    blocks.push_back(block);
+    jacobians.push_back(jacobian);
+  }
+
+  std::vector<StateBlock> blocks;
+  std::vector<MatX> jacobians;
+  VecX residual; // measured - predicted
+  VecX diagR;    // diagonal of the measurement covariance
+  number_t MH_thresh{-1}; // Mahalanobis gate of the whole measurement, or
+                          // negative for none
+};
+
+class MeasurementModel {
+public:
+  virtual ~MeasurementModel() = default;
+  virtual std::string name() const = 0;
+  /** Linearizes the pending measurement, if any, at the estimate of `est`.
+   *  Returns false if there is none. Called from the thread of the
+   *  estimator, while measurements are usually fed from another one. */
+  virtual bool Linearize(const Estimator &est,
+                         LinearizedMeasurement *meas) = 0;
+};
+using MeasurementModelPtr = std::shared_ptr<MeasurementModel>;
+
+/** Stacks the measurements in the columns they involve: `cols` are the
+ *  indices in the error state of the columns of `H`, sorted. */
+void StackMeasurements(const std::vector<LinearizedMeasurement> &meas,
+                       MatX *H, std::vector<int> *cols, VecX *residual,
+                       VecX *diagR);
+
+/** Mahalanobis distance of a measurement under the covariance `P`. */
+number_t MahalanobisDistance(const LinearizedMeasurement &meas,
+                             const MatX &P);
+
+/** Direct measurement of the body pose, e.g., a pose prior or a pose
+ *  corrected by loop closure. */
+class PoseMeasurement : public MeasurementModel {
+public:
+  PoseMeasurement(number_t std_rotation, number_t std_translation,
+                  number_t MH_thresh = -1)
+      : std_rotation_{std_rotation}, std_translation_{std_translation},
+        MH_thresh_{MH_thresh}, pending_{false} {}
+  std::string name() const override { return "pose"; }
+  bool Linearize(const Estimator &est, LinearizedMeasurement *meas) override;
+  /** Sets the pose measured, in the spatial frame of the estimator, for the
+   *  next update. */
+  void Push(const SE3 &gsb);
+
+  /** Linearization of the measured pose `measured` at `gsb`. */
+  static LinearizedMeasurement Make(const SE3 &gsb, const SE3 &measured,
+                                    number_t std_rotation,
+                                    number_t std_translation);
+
+private:
+  number_t std_rotation_, std_translation_, MH_thresh_;
+  std::mutex mtx_;
+  bool pending_;
+  SE3 measured_;
+};
+
+/** Velocity of the body in the body frame, e.g., from wheel odometry; a zero
+ *  velocity update when the body is known to be still. */
+class VelocityMeasurement : public MeasurementModel {
+public:
+  VelocityMeasurement(number_t std, number_t MH_thresh = -1)
+      : std_{std}, MH_thresh_{MH_thresh}, pending_{false} {}
+  std::string name() const override { return "velocity"; }
+  bool Linearize(const Estimator &est, LinearizedMeasurement *meas) override;
+  void Push(const Vec3 &Vb);
+
+  /** Linearization of the measured body velocity `Vb` at the body rotation
+   *  `Rsb` and spatial velocity `Vsb`. */
+  static LinearizedMeasurement Make(const SO3 &Rsb, const Vec3 &Vsb,
+                                    const Vec3 &Vb, number_t std);
+
+private:
+  number_t std_, MH_thresh_;
+  std::mutex mtx_;
+  bool pending_;
+  Vec3 measured_;
+};
+
+} // namespace xivo
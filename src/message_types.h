@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <list>
+#include <utility>
 
 #include "core.h"
 
@@ -26,6 +27,14 @@ struct Image : public Message {
   std::string image_path_;
 };
 
+// events of an event camera up to ts_
+struct EventBatch : public Message {
+  EventBatch(const timestamp_t &ts, Events &&events)
+      : Message{ts}, events_{std::move(events)} {}
+
+  Events events_;
+};
+
 struct IMU : public Message {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+
 #include "feature.h"
 #include "helpers.h"
 #include "group.h"
@@ -6,21 +10,27 @@
 namespace xivo {
 
 int Feature::ComputeOOSJacobian(const std::vector<Observation> &vobs,
-                                const Mat3 &Rbc, const Vec3 &Tbc,
+                                const Mat3 &Rbc, const Vec3 &Tbc, number_t tr,
                                 const VecX &error_state) {
 
-  int num_constraints =
-      std::count_if(vobs.begin(), vobs.end(),
-                    [](const Observation &obs) { return obs.g->instate(); });
+  std::vector<Observation> instate_obs;
+  std::copy_if(vobs.begin(), vobs.end(), std::back_inserter(instate_obs),
+               [](const Observation &obs) { return obs.g->instate(); });
+  int num_constraints = instate_obs.size();
 
 // A constraint should involve at least 2 poses
-  if (num_constraints >= Estimator::instance()->OOS_update_min_observations()) {
+  auto est = Estimator::instance();
+  if (num_constraints >= est->OOS_update_min_observations()) {
     cache_.Xs = this->Xs(SE3{SO3{Rbc}, Tbc});
+
+    // near-duplicate consecutive views add rows but little information
+    if (int k = est->OOS_max_views(); k > 0 && num_constraints > k) {
+      instate_obs = SelectViews(cache_.Xs, std::move(instate_obs), Tbc, k);
+    }
+
     oos_jac_counter_ = 0;
-    for (auto obs : vobs) {
-      if (obs.g->instate()) {
-        ComputeOOSJacobianInternal(obs, Rbc, Tbc, error_state);
-      }
+    for (const auto &obs : instate_obs) {
+      ComputeOOSJacobianInternal(obs, Rbc, Tbc, tr, error_state);
     }
 
     // perform givens elimination
@@ -37,8 +47,71 @@ int Feature::ComputeOOSJacobian(const std::vector<Observation> &vobs,
   return oos_jac_counter_;
 }
 
+std::vector<int> Feature::SelectViews(const Vec3 &Xs,
+                                      const std::vector<Vec3> &centers,
+                                      int k) {
+  CHECK(k >= 2) << "the first and the last views are always selected";
+  int n = centers.size();
+  if (n <= k) {
+    std::vector<int> all(n);
+    std::iota(all.begin(), all.end(), 0);
+    return all;
+  }
+
+  std::vector<Vec3> rays;
+  for (const auto &c : centers) {
+    rays.push_back((Xs - c).normalized());
+  }
+  auto angle = [&rays](int i, int j) {
+    return std::atan2(rays[i].cross(rays[j]).norm(), rays[i].dot(rays[j]));
+  };
+
+  // the first and the last view span the track; then the view farthest from
+  // the ones selected, i.e., whose smallest angle to them is the largest
+  std::vector<int> selected{0};
+  std::vector<number_t> min_angle(n);
+  for (int i = 0; i < n; ++i) {
+    min_angle[i] = angle(i, 0);
+  }
+  min_angle[0] = -1; // selected
+  for (int next = n - 1; selected.size() < k;) {
+    selected.push_back(next);
+    min_angle[next] = -1;
+    for (int i = 0; i < n; ++i) {
+      if (min_angle[i] >= 0) {
+        min_angle[i] = std::min(min_angle[i], angle(i, next));
+      }
+    }
+    next = std::max_element(min_angle.begin(), min_angle.end()) -
+           min_angle.begin();
+  }
+  std::sort(selected.begin(), selected.end());
+  return selected;
+}
+
+std::vector<Observation> Feature::SelectViews(const Vec3 &Xs,
+                                              std::vector<Observation> obs,
+                                              const Vec3 &Tbc, int k) {
+  // the graph keeps the observations in hash order, the first and the last
+  // view are those of the oldest and the newest group
+  std::sort(obs.begin(), obs.end(),
+            [](const Observation &o1, const Observation &o2) {
+              return o1.g->id() < o2.g->id();
+            });
+  std::vector<Vec3> centers;
+  for (const auto &o : obs) {
+    centers.push_back(o.g->Tsb() + o.g->Rsb() * Tbc);
+  }
+  std::vector<Observation> selected;
+  for (int i : SelectViews(Xs, centers, k)) {
+    selected.push_back(obs[i]);
+  }
+  return selected;
+}
+
 void Feature::ComputeOOSJacobianInternal(const Observation &obs,
                                          const Mat3 &Rbc, const Vec3 &Tbc,
+                                         number_t tr,
                                          const VecX &error_state) {
 
   auto g = obs.g;
@@ -77,6 +150,17 @@ void Feature::ComputeOOSJacobianInternal(const Observation &obs,
     cache_.dXcn_dWbc.block<3,1>(0,i) = dXcn_dWbci;
   }
 
+  // rolling shutter: move the point to the exposure time of the observed row
+  // with the motion of the group when it was created, see ComputeJacobian
+  Vec3 dXcn_dt = -Rbc_t * (hat(g->gyro()) * Rsb_t * (cache_.Xs - Tsb) +
+                           Rsb_t * g->Vsb());
+  cache_.dXcn_dtr = dXcn_dt * RowOffset(obs.xp);
+  cache_.Xcn += tr * cache_.dXcn_dtr;
+
+#ifdef USE_BEARING_MEASUREMENT
+  cache_.xp = project_tangent(cache_.Xcn, obs.b, &cache_.dxp_dXcn);
+  oos_.inn.segment<2>(2 * oos_jac_counter_) = -cache_.xp;
+#else
   cache_.xcn = project(cache_.Xcn, &cache_.dxcn_dXcn);
 
   cache_.xp = Camera::instance()->Project(cache_.xcn, &cache_.dxp_dxcn);
@@ -84,6 +168,7 @@ void Feature::ComputeOOSJacobianInternal(const Observation &obs,
   cache_.dxp_dXcn = cache_.dxp_dxcn * cache_.dxcn_dXcn;
 
   oos_.inn.segment<2>(2 * oos_jac_counter_) = obs.xp - cache_.xp;
+#endif
 
   oos_.Hf.block<2, 3>(2 * oos_jac_counter_, 0) =
       cache_.dxp_dXcn * cache_.dXcn_dXs;
@@ -97,6 +182,10 @@ void Feature::ComputeOOSJacobianInternal(const Observation &obs,
       cache_.dxp_dXcn * cache_.dXcn_dWbc;
   oos_.Hx.block<2, 3>(2 * oos_jac_counter_, Index::Tbc) =
       cache_.dxp_dXcn * cache_.dXcn_dTbc;
+#ifdef USE_ONLINE_ROLLING_SHUTTER_CALIB
+  oos_.Hx.block<2, 1>(2 * oos_jac_counter_, Index::tr) =
+      cache_.dxp_dXcn * cache_.dXcn_dtr;
+#endif
   ++oos_jac_counter_;
 }
 
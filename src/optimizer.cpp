@@ -9,6 +9,24 @@
 
 namespace xivo {
 
+g2o::OptimizationAlgorithm *CreateOptimizationAlgorithm(const std::string &solver_type) {
+  // _6_3: poses are parametrized by 6-dim vectors and landmarks by 3-dim vectors
+  std::unique_ptr<g2o::BlockSolver_6_3::LinearSolverType> solver;
+  if (solver_type == "cholmod") {
+    solver = g2o::make_unique<g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>>();
+  } else if (solver_type == "csparse") {
+    solver = g2o::make_unique<g2o::LinearSolverCSparse<g2o::BlockSolver_6_3::PoseMatrixType>>();
+  } else if (solver_type == "dense") {
+    solver = g2o::make_unique<g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>>();
+  } else {
+    // default to cholmod
+    LOG(WARNING) << "unknown linear solver type; default to cholmod";
+    solver = g2o::make_unique<g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>>();
+  }
+  return new g2o::OptimizationAlgorithmLevenberg(
+      g2o::make_unique<g2o::BlockSolver_6_3>(std::move(solver)));
+}
+
 std::unique_ptr<Optimizer> Optimizer::instance_ = nullptr;
 
 OptimizerPtr Optimizer::Create(const Json::Value &cfg) {
@@ -38,27 +56,8 @@ Optimizer::Optimizer(const Json::Value &cfg)
   solver_type_ = cfg.get("solver", "cholmod").asString();
   use_robust_kernel_ = cfg.get("use_robust_kernel", true).asBool();
 
-  // _6_3: poses are parametrized by 6-dim vectors and landmarks by 3-dim vectors
-  std::unique_ptr<g2o::BlockSolver_6_3::LinearSolverType> solver;
-  if (solver_type_ == "cholmod") {
-    solver = g2o::make_unique<g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>>();
-  } else if (solver_type_ == "csparse") {
-    solver = g2o::make_unique<g2o::LinearSolverCSparse<g2o::BlockSolver_6_3::PoseMatrixType>>();
-  } else if (solver_type_ == "dense") {
-    solver = g2o::make_unique<g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>>();
-  } else {
-    // default to cholmod
-    LOG(WARNING) << "unknown linear solver type; default to cholmod";
-    solver = g2o::make_unique<g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>>();
-  }
-
-
   optimizer_.setVerbose(verbose_);
-
-  auto algorithm = new g2o::OptimizationAlgorithmLevenberg(
-      g2o::make_unique<g2o::BlockSolver_6_3>(std::move(solver)));
-
-  optimizer_.setAlgorithm(algorithm);
+  optimizer_.setAlgorithm(CreateOptimizationAlgorithm(solver_type_));
 }
 
 
@@ -16,6 +16,10 @@ namespace xivo {
 class Optimizer;
 using OptimizerPtr = Optimizer*;
 
+/** Creates a Levenberg-Marquardt algorithm with the given linear solver:
+ *  cholmod, csparse or dense. */
+g2o::OptimizationAlgorithm *CreateOptimizationAlgorithm(const std::string &solver_type);
+
 
 class Optimizer {
 public:
@@ -103,6 +103,34 @@ public:
   }
 };
 
+// Relative pose between two groups, e.g., from odometry or loop closure.
+// The measurement is gij = gi.inv() * gj; the error lives in the tangent space
+// of the same perturbation as GroupVertex: (rotation, translation).
+class RelativePoseEdge: public g2o::BaseBinaryEdge<6, SE3, GroupVertex, GroupVertex> {
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  RelativePoseEdge() = default;
+
+  void computeError() {
+    const GroupVertex* vi = static_cast<const GroupVertex*>(_vertices[0]);
+    const GroupVertex* vj = static_cast<const GroupVertex*>(_vertices[1]);
+    SE3 err = _measurement.inv() * vi->estimate().inv() * vj->estimate();
+    _error << err.R().log(), err.T();
+  }
+
+  // jacobians are computed numerically by g2o
+
+  virtual bool read(std::istream& is) {
+    std::cerr << __PRETTY_FUNCTION__ << " not implemented yet" << std::endl;
+    return false;
+  }
+
+  virtual bool write(std::ostream& os) const {
+    std::cerr << __PRETTY_FUNCTION__ << " not implemented yet" << std::endl;
+    return false;
+  }
+};
+
 struct FeatureAdapter {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   int id;
@@ -1,6 +1,8 @@
 // Options objects for various depth-related algorithms,
 // and policies for feature selection, etc.
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
+#include <algorithm>
+
 #include "options.h"
 #include "feature.h"
 
@@ -12,7 +14,9 @@ bool Criteria::Candidate(FeaturePtr f) {
           f->status() == FeatureStatus::INITIALIZING) &&
          (f->outlier_counter() < max_outlier_counter);
   // FIXME: use zmin, zmax parameters
-  good = good && (f->z() > 0.05 && f->z() < 5.0);
+  // far points are well-conditioned in inverse depth
+  good = good && (f->z() > 0.05 && (f->z() < 5.0 ||
+                                    f->depth_param() == DepthParam::INVERSE));
   return good;
 }
 
@@ -21,7 +25,8 @@ bool Criteria::CandidateStrict(FeaturePtr f) {
   bool good = f->status() == FeatureStatus::READY &&
          (f->outlier_counter() < max_outlier_counter);
   // FIXME: use zmin, zmax parameters
-  good = good && (f->z() > 0.05 && f->z() < 5.0);
+  good = good && (f->z() > 0.05 && (f->z() < 5.0 ||
+                                    f->depth_param() == DepthParam::INVERSE));
   return good;
 }
 
@@ -31,4 +36,25 @@ bool Criteria::CandidateComparison(FeaturePtr f1, FeaturePtr f2) {
   return (s1 > s2) || (s1 == s2 && f1->score() > f2->score());
 }
 
+number_t TrackQualityOptions::NoiseScale(const TrackQuality &q) const {
+  number_t fb = q.fb_error / fb_std;
+  number_t klt = q.klt_error / klt_error_std;
+  number_t scale = (1 + fb * fb) * (1 + klt * klt) * (1 + level_factor * q.level);
+  if (q.min_eig > 0 && q.min_eig < min_eig) {
+    scale *= min_eig / q.min_eig;
+  }
+  return std::min(scale, max_scale);
+}
+
+number_t RobustUpdateOptions::Weight(number_t e) const {
+  switch (kernel) {
+  case Kernel::HUBER:
+    return e <= width ? 1.0 : width / e;
+  case Kernel::CAUCHY:
+    return 1.0 / (1.0 + (e / width) * (e / width));
+  default:
+    return 1.0;
+  }
+}
+
 } // namespace xivo
@@ -8,11 +8,13 @@ namespace xivo {
 // depth refinement options
 struct RefinementOptions {
   RefinementOptions()
-      : two_view{false}, use_hessian{false}, max_iters{5}, eps{1e-5}, damping{1e-3},
-        max_res_norm{5.0} {}
+      : two_view{false}, use_hessian{false}, correlated_init{false}, max_iters{5},
+        eps{1e-5}, damping{1e-3}, max_res_norm{5.0} {}
 
   bool two_view;
   bool use_hessian; // overwrite feature covariance with inverse of Hessian from depth refinement
+  bool correlated_init; // insert features with their cross-covariance with the
+                        // poses they were refined from, see Feature::LinearizeInit
   int max_iters;      // maximal iterations to perform
   number_t eps;          // epsilon tolerance to stop optimization
   number_t damping;      // optional damping factor
@@ -38,6 +40,168 @@ struct TriangulateOptions {
   number_t zmin, zmax;
 };
 
+// options for the structureless (epipolar & three-view) update
+struct StructurelessOptions {
+  StructurelessOptions()
+      : max_parallax{0.035}, min_baseline{0.02}, min_views{3}, MH_thresh{3.0} {}
+
+  number_t max_parallax; // tracks with less parallax (radians) skip triangulation
+  number_t min_baseline; // minimal distance between successive views used
+  int min_views;         // minimal number of views to form constraints
+  number_t MH_thresh;    // Mahalanobis gating threshold per constraint
+};
+
+// options for the robust visual update: instead of hard Mahalanobis gating,
+// measurement blocks are down-weighted by an M-estimator kernel through a few
+// iteratively reweighted passes
+struct RobustUpdateOptions {
+  enum class Kernel { NONE, HUBER, CAUCHY };
+
+  RobustUpdateOptions()
+      : kernel{Kernel::NONE}, width{2.0}, iters{2}, min_weight{0.1} {}
+
+  /** Weight of a measurement block whose normalized residual is `e`, i.e.,
+   *  the residual in units of its standard deviation. */
+  number_t Weight(number_t e) const;
+
+  Kernel kernel;
+  number_t width;      // kernel width, in standard deviations
+  int iters;           // reweighting passes, the first one uses the innovation
+  number_t min_weight; // instate features weighted below this are dropped
+};
+
+// options of the online estimation of the visual measurement noise, which
+// scales the configured variance such that the normalized innovations of the
+// gating follow their distribution, see AdaptiveNoise
+struct AdaptiveNoiseOptions {
+  AdaptiveNoiseOptions()
+      : enabled{false}, window{300}, min_samples{50}, rate{0.05},
+        min_scale{0.25}, max_scale{4.0}, grid_cols{1}, grid_rows{1} {}
+
+  bool enabled;
+  int window;         // normalized innovations kept per cell
+  int min_samples;    // before the scale of a cell is adapted
+  number_t rate;      // fraction of the log-ratio corrected per frame
+  number_t min_scale, max_scale; // bounds of the scale of the variance
+  int grid_cols, grid_rows;      // cells of the image with their own scale
+};
+
+// options of the parametrization of the depth of features, see DepthParam:
+// features start in inverse depth, which keeps far points with a bounded
+// uncertainty, and switch to log-depth once their depth is well-conditioned
+struct DepthParamOptions {
+  DepthParamOptions()
+      : adaptive{false}, max_rel_std{0.1}, min_inverse_depth{1e-3} {}
+
+  bool adaptive;         // otherwise all features use kDefaultDepthParam
+  number_t max_rel_std;  // relative std of the depth to switch to log-depth
+  number_t min_inverse_depth; // of instate features, 1/m: the farthest point
+};
+
+// options to choose the form of the Kalman update: the covariance form
+// factors the innovation covariance, of the size of the measurement, and the
+// information form the information matrix, of the size of the states updated
+struct UpdateFormOptions {
+  enum class Form { AUTO, COVARIANCE, INFORMATION };
+
+  UpdateFormOptions() : form{Form::AUTO}, ratio{1.0} {}
+
+  Form form;
+  number_t ratio; // with AUTO, information form if #rows > ratio * #states
+};
+
+// options to turn the track quality reported by the tracker into measurement
+// noise, and to demote poorly tracked features
+struct TrackQualityOptions {
+  TrackQualityOptions()
+      : enabled{false}, fb_std{0.5}, klt_error_std{20}, min_eig{25},
+        level_factor{0.25}, max_scale{25}, demote_scale{6} {}
+
+  /** Multiplier of the measurement variance of an observation. */
+  number_t NoiseScale(const TrackQuality &q) const;
+
+  bool enabled;
+  number_t fb_std;        // forward-backward error considered nominal, pixels
+  number_t klt_error_std; // KLT error considered nominal
+  number_t min_eig;       // patches of lower Shi-Tomasi score are scaled up
+  number_t level_factor;  // extra variance per pyramid level
+  number_t max_scale;     // upper bound of the multiplier
+  number_t demote_scale;  // out-of-state features whose average multiplier
+                          // exceeds this are dropped
+};
+
+// options of the fiducial tag update
+struct FiducialOptions {
+  FiducialOptions()
+      : size{0.16}, corner_std{1.0}, MH_thresh{20.09},
+        init_std_rotation{0.05}, init_std_range{0.05} {}
+
+  number_t size;       // side length of tags not listed in the map, meters
+  number_t corner_std; // corner measurement noise, pixels
+  number_t MH_thresh;  // Mahalanobis gating threshold per tag (8 dof)
+  number_t init_std_rotation; // prior of a new tag state, radians
+  number_t init_std_range;    // prior of a new tag state, fraction of range
+};
+
+// options to re-anchor the spatial frame at the current pose on long runs, to
+// keep the magnitude of the nominal state bounded
+struct RecenterOptions {
+  RecenterOptions() : enabled{false}, max_distance{100}, yaw{false} {}
+
+  bool enabled;
+  number_t max_distance; // re-anchor once the body is this far from the origin
+  bool yaw; // also rotate the frame about gravity to the heading of the body
+};
+
+// options to choose the new reference group of a feature whose reference
+// leaves the graph
+struct OwnershipOptions {
+  OwnershipOptions() : min_depth{0.05}, min_parallax{0.02} {}
+
+  number_t min_depth;    // in the camera of the new reference
+  number_t min_parallax; // radians between the rays of the new reference and
+                         // of the latest view to the feature
+};
+
+// options of the direct update: in-state features keep intensity patches, and
+// the photometric error at their predicted location replaces KLT and the
+// reprojection error
+struct DirectUpdateOptions {
+  DirectUpdateOptions()
+      : enabled{false}, levels{3}, patch_size{7}, intensity_std{12},
+        min_eig{10} {}
+
+  bool enabled;
+  int levels;             // pyramid levels of the patches
+  int patch_size;         // pixels, on each level
+  number_t intensity_std; // photometric noise, gray levels
+  number_t min_eig;       // features of lower Shi-Tomasi score are rejected
+};
+
+// options to fuse the poses of independent estimators by covariance
+// intersection
+struct FusionOptions {
+  FusionOptions()
+      : max_dt{0.002}, align_frames{true}, max_iters{50}, max_pending{100} {}
+
+  number_t max_dt;   // estimates this close in time, seconds, are fused
+  bool align_frames; // map the spatial frames of the sources to the one of
+                     // the first source with the first estimates fused
+  int max_iters;     // of the search of the weights
+  int max_pending;   // estimates kept per source waiting for the others
+};
+
+// options to spread the OOS updates of features dropped at once over the
+// following frames
+struct OOSScheduleOptions {
+  OOSScheduleOptions() : budget_rows{0}, max_wait{5} {}
+
+  int budget_rows; // OOS measurement rows per frame, 0 to use every dropped
+                   // feature in the frame it is dropped
+  int max_wait;    // frames after which a dropped feature is used regardless
+                   // of the budget
+};
+
 struct Criteria {
   // how good is the feature to be an instate candidate
   static bool Candidate(FeaturePtr f);
@@ -0,0 +1,380 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "glog/logging.h"
+
+#include "shm_ring.h"
+
+namespace xivo {
+
+namespace {
+
+size_t AlignUp(size_t x, size_t alignment = 64) {
+  return (x + alignment - 1) / alignment * alignment;
+}
+
+#if CV_VERSION_MAJOR >= 4
+using AccessFlag = cv::AccessFlag;
+#else
+using AccessFlag = int;
+#endif
+
+// Allocator of the cv::Mat wrapping an image slot.
+// Pixels are never allocated here: the reader creates the cv::Mat header
+// around the slot and OpenCV calls `deallocate` once the last reference is
+// released, at which point the slot is handed back to the writer.
+class SlotAllocator : public cv::MatAllocator {
+public:
+  SlotAllocator(ShmRing *ring) : ring_{ring}, in_use_{0} {}
+
+  cv::UMatData *Wrap(int slot) const {
+    cv::UMatData *u = new cv::UMatData(this);
+    u->data = u->origdata = ring_->pixels(slot);
+    u->size = ring_->header()->step * ring_->header()->rows;
+    u->userdata = reinterpret_cast<void *>(static_cast<intptr_t>(slot));
+    u->refcount = 1;
+    ++in_use_;
+    return u;
+  }
+
+  int in_use() const { return in_use_; }
+
+  cv::UMatData *allocate(int dims, const int *sizes, int type, void *data,
+                         size_t *step, AccessFlag flags,
+                         cv::UMatUsageFlags usage_flags) const override {
+    return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step,
+                                                flags, usage_flags);
+  }
+
+  bool allocate(cv::UMatData *u, AccessFlag access_flags,
+                cv::UMatUsageFlags usage_flags) const override {
+    return u != nullptr;
+  }
+
+  void deallocate(cv::UMatData *u) const override {
+    if (!u)
+      return;
+    int slot = static_cast<int>(reinterpret_cast<intptr_t>(u->userdata));
+    ring_->slot(slot)->state.store(static_cast<uint32_t>(ShmSlotState::FREE),
+                                   std::memory_order_release);
+    --in_use_;
+    delete u;
+  }
+
+private:
+  ShmRing *ring_;
+  mutable std::atomic<int> in_use_;
+};
+
+} // namespace
+
+////////////////////////////////////////
+// ShmRing
+////////////////////////////////////////
+ShmRing::ShmRing(const std::string &name, void *base, size_t size, bool owner)
+    : name_{name}, base_{static_cast<uint8_t *>(base)}, size_{size},
+      owner_{owner} {
+  header_ = reinterpret_cast<ShmHeader *>(base_);
+  slots_ = reinterpret_cast<ShmSlot *>(base_ + AlignUp(sizeof(ShmHeader)));
+  imu_ = reinterpret_cast<ShmImuSample *>(
+      base_ + AlignUp(sizeof(ShmHeader)) +
+      AlignUp(sizeof(ShmSlot) * header_->num_slots));
+}
+
+ShmRing::~ShmRing() {
+  munmap(base_, size_);
+  if (owner_) {
+    shm_unlink(name_.c_str());
+  }
+}
+
+std::unique_ptr<ShmRing> ShmRing::Create(const std::string &name,
+                                         int num_slots, int rows, int cols,
+                                         int type, int imu_capacity) {
+  CHECK(num_slots > 0 && imu_capacity > 0);
+  uint64_t step = cols * CV_ELEM_SIZE(type);
+  uint64_t slot_bytes = AlignUp(step * rows);
+  uint64_t image_offset = AlignUp(sizeof(ShmHeader)) +
+                          AlignUp(sizeof(ShmSlot) * num_slots) +
+                          AlignUp(sizeof(ShmImuSample) * imu_capacity);
+  size_t size = image_offset + slot_bytes * num_slots;
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+  if (fd < 0) {
+    LOG(FATAL) << "failed to create shared memory " << name << ": "
+               << strerror(errno);
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    LOG(FATAL) << "failed to size shared memory " << name << ": "
+               << strerror(errno);
+  }
+  void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    LOG(FATAL) << "failed to map shared memory " << name << ": "
+               << strerror(errno);
+  }
+
+  auto header = new (base) ShmHeader;
+  header->version = kShmVersion;
+  header->num_slots = num_slots;
+  header->rows = rows;
+  header->cols = cols;
+  header->type = type;
+  header->step = step;
+  header->slot_bytes = slot_bytes;
+  header->image_offset = image_offset;
+  header->imu_capacity = imu_capacity;
+  header->frame_seq.store(0);
+  header->imu_seq.store(0);
+  header->dropped.store(0);
+
+  std::unique_ptr<ShmRing> ring{new ShmRing{name, base, size, true}};
+  for (int i = 0; i < num_slots; ++i) {
+    auto s = new (ring->slot(i)) ShmSlot;
+    s->state.store(static_cast<uint32_t>(ShmSlotState::FREE));
+    s->seq = 0;
+    s->ts = 0;
+  }
+  // publish the segment only when completely initialized
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = kShmMagic;
+  LOG(INFO) << "shared memory " << name << " created: " << num_slots
+            << " slots of " << rows << "x" << cols << ", " << imu_capacity
+            << " IMU samples";
+  return ring;
+}
+
+std::unique_ptr<ShmRing> ShmRing::Attach(const std::string &name) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0) {
+    LOG(FATAL) << "failed to open shared memory " << name << ": "
+               << strerror(errno);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ShmHeader)) {
+    close(fd);
+    LOG(FATAL) << "invalid shared memory " << name;
+  }
+  void *base =
+      mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    LOG(FATAL) << "failed to map shared memory " << name << ": "
+               << strerror(errno);
+  }
+  auto header = static_cast<ShmHeader *>(base);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (header->magic != kShmMagic || header->version != kShmVersion) {
+    munmap(base, st.st_size);
+    LOG(FATAL) << "shared memory " << name << " is not a ring of version "
+               << kShmVersion;
+  }
+  return std::unique_ptr<ShmRing>{new ShmRing{name, base, (size_t)st.st_size,
+                                              false}};
+}
+
+////////////////////////////////////////
+// ShmWriter
+////////////////////////////////////////
+ShmWriter::ShmWriter(const std::string &name, int num_slots, int rows,
+                     int cols, int type, int imu_capacity)
+    : ring_{ShmRing::Create(name, num_slots, rows, cols, type, imu_capacity)},
+      next_slot_{0} {}
+
+bool ShmWriter::WriteImage(const timestamp_t &ts, const cv::Mat &image) {
+  auto header = ring_->header();
+  CHECK(image.rows == (int)header->rows && image.cols == (int)header->cols &&
+        image.type() == header->type)
+      << "image does not fit in the slots";
+
+  constexpr auto FREE = static_cast<uint32_t>(ShmSlotState::FREE);
+  constexpr auto READY = static_cast<uint32_t>(ShmSlotState::READY);
+  constexpr auto WRITING = static_cast<uint32_t>(ShmSlotState::WRITING);
+
+  // look for a free slot, otherwise take over the oldest frame the reader
+  // has not claimed yet
+  int n = header->num_slots;
+  int slot = -1;
+  for (int i = 0; i < n && slot < 0; ++i) {
+    int k = (next_slot_ + i) % n;
+    uint32_t expected = FREE;
+    if (ring_->slot(k)->state.compare_exchange_strong(
+            expected, WRITING, std::memory_order_acquire)) {
+      slot = k;
+    }
+  }
+  if (slot < 0) {
+    int oldest = -1;
+    for (int k = 0; k < n; ++k) {
+      auto s = ring_->slot(k);
+      if (s->state.load(std::memory_order_acquire) == READY &&
+          (oldest < 0 || s->seq < ring_->slot(oldest)->seq)) {
+        oldest = k;
+      }
+    }
+    uint32_t expected = READY;
+    if (oldest >= 0 && ring_->slot(oldest)->state.compare_exchange_strong(
+                           expected, WRITING, std::memory_order_acquire)) {
+      slot = oldest;
+    }
+    header->dropped.fetch_add(1, std::memory_order_relaxed);
+    if (slot < 0) {
+      // all slots are held by the reader
+      return false;
+    }
+  }
+  next_slot_ = (slot + 1) % n;
+
+  auto s = ring_->slot(slot);
+  uint8_t *dst = ring_->pixels(slot);
+  size_t row_bytes = header->step;
+  if (image.isContinuous()) {
+    std::memcpy(dst, image.data, row_bytes * image.rows);
+  } else {
+    for (int r = 0; r < image.rows; ++r) {
+      std::memcpy(dst + r * row_bytes, image.ptr(r), row_bytes);
+    }
+  }
+  s->ts = ts.count();
+  s->seq = header->frame_seq.fetch_add(1, std::memory_order_relaxed) + 1;
+  s->state.store(READY, std::memory_order_release);
+  return true;
+}
+
+void ShmWriter::WriteInertial(const timestamp_t &ts, const Vec3 &gyro,
+                              const Vec3 &accel) {
+  auto header = ring_->header();
+  uint64_t seq = header->imu_seq.load(std::memory_order_relaxed);
+  auto sample = ring_->imu(seq);
+  sample->ts = ts.count();
+  for (int i = 0; i < 3; ++i) {
+    sample->gyro[i] = gyro(i);
+    sample->accel[i] = accel(i);
+  }
+  header->imu_seq.store(seq + 1, std::memory_order_release);
+}
+
+////////////////////////////////////////
+// ShmReader
+////////////////////////////////////////
+ShmReader::ShmReader(const std::string &name)
+    : ring_{ShmRing::Attach(name)}, allocator_{new SlotAllocator{ring_.get()}},
+      last_frame_seq_{0}, imu_overruns_{0} {
+  // start with the samples still in the ring
+  uint64_t imu_seq = ring_->header()->imu_seq.load(std::memory_order_acquire);
+  uint64_t window = ring_->header()->imu_capacity - 1;
+  imu_seq_ = imu_seq > window ? imu_seq - window : 0;
+}
+
+ShmReader::~ShmReader() {
+  // release claimed but undelivered slots
+  for (const auto &frame : frames_) {
+    ring_->slot(frame.slot)->state.store(
+        static_cast<uint32_t>(ShmSlotState::FREE), std::memory_order_release);
+  }
+  if (slots_in_use() > 0) {
+    // images are still referenced, e.g., by the buffer of the estimator
+    // singleton: keep the mapping and the allocator alive for them
+    LOG(WARNING) << slots_in_use()
+                 << " images from shared memory are still referenced";
+    ring_.release();
+    allocator_.release();
+  }
+}
+
+int ShmReader::slots_in_use() const {
+  return static_cast<SlotAllocator *>(allocator_.get())->in_use();
+}
+
+void ShmReader::ClaimImages() {
+  constexpr auto READY = static_cast<uint32_t>(ShmSlotState::READY);
+  constexpr auto READING = static_cast<uint32_t>(ShmSlotState::READING);
+
+  auto header = ring_->header();
+  for (uint32_t k = 0; k < header->num_slots; ++k) {
+    auto s = ring_->slot(k);
+    uint32_t expected = READY;
+    if (s->state.compare_exchange_strong(expected, READING,
+                                         std::memory_order_acquire)) {
+      if (s->seq > last_frame_seq_ + 1 && last_frame_seq_ > 0) {
+        LOG(WARNING) << s->seq - last_frame_seq_ - 1
+                     << " images dropped before reaching the estimator";
+      }
+      last_frame_seq_ = std::max(last_frame_seq_, s->seq);
+      frames_.push_back({s->ts, s->seq, static_cast<int>(k)});
+    }
+  }
+  std::sort(frames_.begin(), frames_.end(),
+            [](const Frame &f1, const Frame &f2) { return f1.ts < f2.ts; });
+}
+
+void ShmReader::ReadInertials() {
+  auto header = ring_->header();
+  uint64_t capacity = header->imu_capacity;
+  // the slot after the latest sample might be being written
+  uint64_t window = capacity - 1;
+  uint64_t imu_seq = header->imu_seq.load(std::memory_order_acquire);
+  if (imu_seq - imu_seq_ > window) {
+    imu_overruns_ += imu_seq - imu_seq_ - window;
+    LOG(WARNING) << imu_seq - imu_seq_ - window << " IMU samples lost";
+    imu_seq_ = imu_seq - window;
+  }
+  for (; imu_seq_ < imu_seq; ++imu_seq_) {
+    ShmImuSample sample = *ring_->imu(imu_seq_);
+    // the writer might have been overwriting the sample while we copied it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->imu_seq.load(std::memory_order_relaxed) - imu_seq_ >=
+        capacity) {
+      ++imu_overruns_;
+      continue;
+    }
+    imus_.push_back(sample);
+  }
+}
+
+cv::Mat ShmReader::Wrap(int slot) {
+  auto header = ring_->header();
+  auto allocator = static_cast<SlotAllocator *>(allocator_.get());
+  cv::Mat image(header->rows, header->cols, header->type, ring_->pixels(slot),
+                header->step);
+  image.u = allocator->Wrap(slot);
+  return image;
+}
+
+int ShmReader::Poll(const ImageCallback &on_image,
+                    const InertialCallback &on_inertial, bool flush) {
+  ReadInertials();
+  ClaimImages();
+
+  int count = 0;
+  while (!frames_.empty() || !imus_.empty()) {
+    bool image_first =
+        !frames_.empty() &&
+        (imus_.empty() ? flush : frames_.front().ts <= imus_.front().ts);
+    if (image_first) {
+      Frame frame = frames_.front();
+      frames_.pop_front();
+      // the cv::Mat releases the slot when the last reference is gone
+      on_image(timestamp_t{frame.ts}, Wrap(frame.slot));
+    } else if (!imus_.empty()) {
+      const auto &s = imus_.front();
+      on_inertial(timestamp_t{s.ts}, Vec3{s.gyro[0], s.gyro[1], s.gyro[2]},
+                  Vec3{s.accel[0], s.accel[1], s.accel[2]});
+      imus_.pop_front();
+    } else {
+      // images wait for the IMU to catch up
+      break;
+    }
+    ++count;
+  }
+  return count;
+}
+
+} // namespace xivo
@@ -0,0 +1,168 @@
+// Zero-copy ingestion of images and IMU samples written by a driver process
+// into POSIX shared memory.
+// The segment holds a ring of fixed-size image slots and a ring of IMU
+// samples:
+//
+//   | ShmHeader | ShmSlot x num_slots | ShmImuSample x imu_capacity | images |
+//
+// Each image slot carries a state word which hands the slot over between the
+// writer (FREE -> WRITING -> READY) and the reader (READY -> READING -> FREE).
+// The reader wraps the pixels of a slot as a cv::Mat without copying; the slot
+// is handed back to the writer once the last copy of that cv::Mat is gone,
+// i.e., after the estimator is done with the image.
+// IMU samples are written in order into a ring indexed by a monotonic
+// sequence counter.
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+#include "core.h"
+
+namespace xivo {
+
+constexpr uint32_t kShmMagic = 0x5849564f; // "XIVO"
+constexpr uint32_t kShmVersion = 1;
+
+enum class ShmSlotState : uint32_t {
+  FREE = 0,    // available to the writer
+  WRITING = 1, // being filled by the writer
+  READY = 2,   // filled, not yet claimed by the reader
+  READING = 3  // claimed by the reader, pixels in use
+};
+
+struct ShmHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_slots;    // number of image slots
+  uint32_t rows, cols;   // image size
+  int32_t type;          // OpenCV pixel type, e.g., CV_8UC1
+  uint64_t step;         // bytes per image row
+  uint64_t slot_bytes;   // bytes per image slot (padded)
+  uint64_t image_offset; // offset of the first image slot from the header
+  uint32_t imu_capacity; // number of IMU samples in the ring
+  std::atomic<uint64_t> frame_seq; // number of images written so far
+  std::atomic<uint64_t> imu_seq;   // number of IMU samples written so far
+  std::atomic<uint64_t> dropped;   // images dropped by the writer (ring full)
+};
+
+struct ShmSlot {
+  std::atomic<uint32_t> state;
+  uint64_t seq;     // frame sequence number, 1-based
+  int64_t ts;       // timestamp in nanoseconds
+};
+
+struct ShmImuSample {
+  int64_t ts; // timestamp in nanoseconds
+  double gyro[3];
+  double accel[3];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                  std::atomic<uint64_t>::is_always_lock_free,
+              "shared memory ring requires address-free atomics");
+
+/** Mapping of the shared memory segment, owned by either the writer, which
+ *  creates the segment, or the reader, which attaches to it. */
+class ShmRing {
+public:
+  /** Creates (and truncates) the segment `name`. */
+  static std::unique_ptr<ShmRing> Create(const std::string &name,
+                                         int num_slots, int rows, int cols,
+                                         int type, int imu_capacity);
+  /** Attaches to the existing segment `name`. */
+  static std::unique_ptr<ShmRing> Attach(const std::string &name);
+  ~ShmRing();
+
+  ShmHeader *header() const { return header_; }
+  ShmSlot *slot(int i) const { return slots_ + i; }
+  ShmImuSample *imu(uint64_t seq) const {
+    return imu_ + seq % header_->imu_capacity;
+  }
+  uint8_t *pixels(int i) const {
+    return base_ + header_->image_offset + i * header_->slot_bytes;
+  }
+
+private:
+  ShmRing(const std::string &name, void *base, size_t size, bool owner);
+  ShmRing(const ShmRing &) = delete;
+  ShmRing &operator=(const ShmRing &) = delete;
+
+  std::string name_;
+  uint8_t *base_;
+  size_t size_;
+  bool owner_; // unlink the segment on destruction
+  ShmHeader *header_;
+  ShmSlot *slots_;
+  ShmImuSample *imu_;
+};
+
+/** Producer side, used by the driver (or the synthetic writer). */
+class ShmWriter {
+public:
+  ShmWriter(const std::string &name, int num_slots, int rows, int cols,
+            int type, int imu_capacity);
+
+  /** Copies `image` into a free slot. Returns false, and counts the frame as
+   *  dropped, if all the slots are in use. */
+  bool WriteImage(const timestamp_t &ts, const cv::Mat &image);
+  /** Appends an IMU sample; the oldest samples are overwritten if the reader
+   *  falls behind by more than the capacity of the ring minus one. */
+  void WriteInertial(const timestamp_t &ts, const Vec3 &gyro,
+                     const Vec3 &accel);
+
+private:
+  std::unique_ptr<ShmRing> ring_;
+  int next_slot_; // where to start looking for a free slot
+};
+
+/** Consumer side. Images are handed out as cv::Mat pointing into the shared
+ *  memory. If some of them are still referenced when the reader is destroyed,
+ *  the mapping is kept, i.e., leaked, for them. */
+class ShmReader {
+public:
+  using ImageCallback = std::function<void(const timestamp_t &, const cv::Mat &)>;
+  using InertialCallback =
+      std::function<void(const timestamp_t &, const Vec3 &, const Vec3 &)>;
+
+  explicit ShmReader(const std::string &name);
+  ~ShmReader();
+
+  /** Claims newly written images and IMU samples, and delivers them in
+   *  timestamp order. An image is held back until an IMU sample at or after
+   *  its timestamp arrives, unless `flush` is set.
+   *  Returns the number of messages delivered. */
+  int Poll(const ImageCallback &on_image, const InertialCallback &on_inertial,
+           bool flush = false);
+
+  /** Number of images whose pixels are still referenced. */
+  int slots_in_use() const;
+  /** Number of IMU samples lost because the reader fell behind. */
+  uint64_t imu_overruns() const { return imu_overruns_; }
+
+private:
+  struct Frame {
+    int64_t ts;
+    uint64_t seq;
+    int slot;
+  };
+
+  void ClaimImages();
+  void ReadInertials();
+  cv::Mat Wrap(int slot);
+
+  std::unique_ptr<ShmRing> ring_;
+  std::unique_ptr<cv::MatAllocator> allocator_;
+  uint64_t last_frame_seq_; // sequence number of the last claimed image
+  uint64_t imu_seq_;        // next IMU sample to read
+  uint64_t imu_overruns_;
+  std::deque<Frame> frames_; // claimed, not yet delivered, in timestamp order
+  std::deque<ShmImuSample> imus_;
+};
+
+} // namespace xivo
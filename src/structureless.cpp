@@ -0,0 +1,184 @@
+// Structureless visual update: constraints among the in-state poses which
+// observe a feature, used without triangulating the feature.
+// With qi the bearing and ci the optical center of view i, both resolved in
+// the spatial frame, the epipolar (two-view) constraint of views i, j is
+//   e = (cj - ci) . (qi x qj) = 0
+// and the three-view constraint of views i, j, k, which ties the scale of the
+// two baselines, is
+//   s = (qj x qi) . (qk x (ck - cj)) - (qi x (cj - ci)) . (qk x qj) = 0
+// Reference:
+// Indelman et al., Real-time vision-aided localization and navigation based on
+// three-view geometry, IEEE Transactions on Aerospace and Electronic Systems,
+// 2012.
+#include <algorithm>
+
+#include "feature.h"
+#include "group.h"
+#include "helpers.h"
+#include "rodrigues.h"
+
+namespace xivo {
+
+namespace {
+// quantities of a single view needed by the constraints
+struct View {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  int goff;   // offset of the group pose in the error state
+  Vec3 q, c;  // bearing & optical center in spatial frame
+  Mat3 dq_dWsb, dq_dWbc;
+  Mat3 dc_dWsb, dc_dTbc;
+  Eigen::Matrix<number_t, 3, 2> dq_dxp; // w.r.t. pixel coordinates
+};
+} // namespace
+
+number_t Feature::Parallax(const std::vector<Obs> &vobs, const Mat3 &Rbc) {
+  number_t parallax{0};
+  bool first{true};
+  Vec3 b0;
+  for (const auto &obs : vobs) {
+    if (!obs.g->instate())
+      continue;
+    Mat3 Rsb = obs.g->Rsb();
+#ifdef USE_BEARING_MEASUREMENT
+    Vec3 b = Rsb * Rbc * obs.b;
+#else
+    Vec2 xc = Camera::instance()->UnProject(obs.xp);
+    Vec3 b = (Rsb * Rbc * Vec3{xc(0), xc(1), 1}).normalized();
+#endif
+    if (first) {
+      b0 = b;
+      first = false;
+    } else {
+      parallax = std::max<number_t>(
+          parallax, std::acos(std::min<number_t>(1.0, b0.dot(b))));
+    }
+  }
+  return parallax;
+}
+
+int Feature::ComputeStructurelessJacobian(
+    const std::vector<Obs> &vobs, const Mat3 &Rbc, const Vec3 &Tbc,
+    const StructurelessOptions &options) {
+
+  oos_jac_counter_ = 0;
+
+  std::vector<Obs> instate_obs;
+  std::copy_if(vobs.begin(), vobs.end(), std::back_inserter(instate_obs),
+               [](const Obs &obs) { return obs.g->instate(); });
+  // oldest first
+  std::sort(instate_obs.begin(), instate_obs.end(),
+            [](const Obs &o1, const Obs &o2) { return o1.g->id() < o2.g->id(); });
+
+  // select views such that successive views are apart by at least
+  // the minimal baseline
+  std::vector<View, Eigen::aligned_allocator<View>> views;
+  for (const auto &obs : instate_obs) {
+    Mat3 Rsb = obs.g->Rsb();
+    Vec3 c = Rsb * Tbc + obs.g->Tsb();
+    if (!views.empty() && (c - views.back().c).norm() < options.min_baseline) {
+      continue;
+    }
+
+    Mat2 dxc_dxp;
+    Vec2 xc = Camera::instance()->UnProject(obs.xp, &dxc_dxp);
+    Vec3 xc_h{xc(0), xc(1), 1};
+    Mat3 Rsc = Rsb * Rbc;
+
+    View v;
+    v.goff = kGroupBegin + 6 * obs.g->sind();
+    v.q = Rsc * xc_h;
+    v.c = c;
+    v.dq_dWsb = -Rsb * hat(Rbc * xc_h);
+    v.dq_dWbc = -Rsc * hat(xc_h);
+    v.dc_dWsb = -Rsb * hat(Tbc);
+    v.dc_dTbc = Rsb;
+    v.dq_dxp = Rsc.leftCols<2>() * dxc_dxp;
+    views.push_back(v);
+  }
+
+  int m = views.size();
+  if (m < std::max(2, options.min_views)) {
+    return 0;
+  }
+
+  // (m-1) epipolar and (m-2) three-view constraints
+  int rows = 2 * m - 3;
+  VecX e(rows);
+  MatX Hx(rows, kFullSize);
+  MatX Hz(rows, 2 * m); // w.r.t. pixel measurements
+  Hx.setZero();
+  Hz.setZero();
+
+  // accumulate the Jacobian of a constraint w.r.t. the bearing and the optical
+  // center of a view
+  auto add_q = [&](int row, int k, const Vec3 &de_dq) {
+    const View &v = views[k];
+    Hx.block<1, 3>(row, v.goff) += de_dq.transpose() * v.dq_dWsb;
+    Hx.block<1, 3>(row, Index::Wbc) += de_dq.transpose() * v.dq_dWbc;
+    Hz.block<1, 2>(row, 2 * k) += de_dq.transpose() * v.dq_dxp;
+  };
+  auto add_c = [&](int row, int k, const Vec3 &de_dc) {
+    const View &v = views[k];
+    Hx.block<1, 3>(row, v.goff) += de_dc.transpose() * v.dc_dWsb;
+    Hx.block<1, 3>(row, v.goff + 3) += de_dc.transpose();
+    Hx.block<1, 3>(row, Index::Tbc) += de_dc.transpose() * v.dc_dTbc;
+  };
+
+  int row = 0;
+  for (int k = 1; k < m; ++k) {
+    // epipolar constraint between view k-1 and k
+    const Vec3 &qi = views[k - 1].q;
+    const Vec3 &qj = views[k].q;
+    Vec3 t = views[k].c - views[k - 1].c;
+    Vec3 n = qi.cross(qj);
+    e(row) = t.dot(n);
+    add_q(row, k - 1, qj.cross(t));
+    add_q(row, k, t.cross(qi));
+    add_c(row, k - 1, -n);
+    add_c(row, k, n);
+    ++row;
+
+    if (k >= 2) {
+      // three-view constraint among view k-2, k-1 and k
+      const Vec3 &q1 = views[k - 2].q;
+      const Vec3 &q2 = views[k - 1].q;
+      const Vec3 &q3 = views[k].q;
+      Vec3 t12 = views[k - 1].c - views[k - 2].c;
+      Vec3 t23 = views[k].c - views[k - 1].c;
+      Vec3 a = q2.cross(q1);
+      Vec3 b = q3.cross(t23);
+      Vec3 c = q1.cross(t12);
+      Vec3 d = q3.cross(q2);
+      e(row) = a.dot(b) - c.dot(d);
+
+      Vec3 ds_dt12 = -(d.transpose() * hat(q1)).transpose();
+      Vec3 ds_dt23 = (a.transpose() * hat(q3)).transpose();
+      add_q(row, k - 2,
+            (b.transpose() * hat(q2) + d.transpose() * hat(t12)).transpose());
+      add_q(row, k - 1,
+            (-b.transpose() * hat(q1) - c.transpose() * hat(q3)).transpose());
+      add_q(row, k,
+            (-a.transpose() * hat(t23) + c.transpose() * hat(q2)).transpose());
+      add_c(row, k - 2, -ds_dt12);
+      add_c(row, k - 1, ds_dt12 - ds_dt23);
+      add_c(row, k, ds_dt23);
+      ++row;
+    }
+  }
+
+  // The constraints share pixel measurements, thus are correlated.
+  // Whiten them with the covariance induced by unit pixel noise such that
+  // each row carries the same noise as an OOS measurement.
+  MatX Rz = Hz * Hz.transpose();
+  Eigen::LLT<MatX> llt(Rz);
+  if (llt.info() != Eigen::Success) {
+    return 0;
+  }
+  oos_.inn.head(rows) = llt.matrixL().solve(-e);
+  oos_.Hx.topRows(rows) = llt.matrixL().solve(Hx);
+  oos_jac_counter_ = rows;
+
+  return oos_jac_counter_;
+}
+
+} // namespace xivo
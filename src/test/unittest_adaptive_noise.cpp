@@ -0,0 +1,81 @@
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "adaptive_noise.h"
+
+
+using namespace xivo;
+
+
+// normalized innovation of a 2D measurement of variance `ratio` times the one
+// assumed, when the measurement noise dominates the innovation covariance
+number_t Sample(std::mt19937 &rng, number_t ratio) {
+    std::normal_distribution<number_t> normal;
+    number_t x = normal(rng), y = normal(rng);
+    return ratio * (x * x + y * y);
+}
+
+
+TEST(AdaptiveNoise, Converges) {
+    AdaptiveNoiseOptions options;
+    options.rate = 0.1;
+    // the median of fewer samples is off by several percent
+    options.window = 2000;
+    AdaptiveNoise noise(options, 640, 480);
+    std::mt19937 rng(0);
+    for (int frame = 0; frame < 600; ++frame) {
+        for (int i = 0; i < 20; ++i) {
+            noise.AddSample(Vec2{320, 240}, Sample(rng, 2.0 / noise.scale()));
+        }
+        noise.Adapt();
+    }
+    EXPECT_NEAR(noise.scale(), 2.0, 0.2);
+    EXPECT_EQ(noise.scale(Vec2{0, 0}), noise.scale());
+}
+
+
+TEST(AdaptiveNoise, Bounded) {
+    AdaptiveNoiseOptions options;
+    options.rate = 0.5;
+    AdaptiveNoise noise(options, 640, 480);
+    // too few samples to adapt
+    for (int i = 0; i + 1 < options.min_samples; ++i) {
+        noise.AddSample(Vec2{320, 240}, 1e3);
+    }
+    noise.Adapt();
+    EXPECT_EQ(noise.scale(), 1);
+
+    for (int frame = 0; frame < 100; ++frame) {
+        noise.AddSample(Vec2{320, 240}, 1e3);
+        noise.Adapt();
+    }
+    EXPECT_NEAR(noise.scale(), options.max_scale, 1e-9);
+}
+
+
+TEST(AdaptiveNoise, Grid) {
+    AdaptiveNoiseOptions options;
+    options.rate = 0.1;
+    // the median of fewer samples is off by several percent
+    options.window = 2000;
+    options.grid_cols = 2;
+    options.grid_rows = 1;
+    AdaptiveNoise noise(options, 640, 480);
+    std::mt19937 rng(0);
+    Vec2 left{100, 240}, right{600, 240};
+    for (int frame = 0; frame < 600; ++frame) {
+        for (int i = 0; i < 20; ++i) {
+            noise.AddSample(left, Sample(rng, 0.5 / noise.scale(left)));
+            noise.AddSample(right, Sample(rng, 2.0 / noise.scale(right)));
+        }
+        noise.Adapt();
+    }
+    EXPECT_NEAR(noise.scale(left), 0.5, 0.05);
+    EXPECT_NEAR(noise.scale(right), 2.0, 0.2);
+    // geometric mean of the cells
+    EXPECT_NEAR(noise.scale(), 1.0, 0.1);
+    // out of the image falls in the nearest cell
+    EXPECT_EQ(noise.scale(Vec2{-5, 240}), noise.scale(left));
+    EXPECT_EQ(noise.scale(Vec2{700, 500}), noise.scale(right));
+}
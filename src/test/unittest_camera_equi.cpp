@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "core.h"
+#include "project.h"
 
 #include <random>
 
@@ -145,4 +146,50 @@ TEST(CamerasEqui, EquiProjectionJacc) {
   EXPECT_FLOAT_EQ((px_proj_k3(0) - px_proj(0)) / delta, px_jacc(0,7));
   EXPECT_FLOAT_EQ((px_proj_k3(1) - px_proj(1)) / delta, px_jacc(1,7));
   cam->UpdateState(-dX_k3);
-}
\ No newline at end of file
+}
+
+TEST(CamerasEqui, EquiUnProjectBearing) {
+  auto cfg_ = LoadJson("src/test/camera_configs.json");
+  CameraManager *cam = Camera::Create(cfg_["phab_equi"]);
+
+  // within the field of view, the bearing agrees with UnProject
+  Vec2 xc{0.3, -0.2};
+  Vec3 b = cam->UnProjectBearing(cam->Project(xc));
+  Vec3 b_gt = Vec3{xc(0), xc(1), 1}.normalized();
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_NEAR(b(i), b_gt(i), 1e-8);
+  }
+
+  // beyond 90 degrees of incidence, with a lens whose distortion stays
+  // monotonic there
+  EquidistantCamera<number_t> fisheye{512, 512, 160, 160, 256, 256,
+                                      0.01, -0.002, 0, 0};
+  number_t th = 1.8, phi = 0.7;
+  number_t r = th + 0.01 * pow(th, 3) - 0.002 * pow(th, 5);
+  Vec2 xp{160 * r * cos(phi) + 256, 160 * r * sin(phi) + 256};
+  b = fisheye.UnProjectBearing(xp);
+  EXPECT_LT(b(2), 0);
+  EXPECT_NEAR(acos(b(2)), th, 1e-8);
+  EXPECT_NEAR(atan2(b(1), b(0)), phi, 1e-8);
+}
+
+
+TEST(CamerasEqui, TangentProjectionJac) {
+  Vec3 b = Vec3{0.2, -0.5, -0.8}.normalized();
+  Vec3 Xc{0.5, -1.0, -2.0};
+
+  Mat23 jac;
+  Vec2 xt = project_tangent(Xc, b, &jac);
+  EXPECT_NEAR(xt.norm(), sin(acos(b.dot(Xc.normalized()))), 1e-8);
+  EXPECT_NEAR(project_tangent(Vec3{2 * b}, b).norm(), 0, 1e-12);
+
+  number_t delta = 1e-6;
+  for (int i = 0; i < 3; ++i) {
+    Vec3 dX = Vec3::Zero();
+    dX(i) = delta;
+    Vec2 num = (project_tangent(Vec3{Xc + dX}, b) -
+                project_tangent(Vec3{Xc - dX}, b)) / (2 * delta);
+    EXPECT_NEAR(num(0), jac(0, i), 1e-6);
+    EXPECT_NEAR(num(1), jac(1, i), 1e-6);
+  }
+}
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#define private public
+
+#include "alias.h"
+#include "feature.h"
+#include "mm.h"
+
+#include "unittest_helpers.h"
+
+
+using namespace xivo;
+
+
+/* Checks that switching the depth parametrization of a feature keeps the
+ * point and, to first order, its covariance and its correlations. */
+class DepthParamTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        MemoryManager::Create(256, 128);
+        auto cfg = LoadJson("src/test/camera_configs.json");
+        Camera::Create(cfg["perfect_pinhole"]);
+
+        // a far point, 30 meters away
+        Vec2 xp = Camera::instance()->Project(Vec2{0.1, -0.05});
+        f = Feature::Create(xp(0), xp(1));
+        f->Initialize(30.0, {0.01, 0.01, 0.5}, DepthParam::INVERSE);
+    }
+
+    // covariance of the point in the reference camera
+    Mat3 CovXc(const Mat3 &P) {
+        Mat3 J;
+        f->Xc(&J);
+        return J * P * J.transpose();
+    }
+
+    FeaturePtr f;
+    MatX P; // unused while the feature is not instate
+};
+
+
+TEST_F(DepthParamTest, Initialize) {
+    EXPECT_EQ(f->depth_param(), DepthParam::INVERSE);
+    EXPECT_NEAR(f->z(), 30.0, 1e-9);
+    Mat3 cov = CovXc(f->P());
+
+    f->Initialize(30.0, {0.01, 0.01, 0.5}, DepthParam::LOG);
+    EXPECT_NEAR(f->z(), 30.0, 1e-9);
+    EXPECT_NEAR((CovXc(f->P()) - cov).norm(), 0, 1e-9 * cov.norm());
+}
+
+
+TEST_F(DepthParamTest, Local) {
+    Vec3 Xc = f->Xc();
+    Mat3 cov = CovXc(f->P());
+    // dependence of the point on a group
+    f->init_jac_c_.setRandom();
+    Mat3 J;
+    f->Xc(&J);
+    Feature::InitJacobian JA = J * f->init_jac_c_;
+
+    f->SetDepthParam(DepthParam::LOG, P);
+    EXPECT_EQ(f->depth_param(), DepthParam::LOG);
+    EXPECT_NEAR(f->x()(2), std::log(30.0), 1e-9);
+    EXPECT_NEAR((f->Xc() - Xc).norm(), 0, 1e-9);
+    EXPECT_NEAR((CovXc(f->P()) - cov).norm(), 0, 1e-9 * cov.norm());
+    f->Xc(&J);
+    EXPECT_NEAR((J * f->init_jac_c_ - JA).norm(), 0, 1e-9 * JA.norm());
+}
+
+
+TEST_F(DepthParamTest, Instate) {
+    f->SetSind(2);
+    f->SetStatus(FeatureStatus::INSTATE);
+    int offset = kFeatureBegin + kFeatureSize * 2;
+    MatX L = MatX::Random(kFullSize, kFullSize);
+    P = L * L.transpose();
+    MatX P0 = P;
+
+    Mat3 J;
+    f->Xc(&J);
+    Mat3 cov = J * P.block<3, 3>(offset, offset) * J.transpose();
+    MatX cross = J * P.block(offset, 0, 3, kFullSize);
+
+    f->SetDepthParam(DepthParam::LOG, P);
+    f->Xc(&J);
+    EXPECT_NEAR((J * P.block<3, 3>(offset, offset) * J.transpose() - cov).norm(),
+                0, 1e-9 * cov.norm());
+    MatX cross1 = J * P.block(offset, 0, 3, kFullSize);
+    // but for the columns of the feature itself
+    cross1.middleCols<3>(offset) = cross.middleCols<3>(offset);
+    EXPECT_NEAR((cross1 - cross).norm(), 0, 1e-9 * cross.norm());
+    EXPECT_EQ(P, P.transpose());
+
+    // and back
+    f->SetDepthParam(DepthParam::INVERSE, P);
+    EXPECT_NEAR((P - P0).norm(), 0, 1e-9 * P0.norm());
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include "tracker.h"
+
+#include "unittest_helpers.h"
+
+
+using namespace xivo;
+
+
+// soft blobs
+const BlobTexture kTexture(40, 6, 150, 30, Vec2::Zero(), Vec2{160, 120}, 3);
+
+
+// pyramid of the blobs translated by `shift`
+std::vector<cv::Mat> Render(int rows, int cols, int num_levels,
+                            const Vec2 &shift) {
+    std::vector<cv::Mat> levels;
+    for (int l = 0; l < num_levels; ++l) {
+        levels.push_back(RenderBlobs(kTexture, rows, cols, shift, l));
+    }
+    return levels;
+}
+
+
+TEST(DirectUpdate, PhotometricResidual) {
+    int rows = 120, cols = 160;
+    Vec2 shift{1.6, -1.1};
+    auto levels0 = Render(rows, cols, 3, Vec2::Zero());
+    auto levels1 = Render(rows, cols, 3, shift);
+
+    // interpolation and the 8-bit images leave some error per patch
+    number_t error{0};
+    int tested{0};
+    for (int y = 30; y < rows - 30; y += 15) {
+        for (int x = 30; x < cols - 30; x += 15) {
+            Vec2 xp{x, y};
+            PhotometricPatch patch;
+            ASSERT_TRUE(SamplePatch(levels0, xp, 7, &patch));
+            ASSERT_EQ(patch.size(), 3);
+            EXPECT_NEAR(patch[1].mean(), 0, 1e-9);
+
+            // Gauss-Newton on the photometric error recovers the shift
+            Mat2 Lt;
+            Vec2 r;
+            if (!PhotometricResidual(patch, levels1, xp, 5, &Lt, &r)) {
+                continue; // flat
+            }
+            EXPECT_EQ(Lt(1, 0), 0);
+            Vec2 d = Lt.triangularView<Eigen::Upper>().solve(r);
+            for (int iter = 0; iter < 3; ++iter) {
+                ASSERT_TRUE(
+                    PhotometricResidual(patch, levels1, xp + d, 0, &Lt, &r));
+                d += Lt.triangularView<Eigen::Upper>().solve(r);
+            }
+            EXPECT_LT((d - shift).norm(), 0.3) << "at " << xp.transpose();
+            error += (d - shift).norm();
+            ++tested;
+        }
+    }
+    ASSERT_GE(tested, 10);
+    EXPECT_LT(error / tested, 0.1);
+
+    // patches leaving the coarsest level
+    PhotometricPatch patch;
+    EXPECT_FALSE(SamplePatch(levels0, Vec2{8, 60}, 7, &patch));
+    EXPECT_TRUE(patch.empty());
+}
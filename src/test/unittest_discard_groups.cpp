@@ -0,0 +1,98 @@
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "estimator.h"
+#include "feature.h"
+#include "group.h"
+#include "mm.h"
+
+
+using namespace xivo;
+
+
+class DiscardGroupsTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        MemoryManager::Create(256, 128);
+        for (int i = 0; i < kMaxGroup; ++i) {
+            groups.push_back(Group::Create(SO3{}, Vec3::Zero()));
+        }
+    }
+
+    // all but the oldest and every `step`-th one
+    std::vector<GroupPtr> Expected(int step) {
+        std::vector<GroupPtr> expected;
+        for (int i = 1; i < groups.size(); ++i) {
+            if (i % step != 0) {
+                expected.push_back(groups[i]);
+            }
+        }
+        return expected;
+    }
+
+    std::vector<GroupPtr> groups;
+    std::function<bool(GroupPtr)> none = [](GroupPtr) { return false; };
+};
+
+
+TEST_F(DiscardGroupsTest, Oldest) {
+    std::vector<GroupPtr> shuffled(groups.rbegin(), groups.rend());
+    EXPECT_EQ(SelectDiscardGroups(shuffled, 3, {}, none), Expected(3));
+}
+
+
+TEST_F(DiscardGroupsTest, Keep) {
+    auto discards = SelectDiscardGroups(
+        groups, 3, {}, [this](GroupPtr g) { return g == groups[1]; });
+    auto expected = Expected(3);
+    expected.erase(expected.begin());
+    EXPECT_EQ(discards, expected);
+}
+
+
+TEST_F(DiscardGroupsTest, Pinned) {
+    std::unordered_set<GroupPtr> pinned{groups[1], groups[2]};
+    auto discards = SelectDiscardGroups(groups, 3, pinned, none);
+    ASSERT_FALSE(discards.empty());
+    for (auto g : discards) {
+        EXPECT_FALSE(pinned.count(g));
+    }
+}
+
+
+TEST_F(DiscardGroupsTest, FullWindowPinned) {
+    // long queued tracks observed by every group of the full window
+    std::unordered_set<GroupPtr> pinned(groups.begin(), groups.end());
+    EXPECT_EQ(SelectDiscardGroups(groups, 3, pinned, none), Expected(3));
+}
+
+
+TEST_F(DiscardGroupsTest, FullWindowPinnedQueue) {
+    // one queued feature referring to each group, all groups pinned
+    std::vector<std::pair<FeaturePtr, int>> queue;
+    std::unordered_set<GroupPtr> pinned;
+    for (auto g : groups) {
+        auto f = Feature::Create(0, 0);
+        f->SetRef(g);
+        queue.emplace_back(f, 0);
+        pinned.insert(g);
+    }
+    auto discards = SelectDiscardGroups(groups, 3, pinned, none);
+    ASSERT_FALSE(discards.empty());
+
+    // none of the features could be handed to another group
+    std::unordered_set<GroupPtr> discarded(discards.begin(), discards.end());
+    std::vector<FeaturePtr> nullref;
+    for (const auto &[f, frame] : queue) {
+        if (discarded.count(f->ref())) {
+            nullref.push_back(f);
+        }
+    }
+    DropQueued(nullref, &queue);
+
+    EXPECT_EQ(queue.size(), groups.size() - discards.size());
+    for (const auto &[f, frame] : queue) {
+        EXPECT_FALSE(discarded.count(f->ref()));
+    }
+}
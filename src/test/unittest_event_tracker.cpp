@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include "event_tracker.h"
+#include "feature.h"
+#include "mm.h"
+
+#include "unittest_helpers.h"
+
+
+using namespace xivo;
+
+
+// soft blobs, larger than the image such that they enter as it moves
+const BlobTexture kTexture(60, 3, 200, 20, Vec2{-160, -120}, Vec2{160, 120}, 7);
+
+
+TEST(EventSimulator, Contrast) {
+    EventSimulator sim(0.2);
+    cv::Mat img(2, 2, CV_8UC1, cv::Scalar(20));
+    EXPECT_TRUE(sim.Feed(timestamp_t(0), img).empty());
+    img.at<uint8_t>(1, 0) = 60; // log(61 / 21) = 1.07, i.e., 5 levels
+    img.at<uint8_t>(0, 1) = 10; // log(11 / 21) = -0.65, i.e., 3 levels
+    auto events = sim.Feed(timestamp_t(1000000), img);
+    int on{0}, off{0};
+    for (int i = 0; i < events.size(); ++i) {
+        if (i > 0) {
+            EXPECT_GE(events[i].ts, events[i - 1].ts);
+        }
+        EXPECT_LE(events[i].ts, timestamp_t(1000000));
+        if (events[i].polarity > 0) {
+            EXPECT_EQ(events[i].x, 0);
+            EXPECT_EQ(events[i].y, 1);
+            ++on;
+        } else {
+            EXPECT_EQ(events[i].x, 1);
+            EXPECT_EQ(events[i].y, 0);
+            ++off;
+        }
+    }
+    EXPECT_EQ(on, 5);
+    EXPECT_EQ(off, 3);
+}
+
+
+TEST(EventTracker, Translation) {
+    MemoryManager::Create(256, 128);
+    int rows = 120, cols = 160;
+    Json::Value cfg;
+    cfg["rate"] = 200;
+    cfg["num_features_min"] = 10;
+    cfg["num_features_max"] = 20;
+    auto tracker = EventTracker::Create(cfg, rows, cols);
+
+    // 0.5 pixels per update of the tracker, frames rendered every 0.5 ms
+    Vec2 velocity{80, 60};
+    EventSimulator sim;
+    std::unordered_map<int, std::pair<Vec2, number_t>> first;
+    number_t t;
+    for (int k = 0; k <= 400; ++k) {
+        t = 0.5e-3 * k;
+        timestamp_t ts(int64_t(t * 1e9));
+        tracker->AddEvents(sim.Feed(ts, RenderBlobs(kTexture, rows, cols, velocity * t)));
+        if (!tracker->Ready(ts)) {
+            continue;
+        }
+        tracker->Update(ts);
+        for (auto it = tracker->features_.begin();
+             it != tracker->features_.end();) {
+            auto f = *it;
+            if (f->track_status() == TrackStatus::DROPPED) {
+                Feature::Delete(f);
+                it = tracker->features_.erase(it);
+                continue;
+            }
+            // once the time surface has built up
+            if (t > 0.05 && !first.count(f->id())) {
+                first[f->id()] = {f->xp(), t};
+            }
+            ++it;
+        }
+    }
+
+    // tracks move with the image, by 14 pixels or so, without drifting
+    number_t drift{0};
+    int count{0};
+    for (auto f : tracker->features_) {
+        if (auto it = first.find(f->id());
+            it != first.end() && t - it->second.second > 0.1) {
+            Vec2 expected = velocity * (t - it->second.second);
+            drift += (f->xp() - it->second.first - expected).norm();
+            ++count;
+        }
+    }
+    ASSERT_GE(count, 5);
+    EXPECT_LT(drift / count, 0.75);
+}
@@ -0,0 +1,179 @@
+#include <memory>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include "fault_injection.h"
+
+
+using namespace xivo;
+
+
+// IMU at 200 Hz and images at 20 Hz over `seconds`, in time order
+class FaultInjectionTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        for (int k = 0; k < 200 * seconds; ++k) {
+            timestamp_t ts(int64_t(5e6) * k);
+            if (k % 10 == 0) {
+                owned.emplace_back(new msg::Image(ts, "image"));
+                msgs.push_back(owned.back().get());
+            }
+            owned.emplace_back(
+                new msg::IMU(ts, Vec3{0, 0, 5.0 * (k % 2)}, Vec3{0, 0, 9.8}));
+            msgs.push_back(owned.back().get());
+        }
+    }
+
+    DeliveryStream Run(const std::string &faults, uint32_t seed = 0) {
+        Json::Value cfg;
+        cfg["seed"] = seed;
+        std::istringstream{faults} >> cfg["faults"];
+        return FaultInjector{cfg}.Apply(msgs);
+    }
+
+    static int Count(const DeliveryStream &stream, Delivery::Type type) {
+        int count{0};
+        for (const auto &d : stream) {
+            count += d.type == type;
+        }
+        return count;
+    }
+
+    int seconds{20};
+    std::vector<std::unique_ptr<msg::Message>> owned;
+    std::vector<const msg::Message *> msgs;
+};
+
+
+TEST_F(FaultInjectionTest, NoFaults) {
+    auto stream = Run("[]");
+    ASSERT_EQ(stream.size(), msgs.size());
+    for (int i = 0; i < msgs.size(); ++i) {
+        EXPECT_EQ(stream[i].msg, msgs[i]);
+        EXPECT_EQ(stream[i].ts, msgs[i]->ts_);
+        EXPECT_EQ(stream[i].arrival, msgs[i]->ts_);
+    }
+}
+
+
+TEST_F(FaultInjectionTest, Reproducible) {
+    std::string faults = R"([
+        {"type": "drop", "probability": 0.1},
+        {"type": "jitter", "std": 0.001},
+        {"type": "delay", "probability": 0.2, "max_delay": 0.05}
+    ])";
+    auto s1 = Run(faults, 3), s2 = Run(faults, 3), s3 = Run(faults, 4);
+    ASSERT_EQ(s1.size(), s2.size());
+    for (int i = 0; i < s1.size(); ++i) {
+        EXPECT_EQ(s1[i].msg, s2[i].msg);
+        EXPECT_EQ(s1[i].ts, s2[i].ts);
+        EXPECT_EQ(s1[i].arrival, s2[i].arrival);
+    }
+    bool same = s1.size() == s3.size();
+    for (int i = 0; same && i < s1.size(); ++i) {
+        same = s1[i].msg == s3[i].msg && s1[i].ts == s3[i].ts;
+    }
+    EXPECT_FALSE(same);
+}
+
+
+TEST_F(FaultInjectionTest, DropAndDuplicate) {
+    int num_images = Count(Run("[]"), Delivery::IMAGE);
+    int num_imu = Count(Run("[]"), Delivery::IMU);
+
+    auto dropped = Run(R"([{"type": "drop", "target": "image",
+                            "probability": 0.2}])");
+    EXPECT_EQ(Count(dropped, Delivery::IMU), num_imu);
+    EXPECT_NEAR(Count(dropped, Delivery::IMAGE), 0.8 * num_images,
+                0.1 * num_images);
+
+    auto duplicated = Run(R"([{"type": "duplicate", "target": "imu",
+                               "probability": 0.1}])");
+    EXPECT_EQ(Count(duplicated, Delivery::IMAGE), num_images);
+    EXPECT_NEAR(Count(duplicated, Delivery::IMU), 1.1 * num_imu,
+                0.03 * num_imu);
+}
+
+
+TEST_F(FaultInjectionTest, ArrivalOrder) {
+    auto stream = Run(R"([
+        {"type": "delay", "target": "image", "probability": 0.5,
+         "max_delay": 0.03},
+        {"type": "reorder", "target": "imu", "probability": 0.1},
+        {"type": "burst", "probability": 0.5, "period": 1.0, "duration": 0.2}
+    ])");
+    EXPECT_EQ(stream.size(), msgs.size());
+    int out_of_order{0};
+    for (int i = 0; i < stream.size(); ++i) {
+        EXPECT_GE(stream[i].arrival, stream[i].sensor_ts);
+        EXPECT_EQ(stream[i].ts, stream[i].sensor_ts);
+        if (i > 0) {
+            EXPECT_GE(stream[i].arrival, stream[i - 1].arrival);
+            out_of_order += stream[i].ts < stream[i - 1].ts;
+        }
+    }
+    EXPECT_GT(out_of_order, 0);
+
+    // released at the end of the window, at once
+    auto burst = Run(R"([{"type": "burst", "period": 1.0, "duration": 0.2}])");
+    int64_t period(1e9), duration(2e8);
+    for (const auto &d : burst) {
+        int64_t phase = (d.sensor_ts - burst.front().sensor_ts).count() % period;
+        if (phase < duration) {
+            EXPECT_EQ(d.arrival - d.sensor_ts, timestamp_t(duration - phase));
+        } else {
+            EXPECT_EQ(d.arrival, d.sensor_ts);
+        }
+    }
+}
+
+
+TEST_F(FaultInjectionTest, IMU) {
+    auto saturated = Run(R"([{"type": "imu_saturation", "gyro_max": 2,
+                              "accel_max": 8}])");
+    for (const auto &d : saturated) {
+        if (d.type == Delivery::IMU) {
+            EXPECT_LE(d.gyro.lpNorm<Eigen::Infinity>(), 2);
+            EXPECT_EQ(d.accel(2), 8);
+        }
+    }
+
+    auto gaps = Run(R"([{"type": "imu_gap", "probability": 0.01,
+                         "duration": 0.1}])");
+    EXPECT_EQ(Count(gaps, Delivery::IMAGE), Count(Run("[]"), Delivery::IMAGE));
+    int num_gaps{0};
+    timestamp_t last{0};
+    for (const auto &d : gaps) {
+        if (d.type == Delivery::IMU) {
+            if (last.count() > 0 && d.sensor_ts - last > timestamp_t(5000000)) {
+                EXPECT_GE(d.sensor_ts - last, timestamp_t(100000000));
+                ++num_gaps;
+            }
+            last = d.sensor_ts;
+        }
+    }
+    EXPECT_GT(num_gaps, 0);
+}
+
+
+TEST_F(FaultInjectionTest, Photometric) {
+    auto stream = Run(R"([
+        {"type": "noise", "std": 4},
+        {"type": "noise", "std": 3},
+        {"type": "exposure", "probability": 0.05, "min_gain": 2,
+         "max_gain": 2, "frames": 5}
+    ])");
+    int exposed{0};
+    for (const auto &d : stream) {
+        if (d.type == Delivery::IMAGE) {
+            EXPECT_DOUBLE_EQ(d.noise_std, 5);
+            EXPECT_TRUE(d.gain == 1 || d.gain == 2);
+            exposed += d.gain == 2;
+        } else {
+            EXPECT_EQ(d.noise_std, 0);
+            EXPECT_EQ(d.gain, 1);
+        }
+    }
+    EXPECT_GT(exposed, 0);
+}
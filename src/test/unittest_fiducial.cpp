@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "fiducial.h"
+
+
+using namespace xivo;
+
+
+TEST(TagFamily, Decode) {
+    TagFamily family(5, 32, 6);
+    ASSERT_EQ(family.size(), 32);
+    for (int id = 0; id < family.size(); ++id) {
+        uint64_t code = family.code(id);
+        for (int k = 0; k < 4; ++k) {
+            // two misread cells
+            uint64_t observed = code ^ (1 << (id % 25)) ^ (1 << ((id + 11) % 25));
+            int rotation, errors;
+            EXPECT_EQ(family.Decode(observed, 2, &rotation, &errors), id);
+            EXPECT_EQ(rotation, k);
+            EXPECT_EQ(errors, 2);
+            code = RotateCode(code, 5);
+        }
+        EXPECT_EQ(code, family.code(id));
+    }
+}
+
+
+TEST(TagFamily, CornerJacobian) {
+    SE3 gsb{SO3::exp(Vec3{0.3, -0.2, 0.5}), Vec3{1, 2, 3}};
+    SE3 gbc{SO3::exp(Vec3{0.1, 0.2, -0.1}), Vec3{0.05, 0, 0.02}};
+    SE3 gst{SO3::exp(Vec3{-0.4, 0.1, 0.2}), Vec3{2, 2, 6}};
+    Vec3 Xt = TagCorner(1, 0.2);
+    TagCornerJacobian J;
+    Vec3 Xc = TagPointInCamera(gsb, gbc, gst, Xt, &J);
+
+    number_t eps = 1e-6;
+    for (int i = 0; i < 3; ++i) {
+        Vec3 d = Vec3::Zero();
+        d(i) = eps;
+        auto check = [&](const SE3 &gsb2, const SE3 &gbc2, const SE3 &gst2,
+                         const Mat3 &jac) {
+            Vec3 num = (TagPointInCamera(gsb2, gbc2, gst2, Xt) - Xc) / eps;
+            EXPECT_NEAR((num - jac.col(i)).norm(), 0, 1e-4);
+        };
+        check(SE3{gsb.R() * SO3::exp(d), gsb.T()}, gbc, gst, J.dXc_dWsb);
+        check(SE3{gsb.R(), gsb.T() + d}, gbc, gst, J.dXc_dTsb);
+        check(gsb, SE3{gbc.R() * SO3::exp(d), gbc.T()}, gst, J.dXc_dWbc);
+        check(gsb, SE3{gbc.R(), gbc.T() + d}, gst, J.dXc_dTbc);
+        check(gsb, gbc, SE3{gst.R() * SO3::exp(d), gst.T()}, J.dXc_dWst);
+        check(gsb, gbc, SE3{gst.R(), gst.T() + d}, J.dXc_dTst);
+    }
+}
+
+
+TEST(TagDetector, Synthetic) {
+    Json::Value cfg;
+    cfg["detect_level"] = 1;
+    TagDetector detector(cfg);
+
+    // tag #5 turned a quarter clockwise, with some perspective
+    int cell = 20;
+    cv::Mat tag = detector.family().Render(5, cell);
+    number_t lo = cell - 0.5, hi = cell * (detector.family().bits() + 3) - 0.5;
+    std::vector<cv::Point2f> src{{lo, lo}, {hi, lo}, {hi, hi}, {lo, hi}};
+    std::vector<cv::Point2f> dst{{420, 100}, {430, 240}, {290, 250}, {280, 110}};
+    cv::Mat H = cv::getPerspectiveTransform(src, dst);
+    cv::Mat img(480, 640, CV_8UC1, cv::Scalar(100));
+    cv::warpPerspective(tag, img, H, img.size(), cv::INTER_LINEAR,
+                        cv::BORDER_TRANSPARENT);
+
+    auto detections = detector.Detect(img);
+    ASSERT_EQ(detections.size(), 1);
+    EXPECT_EQ(detections[0].id, 5);
+    EXPECT_EQ(detections[0].errors, 0);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_NEAR(detections[0].xp[i](0), dst[i].x, 1.0) << "corner " << i;
+        EXPECT_NEAR(detections[0].xp[i](1), dst[i].y, 1.0) << "corner " << i;
+    }
+}
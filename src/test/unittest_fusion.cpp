@@ -0,0 +1,117 @@
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "estimator_process.h"
+#include "fusion.h"
+
+
+using namespace xivo;
+
+
+static MatX RandomCovariance(int d, std::mt19937 &rng) {
+    std::normal_distribution<number_t> normal;
+    MatX A(d, d);
+    for (int i = 0; i < d; ++i) {
+        for (int j = 0; j < d; ++j) {
+            A(i, j) = normal(rng);
+        }
+    }
+    return A * A.transpose() + 0.1 * MatX::Identity(d, d);
+}
+
+
+TEST(CovarianceIntersection, Symmetric) {
+    std::vector<VecX> x{Vec2{0, 0}, Vec2{1, 1}};
+    std::vector<MatX> P{Vec2{1, 4}.asDiagonal(), Vec2{4, 1}.asDiagonal()};
+    VecX xf;
+    MatX Pf;
+    VecX w = CovarianceIntersection(x, P, &xf, &Pf);
+    EXPECT_NEAR(w(0), 0.5, 1e-6);
+    EXPECT_NEAR(w(1), 0.5, 1e-6);
+    EXPECT_NEAR((Pf - 1.6 * MatX::Identity(2, 2)).norm(), 0, 1e-6);
+    EXPECT_NEAR((xf - Vec2{0.2, 0.8}).norm(), 0, 1e-6);
+}
+
+
+TEST(CovarianceIntersection, Redundant) {
+    // the same estimate twice is worth no more than once
+    std::mt19937 rng(0);
+    MatX P0 = RandomCovariance(6, rng);
+    VecX x0 = VecX::Ones(6);
+    VecX xf;
+    MatX Pf;
+    CovarianceIntersection({x0, x0}, {P0, P0}, &xf, &Pf);
+    EXPECT_NEAR((Pf - P0).norm(), 0, 1e-9);
+    EXPECT_NEAR((xf - x0).norm(), 0, 1e-9);
+}
+
+
+TEST(CovarianceIntersection, MinimalDeterminant) {
+    std::mt19937 rng(1);
+    for (int trial = 0; trial < 10; ++trial) {
+        std::vector<MatX> P{RandomCovariance(3, rng), RandomCovariance(3, rng)};
+        std::vector<VecX> x{VecX::Zero(3), VecX::Ones(3)};
+        VecX xf;
+        MatX Pf;
+        VecX w = CovarianceIntersection(x, P, &xf, &Pf, 200);
+        EXPECT_NEAR(w.sum(), 1, 1e-9);
+        EXPECT_GE(w.minCoeff(), 0);
+
+        number_t best = std::numeric_limits<number_t>::max();
+        for (number_t w0 = 0; w0 <= 1; w0 += 0.001) {
+            MatX M = w0 * P[0].inverse() + (1 - w0) * P[1].inverse();
+            best = std::min(best, M.inverse().determinant());
+        }
+        EXPECT_LE(Pf.determinant(), best * (1 + 1e-3));
+    }
+}
+
+
+class RecordingPublisher : public Publisher {
+public:
+    void Publish(const timestamp_t &ts, const SE3 &gsb,
+                 const Mat6 &cov) override {
+        ts_.push_back(ts);
+    }
+    std::vector<timestamp_t> ts_;
+};
+
+
+TEST(PoseFusion, Synchronization) {
+    RecordingPublisher publisher;
+    FusionOptions options;
+    PoseFusion fusion(2, options, &publisher);
+
+    // source 1 runs in a frame rotated & shifted w.r.t. the one of source 0
+    SE3 g01{SO3::exp(Vec3{0, 0, 0.7}), Vec3{1, -2, 0.5}};
+    Mat6 cov0 = Mat6::Identity() * 0.01;
+    Mat6 cov1 = Mat6::Identity() * 0.04;
+    auto pose = [](int i) {
+        return SE3{SO3::exp(Vec3{0.01 * i, 0.02, 0.1 * i}),
+                   Vec3{0.1 * i, 0.05 * i, 0}};
+    };
+    for (int i = 0; i < 10; ++i) {
+        timestamp_t ts{i * 50000000};
+        fusion.Add(0, {ts, pose(i), cov0});
+        if (i != 4) { // source 1 misses a frame
+            fusion.Add(1, {ts + timestamp_t{100000}, g01.inv() * pose(i), cov1});
+        }
+    }
+    // every frame but the one missing
+    ASSERT_EQ(publisher.ts_.size(), 9);
+    EXPECT_EQ(publisher.ts_[4], timestamp_t{5 * 50000000 + 100000});
+
+    const auto &fused = fusion.fused();
+    EXPECT_NEAR((fused.gsb.T() - pose(9).T()).norm(), 0, 1e-9);
+    EXPECT_NEAR((fused.gsb.R().inv() * pose(9).R()).log().norm(), 0, 1e-9);
+    // isotropic covariances: the more certain source takes all the weight
+    EXPECT_NEAR(fusion.weights()(0), 1, 1e-3);
+    EXPECT_NEAR((fused.cov - cov0).norm(), 0, 1e-4);
+
+    // the other source goes on alone
+    fusion.Remove(1);
+    fusion.Add(0, {timestamp_t{10 * 50000000}, pose(10), cov0});
+    EXPECT_EQ(publisher.ts_.size(), 10);
+    EXPECT_EQ(fusion.weights()(1), 0);
+}
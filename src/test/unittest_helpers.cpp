@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <random>
 #include "unittest_helpers.h"
 #include "gtest/gtest.h"
@@ -54,4 +56,54 @@ Mat3 RandomTransformationMatrix(void) {
     Mat3 R = q.toRotationMatrix();
 
     return R;
-}
\ No newline at end of file
+}
+
+
+BlobTexture::BlobTexture(int count, number_t sigma, number_t amplitude,
+                         number_t background, const Vec2 &lo, const Vec2 &hi,
+                         int seed)
+    : sigma{sigma}, amplitude{amplitude}, background{background} {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<number_t> ux(lo(0), hi(0)), uy(lo(1), hi(1));
+    for (int i = 0; i < count; ++i) {
+        number_t x = ux(rng);
+        centers.emplace_back(x, uy(rng));
+    }
+}
+
+
+number_t BlobTexture::operator()(const Vec2 &q) const {
+    number_t v = background;
+    for (const auto &c : centers) {
+        number_t d2 = (q - c).squaredNorm() / (sigma * sigma);
+        // beyond 4 std, a blob adds less than 1e-3 of its amplitude
+        if (d2 < 16) {
+            v += amplitude * std::exp(-0.5 * d2);
+        }
+    }
+    return v;
+}
+
+
+cv::Mat RenderBlobs(const BlobTexture &texture, int rows, int cols,
+                    const Vec2 &xp0, const Vec2 &xp1, const Mat2 &A,
+                    int level, number_t gain, number_t bias) {
+    int scale = 1 << level;
+    cv::Mat img(rows / scale, cols / scale, CV_8UC1);
+    Mat2 Ainv = A.inverse();
+    for (int y = 0; y < img.rows; ++y) {
+        for (int x = 0; x < img.cols; ++x) {
+            Vec2 q = xp0 + Ainv * (Vec2{x * scale, y * scale} - xp1);
+            number_t v = gain * texture(q) + bias;
+            img.at<uint8_t>(y, x) = std::round(std::clamp<number_t>(v, 0, 255));
+        }
+    }
+    return img;
+}
+
+
+cv::Mat RenderBlobs(const BlobTexture &texture, int rows, int cols,
+                    const Vec2 &shift, int level) {
+    return RenderBlobs(texture, rows, cols, Vec2::Zero(), shift,
+                       Mat2::Identity(), level);
+}
@@ -1,3 +1,8 @@
+#pragma once
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
 #include "alias.h"
 
 using namespace xivo;
@@ -7,4 +12,32 @@ void CheckMatrixEquality(MatX M1, MatX M2, number_t tol);
 void CheckVecZero(VecX v, number_t tol);
 void CheckMatrixZero(MatX M, number_t tol);
 
-Mat3 RandomTransformationMatrix();
\ No newline at end of file
+Mat3 RandomTransformationMatrix();
+
+
+/** Synthetic texture of soft blobs for the image-based tests: `count`
+ *  gaussian blobs of std `sigma` and peak `amplitude` over `background`,
+ *  centered uniformly in [lo, hi) by a generator of seed `seed`. */
+struct BlobTexture {
+    BlobTexture(int count, number_t sigma, number_t amplitude,
+                number_t background, const Vec2 &lo, const Vec2 &hi,
+                int seed);
+    /** Intensity at `q`. */
+    number_t operator()(const Vec2 &q) const;
+
+    std::vector<Vec2> centers;
+    number_t sigma, amplitude, background;
+};
+
+/** 8-bit image of `rows` x `cols` pixels, divided by 2^level, of `texture`
+ *  seen through the warp x = xp1 + A (q - xp0) of its points q, with the
+ *  intensity change gain * I + bias. Pixel x of pyramid level `level`
+ *  samples 2^level x. */
+cv::Mat RenderBlobs(const BlobTexture &texture, int rows, int cols,
+                    const Vec2 &xp0, const Vec2 &xp1,
+                    const Mat2 &A = Mat2::Identity(), int level = 0,
+                    number_t gain = 1, number_t bias = 0);
+
+/** The texture translated by `shift`. */
+cv::Mat RenderBlobs(const BlobTexture &texture, int rows, int cols,
+                    const Vec2 &shift, int level = 0);
@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+
+#define private public
+
+#include "alias.h"
+#include "feature.h"
+#include "group.h"
+#include "mm.h"
+
+#include "unittest_helpers.h"
+
+
+using namespace xivo;
+
+
+/* Checks the linearization of a refined feature w.r.t. the poses it was
+ * refined from against the minimizer of the reprojection errors, re-solved
+ * numerically with each pose perturbed. */
+class InitCovarianceTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        MemoryManager::Create(256, 128);
+        auto cfg = LoadJson("src/test/camera_configs.json");
+        Camera::Create(cfg["perfect_pinhole"]);
+
+        Rbc = SO3::exp(Vec3{0.02, -0.03, 0.01});
+        Tbc = Vec3{0.05, 0.01, -0.02};
+
+        // the reference and three views of a point 3 meters away
+        groups.push_back(Group::Create(SO3::exp(Vec3{0.05, 0.1, -0.02}),
+                                       Vec3{0.3, -0.1, 0.2}));
+        groups.push_back(Group::Create(SO3::exp(Vec3{0.02, 0.15, 0.0}),
+                                       Vec3{0.6, -0.1, 0.25}));
+        groups.push_back(Group::Create(SO3::exp(Vec3{0.08, 0.05, 0.03}),
+                                       Vec3{0.4, 0.3, 0.2}));
+        groups.push_back(Group::Create(SO3::exp(Vec3{-0.03, 0.12, -0.05}),
+                                       Vec3{0.1, -0.3, 0.3}));
+        for (int i = 0; i < groups.size(); ++i) {
+            groups[i]->SetSind(i);
+            groups[i]->SetStatus(GroupStatus::INSTATE);
+        }
+
+        Vec3 Xc0{0.2, -0.1, 3.0};
+        Vec2 xp0 = Camera::instance()->Project(Vec2{Xc0.head<2>() / Xc0(2)});
+        f = Feature::Create(xp0(0), xp0(1));
+        f->SetRef(groups[0]);
+        x0 << Xc0(0) / Xc0(2), Xc0(1) / Xc0(2), XofZ(Xc0(2));
+        f->SetState(x0);
+
+        // noise-free observations
+        Vec3 Xs = groups[0]->gsb() * (SE3{Rbc, Tbc} * Xc0);
+        for (auto g : groups) {
+            Vec3 Xcn = (g->gsb() * SE3{Rbc, Tbc}).inv() * Xs;
+            Vec2 xp = Camera::instance()->Project(Vec2{Xcn.head<2>() / Xcn(2)});
+            obs.push_back({g, xp, Vec3::Zero()});
+        }
+    }
+
+    static number_t XofZ(number_t z) {
+#ifdef USE_INVDEPTH
+        return 1.0 / z;
+#else
+        return std::log(z);
+#endif
+    }
+
+    // reprojection errors of x with the poses perturbed by ds, ordered as the
+    // groups followed by the camera-body alignment, each (W, T)
+    VecX Residual(const Vec3 &x, const VecX &ds) {
+        auto perturb = [&ds](int k, const SE3 &g) {
+            return SE3{g.R() * SO3::exp(ds.segment<3>(6 * k)),
+                       g.T() + ds.segment<3>(6 * k + 3)};
+        };
+        SE3 gbc = perturb(groups.size(), SE3{Rbc, Tbc});
+        f->SetState(x);
+        Vec3 Xs = perturb(0, groups[0]->gsb()) * (gbc * f->Xc());
+        f->SetState(x0);
+
+        VecX r(2 * groups.size());
+        for (int i = 0; i < groups.size(); ++i) {
+            Vec3 Xcn = (perturb(i, groups[i]->gsb()) * gbc).inv() * Xs;
+            r.segment<2>(2 * i) =
+                Camera::instance()->Project(Vec2{Xcn.head<2>() / Xcn(2)}) -
+                obs[i].xp;
+        }
+        return r;
+    }
+
+    // least-squares estimate of the feature with the poses perturbed
+    Vec3 Solve(const VecX &ds) {
+        Vec3 x = x0;
+        for (int iter = 0; iter < 10; ++iter) {
+            VecX r = Residual(x, ds);
+            MatX J(r.size(), 3);
+            for (int j = 0; j < 3; ++j) {
+                Vec3 dx = Vec3::Zero();
+                dx(j) = 1e-7;
+                J.col(j) = (Residual(x + dx, ds) - Residual(x - dx, ds)) / 2e-7;
+            }
+            x -= (J.transpose() * J).ldlt().solve(J.transpose() * r);
+        }
+        return x;
+    }
+
+    SO3 Rbc;
+    Vec3 Tbc;
+    std::vector<GroupPtr> groups;
+    std::vector<Obs> obs;
+    FeaturePtr f;
+    Vec3 x0;
+};
+
+
+TEST_F(InitCovarianceTest, Linearization) {
+    ASSERT_TRUE(f->LinearizeInit(SE3{Rbc, Tbc}, obs, 1.0));
+    ASSERT_EQ(f->init_jac_.size(), groups.size());
+
+    number_t eps = 1e-5;
+    int num_blocks = groups.size() + 1;
+    for (int k = 0; k < num_blocks; ++k) {
+        Feature::InitJacobian A;
+        if (k == groups.size()) {
+            A = f->init_jac_c_;
+        } else {
+            for (const auto &[g, Ag] : f->init_jac_) {
+                if (g == groups[k]) {
+                    A = Ag;
+                }
+            }
+        }
+        for (int j = 0; j < 6; ++j) {
+            VecX ds = VecX::Zero(6 * num_blocks);
+            ds(6 * k + j) = eps;
+            Vec3 num = (Solve(ds) - Solve(-ds)) / (2 * eps);
+            EXPECT_NEAR((num - A.col(j)).norm(), 0, 1e-4 * (1 + num.norm()))
+                << "block " << k << " column " << j;
+        }
+    }
+}
+
+
+TEST_F(InitCovarianceTest, Covariance) {
+    ASSERT_TRUE(f->LinearizeInit(SE3{Rbc, Tbc}, obs, 2.0));
+    f->correlated_init_ = true;
+    f->SetSind(0);
+
+    // random covariance of the state
+    MatX L = MatX::Random(kFullSize, kFullSize);
+    MatX P = 1e-4 * L * L.transpose();
+    MatX P_before = P;
+    f->FillCovarianceBlock(P);
+
+    // cov(x, s) = A P(s, s) and cov(x, x) = P_ + A P(s, s) A', with the
+    // blocks s which the feature depends on
+    std::vector<int> index;
+    MatX A = MatX::Zero(kFeatureSize, 0);
+    auto append = [&](int offset, const Feature::InitJacobian &Ak) {
+        A.conservativeResize(kFeatureSize, A.cols() + 6);
+        A.rightCols<6>() = Ak;
+        for (int i = 0; i < 6; ++i) {
+            index.push_back(offset + i);
+        }
+    };
+    append(Index::Wbc, f->init_jac_c_);
+    for (const auto &[g, Ag] : f->init_jac_) {
+        append(kGroupBegin + kGroupSize * g->sind(), Ag);
+    }
+    MatX Pss(index.size(), index.size());
+    MatX Ps(index.size(), kFullSize);
+    for (int i = 0; i < index.size(); ++i) {
+        Ps.row(i) = P_before.row(index[i]);
+        for (int j = 0; j < index.size(); ++j) {
+            Pss(i, j) = P_before(index[i], index[j]);
+        }
+    }
+    int offset = kFeatureBegin + kFeatureSize * f->sind();
+    MatX cross = A * Ps;
+    int rest = kFullSize - offset - kFeatureSize;
+    EXPECT_NEAR((P.block(offset, 0, kFeatureSize, offset) -
+                 cross.leftCols(offset)).norm(), 0, 1e-9);
+    EXPECT_NEAR((P.block(offset, offset + kFeatureSize, kFeatureSize, rest) -
+                 cross.rightCols(rest)).norm(), 0, 1e-9);
+    Mat3 Pxx = f->P() + A * Pss * A.transpose();
+    EXPECT_NEAR((P.block<kFeatureSize, kFeatureSize>(offset, offset) - Pxx)
+                    .norm(), 0, 1e-9);
+    EXPECT_NEAR((P - P.transpose()).norm(), 0, 1e-12);
+
+    // the joint covariance is that of a linear function of the state
+    Eigen::SelfAdjointEigenSolver<MatX> eig(P);
+    EXPECT_GT(eig.eigenvalues().minCoeff(), -1e-9);
+}
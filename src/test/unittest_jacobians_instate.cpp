@@ -42,6 +42,7 @@ class InstateJacobiansTest : public ::testing::Test {
         Cg_nom = Mat3::Identity();
         bg_nom << 0, 0, 0;
         td_nom = 0.005;
+        tr_nom = 0.0;
         Vsb_nom = Vec3::Random();
 
         // Initialize the error variables
@@ -54,6 +55,7 @@ class InstateJacobiansTest : public ::testing::Test {
         Cg_err = Mat3::Zero();
         bg_err = Vec3::Zero();
         td_err = 0.0;
+        tr_err = 0.0;
         err_state.resize(kFullSize);
         err_state.setZero();
 
@@ -61,6 +63,7 @@ class InstateJacobiansTest : public ::testing::Test {
         // Set reference Rr and Tr for the feature
         Vec2 xp(25, 46);
         f = Feature::Create(xp(0), xp(1)); // sets x_(2) = 2.0 = log(z) (or 1/z)
+        row_offset = Feature::RowOffset(xp);
 
         // Compute coordinates of internal state
         Vec2 xc = Camera::instance()->UnProject(xp);
@@ -75,7 +78,7 @@ class InstateJacobiansTest : public ::testing::Test {
         // Compute the analytic Jacobians and nominal states
         ComputeNominalStates();
         f->ComputeJacobian(Rsb_nom, Tsb_nom, Rbc_nom, Tbc_nom, gyro, 
-                           Cg_nom, bg_nom, Vsb_nom, td_nom, err_state);
+                           Cg_nom, bg_nom, Vsb_nom, td_nom, tr_nom, err_state);
     }
 
     Vec3 ComputeXcn() {
@@ -85,20 +88,23 @@ class InstateJacobiansTest : public ::testing::Test {
         Cg = Cg_nom + Cg_err;
         bg = bg_nom + bg_err;
 
-#ifdef USE_ONLINE_TEMPORAL_CALIB
+        // the row of the feature is exposed tr*row_offset after the image time
         Vec3 angvel_nom = Cg*gyro - bg;
+#ifdef USE_ONLINE_TEMPORAL_CALIB
         Vec3 angvel_err = Cg_err*gyro - bg_err;
-        Vec3 delta_rot = angvel_nom*td_err + angvel_err*(td_nom + td_err);
-        Rsb = Rsb_nom*rodrigues(Wsb_err)*rodrigues(delta_rot);
-        Tsb = Tsb_nom + Tsb_err + Vsb_nom*td_err;
+        number_t dt = td_err + tr_err*row_offset;
+        Vec3 delta_rot = angvel_nom*dt + angvel_err*(td_nom + dt);
 #else
-        Rsb = Rsb_nom*rodrigues(Wsb_err);
-        Tsb = Tsb_nom + Tsb_err;
+        number_t dt = tr_err*row_offset;
+        Vec3 delta_rot = angvel_nom*dt;
 #endif
+        Rsb = Rsb_nom*rodrigues(Wsb_err)*rodrigues(delta_rot);
+        Tsb = Tsb_nom + Tsb_err + Vsb_nom*dt;
 
         Rbc = Rbc_nom*rodrigues(Wbc_err);
         Tbc = Tbc_nom + Tbc_err;
         td = td_nom + td_err;
+        tr = tr_nom + tr_err;
 
 
         Vec3 Xc = f->Xc();
@@ -142,6 +148,7 @@ class InstateJacobiansTest : public ::testing::Test {
     Mat3 Cg;
     Vec3 bg;
     number_t td;
+    number_t tr;
 
     // Nominal state variables containing placeholder values
     Mat3 Rr_nom;
@@ -153,6 +160,7 @@ class InstateJacobiansTest : public ::testing::Test {
     Mat3 Cg_nom;
     Vec3 bg_nom;
     number_t td_nom;
+    number_t tr_nom;
     Vec3 Vsb_nom;
 
     // Error variables containing placeholder values
@@ -166,6 +174,10 @@ class InstateJacobiansTest : public ::testing::Test {
     Mat3 Cg_err;
     Vec3 bg_err;
     number_t td_err;
+    number_t tr_err;
+
+    // row offset of the feature from the middle row of the image
+    number_t row_offset;
 
     // finite difference
     number_t delta;
@@ -393,6 +405,22 @@ TEST_F(InstateJacobiansTest, Tbc) {
 
 
 
+TEST_F(InstateJacobiansTest, tr) {
+    // perturb the exposure time of the row by delta, the derivative scales
+    // with the row offset and so does the tolerance
+    Vec3 Xcn0 = ComputeXcn();
+    tr_err = delta / row_offset;
+
+    Vec3 Xcn1 = ComputeXcn();
+
+    Vec3 dXcn_dtr = (Xcn1 - Xcn0) / tr_err;
+    number_t tol_tr = tol * std::abs(row_offset);
+    EXPECT_NEAR(dXcn_dtr(0), f->cache_.dXcn_dtr(0), tol_tr);
+    EXPECT_NEAR(dXcn_dtr(1), f->cache_.dXcn_dtr(1), tol_tr);
+    EXPECT_NEAR(dXcn_dtr(2), f->cache_.dXcn_dtr(2), tol_tr);
+}
+
+
 #ifdef USE_ONLINE_TEMPORAL_CALIB
 TEST_F(InstateJacobiansTest, td) {
     Vec3 Xcn0 = ComputeXcn();
@@ -66,7 +66,7 @@ class OOSJacobiansTest : public::testing::Test {
 
         // Compute nominal Jacobian
         f->cache_.Xs = Xs_nom;
-        f->ComputeOOSJacobianInternal(obs, Rbc_nom, Tbc_nom, err_state);
+        f->ComputeOOSJacobianInternal(obs, Rbc_nom, Tbc_nom, 0.0, err_state);
     }
 
     Vec3 ComputeXcn() {
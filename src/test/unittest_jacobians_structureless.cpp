@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+
+#define private public
+
+#include "alias.h"
+#include "mm.h"
+#include "group.h"
+#include "graph.h"
+
+#include "unittest_helpers.h"
+
+#include "feature.h"
+
+
+using namespace xivo;
+
+/* Checks the epipolar & three-view constraints formed by a feature observed
+ * from several in-state groups against finite differences. */
+class StructurelessJacobiansTest : public::testing::Test {
+  protected:
+    void SetUp() override {
+
+        MemoryManager::Create(256, 128);
+        auto cfg_ = LoadJson("src/test/camera_configs.json");
+        Camera::Create(cfg_["perfect_pinhole"]);
+        delta = 1e-6;
+        tol = 1e-4;
+
+        Rbc = RandomTransformationMatrix();
+        Tbc = Vec3::Random() * 0.1;
+        Vec3 Xs = Vec3::Random();
+
+        f = Feature::Create(0, 0);
+        for (int i = 0; i < num_views; ++i) {
+            // place the camera such that the point is in front of it
+            Vec3 Xc = Vec3::Random() * 0.5;
+            Xc(2) = 4.0 + Xc(2);
+            Mat3 Rsb = RandomTransformationMatrix();
+            Vec3 Tsb = Xs - Rsb * (Rbc * Xc + Tbc);
+
+            auto g = Group::Create(SO3(Rsb), Tsb);
+            g->SetSind(i);
+            g->SetStatus(GroupStatus::INSTATE);
+
+            Observation obs;
+            obs.g = g;
+            obs.xp = Camera::instance()->Project(project(Xc));
+            vobs.push_back(obs);
+        }
+
+        size = f->ComputeStructurelessJacobian(vobs, Rbc, Tbc, options);
+        ro0 = f->ro();
+        Ho0 = f->Ho();
+    }
+
+    // whitened jacobians scale with the focal length, so does the tolerance
+    number_t ColumnTol(int col) {
+        return tol * std::max<number_t>(1, Ho0.col(col).cwiseAbs().maxCoeff());
+    }
+
+    // innovation with the state of view i perturbed by dX
+    VecX PerturbGroup(int i, const Vec6 &dX) {
+        auto g = vobs[i].g;
+        g->BackupState();
+        g->UpdateState(dX);
+        f->ComputeStructurelessJacobian(vobs, Rbc, Tbc, options);
+        g->RestoreState();
+        return f->ro();
+    }
+
+    static constexpr int num_views = 4;
+
+    FeaturePtr f;
+    std::vector<Observation> vobs;
+    StructurelessOptions options;
+    Mat3 Rbc;
+    Vec3 Tbc;
+
+    int size;
+    VecX ro0;
+    MatX Ho0;
+
+    number_t delta;
+    number_t tol;
+};
+
+
+TEST_F(StructurelessJacobiansTest, Size) {
+    EXPECT_EQ(size, 2 * num_views - 3);
+}
+
+
+TEST_F(StructurelessJacobiansTest, Residual) {
+    // noise-free observations satisfy all the constraints
+    CheckVecZero(ro0, tol);
+}
+
+
+TEST_F(StructurelessJacobiansTest, Group) {
+    for (int i = 0; i < num_views; ++i) {
+        int goff = kGroupBegin + 6 * i;
+        for (int j = 0; j < 6; ++j) {
+            Vec6 dX = Vec6::Zero();
+            dX(j) = delta;
+            // innovation is the negative constraint
+            VecX num = -(PerturbGroup(i, dX) - ro0) / delta;
+            CheckVectorEquality(num, Ho0.col(goff + j), ColumnTol(goff + j));
+        }
+    }
+}
+
+
+TEST_F(StructurelessJacobiansTest, Wbc) {
+    Mat3 Rbc0 = Rbc;
+    for (int j = 0; j < 3; ++j) {
+        Vec3 dW = Vec3::Zero();
+        dW(j) = delta;
+        Rbc = Rbc0 * rodrigues(dW);
+        f->ComputeStructurelessJacobian(vobs, Rbc, Tbc, options);
+        VecX num = -(f->ro() - ro0) / delta;
+        CheckVectorEquality(num, Ho0.col(Index::Wbc + j),
+                            ColumnTol(Index::Wbc + j));
+    }
+    Rbc = Rbc0;
+}
+
+
+TEST_F(StructurelessJacobiansTest, Tbc) {
+    Vec3 Tbc0 = Tbc;
+    for (int j = 0; j < 3; ++j) {
+        Tbc = Tbc0;
+        Tbc(j) += delta;
+        f->ComputeStructurelessJacobian(vobs, Rbc, Tbc, options);
+        VecX num = -(f->ro() - ro0) / delta;
+        CheckVectorEquality(num, Ho0.col(Index::Tbc + j),
+                            ColumnTol(Index::Tbc + j));
+    }
+    Tbc = Tbc0;
+}
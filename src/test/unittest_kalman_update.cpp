@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "helpers.h"
+
+
+using namespace xivo;
+
+
+/* A state of `size` with a block of `n` states in use, a free slot of unit
+ * variance, and a slot of zero variance, as left by a feature or group which
+ * left the state. */
+class KalmanUpdateTest : public ::testing::Test {
+  protected:
+    void Setup(int n, int m) {
+        size = n + 6;
+        MatX L = MatX::Random(n, n);
+        P.setZero(size, size);
+        P.topLeftCorner(n, n) = L * L.transpose() + 0.1 * MatX::Identity(n, n);
+        // states of very different scales
+        for (int i = 0; i < n; i += 4) {
+            P.row(i) *= 1e-3;
+            P.col(i) *= 1e-3;
+        }
+        P.block(n, n, 3, 3).setIdentity();
+
+        H.setZero(m, size);
+        H.leftCols(n) = MatX::Random(m, n);
+        diagR = VecX::Random(m).cwiseAbs() + VecX::Constant(m, 0.5);
+        inn = VecX::Random(m);
+    }
+
+    int size;
+    MatX P, H;
+    VecX diagR, inn;
+};
+
+
+TEST_F(KalmanUpdateTest, UpdatedStates) {
+    Setup(10, 4);
+    auto states = UpdatedStates(H, P);
+    ASSERT_EQ(states.size(), 10);
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(states[i], i);
+    }
+}
+
+
+TEST_F(KalmanUpdateTest, Equivalence) {
+    // fewer, as many and more measurements than states
+    for (int m : {5, 20, 60}) {
+        Setup(20, m);
+        MatX P_cov = P, P_inf = P;
+        VecX err_cov, err_inf;
+        number_t nis_cov = CovarianceFormUpdate(H, diagR, inn, P_cov, err_cov);
+        number_t nis_inf;
+        ASSERT_TRUE(InformationFormUpdate(H, diagR, inn, UpdatedStates(H, P),
+                                          P_inf, err_inf, &nis_inf));
+
+        ASSERT_EQ(err_inf.size(), size);
+        EXPECT_NEAR((err_cov - err_inf).norm(), 0, 1e-8 * err_cov.norm())
+            << "m=" << m;
+        EXPECT_NEAR((P_cov - P_inf).norm(), 0, 1e-8 * P.norm()) << "m=" << m;
+        EXPECT_NEAR(nis_cov, nis_inf, 1e-8 * nis_cov) << "m=" << m;
+        EXPECT_EQ((P_inf - P_inf.transpose()).norm(), 0);
+        // the free slots are left as they are
+        EXPECT_EQ(P_inf.bottomRightCorner(6, 6), P.bottomRightCorner(6, 6));
+    }
+}
+
+
+TEST_F(KalmanUpdateTest, NotPositiveDefinite) {
+    Setup(8, 12);
+    // two states perfectly correlated
+    P.row(1) = P.row(0);
+    P.col(1) = P.col(0);
+    MatX P0 = P;
+    VecX err;
+    number_t nis;
+    EXPECT_FALSE(InformationFormUpdate(H, diagR, inn, UpdatedStates(H, P), P,
+                                       err, &nis));
+    EXPECT_EQ(P, P0);
+}
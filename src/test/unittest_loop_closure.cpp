@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "loop_closure.h"
+
+
+using namespace xivo;
+
+
+// random binary descriptor with `flips` of its bits flipped from `desc`
+static cv::Mat Perturb(const cv::Mat &desc, int flips, std::mt19937 &rng) {
+    cv::Mat out = desc.clone();
+    std::uniform_int_distribution<int> bit(0, 8 * desc.cols - 1);
+    for (int i = 0; i < flips; ++i) {
+        int b = bit(rng);
+        out.at<uint8_t>(0, b >> 3) ^= 1 << (b & 7);
+    }
+    return out;
+}
+
+static cv::Mat RandomDescriptors(int rows, std::mt19937 &rng) {
+    cv::Mat desc(rows, 32, CV_8UC1);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < 32; ++j) {
+            desc.at<uint8_t>(i, j) = byte(rng);
+        }
+    }
+    return desc;
+}
+
+
+TEST(AppearanceIndex, Retrieval) {
+    std::mt19937 rng(0);
+    AppearanceIndex index(8, 12);
+    std::vector<cv::Mat> frames;
+    for (int i = 0; i < 20; ++i) {
+        frames.push_back(RandomDescriptors(50, rng));
+        index.Add(i, frames.back());
+    }
+
+    // a noisy revisit of frame 7
+    cv::Mat query(50, 32, CV_8UC1);
+    for (int i = 0; i < 50; ++i) {
+        Perturb(frames[7].row(i), 4, rng).copyTo(query.row(i));
+    }
+    auto candidates = index.Query(query, 19, 3);
+    ASSERT_FALSE(candidates.empty());
+    EXPECT_EQ(candidates[0].first, 7);
+    if (candidates.size() > 1) {
+        EXPECT_GT(candidates[0].second, 5 * candidates[1].second);
+    }
+
+    // recent frames are excluded
+    candidates = index.Query(query, 6, 3);
+    for (const auto &[id, score] : candidates) {
+        EXPECT_LE(id, 6);
+        EXPECT_LT(score, index.Query(query, 19, 1)[0].second / 5);
+    }
+}
+
+
+/* A camera circles inside a cylindrical room whose wall is covered with
+ * landmarks, looking outwards, and comes back to where it started. The
+ * odometry drifts; the loop found at the end of the circle should pull the
+ * keyframe poses back towards the truth. */
+class LoopClosureTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<number_t> uniform(-1, 1);
+        for (int i = 0; i < num_landmarks; ++i) {
+            number_t angle = 2 * M_PI * i / num_landmarks;
+            landmarks.push_back(Vec3{wall_radius * cos(angle),
+                                     wall_radius * sin(angle), uniform(rng)});
+        }
+        descriptors = RandomDescriptors(num_landmarks, rng);
+
+        gbc = SE3{SO3::exp(Vec3{0.1, -0.2, 0.05}), Vec3{0.02, 0.01, -0.03}};
+
+        Json::Value cfg;
+        cfg["exclude_recent"] = 20;
+        cfg["min_inliers"] = 15;
+        cfg["use_robust_kernel"] = false;
+        lc = LoopClosure::Create(cfg);
+    }
+
+    // true camera pose of the k-th keyframe
+    SE3 Camera(int k) const {
+        number_t theta = 2 * M_PI * k / num_keyframes;
+        Vec3 z{cos(theta), sin(theta), 0};
+        Vec3 y{0, 0, -1};
+        Mat3 Rsc;
+        Rsc << y.cross(z), y, z;
+        return SE3{SO3{Rsc}, Vec3{circle_radius * z}};
+    }
+
+    KeyframePtr MakeKeyframe(int k, std::mt19937 &rng) const {
+        SE3 gsc = Camera(k);
+        SE3 gsb = gsc * gbc.inv();
+        // drift accumulated by the odometry
+        SE3 drift{SO3::exp(Vec3{0, 0, 0.004 * k}), Vec3{0.01 * k, 0.005 * k, 0}};
+
+        auto kf = std::make_unique<Keyframe>();
+        kf->gid = k;
+        kf->ts = timestamp_t{k};
+        kf->godom = drift * gsb;
+        kf->gbc = gbc;
+        std::vector<int> visible;
+        for (int i = 0; i < num_landmarks; ++i) {
+            Vec3 Xc = gsc.inv() * landmarks[i];
+            if (Xc(2) > 0.1 && std::abs(Xc(0) / Xc(2)) < 0.7 &&
+                std::abs(Xc(1) / Xc(2)) < 0.7) {
+                visible.push_back(i);
+                kf->xc.push_back(Xc.head<2>() / Xc(2));
+                kf->Xc.push_back(Xc);
+                kf->has_landmark.push_back(true);
+            }
+        }
+        kf->descriptors.create(visible.size(), 32, CV_8UC1);
+        for (int i = 0; i < visible.size(); ++i) {
+            Perturb(descriptors.row(visible[i]), 8, rng)
+                .copyTo(kf->descriptors.row(i));
+        }
+        return kf;
+    }
+
+    static constexpr int num_landmarks = 720;
+    static constexpr int num_keyframes = 60;
+    static constexpr number_t circle_radius = 2;
+    static constexpr number_t wall_radius = 5;
+
+    std::vector<Vec3> landmarks;
+    cv::Mat descriptors;
+    SE3 gbc;
+    LoopClosurePtr lc;
+};
+
+
+TEST_F(LoopClosureTest, BoundedDrift) {
+    std::mt19937 rng(2);
+    for (int k = 0; k <= num_keyframes + 5; ++k) {
+        lc->AddKeyframe(MakeKeyframe(k, rng));
+    }
+    lc->Flush();
+    EXPECT_EQ(lc->num_keyframes(), num_keyframes + 6);
+    ASSERT_GT(lc->num_loops(), 0);
+
+    // the last keyframes are back at the start
+    auto traj = lc->KeyframeTrajectory();
+    for (int k = num_keyframes; k <= num_keyframes + 5; ++k) {
+        SE3 gsb = Camera(k) * gbc.inv();
+        auto kf = MakeKeyframe(k, rng);
+        number_t drift = (kf->godom.T() - gsb.T()).norm();
+        number_t error = (traj[k].second.T() - gsb.T()).norm();
+        EXPECT_LT(error, 0.1 * drift) << "keyframe #" << k;
+        number_t rotation_drift = (kf->godom.R().inv() * gsb.R()).log().norm();
+        EXPECT_LT((traj[k].second.R().inv() * gsb.R()).log().norm(),
+                  0.25 * rotation_drift);
+
+        // poses given in the filter frame are mapped the same way
+        EXPECT_LT((lc->Correct(kf->godom).T() - traj[k].second.T()).norm(),
+                  0.1 * drift);
+    }
+
+    // the solution is handed to the filter once
+    SE3 gsb_corrected;
+    EXPECT_TRUE(lc->TakeFeedback(SE3{}, &gsb_corrected));
+    EXPECT_FALSE(lc->TakeFeedback(SE3{}, &gsb_corrected));
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include "helpers.h"
+#include "measurement.h"
+
+
+using namespace xivo;
+
+
+// the jacobian of the stacked measurements at full width
+MatX Expand(const MatX &Hc, const std::vector<int> &cols, int size) {
+    MatX H = MatX::Zero(Hc.rows(), size);
+    for (int j = 0; j < cols.size(); ++j) {
+        H.col(cols[j]) = Hc.col(j);
+    }
+    return H;
+}
+
+
+TEST(Measurement, Stack) {
+    LinearizedMeasurement a, b;
+    a.residual = VecX::Random(2);
+    a.diagR = VecX::Constant(2, 0.1);
+    MatX Ja1 = MatX::Random(2, 3), Ja2 = MatX::Random(2, 3);
+    a.Add(StateBlock::FeaturePoint(4), Ja1);
+    a.Add(StateBlock::Velocity(), Ja2);
+    // the same block twice adds up
+    a.Add(StateBlock::Velocity(), Ja2);
+
+    b.residual = VecX::Random(6);
+    b.diagR = VecX::Constant(6, 0.2);
+    MatX Jb = MatX::Random(6, 6);
+    b.Add(StateBlock::GroupPose(2), Jb);
+
+    MatX Hc;
+    std::vector<int> cols;
+    VecX residual, diagR;
+    StackMeasurements({a, b}, &Hc, &cols, &residual, &diagR);
+    ASSERT_EQ(cols.size(), 12);
+    EXPECT_TRUE(std::is_sorted(cols.begin(), cols.end()));
+
+    MatX H = Expand(Hc, cols, kFullSize);
+    MatX expected = MatX::Zero(8, kFullSize);
+    expected.block(0, kFeatureBegin + 4 * kFeatureSize, 2, 3) = Ja1;
+    expected.block(0, Index::Vsb, 2, 3) = 2 * Ja2;
+    expected.block(2, kGroupBegin + 2 * kGroupSize, 6, 6) = Jb;
+    EXPECT_EQ(H, expected);
+    EXPECT_EQ(residual.head(2), a.residual);
+    EXPECT_EQ(residual.tail(6), b.residual);
+    EXPECT_EQ(diagR.tail(6), b.diagR);
+}
+
+
+TEST(Measurement, SparseUpdate) {
+    int size = 60;
+    MatX L = MatX::Random(size, size);
+    MatX P = L * L.transpose() + MatX::Identity(size, size);
+
+    std::vector<int> cols{3, 4, 5, 20, 21, 40};
+    MatX Hc = MatX::Random(9, cols.size());
+    VecX diagR = VecX::Constant(9, 0.5);
+    VecX inn = VecX::Random(9);
+
+    MatX P_dense = P, P_sparse = P;
+    VecX err_dense, err_sparse;
+    number_t nis_dense = CovarianceFormUpdate(Expand(Hc, cols, size), diagR,
+                                              inn, P_dense, err_dense);
+    number_t nis_sparse =
+        SparseCovarianceFormUpdate(Hc, cols, diagR, inn, P_sparse, err_sparse);
+
+    EXPECT_NEAR((err_dense - err_sparse).norm(), 0, 1e-9 * err_dense.norm());
+    EXPECT_NEAR((P_dense - P_sparse).norm(), 0, 1e-9 * P.norm());
+    EXPECT_NEAR(nis_dense, nis_sparse, 1e-9 * nis_dense);
+    EXPECT_EQ(P_sparse, P_sparse.transpose());
+}
+
+
+TEST(Measurement, SparseUpdateJoseph) {
+    int size = 60;
+    MatX L = MatX::Random(size, size);
+    MatX P = L * L.transpose() + MatX::Identity(size, size);
+
+    // a tight measurement of a few states
+    std::vector<int> cols{6, 7, 8, 9, 10, 11};
+    MatX Hc = MatX::Identity(6, cols.size());
+    VecX diagR = VecX::Constant(6, 1e-8);
+    VecX inn = VecX::Random(6);
+
+    MatX P_dense = P, P_sparse = P;
+    VecX err_dense, err_sparse;
+    CovarianceFormUpdate(Expand(Hc, cols, size), diagR, inn, P_dense,
+                         err_dense);
+    SparseCovarianceFormUpdate(Hc, cols, diagR, inn, P_sparse, err_sparse,
+                               true);
+
+    EXPECT_NEAR((err_dense - err_sparse).norm(), 0, 1e-9 * err_dense.norm());
+    EXPECT_NEAR((P_dense - P_sparse).norm(), 0, 1e-9 * P.norm());
+    EXPECT_EQ(P_sparse, P_sparse.transpose());
+    for (int j : cols) {
+        EXPECT_GT(P_sparse(j, j), 0);
+    }
+}
+
+
+TEST(Measurement, VelocityJacobian) {
+    SO3 Rsb = SO3::exp(Vec3{0.3, -0.2, 0.5});
+    Vec3 Vsb{1.0, -0.5, 0.2};
+    Vec3 Vb{0.2, 0.1, 0.0};
+    auto meas = VelocityMeasurement::Make(Rsb, Vsb, Vb, 0.1);
+    ASSERT_EQ(meas.blocks.size(), 2);
+
+    // residual = Vb - h(x), so its derivative is -H
+    number_t eps = 1e-6;
+    for (int i = 0; i < 6; ++i) {
+        Vec3 d = Vec3::Zero();
+        d(i % 3) = eps;
+        SO3 Rp = Rsb, Rm = Rsb;
+        Vec3 Vp = Vsb, Vm = Vsb;
+        if (i < 3) {
+            Rp = Rsb * SO3::exp(d);
+            Rm = Rsb * SO3::exp(-d);
+        } else {
+            Vp += d;
+            Vm -= d;
+        }
+        VecX num = -(VelocityMeasurement::Make(Rp, Vp, Vb, 0.1).residual -
+                     VelocityMeasurement::Make(Rm, Vm, Vb, 0.1).residual) /
+                   (2 * eps);
+        VecX col = i < 3 ? VecX{meas.jacobians[0].col(i)}
+                         : VecX{meas.jacobians[1].col(i - 3)};
+        EXPECT_NEAR((num - col).norm(), 0, 1e-6) << "column " << i;
+    }
+    EXPECT_EQ(meas.jacobians[0].rightCols<3>(), MatX::Zero(3, 3));
+}
@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+
+#include "estimator.h"
+
+
+using namespace xivo;
+
+
+TEST(Recenter, GravityInvariant) {
+    State X;
+    X.Rsb = SO3::exp(Vec3{0.1, -0.05, 1.2});
+    X.Tsb = Vec3{120, -40, 3};
+    X.Vsb = Vec3{1, 0.5, 0};
+    X.Rg = SO3::exp(Vec3{0.05, -0.08, 0});
+    X.td = 0;
+    Vec3 g{0, 0, -9.8};
+    Vec3 gs = X.Rg * g;
+
+    SO3 R0 = HeadingRotation(X, g);
+    RecenterState(SE3{R0, X.Tsb}, &X);
+    EXPECT_NEAR((X.Rg * g - gs).norm(), 0, 1e-9);
+    EXPECT_NEAR(X.Tsb.norm(), 0, 1e-9);
+
+    // the heading of the body is along the new x axis
+    Vec3 up = -gs.normalized();
+    Vec3 b = X.Rsb * Vec3::UnitX();
+    b -= b.dot(up) * up;
+    Vec3 a = Vec3::UnitX() - up(0) * up;
+    EXPECT_NEAR(a.normalized().cross(b.normalized()).norm(), 0, 1e-9);
+    EXPECT_GT(a.dot(b), 0);
+
+    // gravity survives the canonicalization of the state
+    for (int i = 0; i < kEnforceSO3Freq; ++i) {
+        X += State::Tangent::Zero();
+    }
+    EXPECT_NEAR((X.Rg * g - gs).norm(), 0, 1e-9);
+}
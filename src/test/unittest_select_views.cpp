@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "feature.h"
+#include "group.h"
+#include "mm.h"
+
+
+using namespace xivo;
+
+
+TEST(SelectViews, Few) {
+    std::vector<Vec3> centers{Vec3{0, 0, 0}, Vec3{0.1, 0, 0}, Vec3{0.2, 0, 0}};
+    auto selected = Feature::SelectViews(Vec3{0, 0, 2}, centers, 5);
+    EXPECT_EQ(selected, (std::vector<int>{0, 1, 2}));
+}
+
+
+TEST(SelectViews, Spread) {
+    // a camera moving sideways, 1 cm per view
+    std::vector<Vec3> centers;
+    for (int i = 0; i < 15; ++i) {
+        centers.emplace_back(0.01 * i, 0, 0);
+    }
+    auto selected = Feature::SelectViews(Vec3{0.07, 0, 2}, centers, 3);
+    EXPECT_EQ(selected, (std::vector<int>{0, 7, 14}));
+
+    selected = Feature::SelectViews(Vec3{0.07, 0, 2}, centers, 6);
+    ASSERT_EQ(selected.size(), 6);
+    EXPECT_TRUE(std::is_sorted(selected.begin(), selected.end()));
+    EXPECT_EQ(selected.front(), 0);
+    EXPECT_EQ(selected.back(), 14);
+    // no two neighboring views
+    for (int i = 1; i < selected.size(); ++i) {
+        EXPECT_GE(selected[i] - selected[i - 1], 2);
+    }
+}
+
+
+TEST(SelectViews, Duplicates) {
+    // a camera standing still for a while at each of 4 places
+    std::vector<Vec3> centers;
+    for (const Vec3 &c : {Vec3{0, 0, 0}, Vec3{0.3, 0, 0}, Vec3{0, 0.3, 0},
+                          Vec3{0.3, 0.3, 0}}) {
+        for (int i = 0; i < 4; ++i) {
+            centers.push_back(c);
+        }
+    }
+    auto selected = Feature::SelectViews(Vec3{0.15, 0.15, 2}, centers, 4);
+    ASSERT_EQ(selected.size(), 4);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(selected[i] / 4, i);
+    }
+}
+
+
+TEST(SelectViews, Shuffled) {
+    // a camera moving sideways, 1 cm per group, observations in any order
+    MemoryManager::Create(16, 32);
+    std::vector<Obs> obs;
+    for (int i = 0; i < 15; ++i) {
+        obs.push_back({Group::Create(SO3{}, Vec3{0.01 * i, 0, 0}),
+                       Vec2::Zero()});
+    }
+    GroupPtr first = obs.front().g, last = obs.back().g;
+    std::shuffle(obs.begin(), obs.end(), std::default_random_engine{3});
+
+    auto selected =
+        Feature::SelectViews(Vec3{0.07, 0, 2}, obs, Vec3::Zero(), 3);
+    ASSERT_EQ(selected.size(), 3);
+    EXPECT_EQ(selected.front().g, first);
+    EXPECT_NEAR(selected[1].g->Tsb()(0), 0.07, 1e-9);
+    EXPECT_EQ(selected.back().g, last);
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "shm_ring.h"
+
+
+using namespace xivo;
+
+
+class ShmRingTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        name = "/xivo_test_" + std::to_string(getpid());
+        writer = std::make_unique<ShmWriter>(name, num_slots, rows, cols,
+                                             CV_8UC1, imu_capacity);
+        reader = std::make_unique<ShmReader>(name);
+    }
+
+    void TearDown() override {
+        images.clear();
+        reader.reset();
+        writer.reset();
+    }
+
+    cv::Mat Image(uint8_t value) {
+        return cv::Mat(rows, cols, CV_8UC1, cv::Scalar(value));
+    }
+
+    int Poll(bool flush = false) {
+        return reader->Poll(
+            [this](const timestamp_t &ts, const cv::Mat &image) {
+                order.push_back(ts.count());
+                images.push_back(image);
+            },
+            [this](const timestamp_t &ts, const Vec3 &gyro, const Vec3 &accel) {
+                order.push_back(ts.count());
+                gyros.push_back(gyro(0));
+            },
+            flush);
+    }
+
+    static constexpr int num_slots = 3;
+    static constexpr int rows = 4;
+    static constexpr int cols = 6;
+    static constexpr int imu_capacity = 8;
+
+    std::string name;
+    std::unique_ptr<ShmWriter> writer;
+    std::unique_ptr<ShmReader> reader;
+
+    std::vector<int64_t> order;
+    std::vector<cv::Mat> images;
+    std::vector<number_t> gyros;
+};
+
+
+TEST_F(ShmRingTest, TimestampOrder) {
+    writer->WriteInertial(timestamp_t{10}, Vec3::Constant(1), Vec3::Zero());
+    writer->WriteImage(timestamp_t{15}, Image(7));
+    writer->WriteInertial(timestamp_t{20}, Vec3::Constant(2), Vec3::Zero());
+    writer->WriteImage(timestamp_t{25}, Image(9));
+
+    // the image at 25 waits for the IMU to catch up
+    EXPECT_EQ(Poll(), 3);
+    ASSERT_EQ(order, (std::vector<int64_t>{10, 15, 20}));
+    ASSERT_EQ(images.size(), 1);
+    EXPECT_EQ(images[0].at<uint8_t>(2, 3), 7);
+
+    writer->WriteInertial(timestamp_t{30}, Vec3::Constant(3), Vec3::Zero());
+    EXPECT_EQ(Poll(), 2);
+    EXPECT_EQ(order, (std::vector<int64_t>{10, 15, 20, 25, 30}));
+    EXPECT_EQ(gyros, (std::vector<number_t>{1, 2, 3}));
+}
+
+
+TEST_F(ShmRingTest, ZeroCopyRelease) {
+    writer->WriteImage(timestamp_t{1}, Image(5));
+    EXPECT_EQ(Poll(true), 1);
+    EXPECT_EQ(reader->slots_in_use(), 1);
+
+    // copies of the header share the slot
+    cv::Mat copy = images[0];
+    images.clear();
+    EXPECT_EQ(reader->slots_in_use(), 1);
+    EXPECT_EQ(copy.at<uint8_t>(0, 0), 5);
+
+    copy.release();
+    EXPECT_EQ(reader->slots_in_use(), 0);
+
+    // all the slots are available to the writer again
+    for (int i = 0; i < num_slots; ++i) {
+        EXPECT_TRUE(writer->WriteImage(timestamp_t{2 + i}, Image(i)));
+    }
+}
+
+
+TEST_F(ShmRingTest, FullRing) {
+    // the oldest image not yet claimed is replaced
+    for (int i = 0; i < num_slots + 1; ++i) {
+        EXPECT_TRUE(writer->WriteImage(timestamp_t{i}, Image(i)));
+    }
+    EXPECT_EQ(Poll(true), num_slots);
+    EXPECT_EQ(order.front(), 1);
+
+    // with all the slots held by the reader, new images are dropped
+    EXPECT_FALSE(writer->WriteImage(timestamp_t{100}, Image(0)));
+}
+
+
+TEST_F(ShmRingTest, ImuOverrun) {
+    for (int i = 0; i < imu_capacity + 3; ++i) {
+        writer->WriteInertial(timestamp_t{i}, Vec3::Constant(i), Vec3::Zero());
+    }
+    // the slot next to the latest sample is never read
+    EXPECT_EQ(Poll(), imu_capacity - 1);
+    EXPECT_EQ(reader->imu_overruns(), 4);
+    EXPECT_EQ(order.front(), 4);
+}
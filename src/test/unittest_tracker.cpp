@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include "tracker.h"
+
+#include "unittest_helpers.h"
+
+
+using namespace xivo;
+
+
+// soft blobs, several per patch
+const BlobTexture kTexture(300, 2, 60, 30, Vec2::Zero(), Vec2{160, 120}, 5);
+
+
+// image of the blobs seen through x = xp1 + A (q - xp0) with an affine change
+// of intensity
+cv::Mat Render(const Vec2 &xp0, const Vec2 &xp1, const Mat2 &A,
+               number_t gain = 1, number_t bias = 0) {
+    return RenderBlobs(kTexture, 120, 160, xp0, xp1, A, 0, gain, bias);
+}
+
+
+TEST(AlignAffine, Recover) {
+    Mat2 I = Mat2::Identity();
+    cv::Mat img0 = Render(Vec2::Zero(), Vec2::Zero(), I);
+
+    Mat2 A;
+    A << 1.08, 0.06, -0.04, 0.95;
+    Vec2 shift{2.3, -1.7};
+    cv::Mat img1 = Render(Vec2{80, 60}, Vec2{80, 60} + shift, A, 1.2, -10);
+
+    number_t error{0};
+    int tested{0};
+    for (int y = 35; y <= 85; y += 10) {
+        for (int x = 45; x <= 115; x += 10) {
+            Vec2 xp0{x, y};
+            PhotometricPatch patch;
+            ASSERT_TRUE(SamplePatch({img0}, xp0, 15, &patch));
+            // where the point went, and a start one pixel or so away from it
+            Vec2 expected = Vec2{80, 60} + shift + A * (xp0 - Vec2{80, 60});
+            Vec2 xp = expected + Vec2{0.8, -0.6};
+            Mat2 A_est = I;
+            number_t zncc = AlignAffine(img1, patch[0], 20, 1e-3, &xp, &A_est);
+            if (MinEigenValue(img0, x, y, 15) < 5) {
+                continue; // not enough texture
+            }
+            EXPECT_GT(zncc, 0.98);
+            EXPECT_LT((A_est - A).norm(), 0.05);
+            error += (xp - expected).norm();
+            ++tested;
+        }
+    }
+    ASSERT_GE(tested, 10);
+    EXPECT_LT(error / tested, 0.05);
+}
+
+
+TEST(AlignAffine, Inconsistent) {
+    Mat2 I = Mat2::Identity();
+    cv::Mat img = Render(Vec2::Zero(), Vec2::Zero(), I);
+    PhotometricPatch patch;
+    ASSERT_TRUE(SamplePatch({img}, Vec2{60, 50}, 15, &patch));
+    // the template does not match the image around the start
+    Vec2 xp{100, 70};
+    Mat2 A = I;
+    cv::Mat flat(120, 160, CV_8UC1, cv::Scalar(100));
+    for (int y = 0; y < flat.rows; ++y) {
+        for (int x = 0; x < flat.cols; ++x) {
+            flat.at<uint8_t>(y, x) += (x / 4 + y / 4) % 2 ? 40 : 0;
+        }
+    }
+    EXPECT_LT(AlignAffine(flat, patch[0], 10, 1e-3, &xp, &A), 0.8);
+
+    // the warp leaves the image
+    xp << 3, 3;
+    A = I;
+    EXPECT_EQ(AlignAffine(img, patch[0], 10, 1e-3, &xp, &A), -1);
+}
@@ -1,7 +1,10 @@
 // The feature tracking module;
 // Multi-scale Lucas-Kanade tracker from OpenCV.
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
+#include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <unordered_set>
 
 #include "glog/logging.h"
 #include "opencv2/video/video.hpp"
@@ -13,6 +16,11 @@
 
 namespace xivo {
 
+namespace {
+bool SampleGrid(const cv::Mat &img, number_t x, number_t y, int size,
+                MatX *out);
+} // namespace
+
 std::unique_ptr<Tracker> Tracker::instance_ = nullptr;
 
 TrackerPtr Tracker::Create(const Json::Value &cfg) {
@@ -37,6 +45,19 @@ Tracker::Tracker(const Json::Value &cfg) : cfg_{cfg} {
   max_level_ = klt_cfg.get("max_level", 4).asInt();
   max_iter_ = klt_cfg.get("max_iter", 15).asInt();
   eps_ = klt_cfg.get("eps", 0.01).asDouble();
+  fb_check_ = klt_cfg.get("forward_backward_check", false).asBool();
+  max_fb_error_ = klt_cfg.get("max_fb_error", -1).asDouble();
+  min_eig_window_ = klt_cfg.get("min_eig_window", 7).asInt();
+  direct_update_ = false;
+
+  auto anchor_cfg = cfg_["anchor"];
+  anchor_ = anchor_cfg.get("enabled", false).asBool();
+  anchor_win_size_ = anchor_cfg.get("win_size", 15).asInt();
+  anchor_max_iter_ = anchor_cfg.get("max_iter", 10).asInt();
+  anchor_eps_ = anchor_cfg.get("eps", 0.01).asDouble();
+  anchor_min_zncc_ = anchor_cfg.get("min_zncc", 0.8).asDouble();
+  anchor_max_correction_ = anchor_cfg.get("max_correction", 2.0).asDouble();
+  anchor_max_distortion_ = anchor_cfg.get("max_distortion", 0.25).asDouble();
 
   std::string detector_type = cfg_.get("detector", "FAST").asString();
   LOG(INFO) << "detector type=" << detector_type;
@@ -189,6 +210,9 @@ void Tracker::Detect(const cv::Mat &img, int num_to_add) {
         f1->SetDescriptor(descriptors.row(i));
         f1->UpdateTrack(kp.pt.x, kp.pt.y);
         f1->SetTrackStatus(TrackStatus::TRACKED);
+        if (anchor_) {
+          SetAnchor(f1);
+        }
         LOG(INFO) << "Rescued dropped feature #" << f1->id();
         MaskOut(mask_, kp.pt.x, kp.pt.y, mask_size_);
         --num_to_add;
@@ -203,6 +227,9 @@ void Tracker::Detect(const cv::Mat &img, int num_to_add) {
         f->SetDescriptor(descriptors.row(i));
       }
       f->SetKeypoint(kp);
+      if (anchor_) {
+        SetAnchor(f);
+      }
 
       // mask out
       MaskOut(mask_, kp.pt.x, kp.pt.y, mask_size_);
@@ -251,14 +278,44 @@ void Tracker::Update(const cv::Mat &image) {
   cv::TermCriteria criteria(cv::TermCriteria::MAX_ITER | cv::TermCriteria::EPS,
                             max_iter_, eps_);
 
+  if (features_.empty()) {
+    initialized_ = false;
+    return;
+  }
+
+  // Clear list of newly dropped tracks from last time
+  newly_dropped_tracks_.clear();
+  int num_valid_features = 0;
+
+  std::vector<FeaturePtr> vf; // features tracked by KLT
   std::vector<cv::Point2f> pts0, pts1;
   std::vector<uint8_t> status;
   std::vector<float> err;
 
+  vf.reserve(features_.size());
   pts0.reserve(features_.size());
   pts1.reserve(pts0.size());
 
   for (auto f : features_) {
+    if (direct_update_ && f->instate() && !f->patch().empty()) {
+      // measured by the estimator at the predicted location, which is taken
+      // as the observation until the update corrects it
+      Vec2 pred = f->pred();
+      f->ResetPred();
+      if (pred(0) != -1 && pred(1) != -1 && MaskValid(mask_, pred(0), pred(1)) &&
+          (pred - f->xp()).norm() < max_pixel_displacement_) {
+        f->SetTrackStatus(TrackStatus::TRACKED);
+        f->UpdateTrack(pred);
+        f->SetQuality({});
+        MaskOut(mask_, pred(0), pred(1), mask_size_);
+        ++num_valid_features;
+      } else {
+        newly_dropped_tracks_.push_back(f);
+      }
+      continue;
+    }
+    vf.push_back(f);
+
     const Vec2 &pt(f->xp());
     pts0.emplace_back(pt[0], pt[1]);
 
@@ -272,24 +329,37 @@ void Tracker::Update(const cv::Mat &image) {
     }
   }
 
-  if (pts0.size() == 0) {
-    initialized_ = false;
-    return;
-  }
   // cv::calcOpticalFlowPyrLK(pyramid_, pyramid, pts0, pts1, status, err,
   //                          cv::Size(win_size_, win_size_), max_level_,
   //                          criteria,
   //                          cv::OPTFLOW_USE_INITIAL_FLOW |
   //                          cv::OPTFLOW_LK_GET_MIN_EIGENVALS,
   //                          1e-4);
-  cv::calcOpticalFlowPyrLK(pyramid_, pyramid, pts0, pts1, status, err,
-                           cv::Size(win_size_, win_size_), max_level_, criteria,
-                           cv::OPTFLOW_USE_INITIAL_FLOW);
+  if (!pts0.empty()) {
+    cv::calcOpticalFlowPyrLK(pyramid_, pyramid, pts0, pts1, status, err,
+                             cv::Size(win_size_, win_size_), max_level_,
+                             criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
+  }
+
+  // track backwards from the new locations to measure consistency
+  std::vector<cv::Point2f> pts0b;
+  if (fb_check_ && !pts0.empty()) {
+    std::vector<uint8_t> status_b;
+    std::vector<float> err_b;
+    pts0b = pts0;
+    cv::calcOpticalFlowPyrLK(pyramid, pyramid_, pts1, pts0b, status_b, err_b,
+                             cv::Size(win_size_, win_size_), max_level_,
+                             criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
+    for (int i = 0; i < status.size(); ++i) {
+      if (!status_b[i]) {
+        status[i] = 0;
+      }
+    }
+  }
 
   std::vector<cv::KeyPoint> kps;
   cv::Mat descriptors;
-  if (extract_descriptor_) {
-    std::vector<FeaturePtr> vf{features_.begin(), features_.end()};
+  if (extract_descriptor_ && !vf.empty()) {
     kps.reserve(vf.size());
     descriptors.reserveBuffer(vf.size() * 256);
     for (int i = 0; i < vf.size(); ++i) {
@@ -320,16 +390,50 @@ void Tracker::Update(const cv::Mat &image) {
   }
 
   // iterate through features and mark bad ones
-  int num_valid_features = 0;
-  int i = 0;
-
-  // Clear list of newly dropped tracks from last time
-  newly_dropped_tracks_.clear();
-
-  for (auto it = features_.begin(); it != features_.end(); ++it, ++i) {
-    FeaturePtr f(*it);
+  for (int i = 0; i < vf.size(); ++i) {
+    FeaturePtr f(vf[i]);
+
+    // refine against the anchor of the track, which does not drift
+    bool reanchor{false};
+    if (status[i] && anchor_) {
+      auto it = anchors_.find(f->id());
+      if (it != anchors_.end()) {
+        Vec2 xp{pts1[i].x, pts1[i].y};
+        Mat2 A = it->second.A;
+        number_t zncc = AlignAffine(img_, it->second.templ, anchor_max_iter_,
+                                    anchor_eps_, &xp, &A);
+        if (zncc < anchor_min_zncc_ ||
+            (xp - Vec2{pts1[i].x, pts1[i].y}).norm() >
+                anchor_max_correction_) {
+          status[i] = 0;
+        } else {
+          pts1[i] = cv::Point2f(xp(0), xp(1));
+          it->second.A = A;
+          reanchor = (A - Mat2::Identity()).norm() > anchor_max_distortion_;
+        }
+      } else {
+        reanchor = true;
+      }
+    }
 
     Vec2 last_pos(f->xp());
+    TrackQuality quality;
+    if (status[i]) {
+      quality.klt_error = err[i];
+      quality.min_eig =
+          MinEigenValue(img_, pts1[i].x, pts1[i].y, min_eig_window_);
+      // the coarsest level at which the displacement fits in half a window
+      number_t disp = (last_pos - Vec2{pts1[i].x, pts1[i].y}).norm();
+      quality.level = std::min<int>(
+          max_level_, std::max<int>(0, std::ceil(std::log2(
+                                           2 * disp / win_size_ + 1e-12))));
+      if (fb_check_) {
+        quality.fb_error = cv::norm(pts0[i] - pts0b[i]);
+        if (max_fb_error_ > 0 && quality.fb_error > max_fb_error_) {
+          status[i] = 0;
+        }
+      }
+    }
     if (status[i]) {
       if (MaskValid(mask_, pts1[i].x, pts1[i].y) &&
           (last_pos - Vec2{pts1[i].x, pts1[i].y}).norm() <
@@ -338,6 +442,10 @@ void Tracker::Update(const cv::Mat &image) {
         // update track status
         f->SetTrackStatus(TrackStatus::TRACKED);
         f->UpdateTrack(pts1[i].x, pts1[i].y);
+        f->SetQuality(quality);
+        if (reanchor) {
+          SetAnchor(f);
+        }
         // MaskOut(mask_, last_pos(0), last_pos(1), mask_size_);
         MaskOut(mask_, pts1[i].x, pts1[i].y, mask_size_);
         ++num_valid_features;
@@ -365,14 +473,47 @@ void Tracker::Update(const cv::Mat &image) {
     f->SetTrackStatus(TrackStatus::DROPPED);
   }
 
+  // the estimator removes features from the tracker, dropped or not
+  if (anchor_) {
+    std::unordered_set<int> alive;
+    for (auto f : features_) {
+      if (f->track_status() != TrackStatus::DROPPED) {
+        alive.insert(f->id());
+      }
+    }
+    for (auto it = anchors_.begin(); it != anchors_.end();) {
+      it = alive.count(it->first) ? std::next(it) : anchors_.erase(it);
+    }
+  }
+
   // swap buffers ...
   std::swap(pyramid, pyramid_);
 
 }
 
+void Tracker::SetAnchor(FeaturePtr f) {
+  Anchor anchor;
+  if (SampleGrid(img_, f->xp()(0), f->xp()(1), anchor_win_size_,
+                 &anchor.templ)) {
+    anchor.A.setIdentity();
+    anchors_[f->id()] = anchor;
+  } else {
+    // too close to the border, tried again at the next frame
+    anchors_.erase(f->id());
+  }
+}
+
 ////////////////////////////////////////
 // helpers
 ////////////////////////////////////////
+std::vector<cv::Mat> Tracker::levels(int levels) const {
+  std::vector<cv::Mat> out;
+  for (int l = 0; l < std::min(levels, num_levels()); ++l) {
+    out.push_back(pyramid(l));
+  }
+  return out;
+}
+
 void ResetMask(cv::Mat mask) { mask.setTo(255); }
 
 void MaskOut(cv::Mat mask, number_t x, number_t y, int mask_size) {
@@ -389,4 +530,210 @@ bool MaskValid(const cv::Mat &mask, number_t x, number_t y) {
   return static_cast<bool>(mask.at<uint8_t>(row, col));
 }
 
+number_t MinEigenValue(const cv::Mat &img, number_t x, number_t y,
+                       int window) {
+  int half = window >> 1;
+  int col = std::round(x);
+  int row = std::round(y);
+  // central differences need one more pixel on each side
+  if (col - half - 1 < 0 || col + half + 1 >= img.cols || row - half - 1 < 0 ||
+      row + half + 1 >= img.rows) {
+    return 0;
+  }
+  number_t gxx{0}, gxy{0}, gyy{0};
+  for (int r = row - half; r <= row + half; ++r) {
+    const uint8_t *prev = img.ptr<uint8_t>(r - 1);
+    const uint8_t *curr = img.ptr<uint8_t>(r);
+    const uint8_t *next = img.ptr<uint8_t>(r + 1);
+    for (int c = col - half; c <= col + half; ++c) {
+      number_t gx = 0.5 * (curr[c + 1] - curr[c - 1]);
+      number_t gy = 0.5 * (next[c] - prev[c]);
+      gxx += gx * gx;
+      gxy += gx * gy;
+      gyy += gy * gy;
+    }
+  }
+  number_t n = (2 * half + 1) * (2 * half + 1);
+  gxx /= n;
+  gxy /= n;
+  gyy /= n;
+  // smaller eigenvalue of [gxx gxy; gxy gyy]
+  return 0.5 * (gxx + gyy - std::sqrt((gxx - gyy) * (gxx - gyy) + 4 * gxy * gxy));
+}
+
+namespace {
+
+// Bilinear samples of 8-bit image `img` on a `size` x `size` grid centered at
+// (x, y), rows of the patch along y. Returns false if the grid leaves the image.
+bool SampleGrid(const cv::Mat &img, number_t x, number_t y, int size,
+                MatX *out) {
+  number_t x0 = x - 0.5 * (size - 1), y0 = y - 0.5 * (size - 1);
+  int c0 = std::floor(x0), r0 = std::floor(y0);
+  if (c0 < 0 || r0 < 0 || c0 + size >= img.cols || r0 + size >= img.rows) {
+    return false;
+  }
+  number_t a = x0 - c0, b = y0 - r0;
+  out->resize(size, size);
+  for (int i = 0; i < size; ++i) {
+    const uint8_t *p0 = img.ptr<uint8_t>(r0 + i);
+    const uint8_t *p1 = img.ptr<uint8_t>(r0 + i + 1);
+    for (int j = 0; j < size; ++j) {
+      int c = c0 + j;
+      (*out)(i, j) = (1 - b) * ((1 - a) * p0[c] + a * p0[c + 1]) +
+                     b * ((1 - a) * p1[c] + a * p1[c + 1]);
+    }
+  }
+  return true;
+}
+
+// bilinear interpolation of 8-bit image `img` at (x, y), with
+// 0 <= x < cols - 1 and 0 <= y < rows - 1
+number_t Bilinear(const cv::Mat &img, number_t x, number_t y) {
+  int c = std::floor(x), r = std::floor(y);
+  number_t a = x - c, b = y - r;
+  const uint8_t *p0 = img.ptr<uint8_t>(r);
+  const uint8_t *p1 = img.ptr<uint8_t>(r + 1);
+  return (1 - b) * ((1 - a) * p0[c] + a * p0[c + 1]) +
+         b * ((1 - a) * p1[c] + a * p1[c + 1]);
+}
+
+} // namespace
+
+bool SamplePatch(const std::vector<cv::Mat> &levels, const Vec2 &xp, int size,
+                 PhotometricPatch *patch) {
+  patch->resize(levels.size());
+  for (int l = 0; l < levels.size(); ++l) {
+    number_t scale = 1.0 / (1 << l);
+    MatX &I = (*patch)[l];
+    if (!SampleGrid(levels[l], xp(0) * scale, xp(1) * scale, size, &I)) {
+      patch->clear();
+      return false;
+    }
+    I.array() -= I.mean();
+  }
+  return true;
+}
+
+bool PhotometricResidual(const PhotometricPatch &templ,
+                         const std::vector<cv::Mat> &levels, const Vec2 &xp,
+                         number_t min_eig, Mat2 *Lt, Vec2 *r) {
+  if (templ.empty() || levels.size() < templ.size()) {
+    return false;
+  }
+  Mat2 AtA = Mat2::Zero();
+  Vec2 Atb = Vec2::Zero();
+  int n{0};
+  for (int l = 0; l < templ.size(); ++l) {
+    int size = templ[l].rows();
+    number_t scale = 1.0 / (1 << l);
+    // one more pixel on each side for the gradients
+    MatX G;
+    if (!SampleGrid(levels[l], xp(0) * scale, xp(1) * scale, size + 2, &G)) {
+      return false;
+    }
+    MatX I = G.block(1, 1, size, size);
+    // derivatives w.r.t. full-resolution pixels, of the zero-mean patch
+    MatX Ix = 0.5 * scale * (G.block(1, 2, size, size) - G.block(1, 0, size, size));
+    MatX Iy = 0.5 * scale * (G.block(2, 1, size, size) - G.block(0, 1, size, size));
+    Ix.array() -= Ix.mean();
+    Iy.array() -= Iy.mean();
+    MatX b = I.array() - I.mean() - templ[l].array();
+
+    AtA(0, 0) += Ix.squaredNorm();
+    AtA(0, 1) += (Ix.array() * Iy.array()).sum();
+    AtA(1, 1) += Iy.squaredNorm();
+    Atb(0) += (Ix.array() * b.array()).sum();
+    Atb(1) += (Iy.array() * b.array()).sum();
+    n += size * size;
+  }
+  AtA(1, 0) = AtA(0, 1);
+
+  // smaller eigenvalue of the structure tensor per pixel
+  number_t gxx = AtA(0, 0) / n, gxy = AtA(0, 1) / n, gyy = AtA(1, 1) / n;
+  if (0.5 * (gxx + gyy -
+             std::sqrt((gxx - gyy) * (gxx - gyy) + 4 * gxy * gxy)) < min_eig) {
+    return false;
+  }
+  Eigen::LLT<Mat2> llt(AtA);
+  *Lt = llt.matrixU();
+  *r = -llt.matrixL().solve(Atb);
+  return true;
+}
+
+number_t AlignAffine(const cv::Mat &img, const MatX &templ, int max_iter,
+                     number_t eps, Vec2 *xp, Mat2 *A) {
+  using Vec8 = Eigen::Matrix<number_t, 8, 1>;
+  using Mat8 = Eigen::Matrix<number_t, 8, 8>;
+  int n = templ.rows();
+  number_t c = 0.5 * (n - 1);
+  // the warped grid, a parallelogram, with one more pixel on each side for
+  // the gradients
+  auto inside = [&img, c](const Vec2 &xp, const Mat2 &A) {
+    for (number_t u0 : {-c, c}) {
+      for (number_t u1 : {-c, c}) {
+        Vec2 x = xp + A * Vec2{u0, u1};
+        if (!(x(0) >= 1 && x(1) >= 1 && x(0) < img.cols - 2 &&
+              x(1) < img.rows - 2)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+
+  // parameters: xp, A, gain and bias of the intensity
+  number_t gain{1}, bias{0};
+  for (int iter = 0; iter < max_iter; ++iter) {
+    if (!inside(*xp, *A)) {
+      return -1;
+    }
+    Mat8 H = Mat8::Zero();
+    Vec8 g = Vec8::Zero();
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < n; ++j) {
+        Vec2 u{j - c, i - c};
+        Vec2 x = *xp + *A * u;
+        number_t gx = 0.5 * (Bilinear(img, x(0) + 1, x(1)) -
+                             Bilinear(img, x(0) - 1, x(1)));
+        number_t gy = 0.5 * (Bilinear(img, x(0), x(1) + 1) -
+                             Bilinear(img, x(0), x(1) - 1));
+        Vec8 J;
+        J << gx, gy, gx * u(0), gx * u(1), gy * u(0), gy * u(1), -templ(i, j),
+            -1;
+        H += J * J.transpose();
+        g += J * (Bilinear(img, x(0), x(1)) - gain * templ(i, j) - bias);
+      }
+    }
+    Vec8 d = -H.ldlt().solve(g);
+    if (!d.allFinite()) {
+      return -1;
+    }
+    *xp += d.head<2>();
+    (*A)(0, 0) += d(2);
+    (*A)(0, 1) += d(3);
+    (*A)(1, 0) += d(4);
+    (*A)(1, 1) += d(5);
+    gain += d(6);
+    bias += d(7);
+    if (d.head<2>().norm() < eps) {
+      break;
+    }
+  }
+  if (!inside(*xp, *A)) {
+    return -1;
+  }
+
+  MatX I(n, n);
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) {
+      Vec2 x = *xp + *A * Vec2{j - c, i - c};
+      I(i, j) = Bilinear(img, x(0), x(1));
+    }
+  }
+  I.array() -= I.mean();
+  MatX T = templ.array() - templ.mean();
+  number_t den = I.norm() * T.norm();
+  return den > 0 ? I.cwiseProduct(T).sum() / den : 0;
+}
+
 } // namespace xivo
@@ -5,6 +5,7 @@
 
 #include <list>
 #include <memory>
+#include <unordered_map>
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/features2d/features2d.hpp"
@@ -26,6 +27,21 @@ public:
    *        detected features. */
   void Update(const cv::Mat &img);
 
+  /** The current image. */
+  const cv::Mat &image() const { return img_; }
+  /** Level `level` of the LK pyramid of the current image. */
+  const cv::Mat &pyramid(int level) const { return pyramid_[2 * level]; }
+  /** Number of levels of the LK pyramid, which interleaves the images of the
+   *  levels with their derivatives. */
+  int num_levels() const { return pyramid_.size() / 2; }
+  /** The first `levels` levels of the LK pyramid of the current image. */
+  std::vector<cv::Mat> levels(int levels) const;
+
+  /** In-state features with a patch skip KLT if enabled: they are kept at
+   *  their predicted location, and measured from the image directly by the
+   *  estimator's update. */
+  void SetDirectUpdate(bool enabled) { direct_update_ = enabled; }
+
 public:
   std::list<FeaturePtr> features_;
 
@@ -78,6 +94,34 @@ private:
   int max_iter_;
   number_t eps_;
 
+  // track quality
+  bool fb_check_;         // track backwards to measure consistency
+  number_t max_fb_error_; // tracks less consistent are dropped, -1 to disable
+  int min_eig_window_;    // window size of the Shi-Tomasi score
+
+  bool direct_update_; // in-state features with a patch skip KLT
+
+  // anchor templates: KLT tracks frame to frame, so its errors add up along
+  // a track; each track is refined against the patch of its anchor frame
+  bool anchor_;
+  int anchor_win_size_;
+  int anchor_max_iter_;
+  number_t anchor_eps_;
+  number_t anchor_min_zncc_; // tracks less similar to their anchor are dropped
+  number_t anchor_max_correction_;  // of the KLT result, pixels; tracks
+                                    // corrected more are dropped
+  number_t anchor_max_distortion_;  // of the affine warp from the anchor;
+                                    // tracks distorted more are re-anchored
+  struct Anchor {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    MatX templ; // patch at the anchor frame
+    Mat2 A;     // affine warp of the patch from the anchor frame
+  };
+  // keyed by feature id
+  std::unordered_map<int, Anchor, std::hash<int>, std::equal_to<int>,
+                     Eigen::aligned_allocator<std::pair<const int, Anchor>>>
+      anchors_;
+
   // fast params
   int num_features_min_;
   int num_features_max_;
@@ -90,6 +134,10 @@ private:
 private:
   void Detect(const cv::Mat &img, int num_to_add);
 
+  /** Takes the patch around the current location of the feature as its
+   *  anchor. */
+  void SetAnchor(FeaturePtr f);
+
   bool FindMatchInDroppedTracks(cv::Mat new_feature_descriptor,
     FeaturePtr *output_match);
 };
@@ -108,4 +156,37 @@ void MaskOut(cv::Mat mask, number_t x, number_t y, int mask_size = 15);
  *  (x,y) is not too close to the edge of the image. */
 bool MaskValid(const cv::Mat &mask, number_t x, number_t y);
 
+/** Shi-Tomasi score, i.e., the smaller eigenvalue of the structure tensor
+ *  averaged over a `window` x `window` patch of grayscale image `img` centered
+ *  at pixel `(x,y)`. Returns 0 if the patch is not inside the image. */
+number_t MinEigenValue(const cv::Mat &img, number_t x, number_t y,
+                       int window = 7);
+
+/** Samples `size` x `size` patches around full-resolution pixel `xp` on each
+ *  image of `levels`, a pyramid whose level l is downsampled by 2^l, and
+ *  removes their means. Returns false if a patch leaves its image. */
+bool SamplePatch(const std::vector<cv::Mat> &levels, const Vec2 &xp, int size,
+                 PhotometricPatch *patch);
+
+/** Linearizes the photometric error between the patches `templ` and those
+ *  around `xp` + d on `levels`, about d = 0. With the residuals stacked in b
+ *  and their derivatives w.r.t. d in A, it returns the square-root form
+ *  |A d + b|^2 = |Lt d - r|^2 + const, i.e., Lt'Lt = A'A and
+ *  r = -Lt'^{-1} A'b. Returns false if a patch leaves its image, or if the
+ *  smaller eigenvalue of A'A per pixel, the Shi-Tomasi score of the patches,
+ *  is below `min_eig`. */
+bool PhotometricResidual(const PhotometricPatch &templ,
+                         const std::vector<cv::Mat> &levels, const Vec2 &xp,
+                         number_t min_eig, Mat2 *Lt, Vec2 *r);
+
+/** Aligns patch `templ`, sampled on a grid centered at a feature, to
+ *  grayscale image `img` under the affine warp x = xp + A u of the grid
+ *  coordinates u, relative to the center, and a gain and bias of the
+ *  intensity. Gauss-Newton starts from `xp` and `A`, and stops after
+ *  `max_iter` iterations or once the step of `xp` is below `eps`. Returns
+ *  the zero-mean normalized cross-correlation of the aligned patches, or -1 if
+ *  the warped patch leaves the image. */
+number_t AlignAffine(const cv::Mat &img, const MatX &templ, int max_iter,
+                     number_t eps, Vec2 *xp, Mat2 *A);
+
 } // namespace xivo
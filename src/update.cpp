@@ -25,33 +25,70 @@ void Estimator::Update() {
   ProfilerStart(__PRETTY_FUNCTION__);
 #endif
 
-  if (instate_features_.empty() && oos_features_.empty())
+  if (instate_features_.empty() && oos_features_.empty() &&
+      structureless_features_.empty())
     return;
 
   timer_.Tick("update");
+  bool robust{robust_update_options_.kernel !=
+              RobustUpdateOptions::Kernel::NONE};
   std::vector<FeaturePtr> inliers; // individually compatible matches
   std::vector<number_t> dist,
       inlier_dist; // MH distance of features & inlier features
 
   timer_.Tick("jacobian");
-  for (auto f : instate_features_) {
+  std::vector<FeaturePtr> direct_features; // measured photometrically
+  std::vector<cv::Mat> levels;
+  if (direct_update_options_.enabled) {
+    levels = Tracker::instance()->levels(direct_update_options_.levels);
+  }
+  for (auto it = instate_features_.begin(); it != instate_features_.end();) {
+    auto f = *it;
     f->ComputeJacobian(X_.Rsb, X_.Tsb, X_.Rbc, X_.Tbc, last_gyro_, imu_.Cg(),
-                       X_.bg, X_.Vsb, X_.td, err_);
+                       X_.bg, X_.Vsb, X_.td, X_.tr, err_);
+    if (direct_update_options_.enabled && !f->patch().empty()) {
+      // The patch alignment is linearized at the prediction the tracker took
+      // as the observation. Its normal equations are folded into two rows,
+      // whitened by the photometric noise and scaled back to that of a pixel
+      // measurement, such that the gating and the update below treat them as
+      // any other feature.
+      Mat2 Lt;
+      Vec2 r;
+      if (!PhotometricResidual(f->patch(), levels, f->xp(),
+                               direct_update_options_.min_eig, &Lt, &r)) {
+        f->SetStatus(FeatureStatus::REJECTED_BY_FILTER);
+        it = instate_features_.erase(it);
+        continue;
+      }
+      number_t scale = sqrt(R_) / direct_update_options_.intensity_std;
+      f->SetPhotometricMeasurement(scale * Lt, scale * r);
+      direct_features.push_back(f);
+    }
+    ++it;
     const auto &J = f->J();
     const auto &res = f->inn();
 
     // Mahalanobis gating
     Mat2 S = J * P_ * J.transpose();
-    S(0, 0) += R_;
-    S(1, 1) += R_;
+    S(0, 0) += VisualNoise(f);
+    S(1, 1) += VisualNoise(f);
     number_t mh_dist = res.dot(S.llt().solve(res));
     dist.push_back(mh_dist);
+    if (adaptive_noise_ && f->patch().empty()) {
+      adaptive_noise_->AddSample(f->xp(), mh_dist);
+    }
   }
   timer_.Tock("jacobian");
+  if (adaptive_noise_) {
+    // the scale moves for the next update, gated and ungated alike
+    adaptive_noise_->Adapt();
+  }
 
   timer_.Tick("MH-gating");
 
-  if (use_MH_gating_ && instate_features_.size() > min_required_inliers_) {
+  // the robust update down-weights instead of gating
+  if (!robust && use_MH_gating_ &&
+      instate_features_.size() > min_required_inliers_) {
 
     number_t mh_thresh = MH_thresh_;
     while (inliers.size() < min_required_inliers_) {
@@ -79,8 +116,20 @@ void Estimator::Update() {
   }
   timer_.Tock("MH-gating");
 
-  if (use_1pt_RANSAC_) {
+  if (use_1pt_RANSAC_ && !robust) {
+    // hypotheses are scored by reprojection error, which direct features do
+    // not have, so they bypass RANSAC with the outcome of the gating
+    std::vector<FeaturePtr> direct_inliers;
+    for (auto it = inliers.begin(); it != inliers.end();) {
+      if (std::count(direct_features.begin(), direct_features.end(), *it)) {
+        direct_inliers.push_back(*it);
+        it = inliers.erase(it);
+      } else {
+        ++it;
+      }
+    }
     inliers = OnePointRANSAC(inliers);
+    inliers.insert(inliers.end(), direct_inliers.begin(), direct_inliers.end());
   }
 
   std::vector<FeaturePtr> active_oos_features;
@@ -90,12 +139,30 @@ void Estimator::Update() {
     // parametrization
     for (auto f : oos_features_) {
       auto vobs = Graph::instance()->GetObservationsOf(f);
-      int oos_jac_size = f->ComputeOOSJacobian(vobs, X_.Rbc, X_.Tbc, err_);
+      int oos_jac_size = f->ComputeOOSJacobian(vobs, X_.Rbc, X_.Tbc, X_.tr, err_);
       if (oos_jac_size > 0) {
         total_oos_jac_size += oos_jac_size;
         active_oos_features.push_back(f);
       }
     }
+    // epipolar & three-view constraints share the OOS measurement noise
+    for (auto f : structureless_features_) {
+      auto vobs = Graph::instance()->GetObservationsOf(f);
+      int size = f->ComputeStructurelessJacobian(vobs, X_.Rbc, X_.Tbc,
+                                                 structureless_options_);
+      if (size > 0) {
+        // Mahalanobis gating: no depth refinement has screened these tracks
+        MatX Ho = f->Ho();
+        VecX ro = f->ro();
+        MatX S = Ho * P_ * Ho.transpose();
+        S.diagonal().array() += OOSNoise();
+        number_t mh_dist = ro.dot(S.llt().solve(ro));
+        if (mh_dist < structureless_options_.MH_thresh * size) {
+          total_oos_jac_size += size;
+          active_oos_features.push_back(f);
+        }
+      }
+    }
     if (total_oos_jac_size > 0) {
       LOG(INFO) << "#total_oos_jac=" << total_oos_jac_size << std::endl;
     }
@@ -109,21 +176,25 @@ void Estimator::Update() {
   H_.setZero(total_size, err_.size());
   inn_.setZero(total_size);
   diagR_.resize(total_size);
+  std::vector<std::pair<int, int>> blocks; // (offset, size) of each feature
 
   for (int i = 0; i < inliers.size(); ++i) {
     inliers[i]->FillJacobianBlock(H_, 2 * i); 
     inn_.segment<2>(2 * i) = inliers[i]->inn();
+    blocks.push_back({2 * i, 2});
     // if (outlier_thresh_ > 1.0) {
     //   auto [robust_R, is_outlier] = HuberOnInnovation(inliers[i]->inn(), R_);
     //   diagR_.segment<2>(2 * i) << robust_R, robust_R;
     // } else {
     //   diagR_.segment<2>(2 * i) << R_, R_;
     // }
-    diagR_.segment<2>(2 * i) << R_, R_;
+    number_t R = VisualNoise(inliers[i]);
+    diagR_.segment<2>(2 * i) << R, R;
   }
 
   if (total_oos_jac_size) {
     int oos_offset = 2 * inliers.size();
+    number_t Roos = OOSNoise();
 
     for (auto f : active_oos_features) {
       int size = f->oos_inn_size();
@@ -131,31 +202,68 @@ void Estimator::Update() {
       inn_.segment(oos_offset, size) = f->ro();
       for (int i = 0; i < size; ++i) {
         // FIXME (xfei): how to perform huber on innovation for OOS features?
-        diagR_(oos_offset + i) = Roos_;
+        diagR_(oos_offset + i) = Roos;
       }
+      blocks.push_back({oos_offset, size});
       oos_offset += size;
     }
   }
 
+  if (robust) {
+    timer_.Tick("reweighting");
+    VecX weights = RobustReweight(blocks);
+    timer_.Tock("reweighting");
+    // instate features with vanishing weight are not worth their state
+    int rejected{0};
+    for (int i = 0; i < inliers.size(); ++i) {
+      if (weights(i) < robust_update_options_.min_weight) {
+        inliers[i]->SetStatus(FeatureStatus::REJECTED_BY_FILTER);
+        ++rejected;
+      }
+    }
+    LOG(INFO) << "robust update: mean weight=" << weights.mean()
+              << "; #rejected=" << rejected;
+  }
+
   if (use_OOS_) {
     if (use_compression_ &&
         H_.rows() > H_.cols() * compression_trigger_ratio_) {
+      // whiten the rows first, such that the noise stays isotropic under the
+      // orthogonal transform of the compression
+      for (int i = 0; i < H_.rows(); ++i) {
+        number_t std = sqrt(diagR_(i));
+        H_.row(i) /= std;
+        inn_(i) /= std;
+      }
       // prform measurement compression
       int rows = QR(inn_, H_);
       inn_ = inn_.head(rows);
       H_ = H_.topRows(rows);
-      diagR_ = diagR_.head(rows); // FIXME: this does not seem right
+      diagR_.setOnes(rows);
     }
   }
 
   timer_.Tick("actual-update");
-  UpdateJosephForm();
+  MeasurementUpdate();
   timer_.Tock("actual-update");
 
   // absorb error
   AbsorbError();
+  for (auto f : instate_features_) {
+    if (f->status() == FeatureStatus::INSTATE) {
+      UpdateDepthParam(f);
+    }
+  }
   timer_.Tock("update");
 
+  // the observations of the direct features are their updated projections
+  for (auto f : direct_features) {
+    if (f->status() == FeatureStatus::INSTATE) {
+      f->CorrectTrack(f->Predict(gsb(), gbc()));
+      f->ResetPred();
+    }
+  }
+
   LOG(INFO) << "Error state absorbed";
 
 #ifdef USE_GPERFTOOLS
@@ -163,6 +271,83 @@ void Estimator::Update() {
 #endif
 }
 
+number_t Estimator::VisualNoise(const FeaturePtr &f) const {
+  // noise_scale() is 1 unless track quality is used
+  number_t R = R_ * f->noise_scale();
+  // photometric measurements are whitened by the intensity noise instead
+  if (adaptive_noise_ && f->patch().empty()) {
+    R *= adaptive_noise_->scale(f->xp());
+  }
+  return R;
+}
+
+number_t Estimator::OOSNoise() const {
+  return adaptive_noise_ ? Roos_ * adaptive_noise_->scale() : Roos_;
+}
+
+void Estimator::UpdateDepthParam(FeaturePtr f) {
+  if (f->depth_param() != DepthParam::INVERSE) {
+    return;
+  }
+  // points behind the camera, or beyond the farthest, stay at the farthest
+  f->x()(2) = std::max(f->x()(2), depth_param_options_.min_inverse_depth);
+  if (!depth_param_options_.adaptive) {
+    return;
+  }
+  number_t var = f->instate()
+                     ? P_(kFeatureBegin + kFeatureSize * f->sind() + 2,
+                          kFeatureBegin + kFeatureSize * f->sind() + 2)
+                     : f->P()(2, 2);
+  // relative std of the depth, to first order that of the inverse depth
+  number_t max_std = depth_param_options_.max_rel_std * f->x()(2);
+  if (var < max_std * max_std) {
+    f->SetDepthParam(DepthParam::LOG, P_);
+    VLOG(0) << "feature #" << f->id() << " switched to log-depth at z="
+            << f->z();
+  }
+}
+
+VecX Estimator::RobustReweight(
+    const std::vector<std::pair<int, int>> &blocks) {
+  const auto &options = robust_update_options_;
+  // Iteratively reweighted least squares on the linearized measurement: the
+  // Jacobians are not re-evaluated, so each pass only needs the m x m system
+  //   S = H P H' + diag(R / w)
+  // and the posterior residual inn - H dx = inn - H P H' S^{-1} inn.
+  MatX HPHt = H_ * P_ * H_.transpose();
+  VecX R0 = diagR_;
+  VecX res = inn_;
+  VecX weights = VecX::Ones(blocks.size());
+
+  for (int iter = 0; iter < options.iters; ++iter) {
+    for (int b = 0; b < blocks.size(); ++b) {
+      auto [offset, size] = blocks[b];
+      number_t e2;
+      if (iter == 0) {
+        // Mahalanobis distance of the innovation, per degree of freedom
+        MatX S = HPHt.block(offset, offset, size, size);
+        S.diagonal() += R0.segment(offset, size);
+        e2 = inn_.segment(offset, size)
+                 .dot(S.ldlt().solve(inn_.segment(offset, size)));
+      } else {
+        // residual after the previous pass, whitened by the measurement noise
+        e2 = (res.segment(offset, size).array().square() /
+              R0.segment(offset, size).array())
+                 .sum();
+      }
+      weights(b) = std::max<number_t>(options.Weight(sqrt(e2 / size)), 1e-6);
+      diagR_.segment(offset, size) = R0.segment(offset, size) / weights(b);
+    }
+
+    if (iter + 1 < options.iters) {
+      MatX S = HPHt;
+      S.diagonal() += diagR_;
+      res = inn_ - HPHt * S.ldlt().solve(inn_);
+    }
+  }
+  return weights;
+}
+
 std::vector<FeaturePtr>
 Estimator::OnePointRANSAC(const std::vector<FeaturePtr> &mh_inliers) {
   if (mh_inliers.empty())
@@ -215,8 +400,8 @@ Estimator::OnePointRANSAC(const std::vector<FeaturePtr> &mh_inliers) {
     auto inn = mh_inliers[k]->inn();
 
     S = J * P_ * J.transpose();
-    S(0, 0) += R_;
-    S(1, 1) += R_;
+    S(0, 0) += VisualNoise(mh_inliers[k]);
+    S(1, 1) += VisualNoise(mh_inliers[k]);
 
     K.transpose() = S.llt().solve(J * P_);
 
@@ -277,7 +462,7 @@ Estimator::OnePointRANSAC(const std::vector<FeaturePtr> &mh_inliers) {
       H_.block(2 * i, 0, 2, err_.size()) = max_inliers[i]->J();
       inn_.segment<2>(2 * i) = max_inliers[i]->inn();
     }
-    UpdateJosephForm();
+    MeasurementUpdate();
     AbsorbError();
   }
 
@@ -290,13 +475,13 @@ Estimator::OnePointRANSAC(const std::vector<FeaturePtr> &mh_inliers) {
         auto f = mh_inliers[i];
 
         f->ComputeJacobian(X_.Rsb, X_.Tsb, X_.Rbc, X_.Tbc, last_gyro_,
-                           imu_.Cg(), X_.bg, X_.Vsb, X_.td, err_);
+                           imu_.Cg(), X_.bg, X_.Vsb, X_.td, X_.tr, err_);
         auto J = f->J();
         auto res = f->inn();
 
         Mat2 S = J * P_ * J.transpose();
-        S(0, 0) += R_;
-        S(1, 1) += R_;
+        S(0, 0) += VisualNoise(f);
+        S(1, 1) += VisualNoise(f);
         if (res.dot(S.llt().solve(res)) < ransac_Chi2_) {
           hi_inliers.push_back(f);
         } else {
@@ -313,7 +498,7 @@ Estimator::OnePointRANSAC(const std::vector<FeaturePtr> &mh_inliers) {
       //   H_.block(i * 2, 0, 2, err_.size()) = hi_inliers[i]->J();
       //   inn_.segment<2>(i * 2) = hi_inliers[i]->inn();
       // }
-      // UpdateJosephForm();
+      // MeasurementUpdate();
       // AbsorbError();
       //
       // // instead of using high-innovation inliers directly
@@ -338,7 +523,7 @@ Estimator::OnePointRANSAC(const std::vector<FeaturePtr> &mh_inliers) {
   // need to re-compute jacobians
   for (auto f : max_inliers) {
     f->ComputeJacobian(X_.Rsb, X_.Tsb, X_.Rbc, X_.Tbc, last_gyro_, imu_.Cg(),
-                       X_.bg, X_.Vsb, X_.td, err_);
+                       X_.bg, X_.Vsb, X_.td, X_.tr, err_);
   }
   return max_inliers;
 }